@@ -27,6 +27,7 @@
 #include "sdpagent/kmssdprtpavpfmediahandler.h"
 #include "kmsremb.h"
 #include "kmsistats.h"
+#include "kmsrtphdrext.h"
 
 #include <gst/rtp/gstrtpbuffer.h>
 #include <gst/video/video-event.h>
@@ -58,7 +59,6 @@ G_DEFINE_TYPE_WITH_CODE (KmsBaseRtpEndpoint, kms_base_rtp_endpoint,
 #define RTCP_DEMUX_PEER "rtcp-demux-peer"
 
 #define RTP_HDR_EXT_ABS_SEND_TIME_URI "http://www.webrtc.org/experiments/rtp-hdrext/abs-send-time"
-#define RTP_HDR_EXT_ABS_SEND_TIME_SIZE 3
 #define RTP_HDR_EXT_ABS_SEND_TIME_ID 3  /* TODO: do it dynamic when needed */
 
 #define JB_INITIAL_LATENCY 0
@@ -76,6 +76,8 @@ struct _KmsRTPSessionStats
 {
   GObject *rtp_session;
   GSList *ssrcs;                /* list of all jitter buffers associated to a ssrc */
+  gint *generation;             /* stats generation of the endpoint */
+  gint changed;                 /* generation of the last RTCP of the session */
 };
 
 struct _KmsBaseRtpEndpointPrivate
@@ -112,9 +114,12 @@ struct _KmsBaseRtpEndpointPrivate
   /* REMB */
   KmsRembLocal *rl;
   KmsRembRemote *rm;
+  gboolean delay_based_bwe;
+  gint video_abs_send_time_id;
 
   /* RTP statistics */
   GHashTable *stats;
+  gint stats_generation;
 };
 
 /* Signals and args */
@@ -124,6 +129,7 @@ enum
   MEDIA_STOP,
   MEDIA_STATE_CHANGED,
   SIGNAL_REQUEST_LOCAL_KEY_FRAME,
+  SIGNAL_CHANGED_STATS,
   LAST_SIGNAL
 };
 
@@ -133,6 +139,7 @@ static guint obj_signals[LAST_SIGNAL] = { 0 };
 #define DEFAULT_RTCP_NACK    FALSE
 #define DEFAULT_RTCP_REMB    FALSE
 #define DEFAULT_TARGET_BITRATE    0
+#define DEFAULT_DELAY_BASED_BWE    FALSE
 #define MIN_VIDEO_SEND_BW_DEFAULT 100
 #define MAX_VIDEO_SEND_BW_DEFAULT 500
 
@@ -145,6 +152,7 @@ enum
   PROP_TARGET_BITRATE,
   PROP_MIN_VIDEO_SEND_BW,
   PROP_MAX_VIDEO_SEND_BW,
+  PROP_DELAY_BASED_BWE,
   PROP_STATE,
   PROP_LAST
 };
@@ -230,13 +238,41 @@ ssrc_stats_destroy (KmsSSRCStats * stats)
   g_slice_free (KmsSSRCStats, stats);
 }
 
+/* RTP session stats are only updated when RTCP is sent or received */
+static void
+rtp_session_stats_changed (KmsRTPSessionStats * stats)
+{
+  g_atomic_int_set (&stats->changed,
+      g_atomic_int_add (stats->generation, 1) + 1);
+}
+
+static void
+rtp_session_stats_on_ssrc_active (GObject * sess, GObject * source,
+    KmsRTPSessionStats * stats)
+{
+  rtp_session_stats_changed (stats);
+}
+
+static void
+rtp_session_stats_on_sending_rtcp (GObject * sess, GstBuffer * buffer,
+    gboolean is_early, KmsRTPSessionStats * stats)
+{
+  rtp_session_stats_changed (stats);
+}
+
 static KmsRTPSessionStats *
-rtp_session_stats_new (GObject * rtp_session)
+rtp_session_stats_new (GObject * rtp_session, gint * generation)
 {
   KmsRTPSessionStats *stats;
 
   stats = g_slice_new0 (KmsRTPSessionStats);
   stats->rtp_session = g_object_ref (rtp_session);
+  stats->generation = generation;
+
+  g_signal_connect (rtp_session, "on-ssrc-active",
+      G_CALLBACK (rtp_session_stats_on_ssrc_active), stats);
+  g_signal_connect (rtp_session, "on-sending-rtcp",
+      G_CALLBACK (rtp_session_stats_on_sending_rtcp), stats);
 
   return stats;
 }
@@ -248,6 +284,7 @@ rtp_session_stats_destroy (KmsRTPSessionStats * stats)
     g_slist_free_full (stats->ssrcs, (GDestroyNotify) ssrc_stats_destroy);
   }
 
+  g_signal_handlers_disconnect_by_data (stats->rtp_session, stats);
   g_clear_object (&stats->rtp_session);
 
   g_slice_free (KmsRTPSessionStats, stats);
@@ -541,7 +578,8 @@ kms_base_rtp_endpoint_create_rtp_session (KmsBaseRtpEndpoint * self,
       g_hash_table_lookup (self->priv->stats, GUINT_TO_POINTER (session_id));
 
   if (rtp_stats == NULL) {
-    rtp_stats = rtp_session_stats_new (rtpsession);
+    rtp_stats = rtp_session_stats_new (rtpsession,
+        &self->priv->stats_generation);
     g_hash_table_insert (self->priv->stats, GUINT_TO_POINTER (session_id),
         rtp_stats);
   } else {
@@ -671,6 +709,42 @@ kms_base_rtp_endpoint_create_remb_managers (KmsBaseRtpEndpoint * self)
   GST_DEBUG_OBJECT (self, "REMB managers added");
 }
 
+static void
+kms_base_rtp_endpoint_update_delay_bwe (KmsBaseRtpEndpoint * self)
+{
+  if (self->priv->rl == NULL) {
+    return;
+  }
+
+  if (self->priv->delay_based_bwe && self->priv->video_abs_send_time_id >= 0) {
+    kms_remb_local_enable_delay_bwe (self->priv->rl,
+        self->priv->video_abs_send_time_id);
+  } else {
+    kms_remb_local_disable_delay_bwe (self->priv->rl);
+  }
+}
+
+static void
+kms_base_rtp_endpoint_set_remb_recv_pad (KmsBaseRtpEndpoint * self)
+{
+  GstPad *pad;
+
+  if (self->priv->rl == NULL || self->priv->rl->recv_pad != NULL) {
+    return;
+  }
+
+  pad = gst_element_get_static_pad (self->priv->rtpbin,
+      VIDEO_RTPBIN_RECV_RTP_SINK);
+  if (pad == NULL) {
+    /* With bundle it is requested once the video SSRC is demuxed */
+    return;
+  }
+
+  kms_base_rtp_endpoint_update_delay_bwe (self);
+  kms_remb_local_set_recv_pad (self->priv->rl, pad);
+  g_object_unref (pad);
+}
+
 static gboolean
 ssrcs_are_mapped (GstElement * ssrcdemux,
     guint32 local_ssrc, guint32 remote_ssrc)
@@ -711,6 +785,7 @@ rtp_ssrc_demux_new_ssrc_pad (GstElement * ssrcdemux, guint ssrc, GstPad * pad,
         VIDEO_RTPBIN_RECV_RTP_SINK);
     gst_element_link_pads (ssrcdemux, rtcp_pad_name, rtpbin,
         VIDEO_RTPBIN_RECV_RTCP_SINK);
+    kms_base_rtp_endpoint_set_remb_recv_pad (self);
   }
 
   KMS_ELEMENT_UNLOCK (self);
@@ -765,86 +840,6 @@ kms_base_rtp_endpoint_add_bundle_connection (KmsBaseRtpEndpoint * self,
   kms_i_rtp_connection_src_sync_state_with_parent (conn);
 }
 
-static void
-kms_base_rtp_endpoint_write_rtp_hdr_ext (GstPad * pad, GstBuffer * buffer,
-    gint id)
-{
-  GstRTPBuffer rtp = { NULL, };
-  guint8 *data;
-  GstClockTime current_time, ms;
-  guint value;
-
-  if (!gst_rtp_buffer_map (buffer, GST_MAP_WRITE, &rtp)) {
-    GST_WARNING_OBJECT (pad, "Can not map RTP buffer for writting");
-    return;
-  }
-
-  current_time = kms_utils_get_time_nsecs ();
-  ms = current_time / 1000000;
-  value = (((ms << 18) / 1000) & 0x00ffffff);
-
-  data = g_malloc0 (RTP_HDR_EXT_ABS_SEND_TIME_SIZE);
-  data[0] = (guint8) (value >> 16);
-  data[1] = (guint8) (value >> 8);
-  data[2] = (guint8) (value);
-
-  /* TODO: check if header exists and in this case replace the value */
-  if (!gst_rtp_buffer_add_extension_onebyte_header (&rtp,
-          id, data, RTP_HDR_EXT_ABS_SEND_TIME_SIZE)) {
-    GST_WARNING_OBJECT (pad, "RTP hdrext abs-send-time not added");
-  }
-
-  g_free (data);
-  gst_rtp_buffer_unmap (&rtp);
-}
-
-typedef struct _HdrExtData
-{
-  GstPad *pad;
-  gint abs_send_time_id;
-} HdrExtData;
-
-static gboolean
-kms_base_rtp_endpoint_write_rtp_hdr_ext_bufflist (GstBuffer ** buf, guint idx,
-    HdrExtData * data)
-{
-  *buf = gst_buffer_make_writable (*buf);
-  kms_base_rtp_endpoint_write_rtp_hdr_ext (data->pad, *buf,
-      data->abs_send_time_id);
-
-  return TRUE;
-}
-
-static GstPadProbeReturn
-kms_base_rtp_endpoint_write_rtp_hdr_ext_probe (GstPad * pad,
-    GstPadProbeInfo * info, gpointer gp)
-{
-  gint id = GPOINTER_TO_INT (gp);
-
-  if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_BUFFER) {
-    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
-
-    buffer = gst_buffer_make_writable (buffer);
-    kms_base_rtp_endpoint_write_rtp_hdr_ext (pad, buffer, id);
-    GST_PAD_PROBE_INFO_DATA (info) = buffer;
-  } else if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
-    GstBufferList *bufflist = GST_PAD_PROBE_INFO_BUFFER_LIST (info);
-    HdrExtData data;
-
-    data.pad = pad;
-    data.abs_send_time_id = id;
-
-    bufflist = gst_buffer_list_make_writable (bufflist);
-    gst_buffer_list_foreach (bufflist,
-        (GstBufferListFunc) kms_base_rtp_endpoint_write_rtp_hdr_ext_bufflist,
-        &data);
-
-    GST_PAD_PROBE_INFO_DATA (info) = bufflist;
-  }
-
-  return GST_PAD_PROBE_OK;
-}
-
 static void
 kms_base_rtp_endpoint_add_connection_sink (KmsBaseRtpEndpoint * self,
     KmsIRtpConnection * conn, const gchar * rtp_session, gint abs_send_time_id)
@@ -859,13 +854,13 @@ kms_base_rtp_endpoint_add_connection_sink (KmsBaseRtpEndpoint * self,
   gst_pad_link (src, sink);
 
   if (abs_send_time_id > -1) {
+    KmsRtpHdrExtWriter *writer;
+
     GST_DEBUG_OBJECT (self,
         "Add probe for abs-send-time management (id: %d, %" GST_PTR_FORMAT ").",
         abs_send_time_id, src);
-    gst_pad_add_probe (src,
-        GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST,
-        kms_base_rtp_endpoint_write_rtp_hdr_ext_probe,
-        GINT_TO_POINTER (abs_send_time_id), NULL);
+    writer = kms_rtp_hdr_ext_writer_new (abs_send_time_id);
+    kms_rtp_hdr_ext_writer_add_probe (writer, src);
   }
 
   g_object_unref (src);
@@ -1003,6 +998,10 @@ kms_base_rtp_endpoint_add_connection_for_session (KmsBaseRtpEndpoint * self,
 
   abs_send_time_id = get_abs_send_time_id (mconf);
 
+  if (g_strcmp0 (rtp_session, VIDEO_RTP_SESSION_STR) == 0) {
+    self->priv->video_abs_send_time_id = abs_send_time_id;
+  }
+
   if (group != NULL) {          /* bundle */
     kms_base_rtp_endpoint_add_bundle_connection (self, conn, active);
     kms_base_rtp_endpoint_add_connection_sink (self, conn, rtp_session,
@@ -1015,6 +1014,8 @@ kms_base_rtp_endpoint_add_connection_for_session (KmsBaseRtpEndpoint * self,
         abs_send_time_id);
   }
 
+  kms_base_rtp_endpoint_set_remb_recv_pad (self);
+
   return TRUE;
 }
 
@@ -1251,26 +1252,22 @@ gst_base_rtp_get_payloader_for_caps (GstCaps * caps)
 {
   GstElementFactory *factory;
   GstElement *payloader = NULL;
-  GList *payloader_list, *filtered_list;
   GParamSpec *pspec;
 
-  payloader_list =
-      gst_element_factory_list_get_elements (GST_ELEMENT_FACTORY_TYPE_PAYLOADER,
-      GST_RANK_NONE);
-  filtered_list =
-      gst_element_factory_list_filter (payloader_list, caps, GST_PAD_SRC,
-      FALSE);
+  factory =
+      kms_utils_get_element_factory_for_caps
+      (GST_ELEMENT_FACTORY_TYPE_PAYLOADER, NULL, caps, NULL);
 
-  if (filtered_list == NULL) {
-    goto end;
-  }
-
-  factory = GST_ELEMENT_FACTORY (filtered_list->data);
   if (factory == NULL) {
-    goto end;
+    return NULL;
   }
 
   payloader = gst_element_factory_create (factory, NULL);
+  gst_object_unref (factory);
+
+  if (payloader == NULL) {
+    return NULL;
+  }
 
   pspec = g_object_class_find_property (G_OBJECT_GET_CLASS (payloader), "pt");
   if (pspec != NULL && G_PARAM_SPEC_VALUE_TYPE (pspec) == G_TYPE_UINT) {
@@ -1289,54 +1286,32 @@ gst_base_rtp_get_payloader_for_caps (GstCaps * caps)
     g_object_set (payloader, "config-interval", 1, NULL);
   }
 
-end:
-  gst_plugin_feature_list_free (filtered_list);
-  gst_plugin_feature_list_free (payloader_list);
-
   return payloader;
 }
 
+static gboolean
+depayloader_factory_filter (GstElementFactory * factory)
+{
+  /* Do not use asteriskh263 for H263 */
+  return g_strcmp0 (gst_plugin_feature_get_name (factory), "asteriskh263") != 0;
+}
+
 static GstElement *
 gst_base_rtp_get_depayloader_for_caps (GstCaps * caps)
 {
   GstElementFactory *factory;
   GstElement *depayloader = NULL;
-  GList *payloader_list, *filtered_list, *l;
-
-  payloader_list =
-      gst_element_factory_list_get_elements
-      (GST_ELEMENT_FACTORY_TYPE_DEPAYLOADER, GST_RANK_NONE);
-  filtered_list =
-      gst_element_factory_list_filter (payloader_list, caps, GST_PAD_SINK,
-      FALSE);
 
-  if (filtered_list == NULL) {
-    goto end;
-  }
-
-  for (l = filtered_list; l != NULL; l = l->next) {
-    factory = GST_ELEMENT_FACTORY (l->data);
-
-    if (factory == NULL) {
-      continue;
-    }
-
-    if (g_strcmp0 (gst_plugin_feature_get_name (factory), "asteriskh263") == 0) {
-      /* Do not use asteriskh263 for H263 */
-      continue;
-    }
+  factory =
+      kms_utils_get_element_factory_for_caps
+      (GST_ELEMENT_FACTORY_TYPE_DEPAYLOADER, caps, NULL,
+      depayloader_factory_filter);
 
+  if (factory != NULL) {
     depayloader = gst_element_factory_create (factory, NULL);
-
-    if (depayloader != NULL) {
-      break;
-    }
+    gst_object_unref (factory);
   }
 
-end:
-  gst_plugin_feature_list_free (filtered_list);
-  gst_plugin_feature_list_free (payloader_list);
-
   return depayloader;
 }
 
@@ -1926,6 +1901,10 @@ kms_base_rtp_endpoint_set_property (GObject * object, guint property_id,
       self->priv->max_video_send_bw = v;
       break;
     }
+    case PROP_DELAY_BASED_BWE:
+      self->priv->delay_based_bwe = g_value_get_boolean (value);
+      kms_base_rtp_endpoint_update_delay_bwe (self);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
       break;
@@ -1961,6 +1940,9 @@ kms_bse_rtp_endpoint_get_property (GObject * object, guint property_id,
     case PROP_MAX_VIDEO_SEND_BW:
       g_value_set_uint (value, self->priv->max_video_send_bw);
       break;
+    case PROP_DELAY_BASED_BWE:
+      g_value_set_boolean (value, self->priv->delay_based_bwe);
+      break;
     case PROP_STATE:
       g_value_set_enum (value, self->priv->state);
       break;
@@ -2102,12 +2084,53 @@ GstStructure *
 kms_base_rtp_endpoint_stats_action (KmsIStats * obj)
 {
   KmsBaseRtpEndpoint *self = KMS_BASE_RTP_ENDPOINT (obj);
-  GstStructure *stats;
+  GstStructure *stats, *enc_stats, *keyframe_stats;
 
   stats = kms_base_rtp_endpoint_create_stats (self);
 
   kms_base_rtp_endpoint_append_remb_stats (self, stats);
 
+  enc_stats = kms_element_get_video_encoders_stats (KMS_ELEMENT (self));
+  if (enc_stats != NULL) {
+    gst_structure_set (stats, "video-encoders", GST_TYPE_STRUCTURE, enc_stats,
+        NULL);
+    gst_structure_free (enc_stats);
+  }
+
+  keyframe_stats =
+      kms_element_get_keyframe_requests_stats (KMS_ELEMENT (self));
+  gst_structure_set (stats, "keyframe-requests", GST_TYPE_STRUCTURE,
+      keyframe_stats, NULL);
+  gst_structure_free (keyframe_stats);
+
+  return stats;
+}
+
+/* Only the sessions that had RTCP since generation @since */
+static GstStructure *
+kms_base_rtp_endpoint_changed_stats_action (KmsBaseRtpEndpoint * self,
+    guint since)
+{
+  GHashTableIter iter;
+  gpointer key, value;
+  GstStructure *stats;
+  gint generation;
+
+  generation = g_atomic_int_get (&self->priv->stats_generation);
+  stats = gst_structure_new ("stats", "generation", G_TYPE_UINT,
+      (guint) generation, NULL);
+
+  g_hash_table_iter_init (&iter, self->priv->stats);
+  while (g_hash_table_iter_next (&iter, &key, &value)) {
+    KmsRTPSessionStats *rtp_stats = value;
+
+    if (g_atomic_int_get (&rtp_stats->changed) - (gint) since > 0) {
+      append_rtp_session_stats (key, rtp_stats, stats);
+    }
+  }
+
+  kms_base_rtp_endpoint_append_remb_stats (self, stats);
+
   return stats;
 }
 
@@ -2135,6 +2158,7 @@ kms_base_rtp_endpoint_class_init (KmsBaseRtpEndpointClass * klass)
 
   klass->request_local_key_frame =
       kms_base_rtp_endpoint_request_local_key_frame;
+  klass->changed_stats = kms_base_rtp_endpoint_changed_stats_action;
 
   /* Connection management */
   klass->create_connection = kms_base_rtp_endpoint_create_connection_default;
@@ -2193,6 +2217,14 @@ kms_base_rtp_endpoint_class_init (KmsBaseRtpEndpointClass * klass)
           0, G_MAXUINT32, MAX_VIDEO_SEND_BW_DEFAULT,
           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
+  g_object_class_install_property (object_class, PROP_DELAY_BASED_BWE,
+      g_param_spec_boolean ("delay-based-bwe",
+          "Delay based bandwidth estimation",
+          "Estimate the received video bandwidth from the abs-send-time of"
+          " the packets, in addition to the losses, when sending REMB",
+          DEFAULT_DELAY_BASED_BWE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
   /* set signals */
   obj_signals[MEDIA_STATE_CHANGED] =
       g_signal_new ("media-state-changed",
@@ -2225,6 +2257,14 @@ kms_base_rtp_endpoint_class_init (KmsBaseRtpEndpointClass * klass)
       G_STRUCT_OFFSET (KmsBaseRtpEndpointClass, request_local_key_frame), NULL,
       NULL, __kms_core_marshal_BOOLEAN__VOID, G_TYPE_BOOLEAN, 0);
 
+  obj_signals[SIGNAL_CHANGED_STATS] =
+      g_signal_new ("changed-stats",
+      G_TYPE_FROM_CLASS (klass),
+      G_SIGNAL_ACTION | G_SIGNAL_RUN_LAST,
+      G_STRUCT_OFFSET (KmsBaseRtpEndpointClass, changed_stats), NULL,
+      NULL, __kms_core_marshal_BOXED__UINT, GST_TYPE_STRUCTURE, 1,
+      G_TYPE_UINT);
+
   g_type_class_add_private (klass, sizeof (KmsBaseRtpEndpointPrivate));
 }
 
@@ -2395,6 +2435,8 @@ kms_base_rtp_endpoint_init (KmsBaseRtpEndpoint * self)
   self->priv->rtcp_mux = DEFAULT_RTCP_MUX;
   self->priv->rtcp_nack = DEFAULT_RTCP_NACK;
   self->priv->rtcp_remb = DEFAULT_RTCP_REMB;
+  self->priv->delay_based_bwe = DEFAULT_DELAY_BASED_BWE;
+  self->priv->video_abs_send_time_id = -1;
 
   self->priv->min_video_send_bw = MIN_VIDEO_SEND_BW_DEFAULT;
   self->priv->max_video_send_bw = MAX_VIDEO_SEND_BW_DEFAULT;
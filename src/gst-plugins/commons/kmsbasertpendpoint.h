@@ -105,6 +105,10 @@ struct _KmsBaseRtpEndpointClass
 
   gboolean (*request_local_key_frame) (KmsBaseRtpEndpoint * self);
 
+  /* Stats of the RTP sessions that had RTCP since a generation, the current
+   * one is in the "generation" field */
+  GstStructure * (*changed_stats) (KmsBaseRtpEndpoint * self, guint since);
+
   /* virtual methods */
   KmsIRtpConnection * (*create_connection) (KmsBaseRtpEndpoint * self, const gchar *name);
   KmsIRtcpMuxConnection* (*create_rtcp_mux_connection) (KmsBaseRtpEndpoint * self, const gchar *name);
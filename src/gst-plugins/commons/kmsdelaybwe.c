@@ -0,0 +1,502 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <math.h>
+
+#include "kmsdelaybwe.h"
+
+#define GST_CAT_DEFAULT kms_delay_bwe_debug_category
+GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
+#define GST_DEFAULT_NAME "kmsdelaybwe"
+
+/* abs-send-time is 6.18 fixed point seconds */
+#define SEND_TIME_BITS 24
+#define SEND_TIME_MASK ((1 << SEND_TIME_BITS) - 1)
+#define SEND_TIME_FRACTION_BITS 18
+
+/* Packets sent within this interval belong to the same group */
+#define BURST_TIME_MS 5.0
+
+/* Arrival time filter */
+#define FILTER_WINDOW 20
+#define FILTER_SMOOTHING 0.9
+#define FILTER_GAIN 4.0
+#define FILTER_MAX_DELTAS 60
+
+/* Over-use detector */
+#define OVERUSE_TIME_MS 10.0
+#define THRESHOLD_INITIAL 12.5
+#define THRESHOLD_MIN 6.0
+#define THRESHOLD_MAX 600.0
+#define THRESHOLD_K_UP 0.0087
+#define THRESHOLD_K_DOWN 0.039
+#define THRESHOLD_MAX_OUTLIER 15.0
+#define THRESHOLD_MAX_TIME_DELTA_MS 100.0
+
+/* Rate controller */
+#define RATE_WINDOW (500 * GST_MSECOND)
+#define RATE_BETA 0.85
+#define RATE_ETA 1.08           /* per second */
+#define RATE_MIN_INCREASE 1000  /* bps */
+#define RATE_MAX_INCOMING_FACTOR 1.5
+#define RATE_RESPONSE_TIME (300 * GST_MSECOND)
+#define RATE_PACKET_BITS (1200 * 8)
+#define RATE_AVG_MAX_FACTOR 0.05
+
+typedef enum
+{
+  RATE_HOLD,
+  RATE_INCREASE,
+  RATE_DECREASE
+} RateState;
+
+struct _KmsDelayBwe
+{
+  guint min_bitrate;
+  guint max_bitrate;
+
+  /* Packet group being received */
+  gboolean has_group;
+  guint32 group_first_send;
+  guint32 group_last_send;
+  GstClockTime group_arrival;
+
+  /* Last completed group */
+  gboolean has_prev;
+  guint32 prev_send;
+  GstClockTime prev_arrival;
+
+  /* Arrival time filter, in milliseconds */
+  GstClockTime first_arrival;
+  gdouble accumulated_delay;
+  gdouble smoothed_delay;
+  gdouble window_time[FILTER_WINDOW];
+  gdouble window_delay[FILTER_WINDOW];
+  guint window_len;
+  guint window_pos;
+  gdouble trend;
+  guint n_deltas;
+
+  /* Over-use detector */
+  KmsDelayBweSignal signal;
+  gdouble threshold;
+  gdouble prev_trend;
+  gdouble overuse_time;
+  guint overuse_count;
+  GstClockTime last_threshold_update;
+
+  /* Incoming bitrate */
+  GstClockTime window_start;
+  guint64 window_bytes;
+  guint incoming_bitrate;
+
+  /* Rate controller */
+  RateState state;
+  guint estimate;
+  GstClockTime last_update;
+  GstClockTime last_decrease;
+  /* kbps, negative while unknown */
+  gdouble avg_max_bitrate;
+  gdouble var_max_bitrate;
+};
+
+/* Milliseconds from b to a, wrapping as abs-send-time does every 64s */
+static gdouble
+send_time_diff_ms (guint32 a, guint32 b)
+{
+  gint32 diff = (a - b) & SEND_TIME_MASK;
+
+  if (diff >= (1 << (SEND_TIME_BITS - 1))) {
+    diff -= (1 << SEND_TIME_BITS);
+  }
+
+  return diff * 1000.0 / (1 << SEND_TIME_FRACTION_BITS);
+}
+
+/* The trend of the one way delay variation is the slope of a linear
+ * regression over the last groups of the smoothed accumulated delay */
+static void
+kms_delay_bwe_update_filter (KmsDelayBwe * bwe, gdouble delta_ms,
+    GstClockTime arrival)
+{
+  gdouble avg_time = 0, avg_delay = 0, num = 0, den = 0;
+  guint i;
+
+  if (!GST_CLOCK_TIME_IS_VALID (bwe->first_arrival)) {
+    bwe->first_arrival = arrival;
+  }
+
+  bwe->accumulated_delay += delta_ms;
+  bwe->smoothed_delay = FILTER_SMOOTHING * bwe->smoothed_delay +
+      (1 - FILTER_SMOOTHING) * bwe->accumulated_delay;
+
+  bwe->window_time[bwe->window_pos] =
+      (gdouble) (arrival - bwe->first_arrival) / GST_MSECOND;
+  bwe->window_delay[bwe->window_pos] = bwe->smoothed_delay;
+  bwe->window_pos = (bwe->window_pos + 1) % FILTER_WINDOW;
+
+  if (bwe->window_len < FILTER_WINDOW) {
+    bwe->window_len++;
+  }
+
+  if (bwe->n_deltas < FILTER_MAX_DELTAS) {
+    bwe->n_deltas++;
+  }
+
+  if (bwe->window_len < FILTER_WINDOW) {
+    return;
+  }
+
+  for (i = 0; i < FILTER_WINDOW; i++) {
+    avg_time += bwe->window_time[i];
+    avg_delay += bwe->window_delay[i];
+  }
+
+  avg_time /= FILTER_WINDOW;
+  avg_delay /= FILTER_WINDOW;
+
+  for (i = 0; i < FILTER_WINDOW; i++) {
+    num += (bwe->window_time[i] - avg_time) *
+        (bwe->window_delay[i] - avg_delay);
+    den += (bwe->window_time[i] - avg_time) * (bwe->window_time[i] - avg_time);
+  }
+
+  if (den > 0) {
+    bwe->trend = num / den;
+  }
+}
+
+static void
+kms_delay_bwe_update_threshold (KmsDelayBwe * bwe, gdouble modified_trend,
+    GstClockTime now)
+{
+  gdouble k, dt;
+
+  if (!GST_CLOCK_TIME_IS_VALID (bwe->last_threshold_update)) {
+    bwe->last_threshold_update = now;
+  }
+
+  if (fabs (modified_trend) > bwe->threshold + THRESHOLD_MAX_OUTLIER) {
+    /* Do not adapt to spikes, like the ones caused by a route change */
+    bwe->last_threshold_update = now;
+    return;
+  }
+
+  k = fabs (modified_trend) < bwe->threshold ? THRESHOLD_K_DOWN :
+      THRESHOLD_K_UP;
+  dt = MIN ((gdouble) (now - bwe->last_threshold_update) / GST_MSECOND,
+      THRESHOLD_MAX_TIME_DELTA_MS);
+
+  bwe->threshold += k * (fabs (modified_trend) - bwe->threshold) * dt;
+  bwe->threshold = CLAMP (bwe->threshold, THRESHOLD_MIN, THRESHOLD_MAX);
+  bwe->last_threshold_update = now;
+}
+
+static void
+kms_delay_bwe_detect (KmsDelayBwe * bwe, gdouble send_delta_ms,
+    GstClockTime now)
+{
+  gdouble modified_trend = bwe->trend * bwe->n_deltas * FILTER_GAIN;
+
+  if (modified_trend > bwe->threshold) {
+    if (bwe->overuse_time < 0) {
+      bwe->overuse_time = send_delta_ms / 2;
+    } else {
+      bwe->overuse_time += send_delta_ms;
+    }
+
+    bwe->overuse_count++;
+
+    if (bwe->overuse_time > OVERUSE_TIME_MS && bwe->overuse_count > 1
+        && bwe->trend >= bwe->prev_trend) {
+      bwe->overuse_time = 0;
+      bwe->overuse_count = 0;
+      bwe->signal = KMS_DELAY_BWE_OVERUSING;
+    }
+  } else if (modified_trend < -bwe->threshold) {
+    bwe->overuse_time = -1;
+    bwe->overuse_count = 0;
+    bwe->signal = KMS_DELAY_BWE_UNDERUSING;
+  } else {
+    bwe->overuse_time = -1;
+    bwe->overuse_count = 0;
+    bwe->signal = KMS_DELAY_BWE_NORMAL;
+  }
+
+  bwe->prev_trend = bwe->trend;
+  kms_delay_bwe_update_threshold (bwe, modified_trend, now);
+}
+
+static void
+kms_delay_bwe_update_max_bitrate (KmsDelayBwe * bwe, gdouble incoming_kbps)
+{
+  gdouble norm;
+
+  if (bwe->avg_max_bitrate < 0) {
+    bwe->avg_max_bitrate = incoming_kbps;
+  } else {
+    bwe->avg_max_bitrate = (1 - RATE_AVG_MAX_FACTOR) * bwe->avg_max_bitrate +
+        RATE_AVG_MAX_FACTOR * incoming_kbps;
+  }
+
+  norm = MAX (bwe->avg_max_bitrate, 1.0);
+  bwe->var_max_bitrate = (1 - RATE_AVG_MAX_FACTOR) * bwe->var_max_bitrate +
+      RATE_AVG_MAX_FACTOR * (bwe->avg_max_bitrate - incoming_kbps) *
+      (bwe->avg_max_bitrate - incoming_kbps) / norm;
+  bwe->var_max_bitrate = CLAMP (bwe->var_max_bitrate, 0.4, 2.5);
+}
+
+static void
+kms_delay_bwe_update_rate (KmsDelayBwe * bwe, GstClockTime now)
+{
+  gdouble incoming_kbps, std_max, dt, estimate;
+
+  if (bwe->incoming_bitrate == 0) {
+    return;
+  }
+
+  if (bwe->estimate == 0) {
+    /* Start from what we are actually receiving */
+    bwe->estimate = bwe->incoming_bitrate;
+    bwe->last_update = now;
+    bwe->state = RATE_INCREASE;
+  }
+
+  switch (bwe->signal) {
+    case KMS_DELAY_BWE_OVERUSING:
+      bwe->state = RATE_DECREASE;
+      break;
+    case KMS_DELAY_BWE_UNDERUSING:
+      /* Let the queues drain before increasing again */
+      bwe->state = RATE_HOLD;
+      break;
+    case KMS_DELAY_BWE_NORMAL:
+      if (bwe->state == RATE_HOLD) {
+        bwe->state = RATE_INCREASE;
+      }
+      break;
+  }
+
+  estimate = bwe->estimate;
+  incoming_kbps = bwe->incoming_bitrate / 1000.0;
+  std_max = sqrt (bwe->var_max_bitrate * MAX (bwe->avg_max_bitrate, 1.0));
+  dt = MIN ((gdouble) (now - bwe->last_update) / GST_SECOND, 1.0);
+
+  switch (bwe->state) {
+    case RATE_HOLD:
+      break;
+    case RATE_INCREASE:
+      if (bwe->avg_max_bitrate >= 0
+          && incoming_kbps > bwe->avg_max_bitrate + 3 * std_max) {
+        /* The link got better, look for the new limit */
+        bwe->avg_max_bitrate = -1;
+      }
+
+      if (bwe->avg_max_bitrate >= 0) {
+        /* Close to the last known limit, probe carefully */
+        estimate += MAX (RATE_MIN_INCREASE * dt,
+            dt * RATE_PACKET_BITS / 2 * GST_SECOND / RATE_RESPONSE_TIME);
+      } else {
+        estimate += MAX (RATE_MIN_INCREASE * dt,
+            estimate * (pow (RATE_ETA, dt) - 1));
+      }
+
+      estimate = MIN (estimate,
+          RATE_MAX_INCOMING_FACTOR * bwe->incoming_bitrate + 10000);
+      break;
+    case RATE_DECREASE:
+      if (GST_CLOCK_TIME_IS_VALID (bwe->last_decrease)
+          && now - bwe->last_decrease < RATE_RESPONSE_TIME) {
+        /* Wait for the previous decrease to take effect */
+        break;
+      }
+
+      if (bwe->avg_max_bitrate >= 0
+          && incoming_kbps < bwe->avg_max_bitrate - 3 * std_max) {
+        bwe->avg_max_bitrate = -1;
+      }
+
+      estimate = MIN (estimate, RATE_BETA * bwe->incoming_bitrate);
+      kms_delay_bwe_update_max_bitrate (bwe, incoming_kbps);
+      bwe->last_decrease = now;
+      bwe->state = RATE_HOLD;
+      break;
+  }
+
+  estimate = MAX (estimate, bwe->min_bitrate);
+  if (bwe->max_bitrate > 0) {
+    estimate = MIN (estimate, bwe->max_bitrate);
+  }
+
+  if ((guint) estimate != bwe->estimate) {
+    GST_TRACE ("Estimate %u bps (incoming %u bps, trend %f, threshold %f)",
+        (guint) estimate, bwe->incoming_bitrate, bwe->trend, bwe->threshold);
+  }
+
+  bwe->estimate = estimate;
+  bwe->last_update = now;
+}
+
+static void
+kms_delay_bwe_update_incoming_bitrate (KmsDelayBwe * bwe,
+    GstClockTime arrival, guint size)
+{
+  GstClockTime elapsed;
+
+  if (!GST_CLOCK_TIME_IS_VALID (bwe->window_start)) {
+    bwe->window_start = arrival;
+  }
+
+  bwe->window_bytes += size;
+  elapsed = arrival - bwe->window_start;
+
+  if (elapsed >= RATE_WINDOW) {
+    bwe->incoming_bitrate =
+        gst_util_uint64_scale (bwe->window_bytes, 8 * GST_SECOND, elapsed);
+    bwe->window_start = arrival;
+    bwe->window_bytes = 0;
+  }
+}
+
+void
+kms_delay_bwe_incoming_packet (KmsDelayBwe * bwe, GstClockTime arrival,
+    guint32 send_time, guint size)
+{
+  gdouble send_delta, arrival_delta;
+
+  g_return_if_fail (bwe != NULL);
+
+  send_time &= SEND_TIME_MASK;
+  kms_delay_bwe_update_incoming_bitrate (bwe, arrival, size);
+
+  if (!bwe->has_group) {
+    bwe->has_group = TRUE;
+    bwe->group_first_send = bwe->group_last_send = send_time;
+    bwe->group_arrival = arrival;
+    return;
+  }
+
+  if (send_time_diff_ms (send_time, bwe->group_first_send) < 0) {
+    /* Reordered packet of an already processed group */
+    return;
+  }
+
+  if (send_time_diff_ms (send_time, bwe->group_first_send) <= BURST_TIME_MS) {
+    if (send_time_diff_ms (send_time, bwe->group_last_send) > 0) {
+      bwe->group_last_send = send_time;
+    }
+    bwe->group_arrival = arrival;
+    return;
+  }
+
+  /* A new group starts, compare the completed one with the previous one */
+  if (bwe->has_prev) {
+    send_delta = send_time_diff_ms (bwe->group_last_send, bwe->prev_send);
+    arrival_delta =
+        (gdouble) GST_CLOCK_DIFF (bwe->prev_arrival,
+        bwe->group_arrival) / GST_MSECOND;
+
+    kms_delay_bwe_update_filter (bwe, arrival_delta - send_delta,
+        bwe->group_arrival);
+    kms_delay_bwe_detect (bwe, send_delta, bwe->group_arrival);
+    kms_delay_bwe_update_rate (bwe, bwe->group_arrival);
+  }
+
+  bwe->has_prev = TRUE;
+  bwe->prev_send = bwe->group_last_send;
+  bwe->prev_arrival = bwe->group_arrival;
+
+  bwe->group_first_send = bwe->group_last_send = send_time;
+  bwe->group_arrival = arrival;
+}
+
+guint
+kms_delay_bwe_get_estimate (KmsDelayBwe * bwe)
+{
+  g_return_val_if_fail (bwe != NULL, 0);
+
+  return bwe->estimate;
+}
+
+guint
+kms_delay_bwe_get_incoming_bitrate (KmsDelayBwe * bwe)
+{
+  g_return_val_if_fail (bwe != NULL, 0);
+
+  return bwe->incoming_bitrate;
+}
+
+KmsDelayBweSignal
+kms_delay_bwe_get_signal (KmsDelayBwe * bwe)
+{
+  g_return_val_if_fail (bwe != NULL, KMS_DELAY_BWE_NORMAL);
+
+  return bwe->signal;
+}
+
+void
+kms_delay_bwe_set_max_bitrate (KmsDelayBwe * bwe, guint max_bitrate)
+{
+  g_return_if_fail (bwe != NULL);
+
+  bwe->max_bitrate = max_bitrate;
+}
+
+KmsDelayBwe *
+kms_delay_bwe_new (guint min_bitrate, guint max_bitrate)
+{
+  KmsDelayBwe *bwe = g_slice_new0 (KmsDelayBwe);
+
+  bwe->min_bitrate = min_bitrate;
+  bwe->max_bitrate = max_bitrate;
+
+  bwe->first_arrival = GST_CLOCK_TIME_NONE;
+
+  bwe->signal = KMS_DELAY_BWE_NORMAL;
+  bwe->threshold = THRESHOLD_INITIAL;
+  bwe->overuse_time = -1;
+  bwe->last_threshold_update = GST_CLOCK_TIME_NONE;
+
+  bwe->window_start = GST_CLOCK_TIME_NONE;
+
+  bwe->state = RATE_HOLD;
+  bwe->last_decrease = GST_CLOCK_TIME_NONE;
+  bwe->avg_max_bitrate = -1;
+  bwe->var_max_bitrate = 0.4;
+
+  return bwe;
+}
+
+void
+kms_delay_bwe_free (KmsDelayBwe * bwe)
+{
+  if (bwe == NULL) {
+    return;
+  }
+
+  g_slice_free (KmsDelayBwe, bwe);
+}
+
+static void init_debug (void) __attribute__ ((constructor));
+
+static void
+init_debug (void)
+{
+  GST_DEBUG_CATEGORY_INIT (GST_CAT_DEFAULT, GST_DEFAULT_NAME, 0,
+      GST_DEFAULT_NAME);
+}
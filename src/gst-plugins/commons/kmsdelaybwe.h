@@ -0,0 +1,59 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef __KMS_DELAY_BWE_H__
+#define __KMS_DELAY_BWE_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Receive side, delay based bandwidth estimator as described in
+ * draft-ietf-rmcat-gcc: packets are grouped by send time, the variation of
+ * the one way delay between groups is smoothed by an arrival time filter and
+ * an over-use detector with adaptive threshold drives an AIMD rate
+ * controller.
+ *
+ * Send times are abs-send-time values. It is not thread safe and it does not
+ * read any clock, so it can be fed with simulated time.
+ */
+typedef struct _KmsDelayBwe KmsDelayBwe;
+
+typedef enum
+{
+  KMS_DELAY_BWE_NORMAL,
+  KMS_DELAY_BWE_OVERUSING,
+  KMS_DELAY_BWE_UNDERUSING
+} KmsDelayBweSignal;
+
+/* Bitrates in bps. A max_bitrate of 0 means unlimited */
+KmsDelayBwe * kms_delay_bwe_new (guint min_bitrate, guint max_bitrate);
+void kms_delay_bwe_free (KmsDelayBwe * bwe);
+
+void kms_delay_bwe_set_max_bitrate (KmsDelayBwe * bwe, guint max_bitrate);
+
+/* arrival: local reception time, send_time: 24 bits abs-send-time */
+void kms_delay_bwe_incoming_packet (KmsDelayBwe * bwe, GstClockTime arrival,
+    guint32 send_time, guint size);
+
+/* Returns 0 until there is enough information to estimate */
+guint kms_delay_bwe_get_estimate (KmsDelayBwe * bwe);
+guint kms_delay_bwe_get_incoming_bitrate (KmsDelayBwe * bwe);
+KmsDelayBweSignal kms_delay_bwe_get_signal (KmsDelayBwe * bwe);
+
+G_END_DECLS
+
+#endif /* __KMS_DELAY_BWE_H__ */
@@ -23,11 +23,21 @@
 #include "kmselement.h"
 #include "kmsagnosticcaps.h"
 #include "kmsutils.h"
+#include "kmsistats.h"
+#include "kmskeyframearbiter.h"
+#include "kmssyncbase.h"
+#include "kmselementpool.h"
 
 #define PLUGIN_NAME "kmselement"
 #define DEFAULT_ACCEPT_EOS TRUE
 #define DEFAULT_DO_SYNCHRONIZATION FALSE
 #define DEFAULT_BITRATE_ "default-bitrate"
+#define ENCODER_CONFIG "encoder-config"
+#define SHARED_FAN_OUT "shared-fan-out"
+#define DEFAULT_SHARED_FAN_OUT FALSE
+#define GOP_CACHE "gop-cache"
+#define DEFAULT_GOP_CACHE FALSE
+#define DEFER_OUTPUTS "defer-outputs"
 
 GST_DEBUG_CATEGORY_STATIC (kms_element_debug_category);
 #define GST_CAT_DEFAULT kms_element_debug_category
@@ -45,14 +55,6 @@ G_DEFINE_TYPE_WITH_CODE (KmsElement, kms_element,
 #define KMS_ELEMENT_GET_PRIVATE(obj) \
   (G_TYPE_INSTANCE_GET_PRIVATE ((obj), KMS_TYPE_ELEMENT, KmsElementPrivate))
 
-#define KMS_ELEMENT_SYNC_LOCK(obj) (                      \
-  g_mutex_lock (&(((KmsElement *)obj)->priv->sync_lock))  \
-)
-
-#define KMS_ELEMENT_SYNC_UNLOCK(obj) (                      \
-  g_mutex_unlock (&(((KmsElement *)obj)->priv->sync_lock))  \
-)
-
 typedef struct _PendingSrcPad
 {
   KmsElementPadType type;
@@ -76,15 +78,21 @@ struct _KmsElementPrivate
   GstCaps *video_caps;
 
   /* Synchronization */
-  GMutex sync_lock;
-  GstClockTime base_time;
-  GstClockTime base_clock;
+  KmsSyncBase *sync_base;
 
   gboolean do_synchronization;
 
   GHashTable *pendingpads;
 
   gint target_bitrate;
+  GstStructure *encoder_config;
+  gboolean shared_fan_out;
+  gboolean gop_cache;
+
+  /* Nested batches of src pad connections */
+  guint batch_count;
+
+  KmsKeyframeArbiter *keyframe_arbiter;
 };
 
 /* Signals and args */
@@ -93,6 +101,8 @@ enum
   /* Actions */
   REQUEST_NEW_SRCPAD,
   RELEASE_REQUESTED_SRCPAD,
+  BEGIN_BATCH,
+  END_BATCH,
   LAST_SIGNAL
 };
 
@@ -106,6 +116,9 @@ enum
   PROP_VIDEO_CAPS,
   PROP_DO_SYNCHRONIZATION,
   PROP_TARGET_BITRATE,
+  PROP_ENCODER_CONFIG,
+  PROP_SHARED_FAN_OUT,
+  PROP_GOP_CACHE,
   PROP_LAST
 };
 
@@ -159,110 +172,52 @@ destroy_pendingpads (PendingSrcPad * data)
 }
 
 static GstClockTime
-kms_element_adjust_pts (KmsElement * self, GstClockTime in)
+kms_element_get_running_time (KmsElement * self)
 {
-  GstClockTime pts = in;
-
-  if (GST_CLOCK_TIME_IS_VALID (self->priv->base_time)
-      && GST_CLOCK_TIME_IS_VALID (self->priv->base_clock)) {
-    if (GST_CLOCK_TIME_IS_VALID (in)) {
-      if (self->priv->base_time > in) {
-        GST_WARNING_OBJECT (self,
-            "Received a buffer with a pts lower than base");
-        pts = self->priv->base_clock;
-      } else {
-        pts = (in - self->priv->base_time) + self->priv->base_clock;
-      }
-    }
-  } else {
-    pts = GST_CLOCK_TIME_NONE;
-  }
+  GstObject *parent = GST_OBJECT (self);
+  GstClockTime running_time = GST_CLOCK_TIME_NONE;
+  GstClock *clock;
 
-  return pts;
-}
-
-static GstClockTime
-kms_element_synchronize_pts (KmsElement * self, GstClockTime in)
-{
-  GstClockTime pts;
-
-  KMS_ELEMENT_SYNC_LOCK (self);
-
-  if (!GST_CLOCK_TIME_IS_VALID (self->priv->base_time)
-      && GST_CLOCK_TIME_IS_VALID (in)) {
-    self->priv->base_time = in;
+  while (parent && parent->parent) {
+    parent = parent->parent;
   }
 
-  if (!GST_CLOCK_TIME_IS_VALID (self->priv->base_clock)) {
-    GstObject *parent = GST_OBJECT (self);
-    GstClock *clock;
+  if (parent) {
+    clock = gst_element_get_clock (GST_ELEMENT (parent));
 
-    while (parent && parent->parent) {
-      parent = parent->parent;
-    }
-
-    if (parent) {
-      clock = gst_element_get_clock (GST_ELEMENT (parent));
-
-      if (clock) {
-        self->priv->base_clock =
-            gst_clock_get_time (clock) -
-            gst_element_get_base_time (GST_ELEMENT (parent));
-        g_object_unref (clock);
-      }
+    if (clock) {
+      running_time = gst_clock_get_time (clock) -
+          gst_element_get_base_time (GST_ELEMENT (parent));
+      g_object_unref (clock);
     }
   }
 
-  pts = kms_element_adjust_pts (self, in);
-
-  KMS_ELEMENT_SYNC_UNLOCK (self);
-
-  return pts;
-}
-
-static void
-kms_element_synchronize_buffer (KmsElement * self, GstBuffer * buffer)
-{
-  GST_BUFFER_PTS (buffer) = kms_element_synchronize_pts (self,
-      GST_BUFFER_PTS (buffer));
-  GST_BUFFER_DTS (buffer) = GST_BUFFER_PTS (buffer);
-}
-
-static gboolean
-synchronize_bufferlist (GstBuffer ** buf, guint idx, KmsElement * self)
-{
-  *buf = gst_buffer_make_writable (*buf);
-
-  kms_element_synchronize_buffer (self, *buf);
-
-  return TRUE;
+  return running_time;
 }
 
 static GstPadProbeReturn
 synchronize_probe (GstPad * pad, GstPadProbeInfo * info, gpointer data)
 {
-  KmsElement *self = KMS_ELEMENT (data);
+  KmsSyncBasePad *sync = data;
 
   if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_BUFFER) {
     GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
 
     buffer = gst_buffer_make_writable (buffer);
-    kms_element_synchronize_buffer (self, buffer);
+    kms_sync_base_pad_rebase_buffer (sync, buffer);
 
     GST_PAD_PROBE_INFO_DATA (info) = buffer;
   } else if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
     GstBufferList *bufflist = GST_PAD_PROBE_INFO_BUFFER_LIST (info);
 
-    bufflist = gst_buffer_list_make_writable (bufflist);
-    gst_buffer_list_foreach (bufflist,
-        (GstBufferListFunc) synchronize_bufferlist, self);
-    GST_PAD_PROBE_INFO_DATA (info) = bufflist;
+    GST_PAD_PROBE_INFO_DATA (info) =
+        kms_sync_base_pad_rebase_list (sync, bufflist);
   } else if (GST_PAD_PROBE_INFO_TYPE (info) &
       GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
     GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
 
     event = gst_event_make_writable (event);
-    GST_EVENT_TIMESTAMP (event) = kms_element_synchronize_pts (self,
+    GST_EVENT_TIMESTAMP (event) = kms_sync_base_pad_rebase (sync,
         GST_EVENT_TIMESTAMP (event));
 
     /* Check dowstream events */
@@ -288,12 +243,22 @@ synchronize_probe (GstPad * pad, GstPadProbeInfo * info, gpointer data)
 
     GST_PAD_PROBE_INFO_DATA (info) = event;
   } else {
-    GST_ERROR_OBJECT (self, "Unsupported data received in probe");
+    GST_ERROR_OBJECT (pad, "Unsupported data received in probe");
   }
 
   return GST_PAD_PROBE_OK;
 }
 
+static void
+kms_element_add_synchronize_probe (KmsElement * self, GstPad * pad)
+{
+  /* Each streaming thread keeps its own copy of the base */
+  gst_pad_add_probe (pad,
+      GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST,
+      synchronize_probe, kms_sync_base_pad_new (self->priv->sync_base),
+      (GDestroyNotify) kms_sync_base_pad_free);
+}
+
 static void
 kms_element_set_target_on_linked (GstPad * pad, GstPad * peer,
     GstElement * element)
@@ -441,15 +406,13 @@ kms_element_get_data_tee (KmsElement * self)
     return self->priv->data_tee;
   }
 
-  tee = gst_element_factory_make ("tee", NULL);
+  tee = kms_element_pool_make ("tee");
 
   if (self->priv->do_synchronization) {
     GstPad *sink;
 
     sink = gst_element_get_static_pad (tee, "sink");
-    gst_pad_add_probe (sink,
-        GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST,
-        synchronize_probe, self, NULL);
+    kms_element_add_synchronize_probe (self, sink);
     g_object_unref (sink);
   }
 
@@ -480,15 +443,16 @@ kms_element_get_audio_agnosticbin (KmsElement * self)
   }
 
   self->priv->audio_agnosticbin =
-      gst_element_factory_make ("agnosticbin", NULL);
+      kms_element_pool_make ("agnosticbin");
+  g_object_set (self->priv->audio_agnosticbin, SHARED_FAN_OUT,
+      self->priv->shared_fan_out, DEFER_OUTPUTS, self->priv->batch_count > 0,
+      NULL);
 
   if (self->priv->do_synchronization) {
     GstPad *sink;
 
     sink = gst_element_get_static_pad (self->priv->audio_agnosticbin, "sink");
-    gst_pad_add_probe (sink,
-        GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST,
-        synchronize_probe, self, NULL);
+    kms_element_add_synchronize_probe (self, sink);
     g_object_unref (sink);
   }
 
@@ -504,6 +468,8 @@ kms_element_get_audio_agnosticbin (KmsElement * self)
 GstElement *
 kms_element_get_video_agnosticbin (KmsElement * self)
 {
+  GstPad *sink;
+
   GST_DEBUG_OBJECT (self, "Video agnostic requested");
   KMS_ELEMENT_LOCK (self);
   if (self->priv->video_agnosticbin != NULL) {
@@ -512,18 +478,26 @@ kms_element_get_video_agnosticbin (KmsElement * self)
   }
 
   self->priv->video_agnosticbin =
-      gst_element_factory_make ("agnosticbin", NULL);
+      kms_element_pool_make ("agnosticbin");
+  g_object_set (self->priv->video_agnosticbin, SHARED_FAN_OUT,
+      self->priv->shared_fan_out, GOP_CACHE, self->priv->gop_cache,
+      DEFER_OUTPUTS, self->priv->batch_count > 0, NULL);
+
+  if (self->priv->encoder_config != NULL) {
+    g_object_set (self->priv->video_agnosticbin, ENCODER_CONFIG,
+        self->priv->encoder_config, NULL);
+  }
 
-  if (self->priv->do_synchronization) {
-    GstPad *sink;
+  sink = gst_element_get_static_pad (self->priv->video_agnosticbin, "sink");
 
-    sink = gst_element_get_static_pad (self->priv->video_agnosticbin, "sink");
-    gst_pad_add_probe (sink,
-        GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST,
-        synchronize_probe, self, NULL);
-    g_object_unref (sink);
+  if (self->priv->do_synchronization) {
+    kms_element_add_synchronize_probe (self, sink);
   }
 
+  /* Key frame requests of every output leave through here */
+  kms_keyframe_arbiter_attach (self->priv->keyframe_arbiter, sink);
+  g_object_unref (sink);
+
   gst_bin_add (GST_BIN (self), self->priv->video_agnosticbin);
   gst_element_sync_state_with_parent (self->priv->video_agnosticbin);
   KMS_ELEMENT_UNLOCK (self);
@@ -533,6 +507,37 @@ kms_element_get_video_agnosticbin (KmsElement * self)
   return self->priv->video_agnosticbin;
 }
 
+GstStructure *
+kms_element_get_keyframe_requests_stats (KmsElement * self)
+{
+  return kms_keyframe_arbiter_get_stats (self->priv->keyframe_arbiter);
+}
+
+GstStructure *
+kms_element_get_video_encoders_stats (KmsElement * self)
+{
+  GstElement *agnosticbin = NULL;
+  GstStructure *stats = NULL;
+
+  KMS_ELEMENT_LOCK (self);
+  if (self->priv->video_agnosticbin != NULL) {
+    agnosticbin = g_object_ref (self->priv->video_agnosticbin);
+  }
+  KMS_ELEMENT_UNLOCK (self);
+
+  if (agnosticbin == NULL) {
+    return NULL;
+  }
+
+  if (KMS_IS_ISTATS (agnosticbin)) {
+    g_signal_emit_by_name (agnosticbin, "stats", &stats);
+  }
+
+  g_object_unref (agnosticbin);
+
+  return stats;
+}
+
 static void
 send_flush_on_unlink (GstPad * pad, GstPad * peer, gpointer user_data)
 {
@@ -790,6 +795,46 @@ kms_element_set_property (GObject * object, guint property_id,
           DEFAULT_BITRATE_, self->priv->target_bitrate, NULL);
       KMS_ELEMENT_UNLOCK (self);
       break;
+    case PROP_ENCODER_CONFIG:{
+      const GstStructure *config = gst_value_get_structure (value);
+
+      KMS_ELEMENT_LOCK (self);
+      if (self->priv->encoder_config != NULL) {
+        gst_structure_free (self->priv->encoder_config);
+      }
+      self->priv->encoder_config =
+          config != NULL ? gst_structure_copy (config) : NULL;
+      /* Applied when the video agnosticbin gets created */
+      if (self->priv->video_agnosticbin != NULL) {
+        g_object_set (self->priv->video_agnosticbin, ENCODER_CONFIG,
+            self->priv->encoder_config, NULL);
+      }
+      KMS_ELEMENT_UNLOCK (self);
+      break;
+    }
+    case PROP_SHARED_FAN_OUT:
+      KMS_ELEMENT_LOCK (self);
+      self->priv->shared_fan_out = g_value_get_boolean (value);
+      /* Only used by the outputs linked from now on */
+      if (self->priv->audio_agnosticbin != NULL) {
+        g_object_set (self->priv->audio_agnosticbin, SHARED_FAN_OUT,
+            self->priv->shared_fan_out, NULL);
+      }
+      if (self->priv->video_agnosticbin != NULL) {
+        g_object_set (self->priv->video_agnosticbin, SHARED_FAN_OUT,
+            self->priv->shared_fan_out, NULL);
+      }
+      KMS_ELEMENT_UNLOCK (self);
+      break;
+    case PROP_GOP_CACHE:
+      KMS_ELEMENT_LOCK (self);
+      self->priv->gop_cache = g_value_get_boolean (value);
+      if (self->priv->video_agnosticbin != NULL) {
+        g_object_set (self->priv->video_agnosticbin, GOP_CACHE,
+            self->priv->gop_cache, NULL);
+      }
+      KMS_ELEMENT_UNLOCK (self);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
       break;
@@ -824,6 +869,21 @@ kms_element_get_property (GObject * object, guint property_id,
       g_value_set_int (value, self->priv->target_bitrate);
       KMS_ELEMENT_UNLOCK (self);
       break;
+    case PROP_ENCODER_CONFIG:
+      KMS_ELEMENT_LOCK (self);
+      gst_value_set_structure (value, self->priv->encoder_config);
+      KMS_ELEMENT_UNLOCK (self);
+      break;
+    case PROP_SHARED_FAN_OUT:
+      KMS_ELEMENT_LOCK (self);
+      g_value_set_boolean (value, self->priv->shared_fan_out);
+      KMS_ELEMENT_UNLOCK (self);
+      break;
+    case PROP_GOP_CACHE:
+      KMS_ELEMENT_LOCK (self);
+      g_value_set_boolean (value, self->priv->gop_cache);
+      KMS_ELEMENT_UNLOCK (self);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
       break;
@@ -849,7 +909,13 @@ kms_element_finalize (GObject * object)
     gst_caps_unref (element->priv->audio_caps);
   }
 
-  g_mutex_clear (&element->priv->sync_lock);
+  if (element->priv->encoder_config != NULL) {
+    gst_structure_free (element->priv->encoder_config);
+  }
+
+  kms_sync_base_unref (element->priv->sync_base);
+
+  kms_keyframe_arbiter_unref (element->priv->keyframe_arbiter);
 
   /* chain up */
   G_OBJECT_CLASS (kms_element_parent_class)->finalize (object);
@@ -979,6 +1045,60 @@ kms_element_release_requested_srcpad_action (KmsElement * self,
   return released;
 }
 
+static void
+kms_element_set_defer_outputs (KmsElement * self, gboolean defer)
+{
+  GstElement *agnosticbins[2];
+  guint i;
+
+  KMS_ELEMENT_LOCK (self);
+  agnosticbins[0] = self->priv->audio_agnosticbin != NULL ?
+      g_object_ref (self->priv->audio_agnosticbin) : NULL;
+  agnosticbins[1] = self->priv->video_agnosticbin != NULL ?
+      g_object_ref (self->priv->video_agnosticbin) : NULL;
+  KMS_ELEMENT_UNLOCK (self);
+
+  for (i = 0; i < G_N_ELEMENTS (agnosticbins); i++) {
+    if (agnosticbins[i] != NULL) {
+      g_object_set (agnosticbins[i], DEFER_OUTPUTS, defer, NULL);
+      g_object_unref (agnosticbins[i]);
+    }
+  }
+}
+
+static void
+kms_element_begin_batch_action (KmsElement * self)
+{
+  gboolean first;
+
+  KMS_ELEMENT_LOCK (self);
+  first = self->priv->batch_count++ == 0;
+  KMS_ELEMENT_UNLOCK (self);
+
+  if (first) {
+    kms_element_set_defer_outputs (self, TRUE);
+  }
+}
+
+static void
+kms_element_end_batch_action (KmsElement * self)
+{
+  gboolean last;
+
+  KMS_ELEMENT_LOCK (self);
+  if (self->priv->batch_count == 0) {
+    GST_WARNING_OBJECT (self, "Ending a batch that was not begun");
+    KMS_ELEMENT_UNLOCK (self);
+    return;
+  }
+  last = --self->priv->batch_count == 0;
+  KMS_ELEMENT_UNLOCK (self);
+
+  if (last) {
+    kms_element_set_defer_outputs (self, FALSE);
+  }
+}
+
 static void
 kms_element_class_init (KmsElementClass * klass)
 {
@@ -1033,6 +1153,23 @@ kms_element_class_init (KmsElementClass * klass)
           "Configure the bitrate to media encoding",
           0, G_MAXINT, 0, G_PARAM_READWRITE));
 
+  g_object_class_install_property (gobject_class, PROP_ENCODER_CONFIG,
+      g_param_spec_boxed (ENCODER_CONFIG, "Encoder configuration",
+          "Threads, speed level and adaptation of video encoders",
+          GST_TYPE_STRUCTURE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_SHARED_FAN_OUT,
+      g_param_spec_boolean (SHARED_FAN_OUT, "Shared fan out",
+          "Feed the outputs from a shared pool of threads instead of a "
+          "thread per output", DEFAULT_SHARED_FAN_OUT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_GOP_CACHE,
+      g_param_spec_boolean (GOP_CACHE, "GOP cache",
+          "Start new video outputs with the frames since the last key frame "
+          "instead of requesting one", DEFAULT_GOP_CACHE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
   klass->sink_query = GST_DEBUG_FUNCPTR (kms_element_sink_query_default);
 
   /* set actions */
@@ -1051,10 +1188,27 @@ kms_element_class_init (KmsElementClass * klass)
       G_STRUCT_OFFSET (KmsElementClass, release_requested_srcpad), NULL, NULL,
       __kms_core_marshal_BOOLEAN__STRING, G_TYPE_BOOLEAN, 1, G_TYPE_STRING);
 
+  /* Src pads requested and linked between them are configured at once */
+  element_signals[BEGIN_BATCH] =
+      g_signal_new ("begin-batch",
+      G_TYPE_FROM_CLASS (klass),
+      G_SIGNAL_RUN_LAST,
+      G_STRUCT_OFFSET (KmsElementClass, begin_batch), NULL, NULL,
+      g_cclosure_marshal_VOID__VOID, G_TYPE_NONE, 0);
+
+  element_signals[END_BATCH] =
+      g_signal_new ("end-batch",
+      G_TYPE_FROM_CLASS (klass),
+      G_SIGNAL_RUN_LAST,
+      G_STRUCT_OFFSET (KmsElementClass, end_batch), NULL, NULL,
+      g_cclosure_marshal_VOID__VOID, G_TYPE_NONE, 0);
+
   klass->request_new_srcpad =
       GST_DEBUG_FUNCPTR (kms_element_request_new_srcpad_action);
   klass->release_requested_srcpad =
       GST_DEBUG_FUNCPTR (kms_element_release_requested_srcpad_action);
+  klass->begin_batch = GST_DEBUG_FUNCPTR (kms_element_begin_batch_action);
+  klass->end_batch = GST_DEBUG_FUNCPTR (kms_element_end_batch_action);
 
   g_type_class_add_private (klass, sizeof (KmsElementPrivate));
 }
@@ -1075,11 +1229,13 @@ kms_element_init (KmsElement * element)
   element->priv->audio_agnosticbin = NULL;
   element->priv->video_agnosticbin = NULL;
 
-  element->priv->base_time = GST_CLOCK_TIME_NONE;
-  element->priv->base_clock = GST_CLOCK_TIME_NONE;
-  g_mutex_init (&element->priv->sync_lock);
+  element->priv->sync_base = kms_sync_base_new ((KmsSyncBaseClockFunc)
+      kms_element_get_running_time, element);
 
   element->priv->do_synchronization = DEFAULT_DO_SYNCHRONIZATION;
+  element->priv->shared_fan_out = DEFAULT_SHARED_FAN_OUT;
+  element->priv->gop_cache = DEFAULT_GOP_CACHE;
+  element->priv->keyframe_arbiter = kms_keyframe_arbiter_new ();
   element->priv->pendingpads = g_hash_table_new_full (g_str_hash, g_str_equal,
       g_free, (GDestroyNotify) destroy_pendingpads);
 }
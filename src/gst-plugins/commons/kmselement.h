@@ -67,6 +67,8 @@ struct _KmsElementClass
   /* actions */
   gchar * (*request_new_srcpad) (KmsElement *self, KmsElementPadType type, const gchar *desc);
   gboolean (*release_requested_srcpad) (KmsElement *self, const gchar *pad_name);
+  void (*begin_batch) (KmsElement *self);
+  void (*end_batch) (KmsElement *self);
 
   /* protected methods */
   gboolean (*sink_query) (KmsElement *self, GstPad * pad, GstQuery *query);
@@ -77,6 +79,8 @@ GType kms_element_get_type (void);
 /* Private methods */
 GstElement * kms_element_get_audio_agnosticbin (KmsElement * self);
 GstElement * kms_element_get_video_agnosticbin (KmsElement * self);
+GstStructure * kms_element_get_video_encoders_stats (KmsElement * self);
+GstStructure * kms_element_get_keyframe_requests_stats (KmsElement * self);
 GstElement * kms_element_get_data_tee (KmsElement * self);
 
 #define kms_element_connect_sink_target(self, target, type)   \
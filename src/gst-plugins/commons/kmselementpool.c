@@ -0,0 +1,240 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include "kmselementpool.h"
+
+#define GST_CAT_DEFAULT kms_element_pool_debug_category
+GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
+#define GST_DEFAULT_NAME "kmselementpool"
+
+typedef struct _KmsElementPoolEntry
+{
+  const gchar *factory_name;
+  /* Spares keep the floating reference of gst_element_factory_make */
+  GQueue spares;
+} KmsElementPoolEntry;
+
+static KmsElementPoolEntry entries[] = {
+  {"agnosticbin", G_QUEUE_INIT},
+  {"tee", G_QUEUE_INIT},
+};
+
+static GMutex mutex;
+static GCond cond;
+static guint size;
+static guint64 hits;
+static guint64 misses;
+
+static KmsElementPoolRefillFunc refill_func;
+static gpointer refill_data;
+/* Calls to refill_func running out of the lock */
+static guint refill_calls;
+
+static KmsElementPoolEntry *
+kms_element_pool_find_entry (const gchar * factory_name)
+{
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (entries); i++) {
+    if (strcmp (entries[i].factory_name, factory_name) == 0) {
+      return &entries[i];
+    }
+  }
+
+  return NULL;
+}
+
+static void
+kms_element_pool_drop (GstElement * element)
+{
+  gst_object_ref_sink (element);
+  gst_object_unref (element);
+}
+
+void
+kms_element_pool_set_size (guint new_size)
+{
+  GList *dropped = NULL;
+  guint i;
+
+  GST_INFO ("Spare elements by factory: %u", new_size);
+
+  g_mutex_lock (&mutex);
+  size = new_size;
+
+  for (i = 0; i < G_N_ELEMENTS (entries); i++) {
+    while (g_queue_get_length (&entries[i].spares) > size) {
+      dropped = g_list_prepend (dropped,
+          g_queue_pop_tail (&entries[i].spares));
+    }
+  }
+  g_mutex_unlock (&mutex);
+
+  g_list_free_full (dropped, (GDestroyNotify) kms_element_pool_drop);
+}
+
+guint
+kms_element_pool_get_size (void)
+{
+  guint ret;
+
+  g_mutex_lock (&mutex);
+  ret = size;
+  g_mutex_unlock (&mutex);
+
+  return ret;
+}
+
+void
+kms_element_pool_set_refill_func (KmsElementPoolRefillFunc func,
+    gpointer user_data)
+{
+  g_mutex_lock (&mutex);
+  refill_func = func;
+  refill_data = user_data;
+
+  /* Calls already made with the old function must end before its data can
+   * be freed */
+  while (refill_calls > 0) {
+    g_cond_wait (&cond, &mutex);
+  }
+
+  g_mutex_unlock (&mutex);
+}
+
+gboolean
+kms_element_pool_is_full (void)
+{
+  gboolean full = TRUE;
+  guint i;
+
+  g_mutex_lock (&mutex);
+
+  for (i = 0; i < G_N_ELEMENTS (entries) && full; i++) {
+    full = g_queue_get_length (&entries[i].spares) >= size;
+  }
+
+  g_mutex_unlock (&mutex);
+
+  return full;
+}
+
+void
+kms_element_pool_fill (void)
+{
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (entries); i++) {
+    KmsElementPoolEntry *entry = &entries[i];
+    GstElement *element;
+
+    g_mutex_lock (&mutex);
+
+    while (g_queue_get_length (&entry->spares) < size) {
+      /* Construction is what the pool saves, it is done out of the lock */
+      g_mutex_unlock (&mutex);
+      element = gst_element_factory_make (entry->factory_name, NULL);
+      g_mutex_lock (&mutex);
+
+      if (element == NULL) {
+        GST_ERROR ("Cannot create %s", entry->factory_name);
+        break;
+      }
+
+      if (g_queue_get_length (&entry->spares) >= size) {
+        g_mutex_unlock (&mutex);
+        kms_element_pool_drop (element);
+        g_mutex_lock (&mutex);
+        break;
+      }
+
+      g_queue_push_tail (&entry->spares, element);
+    }
+
+    g_mutex_unlock (&mutex);
+  }
+}
+
+GstElement *
+kms_element_pool_make (const gchar * factory_name)
+{
+  KmsElementPoolEntry *entry;
+  KmsElementPoolRefillFunc func = NULL;
+  gpointer user_data = NULL;
+  GstElement *element;
+
+  entry = kms_element_pool_find_entry (factory_name);
+
+  if (entry == NULL) {
+    return gst_element_factory_make (factory_name, NULL);
+  }
+
+  g_mutex_lock (&mutex);
+  element = g_queue_pop_head (&entry->spares);
+
+  if (element != NULL) {
+    hits++;
+  } else if (size > 0) {
+    misses++;
+  }
+
+  if (size > 0 && refill_func != NULL) {
+    func = refill_func;
+    user_data = refill_data;
+    refill_calls++;
+  }
+
+  g_mutex_unlock (&mutex);
+
+  if (func != NULL) {
+    func (user_data);
+
+    g_mutex_lock (&mutex);
+    if (--refill_calls == 0) {
+      g_cond_broadcast (&cond);
+    }
+    g_mutex_unlock (&mutex);
+  }
+
+  if (element == NULL) {
+    GST_DEBUG ("No spare %s", factory_name);
+    element = gst_element_factory_make (factory_name, NULL);
+  }
+
+  return element;
+}
+
+void
+kms_element_pool_get_stats (guint64 * hits_ptr, guint64 * misses_ptr)
+{
+  g_mutex_lock (&mutex);
+  *hits_ptr = hits;
+  *misses_ptr = misses;
+  g_mutex_unlock (&mutex);
+}
+
+static void init_debug (void) __attribute__ ((constructor));
+
+static void
+init_debug (void)
+{
+  GST_DEBUG_CATEGORY_INIT (GST_CAT_DEFAULT, GST_DEFAULT_NAME, 0,
+      GST_DEFAULT_NAME);
+}
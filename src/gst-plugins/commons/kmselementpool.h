@@ -0,0 +1,58 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef __KMS_ELEMENT_POOL_H__
+#define __KMS_ELEMENT_POOL_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Spare agnosticbins and tees built ahead of time, so that KmsElement does
+ * not pay for their construction when its first pad is requested. The pool
+ * is empty until a size is set, and it is only refilled by
+ * kms_element_pool_fill, which is meant to run in a background thread.
+ */
+
+/* Called without locks when a take leaves the pool below its size */
+typedef void (*KmsElementPoolRefillFunc) (gpointer user_data);
+
+void kms_element_pool_set_size (guint size);
+guint kms_element_pool_get_size (void);
+
+/*
+ * Returns once no call to the previous function is running, so its data can
+ * be freed. It must not be called from the function itself nor holding a
+ * lock that the function takes.
+ */
+void kms_element_pool_set_refill_func (KmsElementPoolRefillFunc func,
+  gpointer user_data);
+
+/* Creates the missing spares of every pooled factory */
+void kms_element_pool_fill (void);
+gboolean kms_element_pool_is_full (void);
+
+/*
+ * Same as gst_element_factory_make. Spares are used for pooled factories
+ * when there are any, the element is created in place otherwise.
+ */
+GstElement * kms_element_pool_make (const gchar * factory_name);
+
+void kms_element_pool_get_stats (guint64 * hits, guint64 * misses);
+
+G_END_DECLS
+
+#endif /* __KMS_ELEMENT_POOL_H__ */
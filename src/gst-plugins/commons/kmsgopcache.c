@@ -0,0 +1,227 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "kmsgopcache.h"
+#include "kmsrefstruct.h"
+
+#define GST_CAT_DEFAULT kms_gop_cache_debug_category
+GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
+#define GST_DEFAULT_NAME "kmsgopcache"
+
+/* Distance between replayed frames */
+#define REPLAY_STEP GST_MSECOND
+
+#define BUFFER_TIME(buffer) (GST_BUFFER_DTS_IS_VALID (buffer) ? \
+    GST_BUFFER_DTS (buffer) : GST_BUFFER_PTS (buffer))
+
+struct _KmsGopCache
+{
+  KmsRefStruct ref;
+
+  GMutex mutex;
+  gsize max_bytes;
+  GstClockTime max_duration;
+
+  /* Key frame first, only while valid */
+  GPtrArray *frames;
+  gsize bytes;
+  gboolean valid;
+};
+
+static void
+kms_gop_cache_destroy (KmsGopCache * cache)
+{
+  g_ptr_array_unref (cache->frames);
+  g_mutex_clear (&cache->mutex);
+
+  g_slice_free (KmsGopCache, cache);
+}
+
+KmsGopCache *
+kms_gop_cache_new (gsize max_bytes, GstClockTime max_duration)
+{
+  KmsGopCache *cache = g_slice_new0 (KmsGopCache);
+
+  kms_ref_struct_init (KMS_REF_STRUCT_CAST (cache),
+      (GDestroyNotify) kms_gop_cache_destroy);
+
+  g_mutex_init (&cache->mutex);
+  cache->max_bytes = max_bytes;
+  cache->max_duration = max_duration;
+  cache->frames =
+      g_ptr_array_new_with_free_func ((GDestroyNotify) gst_buffer_unref);
+
+  return cache;
+}
+
+KmsGopCache *
+kms_gop_cache_ref (KmsGopCache * cache)
+{
+  return (KmsGopCache *) kms_ref_struct_ref (KMS_REF_STRUCT_CAST (cache));
+}
+
+void
+kms_gop_cache_unref (KmsGopCache * cache)
+{
+  kms_ref_struct_unref (KMS_REF_STRUCT_CAST (cache));
+}
+
+/* Must be called with the cache locked */
+static void
+kms_gop_cache_reset (KmsGopCache * cache)
+{
+  g_ptr_array_set_size (cache->frames, 0);
+  cache->bytes = 0;
+  cache->valid = FALSE;
+}
+
+/* Must be called with the cache locked */
+static gboolean
+kms_gop_cache_fits (KmsGopCache * cache, GstBuffer * buffer)
+{
+  GstBuffer *first;
+  GstClockTime first_time, time;
+
+  if (cache->bytes + gst_buffer_get_size (buffer) > cache->max_bytes) {
+    return FALSE;
+  }
+
+  first = g_ptr_array_index (cache->frames, 0);
+  first_time = BUFFER_TIME (first);
+  time = BUFFER_TIME (buffer);
+
+  if (!GST_CLOCK_TIME_IS_VALID (first_time) || !GST_CLOCK_TIME_IS_VALID (time)
+      || time < first_time) {
+    return TRUE;
+  }
+
+  return time - first_time <= cache->max_duration;
+}
+
+void
+kms_gop_cache_add (KmsGopCache * cache, GstBuffer * buffer)
+{
+  g_mutex_lock (&cache->mutex);
+
+  if (!GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT)) {
+    kms_gop_cache_reset (cache);
+    cache->valid = TRUE;
+  } else if (!cache->valid) {
+    goto end;
+  } else if (!kms_gop_cache_fits (cache, buffer)) {
+    GST_DEBUG ("GOP over the limits (%" G_GSIZE_FORMAT " bytes, %u frames),"
+        " dropped until the next key frame", cache->bytes, cache->frames->len);
+    kms_gop_cache_reset (cache);
+    goto end;
+  }
+
+  g_ptr_array_add (cache->frames, gst_buffer_ref (buffer));
+  cache->bytes += gst_buffer_get_size (buffer);
+
+end:
+  g_mutex_unlock (&cache->mutex);
+}
+
+void
+kms_gop_cache_clear (KmsGopCache * cache)
+{
+  g_mutex_lock (&cache->mutex);
+  kms_gop_cache_reset (cache);
+  g_mutex_unlock (&cache->mutex);
+}
+
+gboolean
+kms_gop_cache_is_valid (KmsGopCache * cache)
+{
+  gboolean valid;
+
+  g_mutex_lock (&cache->mutex);
+  valid = cache->valid;
+  g_mutex_unlock (&cache->mutex);
+
+  return valid;
+}
+
+static void
+retime_buffer (GstBuffer * buffer, GstClockTime base, GstClockTime offset)
+{
+  GstClockTime time = base > offset ? base - offset : 0;
+  GstClockTimeDiff pts_offset = 0;
+
+  if (GST_BUFFER_PTS_IS_VALID (buffer) && GST_BUFFER_DTS_IS_VALID (buffer)) {
+    /* Keep the reordering of the frames */
+    pts_offset = GST_CLOCK_DIFF (GST_BUFFER_DTS (buffer),
+        GST_BUFFER_PTS (buffer));
+  }
+
+  if (GST_BUFFER_DTS_IS_VALID (buffer)) {
+    GST_BUFFER_DTS (buffer) = time;
+  }
+
+  if (GST_BUFFER_PTS_IS_VALID (buffer)) {
+    GST_BUFFER_PTS (buffer) = MAX ((GstClockTimeDiff) time + pts_offset, 0);
+  }
+}
+
+GstBufferList *
+kms_gop_cache_get_replay (KmsGopCache * cache, GstBuffer * next)
+{
+  GstBufferList *list = NULL;
+  GstClockTime base;
+  guint i, len;
+
+  g_mutex_lock (&cache->mutex);
+
+  len = cache->frames->len;
+  if (len > 0 && g_ptr_array_index (cache->frames, len - 1) == next) {
+    len--;
+  }
+
+  if (!cache->valid || len == 0) {
+    goto end;
+  }
+
+  base = BUFFER_TIME (next);
+  list = gst_buffer_list_new_sized (len);
+
+  for (i = 0; i < len; i++) {
+    GstBuffer *frame = gst_buffer_copy (g_ptr_array_index (cache->frames, i));
+
+    if (GST_CLOCK_TIME_IS_VALID (base)) {
+      retime_buffer (frame, base, (len - i) * REPLAY_STEP);
+    }
+
+    gst_buffer_list_add (list, frame);
+  }
+
+  GST_DEBUG ("Replaying %u frames", len);
+
+end:
+  g_mutex_unlock (&cache->mutex);
+
+  return list;
+}
+
+static void init_debug (void) __attribute__ ((constructor));
+
+static void
+init_debug (void)
+{
+  GST_DEBUG_CATEGORY_INIT (GST_CAT_DEFAULT, GST_DEFAULT_NAME, 0,
+      GST_DEFAULT_NAME);
+}
@@ -0,0 +1,46 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef __KMS_GOP_CACHE_H__
+#define __KMS_GOP_CACHE_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Encoded frames since the last key frame of a stream, so a new consumer can
+ * start decoding without requesting a key frame upstream. The cache is
+ * dropped when it grows over its limits, until the next key frame.
+ */
+typedef struct _KmsGopCache KmsGopCache;
+
+KmsGopCache * kms_gop_cache_new (gsize max_bytes, GstClockTime max_duration);
+KmsGopCache * kms_gop_cache_ref (KmsGopCache * cache);
+void kms_gop_cache_unref (KmsGopCache * cache);
+
+void kms_gop_cache_add (KmsGopCache * cache, GstBuffer * buffer);
+void kms_gop_cache_clear (KmsGopCache * cache);
+gboolean kms_gop_cache_is_valid (KmsGopCache * cache);
+
+/* Copies of the cached frames to be pushed just before @next, retimed so
+ * they are consumed immediately. @next itself is not included if it is
+ * cached. Returns NULL if there is not a complete GOP */
+GstBufferList * kms_gop_cache_get_replay (KmsGopCache * cache,
+  GstBuffer * next);
+
+G_END_DECLS
+
+#endif /* __KMS_GOP_CACHE_H__ */
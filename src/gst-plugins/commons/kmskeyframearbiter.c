@@ -0,0 +1,426 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gst/video/video-event.h>
+
+#include "kmskeyframearbiter.h"
+#include "kmsrefstruct.h"
+
+#define GST_CAT_DEFAULT kms_keyframe_arbiter_debug_category
+GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
+#define GST_DEFAULT_NAME "kmskeyframearbiter"
+
+/* Used until a key frame is received */
+#define DEFAULT_DISPERSION GST_SECOND
+#define MIN_DISPERSION (200 * GST_MSECOND)
+#define MAX_DISPERSION (5 * GST_SECOND)
+/* Added to the response time for each time a key frame is bigger than the
+ * average frame */
+#define DISPERSION_PER_SIZE_RATIO (50 * GST_MSECOND)
+
+/* Weight of the last sample in the averages, in 1/16 */
+#define AVG_WEIGHT 2
+
+struct _KmsKeyframeArbiter
+{
+  KmsRefStruct ref;
+
+  GMutex mutex;
+  GstClock *clock;
+
+  GstClockTime last_grant;
+  /* A granted request has not been answered with a key frame yet */
+  gboolean waiting;
+  /* Requests dropped since the last key frame, sent when the window ends */
+  gboolean pending;
+  gboolean pending_all_headers;
+  /* Request sent by the arbiter itself, not to be arbitrated */
+  GstEvent *own_request;
+  /* Fires when the window of the last grant ends, along with the pad the
+   * request was received from. Owned by the clock until it fires */
+  GstClockID timer;
+  GstPad *timer_pad;
+
+  GstClockTime dispersion;
+  GstClockTime response_time;
+  guint64 keyframe_size;
+  guint64 frame_size;
+
+  guint64 requests;
+  guint64 grants;
+  guint64 keyframes;
+};
+
+static void
+kms_keyframe_arbiter_destroy (KmsKeyframeArbiter * arbiter)
+{
+  /* A scheduled timer holds a reference, so it is gone already */
+  g_clear_object (&arbiter->timer_pad);
+  gst_object_unref (arbiter->clock);
+  g_mutex_clear (&arbiter->mutex);
+
+  g_slice_free (KmsKeyframeArbiter, arbiter);
+}
+
+KmsKeyframeArbiter *
+kms_keyframe_arbiter_new (void)
+{
+  KmsKeyframeArbiter *arbiter = g_slice_new0 (KmsKeyframeArbiter);
+
+  kms_ref_struct_init (KMS_REF_STRUCT_CAST (arbiter),
+      (GDestroyNotify) kms_keyframe_arbiter_destroy);
+
+  g_mutex_init (&arbiter->mutex);
+  arbiter->clock = gst_system_clock_obtain ();
+  arbiter->last_grant = GST_CLOCK_TIME_NONE;
+  arbiter->dispersion = DEFAULT_DISPERSION;
+  arbiter->response_time = GST_CLOCK_TIME_NONE;
+
+  return arbiter;
+}
+
+KmsKeyframeArbiter *
+kms_keyframe_arbiter_ref (KmsKeyframeArbiter * arbiter)
+{
+  return (KmsKeyframeArbiter *)
+      kms_ref_struct_ref (KMS_REF_STRUCT_CAST (arbiter));
+}
+
+void
+kms_keyframe_arbiter_unref (KmsKeyframeArbiter * arbiter)
+{
+  kms_ref_struct_unref (KMS_REF_STRUCT_CAST (arbiter));
+}
+
+void
+kms_keyframe_arbiter_set_clock (KmsKeyframeArbiter * arbiter, GstClock * clock)
+{
+  g_return_if_fail (GST_IS_CLOCK (clock));
+
+  g_mutex_lock (&arbiter->mutex);
+  gst_object_replace ((GstObject **) & arbiter->clock, GST_OBJECT (clock));
+  g_mutex_unlock (&arbiter->mutex);
+}
+
+static guint64
+update_avg (guint64 avg, guint64 value)
+{
+  if (avg == 0) {
+    return value;
+  }
+
+  return (avg * (16 - AVG_WEIGHT) + value * AVG_WEIGHT) / 16;
+}
+
+/* Must be called with the arbiter locked */
+static void
+kms_keyframe_arbiter_update_dispersion (KmsKeyframeArbiter * arbiter)
+{
+  GstClockTime dispersion;
+
+  if (!GST_CLOCK_TIME_IS_VALID (arbiter->response_time)
+      || arbiter->frame_size == 0) {
+    return;
+  }
+
+  dispersion = arbiter->response_time +
+      gst_util_uint64_scale (DISPERSION_PER_SIZE_RATIO,
+      arbiter->keyframe_size, arbiter->frame_size);
+  arbiter->dispersion = CLAMP (dispersion, MIN_DISPERSION, MAX_DISPERSION);
+}
+
+/* Must be called with the arbiter locked */
+static gboolean
+kms_keyframe_arbiter_window_open (KmsKeyframeArbiter * arbiter,
+    GstClockTime now)
+{
+  return !GST_CLOCK_TIME_IS_VALID (arbiter->last_grant)
+      || now >= arbiter->last_grant + arbiter->dispersion;
+}
+
+static gboolean kms_keyframe_arbiter_timeout (GstClock * clock,
+    GstClockTime time, GstClockID id, KmsKeyframeArbiter * arbiter);
+
+/* Must be called with the arbiter locked */
+static void
+kms_keyframe_arbiter_grant (KmsKeyframeArbiter * arbiter, GstPad * pad,
+    GstClockTime now)
+{
+  arbiter->last_grant = now;
+  arbiter->waiting = TRUE;
+  arbiter->pending = FALSE;
+  arbiter->pending_all_headers = FALSE;
+  arbiter->grants++;
+
+  /* Requests merged meanwhile, or this one if its key frame is lost, are
+   * sent when the window ends even if no frame arrives */
+  if (arbiter->timer != NULL) {
+    gst_clock_id_unschedule (arbiter->timer);
+  }
+
+  gst_object_replace ((GstObject **) & arbiter->timer_pad, GST_OBJECT (pad));
+  arbiter->timer = gst_clock_new_single_shot_id (arbiter->clock,
+      now + arbiter->dispersion);
+
+  if (gst_clock_id_wait_async (arbiter->timer,
+          (GstClockCallback) kms_keyframe_arbiter_timeout,
+          kms_keyframe_arbiter_ref (arbiter),
+          (GDestroyNotify) kms_keyframe_arbiter_unref) != GST_CLOCK_OK) {
+    GST_WARNING_OBJECT (pad, "Can not schedule the end of the window");
+    gst_clock_id_unref (arbiter->timer);
+    arbiter->timer = NULL;
+    kms_keyframe_arbiter_unref (arbiter);
+    return;
+  }
+
+  /* The clock keeps it until it fires or is unscheduled */
+  gst_clock_id_unref (arbiter->timer);
+}
+
+/* Must be called with the arbiter locked. Returns the request to send if
+ * requests were merged and the window is open */
+static GstEvent *
+kms_keyframe_arbiter_merged_request (KmsKeyframeArbiter * arbiter,
+    GstPad * pad, GstClockTime now)
+{
+  GstEvent *request;
+
+  if (!arbiter->pending || arbiter->waiting
+      || !kms_keyframe_arbiter_window_open (arbiter, now)) {
+    return NULL;
+  }
+
+  request =
+      gst_video_event_new_upstream_force_key_unit (GST_CLOCK_TIME_NONE,
+      arbiter->pending_all_headers, 0);
+  arbiter->own_request = request;
+  kms_keyframe_arbiter_grant (arbiter, pad, now);
+
+  return request;
+}
+
+static void
+kms_keyframe_arbiter_send_request (KmsKeyframeArbiter * arbiter, GstPad * pad,
+    GstEvent * request)
+{
+  GST_DEBUG_OBJECT (pad, "Sending merged key frame request");
+
+  if (GST_PAD_IS_SINK (pad)) {
+    gst_pad_push_event (pad, request);
+  } else {
+    gst_pad_send_event (pad, request);
+  }
+
+  g_mutex_lock (&arbiter->mutex);
+  if (arbiter->own_request == request) {
+    /* It did not reach the probe */
+    arbiter->own_request = NULL;
+  }
+  g_mutex_unlock (&arbiter->mutex);
+}
+
+static gboolean
+kms_keyframe_arbiter_timeout (GstClock * clock, GstClockTime time,
+    GstClockID id, KmsKeyframeArbiter * arbiter)
+{
+  GstEvent *request = NULL;
+  GstPad *pad;
+
+  g_mutex_lock (&arbiter->mutex);
+
+  if (arbiter->timer != id) {
+    /* Replaced by a later grant */
+    g_mutex_unlock (&arbiter->mutex);
+    return TRUE;
+  }
+
+  arbiter->timer = NULL;
+  pad = arbiter->timer_pad;
+  arbiter->timer_pad = NULL;
+
+  if (arbiter->waiting) {
+    GST_DEBUG_OBJECT (pad, "Key frame requested was not received");
+    /* Ask for it again */
+    arbiter->waiting = FALSE;
+    arbiter->pending = TRUE;
+  }
+
+  request = kms_keyframe_arbiter_merged_request (arbiter, pad,
+      gst_clock_get_time (arbiter->clock));
+
+  g_mutex_unlock (&arbiter->mutex);
+
+  if (request != NULL) {
+    kms_keyframe_arbiter_send_request (arbiter, pad, request);
+  }
+
+  gst_object_unref (pad);
+
+  return TRUE;
+}
+
+static GstPadProbeReturn
+kms_keyframe_arbiter_request (KmsKeyframeArbiter * arbiter, GstPad * pad,
+    GstPadProbeInfo * info)
+{
+  GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+  gboolean all_headers = FALSE, merge_headers;
+  GstClockTime now;
+
+  g_mutex_lock (&arbiter->mutex);
+
+  now = gst_clock_get_time (arbiter->clock);
+
+  if (event == arbiter->own_request) {
+    arbiter->own_request = NULL;
+    g_mutex_unlock (&arbiter->mutex);
+    return GST_PAD_PROBE_OK;
+  }
+
+  arbiter->requests++;
+  gst_video_event_parse_upstream_force_key_unit (event, NULL, &all_headers,
+      NULL);
+
+  if (arbiter->waiting && kms_keyframe_arbiter_window_open (arbiter, now)) {
+    GST_DEBUG_OBJECT (pad, "Key frame requested was not received");
+    arbiter->waiting = FALSE;
+  }
+
+  if (arbiter->waiting || !kms_keyframe_arbiter_window_open (arbiter, now)) {
+    if (!arbiter->waiting) {
+      /* The key frame sent can not be used by this consumer */
+      arbiter->pending = TRUE;
+    }
+
+    arbiter->pending_all_headers |= all_headers;
+    g_mutex_unlock (&arbiter->mutex);
+
+    GST_TRACE_OBJECT (pad, "Merging key frame request");
+    return GST_PAD_PROBE_DROP;
+  }
+
+  merge_headers = arbiter->pending_all_headers && !all_headers;
+  kms_keyframe_arbiter_grant (arbiter, pad, now);
+
+  g_mutex_unlock (&arbiter->mutex);
+
+  if (merge_headers) {
+    GST_PAD_PROBE_INFO_DATA (info) =
+        gst_video_event_new_upstream_force_key_unit (GST_CLOCK_TIME_NONE,
+        TRUE, 0);
+    gst_event_unref (event);
+  }
+
+  GST_TRACE_OBJECT (pad, "Sending key frame request");
+
+  return GST_PAD_PROBE_OK;
+}
+
+static void
+kms_keyframe_arbiter_frame (KmsKeyframeArbiter * arbiter, GstPad * pad,
+    GstBuffer * buffer)
+{
+  GstEvent *request;
+  GstClockTime now;
+
+  g_mutex_lock (&arbiter->mutex);
+
+  now = gst_clock_get_time (arbiter->clock);
+
+  if (!GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT)) {
+    arbiter->keyframes++;
+    arbiter->keyframe_size = update_avg (arbiter->keyframe_size,
+        gst_buffer_get_size (buffer));
+
+    if (arbiter->waiting) {
+      arbiter->waiting = FALSE;
+      arbiter->response_time = update_avg (GST_CLOCK_TIME_IS_VALID
+          (arbiter->response_time) ? arbiter->response_time : 0,
+          now - arbiter->last_grant);
+    }
+
+    /* Received after the requests, so it answers them as well */
+    arbiter->pending = FALSE;
+    arbiter->pending_all_headers = FALSE;
+
+    kms_keyframe_arbiter_update_dispersion (arbiter);
+  } else {
+    arbiter->frame_size = update_avg (arbiter->frame_size,
+        gst_buffer_get_size (buffer));
+  }
+
+  request = kms_keyframe_arbiter_merged_request (arbiter, pad, now);
+
+  g_mutex_unlock (&arbiter->mutex);
+
+  if (request != NULL) {
+    kms_keyframe_arbiter_send_request (arbiter, pad, request);
+  }
+}
+
+static GstPadProbeReturn
+kms_keyframe_arbiter_probe (GstPad * pad, GstPadProbeInfo * info,
+    gpointer arbiter)
+{
+  if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_BUFFER) {
+    kms_keyframe_arbiter_frame (arbiter, pad, GST_PAD_PROBE_INFO_BUFFER (info));
+  } else if (GST_PAD_PROBE_INFO_TYPE (info) &
+      GST_PAD_PROBE_TYPE_EVENT_UPSTREAM) {
+    GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+
+    if (gst_video_event_is_force_key_unit (event)) {
+      return kms_keyframe_arbiter_request (arbiter, pad, info);
+    }
+  }
+
+  return GST_PAD_PROBE_OK;
+}
+
+void
+kms_keyframe_arbiter_attach (KmsKeyframeArbiter * arbiter, GstPad * pad)
+{
+  gst_pad_add_probe (pad,
+      GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_UPSTREAM,
+      kms_keyframe_arbiter_probe, kms_keyframe_arbiter_ref (arbiter),
+      (GDestroyNotify) kms_keyframe_arbiter_unref);
+}
+
+GstStructure *
+kms_keyframe_arbiter_get_stats (KmsKeyframeArbiter * arbiter)
+{
+  GstStructure *stats;
+
+  g_mutex_lock (&arbiter->mutex);
+  stats = gst_structure_new ("keyframe-requests",
+      "requests", G_TYPE_UINT64, arbiter->requests,
+      "grants", G_TYPE_UINT64, arbiter->grants,
+      "keyframes", G_TYPE_UINT64, arbiter->keyframes,
+      "dispersion", G_TYPE_UINT64, arbiter->dispersion, NULL);
+  g_mutex_unlock (&arbiter->mutex);
+
+  return stats;
+}
+
+static void init_debug (void) __attribute__ ((constructor));
+
+static void
+init_debug (void)
+{
+  GST_DEBUG_CATEGORY_INIT (GST_CAT_DEFAULT, GST_DEFAULT_NAME, 0,
+      GST_DEFAULT_NAME);
+}
@@ -0,0 +1,51 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef __KMS_KEYFRAME_ARBITER_H__
+#define __KMS_KEYFRAME_ARBITER_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Merges the key frame requests that every consumer of a video source sends
+ * upstream. Only one request is let through per dispersion window, the
+ * requests received meanwhile are answered by the key frame already asked
+ * for or by one more request when the window ends. If the key frame asked
+ * for does not arrive within the window, it is asked for again. The window adapts to the
+ * time the source takes to send the key frame and to its size compared with
+ * the rest of frames.
+ */
+typedef struct _KmsKeyframeArbiter KmsKeyframeArbiter;
+
+KmsKeyframeArbiter * kms_keyframe_arbiter_new (void);
+KmsKeyframeArbiter * kms_keyframe_arbiter_ref (KmsKeyframeArbiter * arbiter);
+void kms_keyframe_arbiter_unref (KmsKeyframeArbiter * arbiter);
+
+/* Clock used to measure the windows and to schedule the merged requests.
+ * Defaults to the system clock */
+void kms_keyframe_arbiter_set_clock (KmsKeyframeArbiter * arbiter,
+    GstClock * clock);
+
+/* Watches the buffers going through @pad and the force key unit events sent
+ * upstream through it */
+void kms_keyframe_arbiter_attach (KmsKeyframeArbiter * arbiter, GstPad * pad);
+
+GstStructure * kms_keyframe_arbiter_get_stats (KmsKeyframeArbiter * arbiter);
+
+G_END_DECLS
+
+#endif /* __KMS_KEYFRAME_ARBITER_H__ */
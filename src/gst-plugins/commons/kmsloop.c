@@ -18,6 +18,7 @@
 
 #include <gst/gst.h>
 #include "kmsloop.h"
+#include "kmsrefstruct.h"
 
 #define NAME "loop"
 
@@ -37,17 +38,69 @@ G_DEFINE_TYPE_WITH_CODE (KmsLoop, kms_loop,
   )                                 \
 )
 
-struct _KmsLoopPrivate
+/* Loops do not own a thread. They are handles onto a shared pool of threads,
+ * each one running its own main context. All the sources of a loop are
+ * attached to the same thread, so they keep being dispatched in order. The
+ * size of the pool is set with kms_loop_set_pool_size, or else with the
+ * KMS_LOOP_THREADS environment variable, and defaults to the number of
+ * processors */
+#define KMS_LOOP_THREADS_ENV "KMS_LOOP_THREADS"
+
+typedef struct _KmsLoopThread
 {
+  guint index;
+  guint users;
   GThread *thread;
-  GRecMutex rmutex;
-  GMainLoop *loop;
   GMainContext *context;
-  GCond cond;
+  GMainLoop *loop;
+
+  GMutex stats_mutex;
+  guint64 dispatched;
+  GstClockTime total_latency;
+  GstClockTime max_latency;
+} KmsLoopThread;
+
+G_LOCK_DEFINE_STATIC (pool);
+static KmsLoopThread **pool_threads = NULL;
+static guint pool_slots = 0;
+static guint pool_size = 0;
+
+/* Shared by a loop and the callbacks of its sources. A callback whose
+ * dispatch has already started can outlive the loop, so it checks here
+ * whether the loop was disposed instead of using the loop itself */
+typedef struct _KmsLoopState
+{
+  KmsRefStruct ref;
   GMutex mutex;
-  gboolean initialized;
+  GCond cond;
+  gboolean disposed;
+  gboolean dispatching;
+
+  guint64 dispatched;
+  GstClockTime total_latency;
+  GstClockTime max_latency;
+} KmsLoopState;
+
+struct _KmsLoopPrivate
+{
+  GRecMutex rmutex;
+  KmsLoopThread *thread;
+  GMainContext *context;
+  GSList *sources;
+  KmsLoopState *state;
 };
 
+typedef struct _KmsLoopCallback
+{
+  KmsLoopState *state;
+  KmsLoopThread *thread;
+  GSourceFunc function;
+  gpointer data;
+  GDestroyNotify notify;
+  guint interval;
+  gint64 expected;
+} KmsLoopCallback;
+
 #define KMS_LOOP_LOCK(elem) \
   (g_rec_mutex_lock (&KMS_LOOP ((elem))->priv->rmutex))
 #define KMS_LOOP_UNLOCK(elem) \
@@ -64,11 +117,11 @@ enum
 static GParamSpec *obj_properties[N_PROPERTIES] = { NULL, };
 
 static gboolean
-quit_main_loop (KmsLoop * self)
+quit_main_loop (GMainLoop * loop)
 {
   GST_DEBUG ("Exiting main loop");
 
-  g_main_loop_quit (self->priv->loop);
+  g_main_loop_quit (loop);
 
   return G_SOURCE_REMOVE;
 }
@@ -76,22 +129,8 @@ quit_main_loop (KmsLoop * self)
 static gpointer
 loop_thread_init (gpointer data)
 {
-  KmsLoop *self = KMS_LOOP (data);
-  GMainLoop *loop;
-  GMainContext *context;
-
-  KMS_LOOP_LOCK (self);
-  self->priv->context = g_main_context_new ();
-  context = g_main_context_ref (self->priv->context);
-  self->priv->loop = g_main_loop_new (context, FALSE);
-  loop = g_main_loop_ref (self->priv->loop);
-  KMS_LOOP_UNLOCK (self);
-
-  /* unlock main process because context is already initialized */
-  g_mutex_lock (&self->priv->mutex);
-  self->priv->initialized = TRUE;
-  g_cond_signal (&self->priv->cond);
-  g_mutex_unlock (&self->priv->mutex);
+  GMainLoop *loop = data;
+  GMainContext *context = g_main_loop_get_context (loop);
 
   if (!g_main_context_acquire (context)) {
     GST_ERROR ("Can not acquire context");
@@ -105,11 +144,182 @@ loop_thread_init (gpointer data)
 end:
   GST_DEBUG ("Thread finished");
   g_main_loop_unref (loop);
-  g_main_context_unref (context);
 
   return NULL;
 }
 
+static void
+kms_loop_state_destroy (KmsLoopState * state)
+{
+  g_mutex_clear (&state->mutex);
+  g_cond_clear (&state->cond);
+
+  g_slice_free (KmsLoopState, state);
+}
+
+static KmsLoopState *
+kms_loop_state_new (void)
+{
+  KmsLoopState *state = g_slice_new0 (KmsLoopState);
+
+  kms_ref_struct_init (KMS_REF_STRUCT_CAST (state),
+      (GDestroyNotify) kms_loop_state_destroy);
+  g_mutex_init (&state->mutex);
+  g_cond_init (&state->cond);
+
+  return state;
+}
+
+static guint
+kms_loop_get_default_pool_size (void)
+{
+  const gchar *env;
+  guint64 size;
+
+  env = g_getenv (KMS_LOOP_THREADS_ENV);
+
+  if (env != NULL) {
+    size = g_ascii_strtoull (env, NULL, 10);
+
+    if (size > 0 && size <= G_MAXUINT16) {
+      return (guint) size;
+    }
+
+    GST_WARNING ("Invalid value for %s: %s", KMS_LOOP_THREADS_ENV, env);
+  }
+
+  return MAX (g_get_num_processors (), 1);
+}
+
+/* Must be called with the pool lock held */
+static void
+kms_loop_pool_resize (guint size)
+{
+  guint i;
+
+  if (size > pool_slots) {
+    pool_threads = g_renew (KmsLoopThread *, pool_threads, size);
+
+    for (i = pool_slots; i < size; i++) {
+      pool_threads[i] = NULL;
+    }
+
+    pool_slots = size;
+  }
+
+  pool_size = size;
+}
+
+guint
+kms_loop_get_pool_size (void)
+{
+  guint size;
+
+  G_LOCK (pool);
+
+  if (pool_size == 0) {
+    kms_loop_pool_resize (kms_loop_get_default_pool_size ());
+  }
+
+  size = pool_size;
+
+  G_UNLOCK (pool);
+
+  return size;
+}
+
+void
+kms_loop_set_pool_size (guint size)
+{
+  g_return_if_fail (size > 0 && size <= G_MAXUINT16);
+
+  G_LOCK (pool);
+
+  /* Threads above the new size keep running the loops they already have,
+   * but new loops are only bound to the first size threads */
+  kms_loop_pool_resize (size);
+
+  G_UNLOCK (pool);
+}
+
+static KmsLoopThread *
+kms_loop_thread_acquire (void)
+{
+  KmsLoopThread *thread = NULL;
+  gchar *name;
+  guint i;
+
+  G_LOCK (pool);
+
+  if (pool_size == 0) {
+    kms_loop_pool_resize (kms_loop_get_default_pool_size ());
+    GST_INFO ("Using %u loop threads", pool_size);
+  }
+
+  /* Pick the least used thread, starting a new one while there is room */
+  for (i = 0; i < pool_size; i++) {
+    if (pool_threads[i] == NULL) {
+      thread = g_slice_new0 (KmsLoopThread);
+      thread->index = i;
+      thread->context = g_main_context_new ();
+      thread->loop = g_main_loop_new (thread->context, FALSE);
+      g_mutex_init (&thread->stats_mutex);
+      name = g_strdup_printf ("KmsLoop%u", i);
+      thread->thread = g_thread_new (name, loop_thread_init,
+          g_main_loop_ref (thread->loop));
+      g_free (name);
+      pool_threads[i] = thread;
+      break;
+    }
+
+    if (thread == NULL || pool_threads[i]->users < thread->users) {
+      thread = pool_threads[i];
+    }
+  }
+
+  thread->users++;
+
+  G_UNLOCK (pool);
+
+  return thread;
+}
+
+static void
+kms_loop_thread_release (KmsLoopThread * thread)
+{
+  GSource *source;
+
+  G_LOCK (pool);
+
+  if (--thread->users > 0) {
+    G_UNLOCK (pool);
+    return;
+  }
+
+  pool_threads[thread->index] = NULL;
+
+  source = g_idle_source_new ();
+  g_source_set_priority (source, G_PRIORITY_LOW);
+  g_source_set_callback (source, (GSourceFunc) quit_main_loop,
+      g_main_loop_ref (thread->loop), (GDestroyNotify) g_main_loop_unref);
+  g_source_attach (source, thread->context);
+  g_source_unref (source);
+
+  G_UNLOCK (pool);
+
+  if (g_thread_self () != thread->thread) {
+    g_thread_join (thread->thread);
+  } else {
+    /* self thread does not need to wait for itself */
+    g_thread_unref (thread->thread);
+  }
+
+  g_main_loop_unref (thread->loop);
+  g_main_context_unref (thread->context);
+  g_mutex_clear (&thread->stats_mutex);
+  g_slice_free (KmsLoopThread, thread);
+}
+
 static void
 kms_loop_get_property (GObject * object, guint property_id, GValue * value,
     GParamSpec * pspec)
@@ -134,29 +344,41 @@ static void
 kms_loop_dispose (GObject * obj)
 {
   KmsLoop *self = KMS_LOOP (obj);
+  KmsLoopState *state = self->priv->state;
+  KmsLoopThread *thread;
+  GSList *sources, *l;
 
   GST_DEBUG_OBJECT (obj, "Dispose");
 
   KMS_LOOP_LOCK (self);
+  thread = self->priv->thread;
+  sources = self->priv->sources;
+  self->priv->thread = NULL;
+  self->priv->sources = NULL;
+  KMS_LOOP_UNLOCK (self);
 
-  if (self->priv->thread != NULL) {
-    if (g_thread_self () != self->priv->thread) {
-      GThread *aux = self->priv->thread;
-
-      kms_loop_idle_add (self, (GSourceFunc) quit_main_loop, self);
-      self->priv->thread = NULL;
-      KMS_LOOP_UNLOCK (self);
-      g_thread_join (aux);
-      KMS_LOOP_LOCK (self);
-    } else {
-      /* self thread does not need to wait for itself */
-      quit_main_loop (self);
-      g_thread_unref (self->priv->thread);
-      self->priv->thread = NULL;
+  /* Only the callback of this loop that may be running is waited for, the
+   * ones of other loops sharing the thread are not */
+  g_mutex_lock (&state->mutex);
+  state->disposed = TRUE;
+
+  if (thread != NULL && g_thread_self () != thread->thread) {
+    while (state->dispatching) {
+      g_cond_wait (&state->cond, &state->mutex);
     }
   }
 
-  KMS_LOOP_UNLOCK (self);
+  g_mutex_unlock (&state->mutex);
+
+  for (l = sources; l != NULL; l = l->next) {
+    g_source_destroy (l->data);
+  }
+
+  g_slist_free_full (sources, (GDestroyNotify) g_source_unref);
+
+  if (thread != NULL) {
+    kms_loop_thread_release (thread);
+  }
 
   G_OBJECT_CLASS (kms_loop_parent_class)->dispose (obj);
 }
@@ -172,13 +394,8 @@ kms_loop_finalize (GObject * obj)
     g_main_context_unref (self->priv->context);
   }
 
-  if (self->priv->loop != NULL) {
-    g_main_loop_unref (self->priv->loop);
-  }
-
   g_rec_mutex_clear (&self->priv->rmutex);
-  g_mutex_clear (&self->priv->mutex);
-  g_cond_clear (&self->priv->cond);
+  kms_ref_struct_unref (KMS_REF_STRUCT_CAST (self->priv->state));
 
   G_OBJECT_CLASS (kms_loop_parent_class)->finalize (obj);
 }
@@ -208,21 +425,12 @@ static void
 kms_loop_init (KmsLoop * self)
 {
   self->priv = KMS_LOOP_GET_PRIVATE (self);
-  self->priv->context = NULL;
-  self->priv->loop = NULL;
   g_rec_mutex_init (&self->priv->rmutex);
-  g_cond_init (&self->priv->cond);
-  g_mutex_init (&self->priv->mutex);
-
-  self->priv->thread = g_thread_new ("KmsLoop", loop_thread_init, self);
+  self->priv->state = kms_loop_state_new ();
 
-  g_mutex_lock (&self->priv->mutex);
-
-  while (!self->priv->initialized) {
-    g_cond_wait (&self->priv->cond, &self->priv->mutex);
-  }
-
-  g_mutex_unlock (&self->priv->mutex);
+  self->priv->thread = kms_loop_thread_acquire ();
+  self->priv->context = g_main_context_ref (self->priv->thread->context);
+  self->priv->sources = NULL;
 }
 
 KmsLoop *
@@ -235,10 +443,68 @@ kms_loop_new (void)
   return KMS_LOOP (loop);
 }
 
+static gboolean
+kms_loop_callback_dispatch (KmsLoopCallback * cb)
+{
+  KmsLoopState *state = cb->state;
+  KmsLoopThread *thread = cb->thread;
+  gint64 now = g_get_monotonic_time ();
+  GstClockTime latency;
+  gboolean ret;
+
+  latency = now > cb->expected ? (now - cb->expected) * GST_USECOND : 0;
+
+  g_mutex_lock (&state->mutex);
+
+  if (state->disposed) {
+    /* Destroyed while its dispatch was starting */
+    g_mutex_unlock (&state->mutex);
+    return G_SOURCE_REMOVE;
+  }
+
+  state->dispatching = TRUE;
+  state->dispatched++;
+  state->total_latency += latency;
+  state->max_latency = MAX (state->max_latency, latency);
+  g_mutex_unlock (&state->mutex);
+
+  g_mutex_lock (&thread->stats_mutex);
+  thread->dispatched++;
+  thread->total_latency += latency;
+  thread->max_latency = MAX (thread->max_latency, latency);
+  g_mutex_unlock (&thread->stats_mutex);
+
+  cb->expected = now + cb->interval * G_GINT64_CONSTANT (1000);
+
+  /* The loop, and even its thread, can be disposed by the callback, do not
+   * use them from here */
+  ret = cb->function (cb->data);
+
+  g_mutex_lock (&state->mutex);
+  state->dispatching = FALSE;
+  g_cond_broadcast (&state->cond);
+  g_mutex_unlock (&state->mutex);
+
+  return ret;
+}
+
+static void
+kms_loop_callback_destroy (KmsLoopCallback * cb)
+{
+  if (cb->notify != NULL) {
+    cb->notify (cb->data);
+  }
+
+  kms_ref_struct_unref (KMS_REF_STRUCT_CAST (cb->state));
+  g_slice_free (KmsLoopCallback, cb);
+}
+
 static guint
 kms_loop_attach (KmsLoop * self, GSource * source, gint priority,
-    GSourceFunc function, gpointer data, GDestroyNotify notify)
+    guint interval, GSourceFunc function, gpointer data, GDestroyNotify notify)
 {
+  KmsLoopCallback *cb;
+  GSList *l, *next;
   guint id;
 
   KMS_LOOP_LOCK (self);
@@ -248,9 +514,32 @@ kms_loop_attach (KmsLoop * self, GSource * source, gint priority,
     return 0;
   }
 
+  /* Forget sources that are already gone */
+  for (l = self->priv->sources; l != NULL; l = next) {
+    next = l->next;
+
+    if (g_source_is_destroyed (l->data)) {
+      g_source_unref (l->data);
+      self->priv->sources = g_slist_delete_link (self->priv->sources, l);
+    }
+  }
+
+  cb = g_slice_new0 (KmsLoopCallback);
+  cb->state = (KmsLoopState *)
+      kms_ref_struct_ref (KMS_REF_STRUCT_CAST (self->priv->state));
+  cb->thread = self->priv->thread;
+  cb->function = function;
+  cb->data = data;
+  cb->notify = notify;
+  cb->interval = interval;
+  cb->expected = g_get_monotonic_time () + interval * G_GINT64_CONSTANT (1000);
+
   g_source_set_priority (source, priority);
-  g_source_set_callback (source, function, data, notify);
+  g_source_set_callback (source, (GSourceFunc) kms_loop_callback_dispatch, cb,
+      (GDestroyNotify) kms_loop_callback_destroy);
   id = g_source_attach (source, self->priv->context);
+  self->priv->sources = g_slist_prepend (self->priv->sources,
+      g_source_ref (source));
 
   KMS_LOOP_UNLOCK (self);
 
@@ -268,7 +557,7 @@ kms_loop_idle_add_full (KmsLoop * self, gint priority, GSourceFunc function,
     return 0;
 
   source = g_idle_source_new ();
-  id = kms_loop_attach (self, source, priority, function, data, notify);
+  id = kms_loop_attach (self, source, priority, 0, function, data, notify);
   g_source_unref (source);
 
   return id;
@@ -292,7 +581,8 @@ kms_loop_timeout_add_full (KmsLoop * self, gint priority, guint interval,
     return 0;
 
   source = g_timeout_source_new (interval);
-  id = kms_loop_attach (self, source, priority, function, data, notify);
+  id = kms_loop_attach (self, source, priority, interval, function, data,
+      notify);
   g_source_unref (source);
 
   return id;
@@ -305,3 +595,68 @@ kms_loop_timeout_add (KmsLoop * self, guint interval, GSourceFunc function,
   return kms_loop_timeout_add_full (self, G_PRIORITY_DEFAULT, interval,
       function, data, NULL);
 }
+
+GstStructure *
+kms_loop_get_stats (KmsLoop * self)
+{
+  GstStructure *stats;
+  guint thread;
+
+  g_return_val_if_fail (KMS_IS_LOOP (self), NULL);
+
+  KMS_LOOP_LOCK (self);
+  thread = self->priv->thread != NULL ? self->priv->thread->index : 0;
+  KMS_LOOP_UNLOCK (self);
+
+  g_mutex_lock (&self->priv->state->mutex);
+  stats = gst_structure_new ("loop-stats",
+      "thread", G_TYPE_UINT, thread,
+      "dispatched", G_TYPE_UINT64, self->priv->state->dispatched,
+      "mean-latency", G_TYPE_UINT64, self->priv->state->dispatched > 0 ?
+      self->priv->state->total_latency / self->priv->state->dispatched :
+      (guint64) 0,
+      "max-latency", G_TYPE_UINT64, self->priv->state->max_latency, NULL);
+  g_mutex_unlock (&self->priv->state->mutex);
+
+  return stats;
+}
+
+GstStructure *
+kms_loop_get_pool_stats (void)
+{
+  guint64 dispatched = 0;
+  GstClockTime total_latency = 0, max_latency = 0;
+  guint threads = 0, loops = 0, size, i;
+
+  G_LOCK (pool);
+
+  size = pool_size;
+
+  for (i = 0; i < pool_slots; i++) {
+    KmsLoopThread *thread = pool_threads[i];
+
+    if (thread == NULL) {
+      continue;
+    }
+
+    threads++;
+    loops += thread->users;
+
+    g_mutex_lock (&thread->stats_mutex);
+    dispatched += thread->dispatched;
+    total_latency += thread->total_latency;
+    max_latency = MAX (max_latency, thread->max_latency);
+    g_mutex_unlock (&thread->stats_mutex);
+  }
+
+  G_UNLOCK (pool);
+
+  return gst_structure_new ("loop-pool-stats",
+      "size", G_TYPE_UINT, size,
+      "threads", G_TYPE_UINT, threads,
+      "loops", G_TYPE_UINT, loops,
+      "dispatched", G_TYPE_UINT64, dispatched,
+      "mean-latency", G_TYPE_UINT64,
+      dispatched > 0 ? total_latency / dispatched : (guint64) 0,
+      "max-latency", G_TYPE_UINT64, max_latency, NULL);
+}
@@ -15,6 +15,9 @@
 #ifndef _KMS_LOOP_H_
 #define _KMS_LOOP_H_
 
+#include <gst/gst.h>
+
+
 G_BEGIN_DECLS
 #define KMS_TYPE_LOOP (kms_loop_get_type())
 #define KMS_LOOP(obj) (                    \
@@ -79,5 +82,18 @@ guint kms_loop_timeout_add (KmsLoop *self, guint interval, GSourceFunc function,
 guint kms_loop_timeout_add_full (KmsLoop *self, gint priority, guint interval,
   GSourceFunc function, gpointer data, GDestroyNotify notify);
 
+/* Returns the index of the pool thread used by this loop, the number of
+ * dispatched callbacks and their mean and max queue latency */
+GstStructure * kms_loop_get_stats (KmsLoop *self);
+
+/* Number of threads new loops are spread over. Threads are started when
+ * needed, and shrinking the pool does not move the loops already running */
+guint kms_loop_get_pool_size (void);
+void kms_loop_set_pool_size (guint size);
+
+/* Returns the pool size, the running threads, the loops bound to them, the
+ * dispatched callbacks and their mean and max queue latency */
+GstStructure * kms_loop_get_pool_stats (void);
+
 G_END_DECLS
 #endif
\ No newline at end of file
@@ -15,6 +15,8 @@
 
 #include "kmsremb.h"
 #include "kmsrtcp.h"
+#include "kmsrtphdrext.h"
+#include <gst/rtp/gstrtpbuffer.h>
 
 #define GST_CAT_DEFAULT kmsutils
 GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
@@ -33,6 +35,8 @@ GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
 #define REMB_DECREMENT_FACTOR 0.5
 #define REMB_THRESHOLD_FACTOR 0.8
 #define REMB_UP_LOSSES 12       /* 4% losses */
+/* Shorter intervals do not give a meaningful bitrate */
+#define REMB_MIN_ESTIMATION_TIME (100 * GST_MSECOND)
 
 static void
 kms_remb_base_destroy (KmsRembBase * rb)
@@ -72,71 +76,83 @@ kms_remb_base_update_stats (KmsRembBase * rb, guint ssrc, guint bitrate)
   KMS_REMB_BASE_UNLOCK (rb);
 }
 
+static void
+kms_remb_recv_meter_update (KmsRembRecvMeter * meter, guint16 seq, guint size)
+{
+  /* Only the streaming thread writes, readers take snapshots */
+  if (!meter->started) {
+    meter->first_time = kms_utils_get_time_nsecs ();
+    meter->first_seq = seq;
+    g_atomic_int_set (&meter->ext_max_seq, seq);
+    meter->started = TRUE;
+  } else {
+    gint16 delta = (gint16) (seq - (guint16) meter->ext_max_seq);
+
+    if (delta > 0) {
+      g_atomic_int_set (&meter->ext_max_seq, meter->ext_max_seq + delta);
+    }
+  }
+
+  g_atomic_int_add (&meter->octets, size);
+  g_atomic_int_inc (&meter->packets);
+}
+
 static gboolean
 get_video_recv_info (KmsRembLocal * rl,
     guint64 * bitrate, guint * fraction_lost)
 {
-  GValueArray *arr;
-  GValue *val;
-  guint i;
+  KmsRembRecvMeter *meter = &rl->meter;
+  GstClockTime current_time, elapsed;
+  guint octets, packets, ext_max_seq;
+  gint expected, lost;
   gboolean ret = FALSE;
 
-  g_object_get (KMS_REMB_BASE (rl)->rtpsess, "sources", &arr, NULL);
-
-  for (i = 0; i < arr->n_values; i++) {
-    GObject *source;
-    guint ssrc;
-    GstStructure *s;
-
-    val = g_value_array_get_nth (arr, i);
-    source = g_value_get_object (val);
-    g_object_get (source, "ssrc", &ssrc, "stats", &s, NULL);
+  /* Counters wrap, only differences between snapshots are used */
+  octets = g_atomic_int_get (&meter->octets);
+  packets = g_atomic_int_get (&meter->packets);
+  ext_max_seq = g_atomic_int_get (&meter->ext_max_seq);
+  current_time = kms_utils_get_time_nsecs ();
 
-    GST_TRACE_OBJECT (source, "source ssrc: %u", ssrc);
-    GST_TRACE_OBJECT (KMS_REMB_BASE (rl)->rtpsess, "stats: %" GST_PTR_FORMAT,
-        s);
-
-    if (ssrc == rl->remote_ssrc) {
-      GstClockTime current_time;
-      guint64 octets_received;
-
-      if (!gst_structure_get_uint64 (s, "bitrate", bitrate)) {
-        break;
-      }
-      if (!gst_structure_get_uint64 (s, "octets-received", &octets_received)) {
-        break;
-      }
-      if (!gst_structure_get_uint (s, "sent-rb-fractionlost", fraction_lost)) {
-        break;
-      }
+  if (rl->last_time == 0) {
+    if (packets == 0) {
+      return FALSE;
+    }
 
-      current_time = kms_utils_get_time_nsecs ();
+    /* The first estimation is measured from the first packet */
+    rl->last_time = meter->first_time;
+    meter->last_ext_max_seq = meter->first_seq - 1;
+  }
 
-      if (rl->last_time != 0) {
-        GstClockTime elapsed = current_time - rl->last_time;
-        guint64 bytes_handled = octets_received - rl->last_octets_received;
+  elapsed = current_time - rl->last_time;
 
-        *bitrate =
-            gst_util_uint64_scale (bytes_handled, 8 * GST_SECOND, elapsed);
-        GST_TRACE_OBJECT (KMS_REMB_BASE (rl)->rtpsess,
-            "Elapsed %" G_GUINT64_FORMAT " bytes %" G_GUINT64_FORMAT ", rate %"
-            G_GUINT64_FORMAT, elapsed, bytes_handled, *bitrate);
-      }
+  if (elapsed < REMB_MIN_ESTIMATION_TIME) {
+    return FALSE;
+  }
 
-      rl->last_time = current_time;
-      rl->last_octets_received = octets_received;
+  if (packets != meter->last_packets) {
+    *bitrate = gst_util_uint64_scale (octets - meter->last_octets,
+        8 * GST_SECOND, elapsed);
 
-      ret = TRUE;
+    expected = ext_max_seq - meter->last_ext_max_seq;
+    lost = expected - (gint) (packets - meter->last_packets);
+    if (expected > 0 && lost > 0) {
+      *fraction_lost = MIN ((lost << 8) / expected, 255);
+    } else {
+      *fraction_lost = 0;
     }
 
-    gst_structure_free (s);
+    GST_TRACE_OBJECT (KMS_REMB_BASE (rl)->rtpsess,
+        "Elapsed %" G_GUINT64_FORMAT " bytes %u, rate %" G_GUINT64_FORMAT
+        ", fraction lost %u", elapsed, octets - meter->last_octets, *bitrate,
+        *fraction_lost);
 
-    if (ret) {
-      break;
-    }
+    ret = TRUE;
   }
 
-  g_value_array_free (arr);
+  rl->last_time = current_time;
+  meter->last_octets = octets;
+  meter->last_packets = packets;
+  meter->last_ext_max_seq = ext_max_seq;
 
   return ret;
 }
@@ -148,7 +164,8 @@ kms_remb_local_update (KmsRembLocal * rl)
   guint fraction_lost;
 
   if (!get_video_recv_info (rl, &bitrate, &fraction_lost)) {
-    return FALSE;
+    /* Nothing new to estimate from, the last estimation is sent again */
+    return rl->probed;
   }
 
   if (!rl->probed) {
@@ -241,10 +258,28 @@ on_sending_rtcp (GObject * sess, GstBuffer * buffer, gboolean is_early,
   }
 
   if (!kms_remb_local_update (rl)) {
+    gst_rtcp_packet_remove (&packet);
     goto end;
   }
 
   remb_packet.bitrate = rl->remb;
+
+  {
+    guint delay_remb = 0;
+
+    KMS_REMB_BASE_LOCK (rl);
+    if (rl->delay_bwe != NULL) {
+      delay_remb = kms_delay_bwe_get_estimate (rl->delay_bwe);
+    }
+    KMS_REMB_BASE_UNLOCK (rl);
+
+    if (delay_remb > 0) {
+      GST_TRACE_OBJECT (sess, "Delay based REMB: %" G_GUINT32_FORMAT,
+          delay_remb);
+      remb_packet.bitrate = MIN (remb_packet.bitrate, delay_remb);
+    }
+  }
+
   if (rl->event_manager != NULL) {
     guint remb_local_max;
 
@@ -252,7 +287,7 @@ on_sending_rtcp (GObject * sess, GstBuffer * buffer, gboolean is_early,
     if (remb_local_max > 0) {
       GST_TRACE_OBJECT (sess, "REMB local max: %" G_GUINT32_FORMAT,
           remb_local_max);
-      remb_packet.bitrate = MIN (remb_local_max, rl->remb);
+      remb_packet.bitrate = MIN (remb_local_max, remb_packet.bitrate);
     }
   }
 
@@ -285,6 +320,12 @@ kms_remb_local_destroy (KmsRembLocal * rl)
     kms_utils_remb_event_manager_destroy (rl->event_manager);
   }
 
+  if (rl->recv_pad != NULL) {
+    gst_pad_remove_probe (rl->recv_pad, rl->recv_probe_id);
+    g_object_unref (rl->recv_pad);
+  }
+
+  kms_delay_bwe_free (rl->delay_bwe);
   kms_remb_base_destroy (KMS_REMB_BASE (rl));
 
   g_slice_free (KmsRembLocal, rl);
@@ -309,10 +350,159 @@ kms_remb_local_create (GObject * rtpsess, guint session, guint remote_ssrc,
   rl->remb = REMB_MAX;
   rl->threshold = REMB_MAX;
   rl->lineal_factor = REMB_LINEAL_FACTOR_MIN;
+  rl->abs_send_time_id = -1;
 
   return rl;
 }
 
+static void
+kms_remb_local_process_rtp (KmsRembLocal * rl, GstBuffer * buffer,
+    GstClockTime arrival)
+{
+  GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+  gpointer data;
+  guint size;
+  guint8 *ext;
+  guint32 send_time;
+  gint abs_send_time_id;
+
+  if (!gst_rtp_buffer_map (buffer, GST_MAP_READ, &rtp)) {
+    return;
+  }
+
+  if (rl->remote_ssrc != 0
+      && gst_rtp_buffer_get_ssrc (&rtp) != rl->remote_ssrc) {
+    goto end;
+  }
+
+  kms_remb_recv_meter_update (&rl->meter, gst_rtp_buffer_get_seq (&rtp),
+      gst_buffer_get_size (buffer));
+
+  /* The estimation can be enabled or disabled while receiving */
+  abs_send_time_id = g_atomic_int_get (&rl->abs_send_time_id);
+
+  if (abs_send_time_id < 0 || !GST_CLOCK_TIME_IS_VALID (arrival)) {
+    goto end;
+  }
+
+  if (!gst_rtp_buffer_get_extension_onebyte_header (&rtp,
+          abs_send_time_id, 0, &data, &size)
+      || size < KMS_RTP_HDR_EXT_ABS_SEND_TIME_SIZE) {
+    goto end;
+  }
+
+  ext = data;
+  send_time = (ext[0] << 16) | (ext[1] << 8) | ext[2];
+
+  KMS_REMB_BASE_LOCK (rl);
+  if (rl->delay_bwe != NULL) {
+    kms_delay_bwe_incoming_packet (rl->delay_bwe, arrival, send_time,
+        gst_buffer_get_size (buffer));
+  }
+  KMS_REMB_BASE_UNLOCK (rl);
+
+end:
+  gst_rtp_buffer_unmap (&rtp);
+}
+
+static gboolean
+process_rtp_list_item (GstBuffer ** buffer, guint idx, gpointer user_data)
+{
+  gpointer *data = user_data;
+
+  kms_remb_local_process_rtp (data[0], *buffer, *(GstClockTime *) data[1]);
+
+  return TRUE;
+}
+
+static GstPadProbeReturn
+recv_rtp_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  KmsRembLocal *rl = user_data;
+  GstClockTime arrival = GST_CLOCK_TIME_NONE;
+
+  if (g_atomic_int_get (&rl->abs_send_time_id) >= 0) {
+    arrival = kms_utils_get_time_nsecs ();
+  }
+
+  if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_BUFFER) {
+    kms_remb_local_process_rtp (rl, GST_PAD_PROBE_INFO_BUFFER (info), arrival);
+  } else if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+    gpointer data[2] = { rl, &arrival };
+
+    gst_buffer_list_foreach (GST_PAD_PROBE_INFO_BUFFER_LIST (info),
+        process_rtp_list_item, data);
+  }
+
+  return GST_PAD_PROBE_OK;
+}
+
+void
+kms_remb_local_set_recv_pad (KmsRembLocal * rl, GstPad * pad)
+{
+  g_return_if_fail (rl != NULL);
+  g_return_if_fail (GST_IS_PAD (pad));
+
+  if (rl->recv_pad != NULL) {
+    return;
+  }
+
+  rl->recv_pad = g_object_ref (pad);
+  rl->recv_probe_id = gst_pad_add_probe (pad,
+      GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST,
+      recv_rtp_probe, rl, NULL);
+
+  GST_DEBUG_OBJECT (KMS_REMB_BASE (rl)->rtpsess,
+      "Metering received RTP on %" GST_PTR_FORMAT, pad);
+}
+
+void
+kms_remb_local_enable_delay_bwe (KmsRembLocal * rl, gint abs_send_time_id)
+{
+  g_return_if_fail (rl != NULL);
+  g_return_if_fail (abs_send_time_id >= 0);
+
+  KMS_REMB_BASE_LOCK (rl);
+
+  if (rl->delay_bwe != NULL) {
+    KMS_REMB_BASE_UNLOCK (rl);
+    return;
+  }
+
+  rl->delay_bwe = kms_delay_bwe_new (REMB_MIN,
+      rl->max_bw > 0 ? rl->max_bw * 1000 : REMB_MAX);
+  g_atomic_int_set (&rl->abs_send_time_id, abs_send_time_id);
+
+  KMS_REMB_BASE_UNLOCK (rl);
+
+  GST_DEBUG_OBJECT (KMS_REMB_BASE (rl)->rtpsess,
+      "Delay based estimation enabled (abs-send-time id: %d)",
+      abs_send_time_id);
+}
+
+void
+kms_remb_local_disable_delay_bwe (KmsRembLocal * rl)
+{
+  KmsDelayBwe *delay_bwe;
+
+  g_return_if_fail (rl != NULL);
+
+  KMS_REMB_BASE_LOCK (rl);
+  delay_bwe = rl->delay_bwe;
+  rl->delay_bwe = NULL;
+  g_atomic_int_set (&rl->abs_send_time_id, -1);
+  KMS_REMB_BASE_UNLOCK (rl);
+
+  if (delay_bwe == NULL) {
+    return;
+  }
+
+  kms_delay_bwe_free (delay_bwe);
+
+  GST_DEBUG_OBJECT (KMS_REMB_BASE (rl)->rtpsess,
+      "Delay based estimation disabled");
+}
+
 /* KmsRembLocal end */
 
 /* KmsRembRemote begin */
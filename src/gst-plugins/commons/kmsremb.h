@@ -17,6 +17,7 @@
 #define __KMS_REMB_H__
 
 #include "kmsutils.h" /* TODO: must be not needed */
+#include "kmsdelaybwe.h"
 
 G_BEGIN_DECLS
 
@@ -40,6 +41,24 @@ struct _KmsRembBase
 /* KmsRembLocal begin */
 typedef struct _KmsRembLocal KmsRembLocal;
 
+/* Received RTP counters of the remote SSRC, written with atomic operations
+ * from the streaming thread and read when sending RTCP */
+typedef struct _KmsRembRecvMeter
+{
+  gint octets;
+  gint packets;
+  gint ext_max_seq;
+  gboolean started;
+  /* Written with the first packet, before it is counted */
+  GstClockTime first_time;
+  guint first_seq;
+
+  /* Values at the last estimation */
+  guint last_octets;
+  guint last_packets;
+  guint last_ext_max_seq;
+} KmsRembRecvMeter;
+
 struct _KmsRembLocal
 {
   KmsRembBase base;
@@ -54,13 +73,30 @@ struct _KmsRembLocal
   guint max_br;
   guint avg_br;
   GstClockTime last_time;
-  guint64 last_octets_received;
+  KmsRembRecvMeter meter;
   RembEventManager *event_manager;
+
+  /* Delay based estimation */
+  KmsDelayBwe *delay_bwe;
+  gint abs_send_time_id;
+  GstPad *recv_pad;
+  gulong recv_probe_id;
 };
 
 KmsRembLocal * kms_remb_local_create (GObject *rtpsess, guint session,
   guint remote_ssrc, guint max_bw);
 void kms_remb_local_destroy (KmsRembLocal *rl);
+
+/* Measures the received bitrate and losses from the RTP packets going
+ * through @pad */
+void kms_remb_local_set_recv_pad (KmsRembLocal *rl, GstPad *pad);
+
+/* Estimates also from the abs-send-time of the received RTP packets. The
+ * REMB sent is the lowest of both estimations. It can be enabled and
+ * disabled at any time, each time starting from a new estimation */
+void kms_remb_local_enable_delay_bwe (KmsRembLocal *rl,
+  gint abs_send_time_id);
+void kms_remb_local_disable_delay_bwe (KmsRembLocal *rl);
 /* KmsRembLocal end */
 
 /* KmsRembRemote begin */
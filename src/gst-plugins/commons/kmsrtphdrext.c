@@ -0,0 +1,184 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "kmsrtphdrext.h"
+#include "kmsutils.h"
+
+#include <string.h>
+#include <gst/rtp/gstrtpbuffer.h>
+
+#define GST_DEFAULT_NAME "kmsrtphdrext"
+#define GST_CAT_DEFAULT kms_rtp_hdr_ext_debug
+GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
+
+struct _KmsRtpHdrExtWriter
+{
+  gint abs_send_time_id;
+};
+
+/* Values shared by all the packets of a write */
+typedef struct _KmsRtpHdrExtValues
+{
+  KmsRtpHdrExtWriter *writer;
+  guint8 abs_send_time[KMS_RTP_HDR_EXT_ABS_SEND_TIME_SIZE];
+} KmsRtpHdrExtValues;
+
+KmsRtpHdrExtWriter *
+kms_rtp_hdr_ext_writer_new (gint abs_send_time_id)
+{
+  KmsRtpHdrExtWriter *writer = g_slice_new0 (KmsRtpHdrExtWriter);
+
+  writer->abs_send_time_id = abs_send_time_id;
+
+  return writer;
+}
+
+void
+kms_rtp_hdr_ext_writer_free (KmsRtpHdrExtWriter * writer)
+{
+  g_slice_free (KmsRtpHdrExtWriter, writer);
+}
+
+guint32
+kms_rtp_hdr_ext_abs_send_time (GstClockTime time)
+{
+  return gst_util_uint64_scale (time, 1 << 18, GST_SECOND) & 0x00ffffff;
+}
+
+static void
+kms_rtp_hdr_ext_values_init (KmsRtpHdrExtValues * values,
+    KmsRtpHdrExtWriter * writer, GstClockTime time)
+{
+  guint32 abs_send_time = kms_rtp_hdr_ext_abs_send_time (time);
+
+  values->writer = writer;
+  values->abs_send_time[0] = (guint8) (abs_send_time >> 16);
+  values->abs_send_time[1] = (guint8) (abs_send_time >> 8);
+  values->abs_send_time[2] = (guint8) (abs_send_time);
+}
+
+static gboolean
+write_onebyte_header (GstRTPBuffer * rtp, guint8 id, const guint8 * value,
+    guint size)
+{
+  gpointer data;
+  guint current_size;
+
+  if (gst_rtp_buffer_get_extension_onebyte_header (rtp, id, 0, &data,
+          &current_size) && current_size == size) {
+    memcpy (data, value, size);
+    return TRUE;
+  }
+
+  return gst_rtp_buffer_add_extension_onebyte_header (rtp, id, value, size);
+}
+
+static GstBuffer *
+kms_rtp_hdr_ext_write (KmsRtpHdrExtValues * values, GstBuffer * buffer)
+{
+  KmsRtpHdrExtWriter *writer = values->writer;
+  GstRTPBuffer rtp = { NULL, };
+
+  if (writer->abs_send_time_id < 0) {
+    return buffer;
+  }
+
+  buffer = gst_buffer_make_writable (buffer);
+
+  if (!gst_rtp_buffer_map (buffer, GST_MAP_READWRITE, &rtp)) {
+    GST_WARNING ("Can not map RTP buffer for writting");
+    return buffer;
+  }
+
+  if (!write_onebyte_header (&rtp, writer->abs_send_time_id,
+          values->abs_send_time, KMS_RTP_HDR_EXT_ABS_SEND_TIME_SIZE)) {
+    GST_WARNING ("RTP hdrext abs-send-time not added");
+  }
+
+  gst_rtp_buffer_unmap (&rtp);
+
+  return buffer;
+}
+
+static gboolean
+write_buffer_list_item (GstBuffer ** buffer, guint idx,
+    KmsRtpHdrExtValues * values)
+{
+  *buffer = kms_rtp_hdr_ext_write (values, *buffer);
+
+  return TRUE;
+}
+
+GstBuffer *
+kms_rtp_hdr_ext_writer_write_buffer (KmsRtpHdrExtWriter * writer,
+    GstBuffer * buffer, GstClockTime time)
+{
+  KmsRtpHdrExtValues values;
+
+  kms_rtp_hdr_ext_values_init (&values, writer, time);
+
+  return kms_rtp_hdr_ext_write (&values, buffer);
+}
+
+GstBufferList *
+kms_rtp_hdr_ext_writer_write_buffer_list (KmsRtpHdrExtWriter * writer,
+    GstBufferList * list, GstClockTime time)
+{
+  KmsRtpHdrExtValues values;
+
+  kms_rtp_hdr_ext_values_init (&values, writer, time);
+
+  list = gst_buffer_list_make_writable (list);
+  gst_buffer_list_foreach (list, (GstBufferListFunc) write_buffer_list_item,
+      &values);
+
+  return list;
+}
+
+static GstPadProbeReturn
+write_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  KmsRtpHdrExtWriter *writer = user_data;
+  GstClockTime time = kms_utils_get_time_nsecs ();
+
+  if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_BUFFER) {
+    GST_PAD_PROBE_INFO_DATA (info) =
+        kms_rtp_hdr_ext_writer_write_buffer (writer,
+        GST_PAD_PROBE_INFO_BUFFER (info), time);
+  } else if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+    GST_PAD_PROBE_INFO_DATA (info) =
+        kms_rtp_hdr_ext_writer_write_buffer_list (writer,
+        GST_PAD_PROBE_INFO_BUFFER_LIST (info), time);
+  }
+
+  return GST_PAD_PROBE_OK;
+}
+
+gulong
+kms_rtp_hdr_ext_writer_add_probe (KmsRtpHdrExtWriter * writer, GstPad * pad)
+{
+  return gst_pad_add_probe (pad,
+      GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST,
+      write_probe, writer, (GDestroyNotify) kms_rtp_hdr_ext_writer_free);
+}
+
+static void init_debug (void) __attribute__ ((constructor));
+
+static void
+init_debug (void)
+{
+  GST_DEBUG_CATEGORY_INIT (GST_CAT_DEFAULT, GST_DEFAULT_NAME, 0,
+      GST_DEFAULT_NAME);
+}
@@ -0,0 +1,49 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+#ifndef __KMS_RTP_HDR_EXT_H__
+#define __KMS_RTP_HDR_EXT_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+#define KMS_RTP_HDR_EXT_ABS_SEND_TIME_SIZE 3
+
+/*
+ * Writes RTP header extensions on outgoing packets. Every packet of a
+ * buffer or buffer list gets the same send time, read once per call, and
+ * extensions already present in a packet are rewritten in place.
+ */
+typedef struct _KmsRtpHdrExtWriter KmsRtpHdrExtWriter;
+
+/* Negative ids disable the corresponding extension */
+KmsRtpHdrExtWriter * kms_rtp_hdr_ext_writer_new (gint abs_send_time_id);
+void kms_rtp_hdr_ext_writer_free (KmsRtpHdrExtWriter * writer);
+
+/* 6.18 fixed point seconds, 24 bits, as sent in abs-send-time */
+guint32 kms_rtp_hdr_ext_abs_send_time (GstClockTime time);
+
+GstBuffer * kms_rtp_hdr_ext_writer_write_buffer (KmsRtpHdrExtWriter * writer,
+    GstBuffer * buffer, GstClockTime time);
+GstBufferList * kms_rtp_hdr_ext_writer_write_buffer_list (
+    KmsRtpHdrExtWriter * writer, GstBufferList * list, GstClockTime time);
+
+/* Writes on every buffer leaving @pad. Takes ownership of @writer */
+gulong kms_rtp_hdr_ext_writer_add_probe (KmsRtpHdrExtWriter * writer,
+    GstPad * pad);
+
+G_END_DECLS
+
+#endif /* __KMS_RTP_HDR_EXT_H__ */
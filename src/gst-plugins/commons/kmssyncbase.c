@@ -0,0 +1,203 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "kmssyncbase.h"
+#include "kmsrefstruct.h"
+
+#define GST_CAT_DEFAULT kms_sync_base_debug_category
+GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
+#define GST_DEFAULT_NAME "kmssyncbase"
+
+struct _KmsSyncBase
+{
+  KmsRefStruct ref;
+
+  KmsSyncBaseClockFunc func;
+  gpointer user_data;
+
+  /* Only taken until the base is initialized */
+  GMutex mutex;
+  GstClockTime base_time;
+  GstClockTime base_clock;
+
+  /* Set once both values above are valid, they are read-only after that */
+  gint initialized;
+};
+
+struct _KmsSyncBasePad
+{
+  KmsSyncBase *base;
+
+  gboolean cached;
+  GstClockTime base_time;
+  GstClockTime base_clock;
+};
+
+static void
+kms_sync_base_destroy (KmsSyncBase * base)
+{
+  g_mutex_clear (&base->mutex);
+
+  g_slice_free (KmsSyncBase, base);
+}
+
+KmsSyncBase *
+kms_sync_base_new (KmsSyncBaseClockFunc func, gpointer user_data)
+{
+  KmsSyncBase *base = g_slice_new0 (KmsSyncBase);
+
+  kms_ref_struct_init (KMS_REF_STRUCT_CAST (base),
+      (GDestroyNotify) kms_sync_base_destroy);
+
+  g_mutex_init (&base->mutex);
+  base->func = func;
+  base->user_data = user_data;
+  base->base_time = GST_CLOCK_TIME_NONE;
+  base->base_clock = GST_CLOCK_TIME_NONE;
+
+  return base;
+}
+
+KmsSyncBase *
+kms_sync_base_ref (KmsSyncBase * base)
+{
+  return (KmsSyncBase *) kms_ref_struct_ref (KMS_REF_STRUCT_CAST (base));
+}
+
+void
+kms_sync_base_unref (KmsSyncBase * base)
+{
+  kms_ref_struct_unref (KMS_REF_STRUCT_CAST (base));
+}
+
+static gboolean
+kms_sync_base_initialize (KmsSyncBase * base, GstClockTime in)
+{
+  gboolean initialized;
+
+  if (g_atomic_int_get (&base->initialized)) {
+    return TRUE;
+  }
+
+  g_mutex_lock (&base->mutex);
+
+  if (!base->initialized) {
+    if (!GST_CLOCK_TIME_IS_VALID (base->base_time)
+        && GST_CLOCK_TIME_IS_VALID (in)) {
+      base->base_time = in;
+    }
+
+    if (!GST_CLOCK_TIME_IS_VALID (base->base_clock)) {
+      base->base_clock = base->func (base->user_data);
+    }
+
+    if (GST_CLOCK_TIME_IS_VALID (base->base_time)
+        && GST_CLOCK_TIME_IS_VALID (base->base_clock)) {
+      GST_DEBUG ("Base time %" GST_TIME_FORMAT " set on clock %"
+          GST_TIME_FORMAT, GST_TIME_ARGS (base->base_time),
+          GST_TIME_ARGS (base->base_clock));
+      g_atomic_int_set (&base->initialized, TRUE);
+    }
+  }
+
+  initialized = base->initialized;
+
+  g_mutex_unlock (&base->mutex);
+
+  return initialized;
+}
+
+KmsSyncBasePad *
+kms_sync_base_pad_new (KmsSyncBase * base)
+{
+  KmsSyncBasePad *pad = g_slice_new0 (KmsSyncBasePad);
+
+  pad->base = kms_sync_base_ref (base);
+  pad->base_time = GST_CLOCK_TIME_NONE;
+  pad->base_clock = GST_CLOCK_TIME_NONE;
+
+  return pad;
+}
+
+void
+kms_sync_base_pad_free (KmsSyncBasePad * pad)
+{
+  kms_sync_base_unref (pad->base);
+
+  g_slice_free (KmsSyncBasePad, pad);
+}
+
+GstClockTime
+kms_sync_base_pad_rebase (KmsSyncBasePad * pad, GstClockTime in)
+{
+  if (G_UNLIKELY (!pad->cached)) {
+    if (!kms_sync_base_initialize (pad->base, in)) {
+      return GST_CLOCK_TIME_NONE;
+    }
+
+    pad->base_time = pad->base->base_time;
+    pad->base_clock = pad->base->base_clock;
+    pad->cached = TRUE;
+  }
+
+  if (!GST_CLOCK_TIME_IS_VALID (in)) {
+    return in;
+  }
+
+  if (pad->base_time > in) {
+    GST_WARNING ("Received a buffer with a pts lower than base");
+    return pad->base_clock;
+  }
+
+  return (in - pad->base_time) + pad->base_clock;
+}
+
+void
+kms_sync_base_pad_rebase_buffer (KmsSyncBasePad * pad, GstBuffer * buffer)
+{
+  GST_BUFFER_PTS (buffer) = kms_sync_base_pad_rebase (pad,
+      GST_BUFFER_PTS (buffer));
+  GST_BUFFER_DTS (buffer) = GST_BUFFER_PTS (buffer);
+}
+
+static gboolean
+rebase_list_buffer (GstBuffer ** buffer, guint idx, KmsSyncBasePad * pad)
+{
+  *buffer = gst_buffer_make_writable (*buffer);
+  kms_sync_base_pad_rebase_buffer (pad, *buffer);
+
+  return TRUE;
+}
+
+GstBufferList *
+kms_sync_base_pad_rebase_list (KmsSyncBasePad * pad, GstBufferList * list)
+{
+  list = gst_buffer_list_make_writable (list);
+  gst_buffer_list_foreach (list, (GstBufferListFunc) rebase_list_buffer, pad);
+
+  return list;
+}
+
+static void init_debug (void) __attribute__ ((constructor));
+
+static void
+init_debug (void)
+{
+  GST_DEBUG_CATEGORY_INIT (GST_CAT_DEFAULT, GST_DEFAULT_NAME, 0,
+      GST_DEFAULT_NAME);
+}
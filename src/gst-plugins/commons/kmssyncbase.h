@@ -0,0 +1,57 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef __KMS_SYNC_BASE_H__
+#define __KMS_SYNC_BASE_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Rebases timestamps of several streams onto the running time of the
+ * pipeline clock. The base is taken once, from the first valid timestamp
+ * seen when the clock is available, and never changes afterwards.
+ */
+typedef struct _KmsSyncBase KmsSyncBase;
+
+/* Running time of the pipeline clock or GST_CLOCK_TIME_NONE */
+typedef GstClockTime (*KmsSyncBaseClockFunc) (gpointer user_data);
+
+KmsSyncBase * kms_sync_base_new (KmsSyncBaseClockFunc func,
+  gpointer user_data);
+KmsSyncBase * kms_sync_base_ref (KmsSyncBase * base);
+void kms_sync_base_unref (KmsSyncBase * base);
+
+/*
+ * Per stream view of a base. It caches the offset once the base is
+ * initialized, so it must only be used from one streaming thread.
+ */
+typedef struct _KmsSyncBasePad KmsSyncBasePad;
+
+KmsSyncBasePad * kms_sync_base_pad_new (KmsSyncBase * base);
+void kms_sync_base_pad_free (KmsSyncBasePad * pad);
+
+/* GST_CLOCK_TIME_NONE until the base is initialized */
+GstClockTime kms_sync_base_pad_rebase (KmsSyncBasePad * pad,
+  GstClockTime in);
+void kms_sync_base_pad_rebase_buffer (KmsSyncBasePad * pad,
+  GstBuffer * buffer);
+GstBufferList * kms_sync_base_pad_rebase_list (KmsSyncBasePad * pad,
+  GstBufferList * list);
+
+G_END_DECLS
+
+#endif /* __KMS_SYNC_BASE_H__ */
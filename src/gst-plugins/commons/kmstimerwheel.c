@@ -0,0 +1,388 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "kmstimerwheel.h"
+
+#define GST_CAT_DEFAULT kms_timer_wheel_debug_category
+GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
+#define GST_DEFAULT_NAME "kmstimerwheel"
+
+/* Hierarchical timer wheel with 1ms ticks. The first level covers the next
+ * 256ms with one slot per tick, each of the next levels covers 64 times the
+ * previous one. Timers are moved down one level when the lower one wraps,
+ * so arming and cancelling are O(1) whatever the number of timers */
+#define TICK_USEC G_TIME_SPAN_MILLISECOND
+
+#define ROOT_BITS 8
+#define ROOT_SIZE (1 << ROOT_BITS)
+#define ROOT_MASK (ROOT_SIZE - 1)
+#define LEVEL_BITS 6
+#define LEVEL_SIZE (1 << LEVEL_BITS)
+#define LEVEL_MASK (LEVEL_SIZE - 1)
+#define N_LEVELS 3
+
+#define LEVEL_SHIFT(n) (ROOT_BITS + (n) * LEVEL_BITS)
+#define LEVEL_INDEX(tick, n) (((tick) >> LEVEL_SHIFT (n)) & LEVEL_MASK)
+#define MAX_DELTA ((G_GUINT64_CONSTANT (1) << LEVEL_SHIFT (N_LEVELS)) - 1)
+
+struct _KmsTimerWheelTimer
+{
+  KmsTimerWheelTimer *prev;
+  KmsTimerWheelTimer *next;
+  KmsTimerWheelTimer **list;
+  guint64 expires;
+
+  KmsTimerWheelFunc func;
+  gpointer data;
+  GDestroyNotify notify;
+};
+
+typedef struct _KmsTimerWheel
+{
+  GMutex mutex;
+  GCond cond;
+  GCond done_cond;
+  GThread *thread;
+
+  gint64 start;
+  /* Next tick to be processed */
+  guint64 current;
+  guint count;
+
+  KmsTimerWheelTimer *root[ROOT_SIZE];
+  KmsTimerWheelTimer *levels[N_LEVELS][LEVEL_SIZE];
+  KmsTimerWheelTimer *expired;
+  KmsTimerWheelTimer *running;
+} KmsTimerWheel;
+
+static void
+kms_timer_wheel_link (KmsTimerWheel * wheel, KmsTimerWheelTimer * timer,
+    KmsTimerWheelTimer ** list)
+{
+  timer->prev = NULL;
+  timer->next = *list;
+
+  if (*list != NULL) {
+    (*list)->prev = timer;
+  }
+
+  *list = timer;
+  timer->list = list;
+
+  if (list != &wheel->expired) {
+    wheel->count++;
+  }
+}
+
+static void
+kms_timer_wheel_unlink (KmsTimerWheel * wheel, KmsTimerWheelTimer * timer)
+{
+  if (timer->list == NULL) {
+    return;
+  }
+
+  if (timer->prev != NULL) {
+    timer->prev->next = timer->next;
+  } else {
+    *timer->list = timer->next;
+  }
+
+  if (timer->next != NULL) {
+    timer->next->prev = timer->prev;
+  }
+
+  if (timer->list != &wheel->expired) {
+    wheel->count--;
+  }
+
+  timer->list = NULL;
+  timer->prev = NULL;
+  timer->next = NULL;
+}
+
+static void
+kms_timer_wheel_add (KmsTimerWheel * wheel, KmsTimerWheelTimer * timer)
+{
+  KmsTimerWheelTimer **list;
+  guint64 delta;
+
+  if (timer->expires < wheel->current) {
+    timer->expires = wheel->current;
+  }
+
+  delta = timer->expires - wheel->current;
+
+  if (delta > MAX_DELTA) {
+    timer->expires = wheel->current + MAX_DELTA;
+    delta = MAX_DELTA;
+  }
+
+  if (delta < ROOT_SIZE) {
+    list = &wheel->root[timer->expires & ROOT_MASK];
+  } else if (delta < (G_GUINT64_CONSTANT (1) << LEVEL_SHIFT (1))) {
+    list = &wheel->levels[0][LEVEL_INDEX (timer->expires, 0)];
+  } else if (delta < (G_GUINT64_CONSTANT (1) << LEVEL_SHIFT (2))) {
+    list = &wheel->levels[1][LEVEL_INDEX (timer->expires, 1)];
+  } else {
+    list = &wheel->levels[2][LEVEL_INDEX (timer->expires, 2)];
+  }
+
+  kms_timer_wheel_link (wheel, timer, list);
+}
+
+static guint
+kms_timer_wheel_cascade (KmsTimerWheel * wheel, guint level, guint index)
+{
+  KmsTimerWheelTimer *timer;
+
+  while ((timer = wheel->levels[level][index]) != NULL) {
+    kms_timer_wheel_unlink (wheel, timer);
+    kms_timer_wheel_add (wheel, timer);
+  }
+
+  return index;
+}
+
+static void
+kms_timer_wheel_advance (KmsTimerWheel * wheel, guint64 now)
+{
+  KmsTimerWheelTimer *timer;
+  guint index;
+
+  if (wheel->count == 0) {
+    /* Nothing to walk through */
+    wheel->current = MAX (wheel->current, now + 1);
+    return;
+  }
+
+  while (wheel->current <= now) {
+    index = wheel->current & ROOT_MASK;
+
+    if (index == 0 &&
+        kms_timer_wheel_cascade (wheel, 0,
+            LEVEL_INDEX (wheel->current, 0)) == 0 &&
+        kms_timer_wheel_cascade (wheel, 1,
+            LEVEL_INDEX (wheel->current, 1)) == 0) {
+      kms_timer_wheel_cascade (wheel, 2, LEVEL_INDEX (wheel->current, 2));
+    }
+
+    while ((timer = wheel->root[index]) != NULL) {
+      kms_timer_wheel_unlink (wheel, timer);
+      kms_timer_wheel_link (wheel, timer, &wheel->expired);
+    }
+
+    wheel->current++;
+  }
+}
+
+/* Returns the tick the thread has to wake up at, or 0 if it can sleep until
+ * a timer is armed */
+static guint64
+kms_timer_wheel_next_tick (KmsTimerWheel * wheel)
+{
+  guint64 tick;
+
+  if (wheel->count == 0) {
+    return 0;
+  }
+
+  /* Wake up at the first pending slot or when the next level cascades */
+  for (tick = wheel->current; (tick & ROOT_MASK) != 0
+      || tick == wheel->current; tick++) {
+    if (wheel->root[tick & ROOT_MASK] != NULL) {
+      return tick;
+    }
+  }
+
+  return tick;
+}
+
+static guint64
+kms_timer_wheel_get_tick (KmsTimerWheel * wheel, gint64 time)
+{
+  if (time <= wheel->start) {
+    return 0;
+  }
+
+  return (time - wheel->start) / TICK_USEC;
+}
+
+static gpointer
+kms_timer_wheel_thread (gpointer data)
+{
+  KmsTimerWheel *wheel = data;
+  KmsTimerWheelTimer *timer;
+  guint64 next;
+
+  g_mutex_lock (&wheel->mutex);
+
+  for (;;) {
+    kms_timer_wheel_advance (wheel,
+        kms_timer_wheel_get_tick (wheel, g_get_monotonic_time ()));
+
+    while ((timer = wheel->expired) != NULL) {
+      kms_timer_wheel_unlink (wheel, timer);
+      wheel->running = timer;
+      g_mutex_unlock (&wheel->mutex);
+
+      timer->func (timer, timer->data);
+
+      g_mutex_lock (&wheel->mutex);
+      wheel->running = NULL;
+      g_cond_broadcast (&wheel->done_cond);
+    }
+
+    next = kms_timer_wheel_next_tick (wheel);
+
+    if (next == 0) {
+      g_cond_wait (&wheel->cond, &wheel->mutex);
+    } else {
+      g_cond_wait_until (&wheel->cond, &wheel->mutex,
+          wheel->start + next * TICK_USEC);
+    }
+  }
+
+  g_mutex_unlock (&wheel->mutex);
+
+  return NULL;
+}
+
+static gpointer
+kms_timer_wheel_create (gpointer data)
+{
+  KmsTimerWheel *wheel = g_new0 (KmsTimerWheel, 1);
+
+  GST_DEBUG_CATEGORY_INIT (GST_CAT_DEFAULT, GST_DEFAULT_NAME, 0,
+      GST_DEFAULT_NAME);
+
+  g_mutex_init (&wheel->mutex);
+  g_cond_init (&wheel->cond);
+  g_cond_init (&wheel->done_cond);
+  wheel->start = g_get_monotonic_time ();
+  wheel->current = 1;
+  wheel->thread = g_thread_new ("KmsTimerWheel", kms_timer_wheel_thread, wheel);
+
+  GST_DEBUG ("Timer wheel started");
+
+  return wheel;
+}
+
+static KmsTimerWheel *
+kms_timer_wheel_get (void)
+{
+  static GOnce once = G_ONCE_INIT;
+
+  g_once (&once, kms_timer_wheel_create, NULL);
+
+  return once.retval;
+}
+
+KmsTimerWheelTimer *
+kms_timer_wheel_timer_new (KmsTimerWheelFunc func, gpointer data,
+    GDestroyNotify notify)
+{
+  KmsTimerWheelTimer *timer;
+
+  g_return_val_if_fail (func != NULL, NULL);
+
+  timer = g_slice_new0 (KmsTimerWheelTimer);
+  timer->func = func;
+  timer->data = data;
+  timer->notify = notify;
+
+  return timer;
+}
+
+void
+kms_timer_wheel_timer_arm (KmsTimerWheelTimer * timer, gint64 deadline)
+{
+  KmsTimerWheel *wheel = kms_timer_wheel_get ();
+  guint64 next;
+
+  g_mutex_lock (&wheel->mutex);
+
+  next = kms_timer_wheel_next_tick (wheel);
+  kms_timer_wheel_unlink (wheel, timer);
+
+  if (wheel->count == 0) {
+    /* The wheel stopped ticking while it was empty, catch up with time */
+    kms_timer_wheel_advance (wheel,
+        kms_timer_wheel_get_tick (wheel, g_get_monotonic_time ()));
+  }
+
+  /* Round up so that the timer never expires before its deadline */
+  timer->expires =
+      kms_timer_wheel_get_tick (wheel, deadline + TICK_USEC - 1);
+  kms_timer_wheel_add (wheel, timer);
+
+  if (next == 0 || timer->expires < next) {
+    g_cond_signal (&wheel->cond);
+  }
+
+  g_mutex_unlock (&wheel->mutex);
+}
+
+void
+kms_timer_wheel_timer_cancel (KmsTimerWheelTimer * timer)
+{
+  KmsTimerWheel *wheel = kms_timer_wheel_get ();
+
+  g_mutex_lock (&wheel->mutex);
+
+  for (;;) {
+    kms_timer_wheel_unlink (wheel, timer);
+
+    if (wheel->running != timer || g_thread_self () == wheel->thread) {
+      break;
+    }
+
+    /* The callback could arm it again, so unlink it once it finishes */
+    g_cond_wait (&wheel->done_cond, &wheel->mutex);
+  }
+
+  g_mutex_unlock (&wheel->mutex);
+}
+
+gboolean
+kms_timer_wheel_timer_is_armed (KmsTimerWheelTimer * timer)
+{
+  KmsTimerWheel *wheel = kms_timer_wheel_get ();
+  gboolean armed;
+
+  g_mutex_lock (&wheel->mutex);
+  armed = timer->list != NULL;
+  g_mutex_unlock (&wheel->mutex);
+
+  return armed;
+}
+
+void
+kms_timer_wheel_timer_free (KmsTimerWheelTimer * timer)
+{
+  if (timer == NULL) {
+    return;
+  }
+
+  kms_timer_wheel_timer_cancel (timer);
+
+  if (timer->notify != NULL) {
+    timer->notify (timer->data);
+  }
+
+  g_slice_free (KmsTimerWheelTimer, timer);
+}
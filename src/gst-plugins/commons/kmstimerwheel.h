@@ -0,0 +1,46 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef __KMS_TIMER_WHEEL_H__
+#define __KMS_TIMER_WHEEL_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+typedef struct _KmsTimerWheelTimer KmsTimerWheelTimer;
+
+/* Called from the timer wheel thread when the deadline of timer expires.
+ * It must not block, as it delays the rest of the timers of the process */
+typedef void (*KmsTimerWheelFunc) (KmsTimerWheelTimer * timer, gpointer data);
+
+KmsTimerWheelTimer * kms_timer_wheel_timer_new (KmsTimerWheelFunc func,
+  gpointer data, GDestroyNotify notify);
+
+/* Waits for the callback of timer if it is running in other thread */
+void kms_timer_wheel_timer_free (KmsTimerWheelTimer * timer);
+
+/* Deadline is in monotonic time (microseconds). Arming an already armed timer
+ * moves its deadline */
+void kms_timer_wheel_timer_arm (KmsTimerWheelTimer * timer, gint64 deadline);
+
+/* Waits for the callback of timer if it is running in other thread */
+void kms_timer_wheel_timer_cancel (KmsTimerWheelTimer * timer);
+
+gboolean kms_timer_wheel_timer_is_armed (KmsTimerWheelTimer * timer);
+
+G_END_DECLS
+
+#endif /* __KMS_TIMER_WHEEL_H__ */
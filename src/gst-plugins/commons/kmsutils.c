@@ -245,6 +245,12 @@ end:
   gst_caps_unref (caps);
 }
 
+void
+kms_utils_request_keyframe (GstPad * pad, gboolean all_headers)
+{
+  send_force_key_unit_event (pad, all_headers);
+}
+
 static GstPadProbeReturn
 drop_until_keyframe_probe (GstPad * pad, GstPadProbeInfo * info,
     gpointer user_data)
@@ -765,6 +771,173 @@ kms_utils_remb_event_manager_get_min (RembEventManager * manager)
 
 /* REMB event end */
 
+/* Element factory cache begin */
+
+/* Entries kept before the cache is emptied */
+#define FACTORY_CACHE_MAX_ENTRIES 512
+
+typedef struct _KmsFactoryCache
+{
+  GMutex mutex;
+  GHashTable *entries;
+  guint32 cookie;
+  guint64 hits;
+  guint64 misses;
+} KmsFactoryCache;
+
+static KmsFactoryCache factory_cache;
+
+static void
+factory_cache_value_destroy (gpointer value)
+{
+  if (value != NULL) {
+    gst_object_unref (value);
+  }
+}
+
+static gchar *
+factory_cache_key_new (GstElementFactoryListType type,
+    const GstCaps * sink_caps, const GstCaps * src_caps,
+    KmsElementFactoryFilter filter)
+{
+  gchar *sink_str, *src_str, *key;
+
+  sink_str = (sink_caps != NULL) ? gst_caps_to_string (sink_caps) : NULL;
+  src_str = (src_caps != NULL) ? gst_caps_to_string (src_caps) : NULL;
+
+  key = g_strdup_printf ("%" G_GUINT64_FORMAT "|%p|%s|%s", type, filter,
+      GST_STR_NULL (sink_str), GST_STR_NULL (src_str));
+
+  g_free (sink_str);
+  g_free (src_str);
+
+  return key;
+}
+
+static GstElementFactory *
+factory_cache_lookup_registry (GstElementFactoryListType type,
+    const GstCaps * sink_caps, const GstCaps * src_caps,
+    KmsElementFactoryFilter filter)
+{
+  GList *factories, *aux, *l;
+  GstElementFactory *factory = NULL;
+
+  factories = gst_element_factory_list_get_elements (type, GST_RANK_NONE);
+
+  if (sink_caps != NULL) {
+    aux = gst_element_factory_list_filter (factories, sink_caps, GST_PAD_SINK,
+        FALSE);
+    gst_plugin_feature_list_free (factories);
+    factories = aux;
+  }
+
+  if (src_caps != NULL) {
+    aux = gst_element_factory_list_filter (factories, src_caps, GST_PAD_SRC,
+        FALSE);
+    gst_plugin_feature_list_free (factories);
+    factories = aux;
+  }
+
+  for (l = factories; l != NULL && factory == NULL; l = l->next) {
+    GstElementFactory *candidate = GST_ELEMENT_FACTORY (l->data);
+
+    if (filter == NULL || filter (candidate)) {
+      factory = gst_object_ref (candidate);
+    }
+  }
+
+  gst_plugin_feature_list_free (factories);
+
+  return factory;
+}
+
+GstElementFactory *
+kms_utils_get_element_factory_for_caps (GstElementFactoryListType type,
+    const GstCaps * sink_caps, const GstCaps * src_caps,
+    KmsElementFactoryFilter filter)
+{
+  GstElementFactory *factory = NULL;
+  gpointer value;
+  guint32 cookie;
+  gchar *key;
+
+  key = factory_cache_key_new (type, sink_caps, src_caps, filter);
+  cookie = gst_registry_get_feature_list_cookie (gst_registry_get ());
+
+  g_mutex_lock (&factory_cache.mutex);
+
+  if (factory_cache.entries == NULL) {
+    factory_cache.entries = g_hash_table_new_full (g_str_hash, g_str_equal,
+        g_free, factory_cache_value_destroy);
+    factory_cache.cookie = cookie;
+  }
+
+  if (factory_cache.cookie != cookie) {
+    GST_DEBUG ("Registry changed, invalidating factory cache");
+    g_hash_table_remove_all (factory_cache.entries);
+    factory_cache.cookie = cookie;
+  }
+
+  if (g_hash_table_lookup_extended (factory_cache.entries, key, NULL, &value)) {
+    factory_cache.hits++;
+    factory = (value != NULL) ? gst_object_ref (value) : NULL;
+    g_mutex_unlock (&factory_cache.mutex);
+    g_free (key);
+
+    return factory;
+  }
+
+  factory_cache.misses++;
+  g_mutex_unlock (&factory_cache.mutex);
+
+  /* Walk the registry without holding the lock */
+  factory = factory_cache_lookup_registry (type, sink_caps, src_caps, filter);
+
+  GST_DEBUG ("Factory for %s: %" GST_PTR_FORMAT, key, factory);
+
+  g_mutex_lock (&factory_cache.mutex);
+
+  if (factory_cache.cookie == cookie) {
+    if (g_hash_table_size (factory_cache.entries) >=
+        FACTORY_CACHE_MAX_ENTRIES) {
+      g_hash_table_remove_all (factory_cache.entries);
+    }
+
+    g_hash_table_insert (factory_cache.entries, key,
+        (factory != NULL) ? gst_object_ref (factory) : NULL);
+    key = NULL;
+  }
+
+  g_mutex_unlock (&factory_cache.mutex);
+  g_free (key);
+
+  return factory;
+}
+
+void
+kms_utils_get_element_factory_cache_stats (guint64 * hits, guint64 * misses)
+{
+  g_mutex_lock (&factory_cache.mutex);
+
+  if (hits != NULL) {
+    *hits = factory_cache.hits;
+  }
+
+  if (misses != NULL) {
+    *misses = factory_cache.misses;
+  }
+
+  g_mutex_unlock (&factory_cache.mutex);
+}
+
+gboolean
+kms_utils_element_factory_has_sink_and_src (GstElementFactory * factory)
+{
+  return gst_element_factory_get_num_pad_templates (factory) == 2;
+}
+
+/* Element factory cache end */
+
 /* time begin */
 
 GstClockTime
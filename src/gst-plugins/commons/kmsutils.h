@@ -39,6 +39,7 @@ GstElement * kms_utils_create_rate_for_caps (const GstCaps * caps);
 
 /* key frame management */
 void kms_utils_drop_until_keyframe (GstPad *pad, gboolean all_headers);
+void kms_utils_request_keyframe (GstPad *pad, gboolean all_headers);
 void kms_utils_manage_gaps (GstPad *pad);
 void kms_utils_control_key_frames_request_duplicates (GstPad *pad);
 
@@ -56,6 +57,17 @@ void kms_utils_remb_event_manager_destroy (RembEventManager * manager);
 void kms_utils_remb_event_manager_pointer_destroy (gpointer manager);
 guint kms_utils_remb_event_manager_get_min (RembEventManager * manager);
 
+/* Element factory lookup */
+typedef gboolean (*KmsElementFactoryFilter) (GstElementFactory * factory);
+
+/* Returns a new reference to the first factory of @type whose pads can
+ * handle @sink_caps and @src_caps (either can be NULL) and that passes
+ * @filter. Results are cached process-wide until the registry changes, so
+ * @filter must always give the same answer for the same factory. */
+GstElementFactory * kms_utils_get_element_factory_for_caps (GstElementFactoryListType type, const GstCaps * sink_caps, const GstCaps * src_caps, KmsElementFactoryFilter filter);
+void kms_utils_get_element_factory_cache_stats (guint64 * hits, guint64 * misses);
+gboolean kms_utils_element_factory_has_sink_and_src (GstElementFactory * factory);
+
 /* time */
 GstClockTime kms_utils_get_time_nsecs ();
 
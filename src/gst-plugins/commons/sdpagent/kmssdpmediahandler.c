@@ -114,8 +114,20 @@ struct _KmsSdpMediaHandlerPrivate
   gchar *addr;
   gchar *addr_type;
   GArray *bwtypes;
+
+  /* Configuration the offers are built from, until it changes */
+  GMutex offers_mutex;
+  gchar *fingerprint;
+  guint offers_generation;
 };
 
+/* Offers only depend on the handler configuration, so the ones already */
+/* built are shared by every handler configured the same way */
+#define MAX_OFFER_TEMPLATES 256
+
+static GMutex templates_mutex;
+static GHashTable *templates;
+
 static void
 kms_sdp_media_handler_get_property (GObject * object, guint prop_id,
     GValue * value, GParamSpec * pspec)
@@ -176,9 +188,50 @@ kms_sdp_media_handler_finalize (GObject * object)
 
   g_array_free (self->priv->bwtypes, TRUE);
 
+  g_free (self->priv->fingerprint);
+  g_mutex_clear (&self->priv->offers_mutex);
+
   G_OBJECT_CLASS (parent_class)->finalize (object);
 }
 
+static void
+kms_sdp_media_handler_append_fingerprint_impl (KmsSdpMediaHandler * handler,
+    GString * fingerprint)
+{
+  GParamSpec **props;
+  guint i, n_props;
+
+  /* Properties of subclasses are included as well */
+  props = g_object_class_list_properties (G_OBJECT_GET_CLASS (handler),
+      &n_props);
+
+  for (i = 0; i < n_props; i++) {
+    GValue value = G_VALUE_INIT;
+    gchar *contents;
+
+    if (!(props[i]->flags & G_PARAM_READABLE)) {
+      continue;
+    }
+
+    g_value_init (&value, props[i]->value_type);
+    g_object_get_property (G_OBJECT (handler), props[i]->name, &value);
+    contents = g_strdup_value_contents (&value);
+    g_string_append_printf (fingerprint, " %s=%s", props[i]->name, contents);
+    g_free (contents);
+    g_value_unset (&value);
+  }
+
+  g_free (props);
+
+  for (i = 0; i < handler->priv->bwtypes->len; i++) {
+    GstSDPBandwidth *bw;
+
+    bw = &g_array_index (handler->priv->bwtypes, GstSDPBandwidth, i);
+    g_string_append_printf (fingerprint, " b=%s:%u", bw->bwtype,
+        bw->bandwidth);
+  }
+}
+
 static GstSDPMedia *
 kms_sdp_media_handler_create_offer_impl (KmsSdpMediaHandler * handler,
     const gchar * media, GError ** error)
@@ -337,6 +390,13 @@ kms_sdp_media_handler_add_answer_attributes_impl (KmsSdpMediaHandler * handler,
   return TRUE;
 }
 
+static void
+kms_sdp_media_handler_notify (GObject * object, GParamSpec * pspec)
+{
+  /* Any property may be part of the offer */
+  kms_sdp_media_handler_invalidate_offers (KMS_SDP_MEDIA_HANDLER (object));
+}
+
 static void
 kms_sdp_media_handler_class_init (KmsSdpMediaHandlerClass * klass)
 {
@@ -346,6 +406,7 @@ kms_sdp_media_handler_class_init (KmsSdpMediaHandlerClass * klass)
   gobject_class->get_property = kms_sdp_media_handler_get_property;
   gobject_class->set_property = kms_sdp_media_handler_set_property;
   gobject_class->finalize = kms_sdp_media_handler_finalize;
+  gobject_class->notify = kms_sdp_media_handler_notify;
 
   g_object_class_install_property (gobject_class, PROP_PROTO,
       g_param_spec_string ("proto", "Protocol",
@@ -370,12 +431,16 @@ kms_sdp_media_handler_class_init (KmsSdpMediaHandlerClass * klass)
 
   klass->init_offer = kms_sdp_media_handler_init_offer_impl;
   klass->add_offer_attributes = kms_sdp_media_handler_add_offer_attributes_impl;
+  klass->append_fingerprint = kms_sdp_media_handler_append_fingerprint_impl;
 
   klass->init_answer = kms_sdp_media_handler_init_answer_impl;
   klass->add_answer_attributes =
       kms_sdp_media_handler_add_answer_attributes_impl;
 
   g_type_class_add_private (klass, sizeof (KmsSdpMediaHandlerPrivate));
+
+  templates = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+      (GDestroyNotify) gst_sdp_media_free);
 }
 
 static void
@@ -385,16 +450,96 @@ kms_sdp_media_handler_init (KmsSdpMediaHandler * self)
   self->priv->bwtypes = g_array_new (FALSE, TRUE, sizeof (GstSDPBandwidth));
   g_array_set_clear_func (self->priv->bwtypes,
       (GDestroyNotify) gst_sdp_bandwidth_clear);
+
+  g_mutex_init (&self->priv->offers_mutex);
+}
+
+static gchar *
+kms_sdp_media_handler_build_fingerprint (KmsSdpMediaHandler * handler)
+{
+  GString *fingerprint = g_string_new (G_OBJECT_TYPE_NAME (handler));
+
+  KMS_SDP_MEDIA_HANDLER_GET_CLASS (handler)->append_fingerprint (handler,
+      fingerprint);
+
+  return g_string_free (fingerprint, FALSE);
 }
 
 GstSDPMedia *
 kms_sdp_media_handler_create_offer (KmsSdpMediaHandler * handler,
     const gchar * media, GError ** error)
 {
+  GstSDPMedia *offer, *template = NULL;
+  gboolean configured;
+  guint generation;
+  gchar *key;
+
   g_return_val_if_fail (KMS_IS_SDP_MEDIA_HANDLER (handler), NULL);
 
-  return KMS_SDP_MEDIA_HANDLER_GET_CLASS (handler)->create_offer (handler,
+  g_mutex_lock (&handler->priv->offers_mutex);
+
+  if (handler->priv->fingerprint == NULL) {
+    handler->priv->fingerprint =
+        kms_sdp_media_handler_build_fingerprint (handler);
+  }
+
+  key = g_strdup_printf ("%s %s", media, handler->priv->fingerprint);
+  generation = handler->priv->offers_generation;
+  g_mutex_unlock (&handler->priv->offers_mutex);
+
+  g_mutex_lock (&templates_mutex);
+  template = g_hash_table_lookup (templates, key);
+
+  if (template != NULL) {
+    gst_sdp_media_copy (template, &offer);
+    g_mutex_unlock (&templates_mutex);
+    g_free (key);
+
+    return offer;
+  }
+
+  g_mutex_unlock (&templates_mutex);
+
+  offer = KMS_SDP_MEDIA_HANDLER_GET_CLASS (handler)->create_offer (handler,
       media, error);
+
+  if (offer == NULL) {
+    g_free (key);
+    return NULL;
+  }
+
+  /* Not kept if the configuration changed while it was built */
+  g_mutex_lock (&handler->priv->offers_mutex);
+  configured = generation == handler->priv->offers_generation;
+  g_mutex_unlock (&handler->priv->offers_mutex);
+
+  if (configured) {
+    gst_sdp_media_copy (offer, &template);
+
+    g_mutex_lock (&templates_mutex);
+
+    if (g_hash_table_size (templates) >= MAX_OFFER_TEMPLATES) {
+      g_hash_table_remove_all (templates);
+    }
+
+    g_hash_table_insert (templates, key, template);
+    g_mutex_unlock (&templates_mutex);
+  } else {
+    g_free (key);
+  }
+
+  return offer;
+}
+
+void
+kms_sdp_media_handler_invalidate_offers (KmsSdpMediaHandler * handler)
+{
+  g_return_if_fail (KMS_IS_SDP_MEDIA_HANDLER (handler));
+
+  g_mutex_lock (&handler->priv->offers_mutex);
+  handler->priv->offers_generation++;
+  g_clear_pointer (&handler->priv->fingerprint, g_free);
+  g_mutex_unlock (&handler->priv->offers_mutex);
 }
 
 GstSDPMedia *
@@ -413,6 +558,7 @@ kms_sdp_media_handler_add_bandwidth (KmsSdpMediaHandler * handler,
 {
   g_return_val_if_fail (KMS_IS_SDP_MEDIA_HANDLER (handler), FALSE);
 
-  return KMS_SDP_MEDIA_HANDLER_GET_CLASS (handler)->add_bandwidth (handler,
-      bwtype, bandwidth);
+  KMS_SDP_MEDIA_HANDLER_GET_CLASS (handler)->add_bandwidth (handler, bwtype,
+      bandwidth);
+  kms_sdp_media_handler_invalidate_offers (handler);
 }
@@ -80,6 +80,7 @@ struct _KmsSdpMediaHandlerClass
 
   gboolean (*init_offer) (KmsSdpMediaHandler *handler, const gchar * media, GstSDPMedia * offer, GError **error);
   gboolean (*add_offer_attributes) (KmsSdpMediaHandler *handler, GstSDPMedia * offer, GError **error);
+  void (*append_fingerprint) (KmsSdpMediaHandler *handler, GString *fingerprint);
 
   gboolean (*init_answer) (KmsSdpMediaHandler *handler, const GstSDPMedia * offer, GstSDPMedia * answer, GError **error);
   gboolean (*add_answer_attributes) (KmsSdpMediaHandler *handler, const GstSDPMedia * offer, GstSDPMedia * answer, GError **error);
@@ -91,6 +92,11 @@ GstSDPMedia * kms_sdp_media_handler_create_offer (KmsSdpMediaHandler *handler, c
 GstSDPMedia * kms_sdp_media_handler_create_answer (KmsSdpMediaHandler *handler, const GstSDPMedia * offer, GError **error);
 void kms_sdp_media_handler_add_bandwidth (KmsSdpMediaHandler *handler, const gchar *bwtype, guint bandwidth);
 
+/* To be called by subclasses when a change of their configuration changes */
+/* the offers they create. Property changes already call it. Subclasses */
+/* with configuration other than properties append it to the fingerprint */
+void kms_sdp_media_handler_invalidate_offers (KmsSdpMediaHandler *handler);
+
 G_END_DECLS
 
 #endif /* _KMS_SDP_MEDIA_HANDLER_H_ */
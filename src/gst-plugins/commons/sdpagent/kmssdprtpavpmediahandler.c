@@ -855,6 +855,50 @@ kms_sdp_rtp_avp_media_handler_add_answer_attributes_impl (KmsSdpMediaHandler *
       answer, error);
 }
 
+static gint
+compare_extmap_ids (gconstpointer a, gconstpointer b)
+{
+  return (gint) GPOINTER_TO_UINT (a) - (gint) GPOINTER_TO_UINT (b);
+}
+
+static void
+kms_sdp_rtp_avp_media_handler_append_fingerprint (KmsSdpMediaHandler *
+    handler, GString * fingerprint)
+{
+  KmsSdpRtpAvpMediaHandler *self = KMS_SDP_RTP_AVP_MEDIA_HANDLER (handler);
+  GList *ids, *l;
+  GSList *item;
+
+  KMS_SDP_MEDIA_HANDLER_CLASS (parent_class)->append_fingerprint (handler,
+      fingerprint);
+
+  for (item = self->priv->audio_fmts; item != NULL; item = g_slist_next (item)) {
+    KmsSdpRtpMap *rtpmap = item->data;
+
+    g_string_append_printf (fingerprint, " audio=%u:%s", rtpmap->payload,
+        rtpmap->name);
+  }
+
+  for (item = self->priv->video_fmts; item != NULL; item = g_slist_next (item)) {
+    KmsSdpRtpMap *rtpmap = item->data;
+
+    g_string_append_printf (fingerprint, " video=%u:%s", rtpmap->payload,
+        rtpmap->name);
+  }
+
+  /* Same extensions in any order are the same configuration */
+  ids = g_list_sort (g_hash_table_get_keys (self->priv->extmaps),
+      compare_extmap_ids);
+
+  for (l = ids; l != NULL; l = g_list_next (l)) {
+    g_string_append_printf (fingerprint, " extmap=%u:%s",
+        GPOINTER_TO_UINT (l->data), (gchar *) g_hash_table_lookup
+        (self->priv->extmaps, l->data));
+  }
+
+  g_list_free (ids);
+}
+
 static void
 kms_sdp_rtp_avp_media_handler_finalize (GObject * object)
 {
@@ -894,6 +938,8 @@ kms_sdp_rtp_avp_media_handler_class_init (KmsSdpRtpAvpMediaHandlerClass * klass)
   handler_class->init_offer = kms_sdp_rtp_avp_media_handler_init_offer;
   handler_class->add_offer_attributes =
       kms_sdp_rtp_avp_media_handler_add_offer_attributes;
+  handler_class->append_fingerprint =
+      kms_sdp_rtp_avp_media_handler_append_fingerprint;
 
   handler_class->init_answer = kms_sdp_rtp_avp_media_handler_init_answer;
   handler_class->add_answer_attributes =
@@ -936,6 +982,7 @@ kms_sdp_rtp_avp_media_handler_add_extmap (KmsSdpRtpAvpMediaHandler * self,
 
   g_hash_table_insert (self->priv->extmaps, GUINT_TO_POINTER (id),
       g_strdup (uri));
+  kms_sdp_media_handler_invalidate_offers (KMS_SDP_MEDIA_HANDLER (self));
 
   return TRUE;
 }
@@ -1004,6 +1051,7 @@ kms_sdp_rtp_avp_media_handler_add_codec (KmsSdpRtpAvpMediaHandler * self,
   }
 
   *fmts = g_slist_append (*fmts, rtpmap);
+  kms_sdp_media_handler_invalidate_offers (KMS_SDP_MEDIA_HANDLER (self));
 
   return TRUE;
 }
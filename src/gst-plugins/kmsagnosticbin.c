@@ -23,6 +23,9 @@
 #include "kmsparsetreebin.h"
 #include "kmsdectreebin.h"
 #include "kmsenctreebin.h"
+#include "kmsistats.h"
+#include "kmsrefstruct.h"
+#include "kmsgopcache.h"
 
 #define PLUGIN_NAME "agnosticbin"
 
@@ -37,8 +40,11 @@ GST_STATIC_CAPS (KMS_AGNOSTIC_RAW_VIDEO_CAPS);
 #define GST_CAT_DEFAULT kms_agnostic_bin2_debug
 GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
 
+static void kms_istats_interface_init (KmsIStatsInterface * iface);
+
 #define kms_agnostic_bin2_parent_class parent_class
-G_DEFINE_TYPE (KmsAgnosticBin2, kms_agnostic_bin2, GST_TYPE_BIN);
+G_DEFINE_TYPE_WITH_CODE (KmsAgnosticBin2, kms_agnostic_bin2, GST_TYPE_BIN,
+    G_IMPLEMENT_INTERFACE (KMS_TYPE_ISTATS, kms_istats_interface_init));
 
 #define KMS_AGNOSTIC_BIN2_GET_PRIVATE(obj) ( \
   G_TYPE_INSTANCE_GET_PRIVATE (              \
@@ -60,6 +66,55 @@ G_DEFINE_TYPE (KmsAgnosticBin2, kms_agnostic_bin2, GST_TYPE_BIN);
 #define CONFIGURED_KEY "kms-configured-key"
 
 #define TARGET_BITRATE_DEFAULT 300000
+#define SHARED_FAN_OUT_DEFAULT FALSE
+#define GOP_CACHE_DEFAULT FALSE
+#define DEFER_OUTPUTS_DEFAULT FALSE
+
+#define GOP_CACHE_KEY "kms-gop-cache"
+#define GOP_CACHE_REPLAY_KEY "kms-gop-cache-replay"
+#define GOP_CACHE_MAX_BYTES (4 * 1024 * 1024)
+#define GOP_CACHE_MAX_DURATION (10 * GST_SECOND)
+
+#define LADDER_KEY "kms-ladder"
+#define LADDER_CONSUMER_KEY "kms-ladder-consumer"
+#define MAX_LADDER_LAYERS 4
+#define NO_LAYER -1
+/* Increase (percent) over the layer bitrate needed to move up to it */
+#define LADDER_UP_MARGIN 115
+#define LADDER_CHECK_INTERVAL GST_SECOND
+#define LADDER_SWITCH_TIMEOUT (2 * GST_SECOND)
+
+/*
+ * Encoders of a ladder, each one encoding the same decoded stream at its own
+ * fixed bitrate. Layer 0 has the highest bitrate, every following layer
+ * gets a quarter of the previous one.
+ */
+typedef struct _KmsAgnosticLadder
+{
+  guint n_layers;
+  GstBin *layers[MAX_LADDER_LAYERS];
+  guint bitrates[MAX_LADDER_LAYERS];
+} KmsAgnosticLadder;
+
+/*
+ * A src pad fed by a ladder. Every layer reaches a funnel, only buffers of
+ * the active layer are let through. Switching waits for a key frame of the
+ * new layer.
+ */
+typedef struct _KmsLadderConsumer
+{
+  KmsRefStruct ref;
+
+  GMutex mutex;
+  RembEventManager *remb_manager;
+  guint n_layers;
+  guint bitrates[MAX_LADDER_LAYERS];
+  GstPad *layer_pads[MAX_LADDER_LAYERS];
+  gint active;
+  gint pending;
+  GstClockTime last_check;
+  GstClockTime pending_since;
+} KmsLadderConsumer;
 
 struct _KmsAgnosticBin2Private
 {
@@ -79,12 +134,26 @@ struct _KmsAgnosticBin2Private
   GThreadPool *remove_pool;
 
   gint default_bitrate;
+  GstStructure *encoder_config;
+  gboolean shared_fan_out;
+  gboolean gop_cache;
+
+  /* Outputs linked while deferred, configured at once when it ends */
+  gboolean defer_outputs;
+  gulong input_block_id;
+  GSList *deferred_pads;
+
+  GSList *ladders;
 };
 
 enum
 {
   PROP_0,
   PROP_DEFAULT_BITRATE,
+  PROP_ENCODER_CONFIG,
+  PROP_SHARED_FAN_OUT,
+  PROP_GOP_CACHE,
+  PROP_DEFER_OUTPUTS,
   N_PROPERTIES
 };
 
@@ -145,6 +214,28 @@ is_raw_caps (GstCaps * caps)
   return ret;
 }
 
+/* The output will start with the cached frames, no key frame is needed */
+static gboolean
+is_gop_replay_pending (GstPad * pad)
+{
+  KmsGopCache *cache;
+  gboolean pending = FALSE;
+
+  GST_OBJECT_LOCK (pad);
+  cache = g_object_get_data (G_OBJECT (pad), GOP_CACHE_REPLAY_KEY);
+  if (cache != NULL) {
+    kms_gop_cache_ref (cache);
+  }
+  GST_OBJECT_UNLOCK (pad);
+
+  if (cache != NULL) {
+    pending = kms_gop_cache_is_valid (cache);
+    kms_gop_cache_unref (cache);
+  }
+
+  return pending;
+}
+
 static GstPadProbeReturn
 tee_src_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
 {
@@ -152,8 +243,12 @@ tee_src_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
     GstEvent *event = gst_pad_probe_info_get_event (info);
 
     if (GST_EVENT_TYPE (event) == GST_EVENT_RECONFIGURE) {
-      // Request key frame to upstream elements
-      kms_utils_drop_until_keyframe (pad, TRUE);
+      if (is_gop_replay_pending (pad)) {
+        GST_DEBUG_OBJECT (pad, "GOP replay pending, no key frame requested");
+      } else {
+        // Request key frame to upstream elements
+        kms_utils_drop_until_keyframe (pad, TRUE);
+      }
       return GST_PAD_PROBE_DROP;
     }
   }
@@ -332,8 +427,57 @@ no_fail_chain (GstPad * pad, GstObject * parent, GstBuffer * buffer)
   return GST_FLOW_OK;
 }
 
+/*
+ * Runs in the streaming thread with the first buffer that a new output gets,
+ * so the frames cached at this moment are the ones just before it.
+ */
+static GstPadProbeReturn
+gop_cache_replay_probe (GstPad * pad, GstPadProbeInfo * info, gpointer cache)
+{
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  GstFlowReturn ret = GST_FLOW_OK;
+  GstBufferList *replay;
+  guint i, len;
+
+  GST_OBJECT_LOCK (pad);
+  g_object_set_data (G_OBJECT (pad), GOP_CACHE_REPLAY_KEY, NULL);
+  GST_OBJECT_UNLOCK (pad);
+
+  if (!GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT)) {
+    return GST_PAD_PROBE_REMOVE;
+  }
+
+  /* Removed before pushing, so the replayed frames do not get here */
+  gst_pad_remove_probe (pad, GST_PAD_PROBE_INFO_ID (info));
+  replay = kms_gop_cache_get_replay (cache, buffer);
+
+  if (replay == NULL) {
+    /* The GOP was dropped, fall back to wait for a key frame */
+    GST_DEBUG_OBJECT (pad, "No GOP to replay");
+    kms_utils_drop_until_keyframe (pad, TRUE);
+    return GST_PAD_PROBE_DROP;
+  }
+
+  len = gst_buffer_list_length (replay);
+  GST_DEBUG_OBJECT (pad, "Replaying %u cached frames", len);
+
+  /* One by one, probes dropping until a key frame only look at buffers */
+  for (i = 0; i < len && ret == GST_FLOW_OK; i++) {
+    ret = gst_pad_push (pad, gst_buffer_ref (gst_buffer_list_get (replay, i)));
+  }
+
+  gst_buffer_list_unref (replay);
+
+  return GST_PAD_PROBE_OK;
+}
+
+/*
+ * With a @cache, the new output starts with its cached frames instead of
+ * requesting a key frame
+ */
 static void
-link_element_to_tee (GstElement * tee, GstElement * element)
+link_element_to_tee_full (GstElement * tee, GstElement * element,
+    KmsGopCache * cache)
 {
   GstPad *tee_src = gst_element_get_request_pad (tee, "src_%u");
   GstPad *element_sink = gst_element_get_static_pad (element, "sink");
@@ -361,6 +505,18 @@ link_element_to_tee (GstElement * tee, GstElement * element)
   gst_pad_add_probe (tee_src, GST_PAD_PROBE_TYPE_EVENT_UPSTREAM, tee_src_probe,
       NULL, NULL);
 
+  if (cache != NULL) {
+    /* Before linking, buffers can flow as soon as it is linked */
+    GST_OBJECT_LOCK (tee_src);
+    g_object_set_data_full (G_OBJECT (tee_src), GOP_CACHE_REPLAY_KEY,
+        kms_gop_cache_ref (cache), (GDestroyNotify) kms_gop_cache_unref);
+    GST_OBJECT_UNLOCK (tee_src);
+
+    gst_pad_add_probe (tee_src, GST_PAD_PROBE_TYPE_BUFFER,
+        gop_cache_replay_probe, kms_gop_cache_ref (cache),
+        (GDestroyNotify) kms_gop_cache_unref);
+  }
+
   ret = gst_pad_link_full (tee_src, element_sink, GST_PAD_LINK_CHECK_NOTHING);
 
   if (G_UNLIKELY (GST_PAD_LINK_FAILED (ret))) {
@@ -372,6 +528,12 @@ link_element_to_tee (GstElement * tee, GstElement * element)
   g_object_unref (tee_src);
 }
 
+static void
+link_element_to_tee (GstElement * tee, GstElement * element)
+{
+  link_element_to_tee_full (tee, element, NULL);
+}
+
 static GstPadProbeReturn
 remove_target_pad_block (GstPad * pad, GstPadProbeInfo * info, gpointer gp)
 {
@@ -400,13 +562,24 @@ remove_target_pad (GstPad * pad)
   g_object_unref (target);
 }
 
+/*
+ * Every output gets its own queue so a slow consumer does not block the
+ * others. With shared fan out the queues have no thread of their own, they
+ * are drained by a shared pool and leak when full.
+ */
 static void
 kms_agnostic_bin2_link_to_tee (KmsAgnosticBin2 * self, GstPad * pad,
-    GstElement * tee, GstCaps * caps)
+    GstElement * tee, GstCaps * caps, KmsGopCache * cache)
 {
-  GstElement *queue = gst_element_factory_make ("queue", NULL);
+  GstElement *queue;
   GstPad *target;
 
+  if (self->priv->shared_fan_out) {
+    queue = gst_element_factory_make ("fanoutqueue", NULL);
+  } else {
+    queue = gst_element_factory_make ("queue", NULL);
+  }
+
   gst_bin_add (GST_BIN (self), queue);
   gst_element_sync_state_with_parent (queue);
 
@@ -433,7 +606,248 @@ kms_agnostic_bin2_link_to_tee (KmsAgnosticBin2 * self, GstPad * pad,
 
   gst_ghost_pad_set_target (GST_GHOST_PAD (pad), target);
   g_object_unref (target);
-  link_element_to_tee (tee, queue);
+  link_element_to_tee_full (tee, queue, cache);
+}
+
+static GstPadProbeReturn
+gop_cache_probe (GstPad * pad, GstPadProbeInfo * info, gpointer cache)
+{
+  if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_BUFFER) {
+    kms_gop_cache_add (cache, GST_PAD_PROBE_INFO_BUFFER (info));
+  } else if (GST_PAD_PROBE_INFO_TYPE (info) &
+      (GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM | GST_PAD_PROBE_TYPE_EVENT_FLUSH)) {
+    GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+
+    if (GST_EVENT_TYPE (event) == GST_EVENT_CAPS
+        || GST_EVENT_TYPE (event) == GST_EVENT_FLUSH_STOP) {
+      kms_gop_cache_clear (cache);
+    }
+  }
+
+  return GST_PAD_PROBE_OK;
+}
+
+/* Must be called with the agnosticbin locked */
+static KmsGopCache *
+kms_agnostic_bin2_get_gop_cache (KmsAgnosticBin2 * self, GstBin * bin)
+{
+  KmsGopCache *cache;
+  GstElement *tee;
+  GstPad *sink;
+
+  cache = g_object_get_data (G_OBJECT (bin), GOP_CACHE_KEY);
+  if (cache != NULL) {
+    return cache;
+  }
+
+  cache = kms_gop_cache_new (GOP_CACHE_MAX_BYTES, GOP_CACHE_MAX_DURATION);
+  g_object_set_data_full (G_OBJECT (bin), GOP_CACHE_KEY, cache,
+      (GDestroyNotify) kms_gop_cache_unref);
+
+  tee = kms_tree_bin_get_output_tee (KMS_TREE_BIN (bin));
+  sink = gst_element_get_static_pad (tee, "sink");
+  gst_pad_add_probe (sink,
+      GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM |
+      GST_PAD_PROBE_TYPE_EVENT_FLUSH, gop_cache_probe,
+      kms_gop_cache_ref (cache), (GDestroyNotify) kms_gop_cache_unref);
+  g_object_unref (sink);
+
+  GST_DEBUG_OBJECT (self, "GOP cache created for %" GST_PTR_FORMAT, bin);
+
+  return cache;
+}
+
+static void
+kms_ladder_consumer_destroy (KmsLadderConsumer * consumer)
+{
+  kms_utils_remb_event_manager_destroy (consumer->remb_manager);
+  g_mutex_clear (&consumer->mutex);
+
+  g_slice_free (KmsLadderConsumer, consumer);
+}
+
+static KmsLadderConsumer *
+kms_ladder_consumer_new (KmsAgnosticLadder * ladder, GstPad * funnel_src)
+{
+  KmsLadderConsumer *consumer;
+  guint i;
+
+  consumer = g_slice_new0 (KmsLadderConsumer);
+  kms_ref_struct_init (KMS_REF_STRUCT_CAST (consumer),
+      (GDestroyNotify) kms_ladder_consumer_destroy);
+
+  g_mutex_init (&consumer->mutex);
+
+  /* Estimations are kept here, encoders of the ladder never get them */
+  consumer->remb_manager = kms_utils_remb_event_manager_create (funnel_src);
+  consumer->n_layers = ladder->n_layers;
+  for (i = 0; i < ladder->n_layers; i++) {
+    consumer->bitrates[i] = ladder->bitrates[i];
+  }
+
+  /* Until there is an estimation, consumers get the best layer */
+  consumer->active = 0;
+  consumer->pending = NO_LAYER;
+
+  return consumer;
+}
+
+static gint
+kms_ladder_consumer_choose_layer (KmsLadderConsumer * consumer,
+    guint estimation)
+{
+  guint i;
+
+  if (estimation == 0) {
+    return 0;
+  }
+
+  for (i = 0; i < consumer->n_layers; i++) {
+    guint64 needed = consumer->bitrates[i];
+
+    if ((gint) i < consumer->active) {
+      needed = needed * LADDER_UP_MARGIN / 100;
+    }
+
+    if (estimation >= needed) {
+      return i;
+    }
+  }
+
+  return consumer->n_layers - 1;
+}
+
+static GstPadProbeReturn
+ladder_layer_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  KmsLadderConsumer *consumer = user_data;
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  GstPad *request_pad = NULL;
+  GstClockTime now;
+  gint layer = NO_LAYER, target;
+  gboolean drop = TRUE;
+  guint i;
+
+  g_mutex_lock (&consumer->mutex);
+
+  for (i = 0; i < consumer->n_layers && layer == NO_LAYER; i++) {
+    if (consumer->layer_pads[i] == pad) {
+      layer = i;
+    }
+  }
+
+  if (layer == consumer->pending &&
+      !GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT)) {
+    GST_DEBUG_OBJECT (pad, "Switching from layer %d to layer %d",
+        consumer->active, layer);
+    consumer->active = layer;
+    consumer->pending = NO_LAYER;
+  }
+
+  if (layer != consumer->active) {
+    goto end;
+  }
+
+  drop = FALSE;
+  now = kms_utils_get_time_nsecs ();
+
+  if (consumer->pending != NO_LAYER) {
+    if (now - consumer->pending_since > LADDER_SWITCH_TIMEOUT) {
+      GST_DEBUG_OBJECT (pad, "No key frame in layer %d, choosing again",
+          consumer->pending);
+      consumer->pending = NO_LAYER;
+      consumer->last_check = 0;
+    }
+
+    goto end;
+  }
+
+  if (now - consumer->last_check < LADDER_CHECK_INTERVAL) {
+    goto end;
+  }
+
+  consumer->last_check = now;
+  target = kms_ladder_consumer_choose_layer (consumer,
+      kms_utils_remb_event_manager_get_min (consumer->remb_manager));
+
+  if (target != consumer->active) {
+    consumer->pending = target;
+    consumer->pending_since = now;
+    request_pad = gst_object_ref (consumer->layer_pads[target]);
+  }
+
+end:
+  g_mutex_unlock (&consumer->mutex);
+
+  if (request_pad != NULL) {
+    kms_utils_request_keyframe (request_pad, TRUE);
+    gst_object_unref (request_pad);
+  }
+
+  return drop ? GST_PAD_PROBE_DROP : GST_PAD_PROBE_OK;
+}
+
+static void
+kms_agnostic_bin2_link_to_ladder (KmsAgnosticBin2 * self, GstPad * pad,
+    KmsAgnosticLadder * ladder)
+{
+  GstElement *queue = gst_element_factory_make ("queue", NULL);
+  GstElement *funnel = gst_element_factory_make ("funnel", NULL);
+  KmsLadderConsumer *consumer;
+  GstPad *target, *funnel_src;
+  guint i;
+
+  gst_bin_add_many (GST_BIN (self), queue, funnel, NULL);
+  gst_element_sync_state_with_parent (queue);
+  gst_element_sync_state_with_parent (funnel);
+
+  remove_element_on_unlinked (queue, "src", "sink");
+  remove_element_on_unlinked (funnel, "src", "sink");
+  gst_element_link_pads (funnel, "src", queue, "sink");
+
+  funnel_src = gst_element_get_static_pad (funnel, "src");
+  consumer = kms_ladder_consumer_new (ladder, funnel_src);
+  g_object_unref (funnel_src);
+
+  for (i = 0; i < ladder->n_layers; i++) {
+    GstPad *funnel_sink = gst_element_get_request_pad (funnel, "sink_%u");
+
+    /* Funnel keeps its request pads, they live as long as the consumer */
+    consumer->layer_pads[i] = funnel_sink;
+    g_object_unref (funnel_sink);
+  }
+
+  for (i = 0; i < ladder->n_layers; i++) {
+    GstElement *tee =
+        kms_tree_bin_get_output_tee (KMS_TREE_BIN (ladder->layers[i]));
+    GstPad *tee_src = gst_element_get_request_pad (tee, "src_%u");
+    GstPadLinkReturn ret;
+
+    g_signal_connect (tee_src, "unlinked",
+        G_CALLBACK (remove_tee_pad_on_unlink), NULL);
+    gst_pad_add_probe (tee_src, GST_PAD_PROBE_TYPE_EVENT_UPSTREAM,
+        tee_src_probe, NULL, NULL);
+    gst_pad_add_probe (consumer->layer_pads[i], GST_PAD_PROBE_TYPE_BUFFER,
+        ladder_layer_probe, kms_ref_struct_ref (KMS_REF_STRUCT_CAST (consumer)),
+        (GDestroyNotify) kms_ref_struct_unref);
+
+    ret = gst_pad_link_full (tee_src, consumer->layer_pads[i],
+        GST_PAD_LINK_CHECK_NOTHING);
+
+    if (G_UNLIKELY (GST_PAD_LINK_FAILED (ret))) {
+      GST_ERROR ("Linking %" GST_PTR_FORMAT " with %" GST_PTR_FORMAT
+          " result %d", tee_src, consumer->layer_pads[i], ret);
+    }
+
+    g_object_unref (tee_src);
+  }
+
+  g_object_set_data_full (G_OBJECT (funnel), LADDER_CONSUMER_KEY, consumer,
+      (GDestroyNotify) kms_ref_struct_unref);
+
+  target = gst_element_get_static_pad (queue, "src");
+  gst_ghost_pad_set_target (GST_GHOST_PAD (pad), target);
+  g_object_unref (target);
 }
 
 static GstBin *
@@ -547,12 +961,34 @@ kms_agnostic_bin2_get_or_create_dec_bin (KmsAgnosticBin2 * self, GstCaps * caps)
 }
 
 static GstBin *
-kms_agnostic_bin2_create_bin_for_caps (KmsAgnosticBin2 * self, GstCaps * caps)
+kms_agnostic_bin2_create_enc_bin (KmsAgnosticBin2 * self, GstBin * dec_bin,
+    GstCaps * caps, gint bitrate)
 {
-  GstBin *dec_bin;
   KmsEncTreeBin *enc_bin;
   GstElement *input_element, *output_tee;
 
+  enc_bin = kms_enc_tree_bin_new (caps, bitrate, self->priv->encoder_config);
+  if (enc_bin == NULL) {
+    return NULL;
+  }
+
+  gst_bin_add (GST_BIN (self), GST_ELEMENT (enc_bin));
+  gst_element_sync_state_with_parent (GST_ELEMENT (enc_bin));
+
+  output_tee = kms_tree_bin_get_output_tee (KMS_TREE_BIN (dec_bin));
+  input_element = kms_tree_bin_get_input_element (KMS_TREE_BIN (enc_bin));
+  link_element_to_tee (output_tee, input_element);
+
+  kms_agnostic_bin2_insert_bin (self, GST_BIN (enc_bin));
+
+  return GST_BIN (enc_bin);
+}
+
+static GstBin *
+kms_agnostic_bin2_create_bin_for_caps (KmsAgnosticBin2 * self, GstCaps * caps)
+{
+  GstBin *dec_bin;
+
   dec_bin = kms_agnostic_bin2_get_or_create_dec_bin (self, caps);
   if (dec_bin == NULL) {
     return NULL;
@@ -562,21 +998,69 @@ kms_agnostic_bin2_create_bin_for_caps (KmsAgnosticBin2 * self, GstCaps * caps)
     return dec_bin;
   }
 
-  enc_bin = kms_enc_tree_bin_new (caps, self->priv->default_bitrate);
-  if (enc_bin == NULL) {
+  return kms_agnostic_bin2_create_enc_bin (self, dec_bin, caps,
+      self->priv->default_bitrate);
+}
+
+static guint
+kms_agnostic_bin2_get_ladder_layers (KmsAgnosticBin2 * self)
+{
+  gint layers = 0;
+
+  if (self->priv->encoder_config != NULL) {
+    gst_structure_get_int (self->priv->encoder_config, "layers", &layers);
+  }
+
+  return CLAMP (layers, 0, MAX_LADDER_LAYERS);
+}
+
+static KmsAgnosticLadder *
+kms_agnostic_bin2_create_ladder (KmsAgnosticBin2 * self, GstCaps * caps)
+{
+  guint n_layers = kms_agnostic_bin2_get_ladder_layers (self);
+  KmsAgnosticLadder *ladder;
+  GstBin *dec_bin;
+  guint i;
+
+  dec_bin = kms_agnostic_bin2_get_or_create_dec_bin (self, caps);
+  if (dec_bin == NULL) {
     return NULL;
   }
 
-  gst_bin_add (GST_BIN (self), GST_ELEMENT (enc_bin));
-  gst_element_sync_state_with_parent (GST_ELEMENT (enc_bin));
+  ladder = g_slice_new0 (KmsAgnosticLadder);
 
-  output_tee = kms_tree_bin_get_output_tee (KMS_TREE_BIN (dec_bin));
-  input_element = kms_tree_bin_get_input_element (KMS_TREE_BIN (enc_bin));
-  link_element_to_tee (output_tee, input_element);
+  for (i = 0; i < n_layers; i++) {
+    gint bitrate = self->priv->default_bitrate >> (2 * i);
+    GstBin *enc_bin;
 
-  kms_agnostic_bin2_insert_bin (self, GST_BIN (enc_bin));
+    enc_bin = kms_agnostic_bin2_create_enc_bin (self, dec_bin, caps, bitrate);
+    if (enc_bin == NULL) {
+      break;
+    }
 
-  return GST_BIN (enc_bin);
+    g_object_set_data (G_OBJECT (enc_bin), LADDER_KEY, ladder);
+    ladder->layers[i] = enc_bin;
+    ladder->bitrates[i] = bitrate;
+    ladder->n_layers++;
+  }
+
+  if (ladder->n_layers == 0) {
+    g_slice_free (KmsAgnosticLadder, ladder);
+    return NULL;
+  }
+
+  GST_DEBUG_OBJECT (self, "Created ladder of %u layers for %" GST_PTR_FORMAT,
+      ladder->n_layers, caps);
+
+  self->priv->ladders = g_slist_prepend (self->priv->ladders, ladder);
+
+  return ladder;
+}
+
+static void
+kms_agnostic_ladder_destroy (gpointer ladder)
+{
+  g_slice_free (KmsAgnosticLadder, ladder);
 }
 
 /**
@@ -589,6 +1073,7 @@ kms_agnostic_bin2_create_bin_for_caps (KmsAgnosticBin2 * self, GstCaps * caps)
 static void
 kms_agnostic_bin2_link_pad (KmsAgnosticBin2 * self, GstPad * pad, GstPad * peer)
 {
+  KmsAgnosticLadder *ladder = NULL;
   GstCaps *caps;
   GstBin *bin;
 
@@ -603,16 +1088,35 @@ kms_agnostic_bin2_link_pad (KmsAgnosticBin2 * self, GstPad * pad, GstPad * peer)
   GST_DEBUG ("Query caps are: %" GST_PTR_FORMAT, caps);
   bin = kms_agnostic_bin2_find_bin_for_caps (self, caps);
 
-  if (bin == NULL) {
+  if (bin != NULL) {
+    ladder = g_object_get_data (G_OBJECT (bin), LADDER_KEY);
+  } else if (kms_agnostic_bin2_get_ladder_layers (self) > 1 &&
+      kms_utils_caps_are_video (caps) && !is_raw_caps (caps)) {
+    ladder = kms_agnostic_bin2_create_ladder (self, caps);
+  } else {
     bin = kms_agnostic_bin2_create_bin_for_caps (self, caps);
     GST_DEBUG_OBJECT (self, "Created bin: %" GST_PTR_FORMAT, bin);
   }
 
-  if (bin != NULL) {
+  if (ladder != NULL) {
+    kms_utils_drop_until_keyframe (pad, TRUE);
+    kms_agnostic_bin2_link_to_ladder (self, pad, ladder);
+  } else if (bin != NULL) {
     GstElement *tee = kms_tree_bin_get_output_tee (KMS_TREE_BIN (bin));
+    KmsGopCache *cache = NULL;
 
-    kms_utils_drop_until_keyframe (pad, TRUE);
-    kms_agnostic_bin2_link_to_tee (self, pad, tee, caps);
+    if (self->priv->gop_cache && !gst_caps_is_any (caps)
+        && !is_raw_caps (caps)) {
+      cache = kms_agnostic_bin2_get_gop_cache (self, bin);
+    }
+
+    if (cache != NULL && kms_gop_cache_is_valid (cache)) {
+      /* Started with the cached frames, without requesting a key frame */
+      kms_agnostic_bin2_link_to_tee (self, pad, tee, caps, cache);
+    } else {
+      kms_utils_drop_until_keyframe (pad, TRUE);
+      kms_agnostic_bin2_link_to_tee (self, pad, tee, caps, NULL);
+    }
   }
 
   gst_caps_unref (caps);
@@ -771,6 +1275,8 @@ kms_agnostic_bin2_configure_input (KmsAgnosticBin2 * self, const GstCaps * caps)
   GST_DEBUG ("Removing old treebins");
   g_hash_table_foreach (self->priv->bins, remove_bin, self);
   g_hash_table_remove_all (self->priv->bins);
+  g_slist_free_full (self->priv->ladders, kms_agnostic_ladder_destroy);
+  self->priv->ladders = NULL;
 
   KMS_AGNOSTIC_BIN2_UNLOCK (self);
 }
@@ -847,7 +1353,12 @@ kms_agnostic_bin2_src_reconfigure_probe (GstPad * pad, GstPadProbeInfo * info,
       GST_DEBUG_OBJECT (pad, "Received reconfigure event");
 
       KMS_AGNOSTIC_BIN2_LOCK (self);
-      kms_agnostic_bin2_process_pad (self, pad);
+      if (!self->priv->defer_outputs) {
+        kms_agnostic_bin2_process_pad (self, pad);
+      } else if (g_slist_find (self->priv->deferred_pads, pad) == NULL) {
+        self->priv->deferred_pads = g_slist_prepend (self->priv->deferred_pads,
+            g_object_ref (pad));
+      }
       ret = GST_PAD_PROBE_DROP;
       KMS_AGNOSTIC_BIN2_UNLOCK (self);
 
@@ -861,6 +1372,59 @@ end:
   return ret;
 }
 
+static GstPadProbeReturn
+input_blocked_probe (GstPad * pad, GstPadProbeInfo * info, gpointer data)
+{
+  GST_TRACE_OBJECT (pad, "Input blocked while outputs are deferred");
+
+  return GST_PAD_PROBE_OK;
+}
+
+static void
+process_deferred_pad (GstPad * pad, KmsAgnosticBin2 * self)
+{
+  kms_agnostic_bin2_process_pad (self, pad);
+}
+
+/*
+ * While outputs are deferred the input is blocked and new outputs are not
+ * configured, so a batch of them is configured once at the end
+ */
+static void
+kms_agnostic_bin2_set_defer_outputs (KmsAgnosticBin2 * self, gboolean defer)
+{
+  GSList *pads;
+
+  KMS_AGNOSTIC_BIN2_LOCK (self);
+
+  if (self->priv->defer_outputs == defer) {
+    KMS_AGNOSTIC_BIN2_UNLOCK (self);
+    return;
+  }
+
+  self->priv->defer_outputs = defer;
+
+  if (defer) {
+    self->priv->input_block_id = gst_pad_add_probe (self->priv->sink,
+        GST_PAD_PROBE_TYPE_BLOCK_DOWNSTREAM, input_blocked_probe, NULL, NULL);
+    KMS_AGNOSTIC_BIN2_UNLOCK (self);
+    return;
+  }
+
+  pads = g_slist_reverse (self->priv->deferred_pads);
+  self->priv->deferred_pads = NULL;
+
+  GST_DEBUG_OBJECT (self, "Configuring %u deferred outputs",
+      g_slist_length (pads));
+  g_slist_foreach (pads, (GFunc) process_deferred_pad, self);
+  g_slist_free_full (pads, g_object_unref);
+
+  gst_pad_remove_probe (self->priv->sink, self->priv->input_block_id);
+  self->priv->input_block_id = 0;
+
+  KMS_AGNOSTIC_BIN2_UNLOCK (self);
+}
+
 static void
 kms_agnostic_bin2_src_unlinked (GstPad * pad, GstPad * peer,
     KmsAgnosticBin2 * self)
@@ -927,6 +1491,9 @@ kms_agnostic_bin2_dispose (GObject * object)
     self->priv->input_caps = NULL;
   }
 
+  g_slist_free_full (self->priv->deferred_pads, g_object_unref);
+  self->priv->deferred_pads = NULL;
+
   KMS_AGNOSTIC_BIN2_UNLOCK (self);
 
   /* chain up */
@@ -944,6 +1511,12 @@ kms_agnostic_bin2_finalize (GObject * object)
 
   g_hash_table_unref (self->priv->bins);
 
+  if (self->priv->encoder_config != NULL) {
+    gst_structure_free (self->priv->encoder_config);
+  }
+
+  g_slist_free_full (self->priv->ladders, kms_agnostic_ladder_destroy);
+
   /* chain up */
   G_OBJECT_CLASS (kms_agnostic_bin2_parent_class)->finalize (object);
 }
@@ -961,6 +1534,33 @@ kms_agnostic_bin2_set_property (GObject * object, guint property_id,
       GST_DEBUG ("default bitrate configured %d", self->priv->default_bitrate);
       KMS_AGNOSTIC_BIN2_UNLOCK (self);
       break;
+    case PROP_ENCODER_CONFIG:{
+      const GstStructure *config = gst_value_get_structure (value);
+
+      KMS_AGNOSTIC_BIN2_LOCK (self);
+      if (self->priv->encoder_config != NULL) {
+        gst_structure_free (self->priv->encoder_config);
+      }
+      self->priv->encoder_config =
+          config != NULL ? gst_structure_copy (config) : NULL;
+      GST_DEBUG ("Encoder config: %" GST_PTR_FORMAT,
+          self->priv->encoder_config);
+      KMS_AGNOSTIC_BIN2_UNLOCK (self);
+      break;
+    }
+    case PROP_SHARED_FAN_OUT:
+      KMS_AGNOSTIC_BIN2_LOCK (self);
+      self->priv->shared_fan_out = g_value_get_boolean (value);
+      KMS_AGNOSTIC_BIN2_UNLOCK (self);
+      break;
+    case PROP_GOP_CACHE:
+      KMS_AGNOSTIC_BIN2_LOCK (self);
+      self->priv->gop_cache = g_value_get_boolean (value);
+      KMS_AGNOSTIC_BIN2_UNLOCK (self);
+      break;
+    case PROP_DEFER_OUTPUTS:
+      kms_agnostic_bin2_set_defer_outputs (self, g_value_get_boolean (value));
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
       break;
@@ -979,6 +1579,26 @@ kms_agnostic_bin2_get_property (GObject * object, guint property_id,
       g_value_set_int (value, self->priv->default_bitrate);
       KMS_AGNOSTIC_BIN2_UNLOCK (self);
       break;
+    case PROP_ENCODER_CONFIG:
+      KMS_AGNOSTIC_BIN2_LOCK (self);
+      gst_value_set_structure (value, self->priv->encoder_config);
+      KMS_AGNOSTIC_BIN2_UNLOCK (self);
+      break;
+    case PROP_SHARED_FAN_OUT:
+      KMS_AGNOSTIC_BIN2_LOCK (self);
+      g_value_set_boolean (value, self->priv->shared_fan_out);
+      KMS_AGNOSTIC_BIN2_UNLOCK (self);
+      break;
+    case PROP_GOP_CACHE:
+      KMS_AGNOSTIC_BIN2_LOCK (self);
+      g_value_set_boolean (value, self->priv->gop_cache);
+      KMS_AGNOSTIC_BIN2_UNLOCK (self);
+      break;
+    case PROP_DEFER_OUTPUTS:
+      KMS_AGNOSTIC_BIN2_LOCK (self);
+      g_value_set_boolean (value, self->priv->defer_outputs);
+      KMS_AGNOSTIC_BIN2_UNLOCK (self);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
       break;
@@ -1020,6 +1640,29 @@ kms_agnostic_bin2_class_init (KmsAgnosticBin2Class * klass)
           "Configure the default bitrate to media encoding",
           0, G_MAXINT, 0, G_PARAM_READWRITE));
 
+  g_object_class_install_property (gobject_class, PROP_ENCODER_CONFIG,
+      g_param_spec_boxed ("encoder-config", "Encoder configuration",
+          "Threads, speed level and adaptation of the encoders created",
+          GST_TYPE_STRUCTURE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_SHARED_FAN_OUT,
+      g_param_spec_boolean ("shared-fan-out", "Shared fan out",
+          "Outputs are fed by queues drained by a shared pool of threads "
+          "instead of a thread per output", SHARED_FAN_OUT_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_GOP_CACHE,
+      g_param_spec_boolean ("gop-cache", "GOP cache",
+          "Keep the encoded frames since the last key frame to start new "
+          "outputs with them instead of requesting a key frame",
+          GOP_CACHE_DEFAULT, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_DEFER_OUTPUTS,
+      g_param_spec_boolean ("defer-outputs", "Defer outputs",
+          "Block the input and leave new outputs unconfigured until unset, "
+          "to configure a batch of them at once", DEFER_OUTPUTS_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
   GST_DEBUG_CATEGORY_INIT (GST_CAT_DEFAULT, PLUGIN_NAME, 0, PLUGIN_NAME);
 
   g_type_class_add_private (klass, sizeof (KmsAgnosticBin2Private));
@@ -1087,6 +1730,47 @@ kms_agnostic_bin2_init (KmsAgnosticBin2 * self)
       g_hash_table_new_full (g_str_hash, g_str_equal, NULL, g_object_unref);
   g_rec_mutex_init (&self->priv->thread_mutex);
   self->priv->default_bitrate = TARGET_BITRATE_DEFAULT;
+  self->priv->encoder_config = NULL;
+  self->priv->shared_fan_out = SHARED_FAN_OUT_DEFAULT;
+  self->priv->gop_cache = GOP_CACHE_DEFAULT;
+  self->priv->defer_outputs = DEFER_OUTPUTS_DEFAULT;
+  self->priv->ladders = NULL;
+}
+
+static GstStructure *
+kms_agnostic_bin2_stats_action (KmsIStats * obj)
+{
+  KmsAgnosticBin2 *self = KMS_AGNOSTIC_BIN2 (obj);
+  GstStructure *stats;
+  GHashTableIter iter;
+  gpointer key, value;
+
+  stats = gst_structure_new_empty ("agnosticbin-stats");
+
+  KMS_AGNOSTIC_BIN2_LOCK (self);
+
+  g_hash_table_iter_init (&iter, self->priv->bins);
+  while (g_hash_table_iter_next (&iter, &key, &value)) {
+    GstStructure *enc_stats;
+
+    if (!KMS_IS_ENC_TREE_BIN (value)) {
+      continue;
+    }
+
+    enc_stats = kms_enc_tree_bin_get_stats (KMS_ENC_TREE_BIN (value));
+    gst_structure_set (stats, key, GST_TYPE_STRUCTURE, enc_stats, NULL);
+    gst_structure_free (enc_stats);
+  }
+
+  KMS_AGNOSTIC_BIN2_UNLOCK (self);
+
+  return stats;
+}
+
+static void
+kms_istats_interface_init (KmsIStatsInterface * iface)
+{
+  iface->stats = kms_agnostic_bin2_stats_action;
 }
 
 gboolean
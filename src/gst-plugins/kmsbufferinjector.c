@@ -18,12 +18,18 @@
 #endif
 
 #include "kmsbufferinjector.h"
+#include "kmstimerwheel.h"
 
 #define PLUGIN_NAME "bufferinjector"
 #define DEFAULT_WAITING_TIME (G_TIME_SPAN_MILLISECOND / (gfloat)15)
 
 #define KMS_BUFFER_INJECTOR_CAPS "video/x-raw; audio/x-raw"
 
+/* A push running for longer than this is blocked downstream. The pool gets an
+ * extra thread for each one, up to MAX_EXTRA_THREADS_FACTOR per processor */
+#define BLOCKED_PUSH_TIME (50 * G_TIME_SPAN_MILLISECOND)
+#define MAX_EXTRA_THREADS_FACTOR 2
+
 static GstStaticPadTemplate sinktemplate = GST_STATIC_PAD_TEMPLATE ("sink",
     GST_PAD_SINK,
     GST_PAD_ALWAYS,
@@ -53,10 +59,6 @@ G_DEFINE_TYPE_WITH_CODE (KmsBufferInjector, kms_buffer_injector,
   )                                          \
 )
 
-#define KMS_BUFFER_INJECTOR_GET_COND(obj) (       \
-  &KMS_BUFFER_INJECTOR (obj)->priv->thread_cond   \
-)
-
 #define KMS_BUFFER_INJECTOR_LOCK(obj) (                           \
   g_rec_mutex_lock (&KMS_BUFFER_INJECTOR (obj)->priv->thread_mutex)   \
 )
@@ -80,8 +82,13 @@ struct _KmsBufferInjectorPrivate
   gboolean still_waiting;
   MediaType type;
   GstBuffer *previous_buffer;
-  GMutex mutex_generate;
-  GCond cond_generate;
+  KmsTimerWheelTimer *timer;
+  gboolean scheduled;
+  /* Waiting for a pool thread or pushing, there is never more than one
+   * injection in flight */
+  gboolean injecting;
+  /* microseconds, monotonic time */
+  gint64 last_input;
   /* milliseconds */
   gint64 wait_time;
   /* nanoseconds */
@@ -96,64 +103,209 @@ enum
   N_PROPERTIES
 };
 
+static void kms_buffer_injector_generate_buffers (KmsBufferInjector * self,
+    gpointer user_data);
+
+/* Injectors do not have their own thread. All of them share the timer wheel
+ * thread, that only wakes up the ones whose input stalled, and a pool of
+ * threads used to push the injected buffers.
+ *
+ * A push that blocks downstream holds a pool thread for as long as it
+ * blocks. Running pushes are tracked and, while there are injections waiting
+ * for a thread, one is added to the pool for each blocked push. They are
+ * removed once those pushes finish */
+G_LOCK_DEFINE_STATIC (pool);
+static GQueue pool_pushes = G_QUEUE_INIT;
+static guint pool_base_threads;
+static gint pool_max_threads;
+
+static gpointer
+kms_buffer_injector_create_pool (gpointer data)
+{
+  pool_base_threads = g_get_num_processors ();
+  pool_max_threads = pool_base_threads;
+
+  return g_thread_pool_new ((GFunc) kms_buffer_injector_generate_buffers,
+      NULL, pool_base_threads, FALSE, NULL);
+}
+
+static GThreadPool *
+kms_buffer_injector_get_pool (void)
+{
+  static GOnce once = G_ONCE_INIT;
+
+  g_once (&once, kms_buffer_injector_create_pool, NULL);
+
+  return once.retval;
+}
+
+static void
+kms_buffer_injector_check_blocked (void)
+{
+  GThreadPool *pool = kms_buffer_injector_get_pool ();
+  guint blocked = 0;
+  gint max_threads;
+  gint64 now;
+  GList *l;
+
+  if (g_thread_pool_unprocessed (pool) == 0
+      && g_atomic_int_get (&pool_max_threads) == (gint) pool_base_threads) {
+    return;
+  }
+
+  now = g_get_monotonic_time ();
+
+  G_LOCK (pool);
+
+  for (l = pool_pushes.head; l != NULL; l = l->next) {
+    if (now - *(gint64 *) l->data > BLOCKED_PUSH_TIME) {
+      blocked++;
+    }
+  }
+
+  max_threads = pool_base_threads +
+      MIN (blocked, MAX_EXTRA_THREADS_FACTOR * pool_base_threads);
+
+  if (max_threads != pool_max_threads) {
+    GST_DEBUG ("%u blocked pushes, using %d pool threads", blocked,
+        max_threads);
+    g_thread_pool_set_max_threads (pool, max_threads, NULL);
+    g_atomic_int_set (&pool_max_threads, max_threads);
+  }
+
+  G_UNLOCK (pool);
+}
+
+/* Must be called with the injector locked */
+static gint64
+kms_buffer_injector_get_timeout (KmsBufferInjector * self)
+{
+  return self->priv->factor_wait_time * self->priv->wait_time *
+      G_TIME_SPAN_MILLISECOND;
+}
+
 static void
-kms_buffer_injector_generate_buffers (KmsBufferInjector * self)
+kms_buffer_injector_generate_buffers (KmsBufferInjector * self,
+    gpointer user_data)
 {
-  gint64 end_time;              /* microseconds */
   gint64 offset_time;           /* milliseconds */
+  gint64 start;
+  GList link = { &start, NULL, NULL };
+  GstBuffer *copy;
 
   KMS_BUFFER_INJECTOR_LOCK (self);
+  if (!self->priv->still_waiting) {
+    self->priv->injecting = FALSE;
+    KMS_BUFFER_INJECTOR_UNLOCK (self);
+    goto end;
+  }
+
   if ((!self->priv->configured) || (self->priv->previous_buffer == NULL)) {
     GST_WARNING_OBJECT (self,
         "Buffer injector is not correctly configured, there is no buffer to send");
+    self->priv->scheduled = FALSE;
+    self->priv->injecting = FALSE;
     KMS_BUFFER_INJECTOR_UNLOCK (self);
-    return;
+    goto end;
   }
 
   offset_time = (self->priv->factor_wait_time * self->priv->wait_time);
-  end_time = g_get_monotonic_time () + (offset_time) * G_TIME_SPAN_MILLISECOND;
-
   self->priv->acumulated_time =
       self->priv->acumulated_time + (offset_time * G_TIME_SPAN_SECOND);
 
+  //timeout reached, it is necessary to inject a new buffer
+  GST_DEBUG_OBJECT (self->priv->srcpad, "Injecting buffer");
+  copy = gst_buffer_copy (self->priv->previous_buffer);
+
+  if (GST_BUFFER_DTS_IS_VALID (copy)) {
+    GST_BUFFER_DTS (copy) = GST_BUFFER_DTS (copy) + self->priv->acumulated_time;
+  }
+  if (GST_BUFFER_PTS_IS_VALID (copy)) {
+    GST_BUFFER_PTS (copy) = GST_BUFFER_PTS (copy) + self->priv->acumulated_time;
+  }
+
+  GST_BUFFER_FLAG_SET (copy, GST_BUFFER_FLAG_GAP);
+  GST_BUFFER_FLAG_SET (copy, GST_BUFFER_FLAG_DROPPABLE);
+  KMS_BUFFER_INJECTOR_UNLOCK (self);
+
+  start = g_get_monotonic_time ();
+  G_LOCK (pool);
+  g_queue_push_tail_link (&pool_pushes, &link);
+  G_UNLOCK (pool);
+
+  gst_pad_push (self->priv->srcpad, copy);
+
+  G_LOCK (pool);
+  g_queue_unlink (&pool_pushes, &link);
+  G_UNLOCK (pool);
+
+  kms_buffer_injector_check_blocked ();
+
+  /* Keep injecting while input is stalled */
+  KMS_BUFFER_INJECTOR_LOCK (self);
+  self->priv->injecting = FALSE;
+  if (self->priv->still_waiting) {
+    kms_timer_wheel_timer_arm (self->priv->timer,
+        g_get_monotonic_time () + kms_buffer_injector_get_timeout (self));
+  }
   KMS_BUFFER_INJECTOR_UNLOCK (self);
 
-  g_mutex_lock (&self->priv->mutex_generate);
+end:
+  gst_object_unref (self);
+}
 
+/* Runs in the timer wheel thread, so it must not block */
+static void
+kms_buffer_injector_timeout (KmsTimerWheelTimer * timer, gpointer data)
+{
+  KmsBufferInjector *self = KMS_BUFFER_INJECTOR (data);
+  gint64 deadline;
+
+  KMS_BUFFER_INJECTOR_LOCK (self);
   if (!self->priv->still_waiting) {
-    g_mutex_unlock (&self->priv->mutex_generate);
+    KMS_BUFFER_INJECTOR_UNLOCK (self);
     return;
   }
 
-  if (!g_cond_wait_until (&self->priv->cond_generate,
-          &self->priv->mutex_generate, end_time)) {
-    GstBuffer *copy;
-
-    //timeout reached, it is necessary to inject a new buffer
-    GST_DEBUG_OBJECT (self->priv->srcpad, "Injecting buffer");
-    KMS_BUFFER_INJECTOR_LOCK (self);
-    if (!self->priv->previous_buffer) {
-      KMS_BUFFER_INJECTOR_UNLOCK (self);
-      g_mutex_unlock (&self->priv->mutex_generate);
-      return;
-    }
-    copy = gst_buffer_copy (self->priv->previous_buffer);
+  if (self->priv->injecting) {
+    /* Still waiting for a pool thread or blocked downstream, check again
+     * later whether the pool has to grow */
+    kms_timer_wheel_timer_arm (timer,
+        g_get_monotonic_time () + BLOCKED_PUSH_TIME);
+    KMS_BUFFER_INJECTOR_UNLOCK (self);
+    kms_buffer_injector_check_blocked ();
+    return;
+  }
 
-    if (GST_BUFFER_DTS_IS_VALID (copy)) {
-      GST_BUFFER_DTS (copy) =
-          GST_BUFFER_DTS (copy) + self->priv->acumulated_time;
-    }
-    if (GST_BUFFER_PTS_IS_VALID (copy)) {
-      GST_BUFFER_PTS (copy) =
-          GST_BUFFER_PTS (copy) + self->priv->acumulated_time;
-    }
+  deadline = self->priv->last_input + kms_buffer_injector_get_timeout (self);
 
-    GST_BUFFER_FLAG_SET (copy, GST_BUFFER_FLAG_GAP);
-    GST_BUFFER_FLAG_SET (copy, GST_BUFFER_FLAG_DROPPABLE);
+  if (deadline > g_get_monotonic_time ()) {
+    /* Input is still flowing, just move the deadline */
+    kms_timer_wheel_timer_arm (timer, deadline);
     KMS_BUFFER_INJECTOR_UNLOCK (self);
-    gst_pad_push (self->priv->srcpad, copy);
+    return;
   }
-  g_mutex_unlock (&self->priv->mutex_generate);
+
+  self->priv->injecting = TRUE;
+  kms_timer_wheel_timer_arm (timer,
+      g_get_monotonic_time () + BLOCKED_PUSH_TIME);
+  KMS_BUFFER_INJECTOR_UNLOCK (self);
+
+  g_thread_pool_push (kms_buffer_injector_get_pool (), gst_object_ref (self),
+      NULL);
+  kms_buffer_injector_check_blocked ();
+}
+
+static void
+kms_buffer_injector_stop (KmsBufferInjector * self)
+{
+  KMS_BUFFER_INJECTOR_LOCK (self);
+  self->priv->still_waiting = FALSE;
+  self->priv->scheduled = FALSE;
+  KMS_BUFFER_INJECTOR_UNLOCK (self);
+
+  /* Not locked, the timer callback could be waiting for the injector lock */
+  kms_timer_wheel_timer_cancel (self->priv->timer);
 }
 
 static gboolean
@@ -228,12 +380,19 @@ kms_buffer_injector_chain (GstPad * pad, GstObject * parent, GstBuffer * buffer)
   gst_buffer_replace (&buffer_injector->priv->previous_buffer, buffer);
   buffer_injector->priv->acumulated_time = 0;
 
-  KMS_BUFFER_INJECTOR_UNLOCK (buffer_injector);
+  /* The timer checks this when it expires, so it does not need to be re-armed
+   * for every buffer */
+  buffer_injector->priv->last_input = g_get_monotonic_time ();
 
-  //wake up pad task
-  g_mutex_lock (&buffer_injector->priv->mutex_generate);
-  g_cond_signal (&buffer_injector->priv->cond_generate);
-  g_mutex_unlock (&buffer_injector->priv->mutex_generate);
+  if (buffer_injector->priv->still_waiting
+      && !buffer_injector->priv->scheduled) {
+    buffer_injector->priv->scheduled = TRUE;
+    kms_timer_wheel_timer_arm (buffer_injector->priv->timer,
+        buffer_injector->priv->last_input +
+        kms_buffer_injector_get_timeout (buffer_injector));
+  }
+
+  KMS_BUFFER_INJECTOR_UNLOCK (buffer_injector);
 
   return gst_pad_push (buffer_injector->priv->srcpad, buffer);
 }
@@ -267,12 +426,14 @@ kms_buffer_injector_activate_mode (GstPad * pad, GstObject * parent,
   switch (mode) {
     case GST_PAD_MODE_PUSH:
       if (active) {
-        res = gst_pad_start_task (pad,
-            (GstTaskFunction) kms_buffer_injector_generate_buffers,
-            buffer_injector, NULL);
+        KMS_BUFFER_INJECTOR_LOCK (buffer_injector);
+        buffer_injector->priv->still_waiting = TRUE;
+        buffer_injector->priv->scheduled = FALSE;
+        KMS_BUFFER_INJECTOR_UNLOCK (buffer_injector);
       } else {
-        res = gst_pad_stop_task (pad);
+        kms_buffer_injector_stop (buffer_injector);
       }
+      res = TRUE;
       break;
     case GST_PAD_MODE_PULL:
       res = TRUE;
@@ -306,12 +467,13 @@ kms_buffer_injector_init (KmsBufferInjector * self)
       kms_buffer_injector_activate_mode);
 
   g_rec_mutex_init (&self->priv->thread_mutex);
-  g_mutex_init (&self->priv->mutex_generate);
-  g_cond_init (&self->priv->cond_generate);
+  self->priv->timer =
+      kms_timer_wheel_timer_new (kms_buffer_injector_timeout, self, NULL);
 
   self->priv->wait_time = DEFAULT_WAITING_TIME;
   self->priv->configured = FALSE;
   self->priv->still_waiting = TRUE;
+  self->priv->scheduled = FALSE;
   self->priv->acumulated_time = 0;
 
   self->priv->factor_wait_time = 2;
@@ -326,11 +488,7 @@ kms_buffer_injector_change_state (GstElement * element,
 
   switch (transition) {
     case GST_STATE_CHANGE_PAUSED_TO_READY:
-      g_mutex_lock (&buffer_injector->priv->mutex_generate);
-      buffer_injector->priv->still_waiting = FALSE;
-      g_cond_signal (&buffer_injector->priv->cond_generate);
-      g_mutex_unlock (&buffer_injector->priv->mutex_generate);
-      gst_pad_pause_task (buffer_injector->priv->srcpad);
+      kms_buffer_injector_stop (buffer_injector);
       break;
     default:
       break;
@@ -346,9 +504,8 @@ kms_buffer_injector_finalize (GObject * object)
 {
   KmsBufferInjector *buffer_injector = KMS_BUFFER_INJECTOR (object);
 
+  kms_timer_wheel_timer_free (buffer_injector->priv->timer);
   g_rec_mutex_clear (&buffer_injector->priv->thread_mutex);
-  g_mutex_clear (&buffer_injector->priv->mutex_generate);
-  g_cond_clear (&buffer_injector->priv->cond_generate);
 
   if (buffer_injector->priv->previous_buffer != NULL) {
     gst_buffer_unref (buffer_injector->priv->previous_buffer);
@@ -20,9 +20,11 @@
 #include <kmshubport.h>
 #include <kmsfilterelement.h>
 #include <kmsaudiomixer.h>
+#include <kmsmixminus.h>
 #include <kmsaudiomixerbin.h>
 #include <kmsbitratefilter.h>
 #include <kmsbufferinjector.h>
+#include <kmsfanoutqueue.h>
 #include <kmspassthrough.h>
 #include <kmsdummysrc.h>
 #include <kmsdummysink.h>
@@ -47,6 +49,9 @@ kurento_init (GstPlugin * kurento)
   if (!kms_audio_mixer_plugin_init (kurento))
     return FALSE;
 
+  if (!kms_mix_minus_plugin_init (kurento))
+    return FALSE;
+
   if (!kms_audio_mixer_bin_plugin_init (kurento))
     return FALSE;
 
@@ -56,6 +61,9 @@ kurento_init (GstPlugin * kurento)
   if (!kms_buffer_injector_plugin_init (kurento))
     return FALSE;
 
+  if (!kms_fan_out_queue_plugin_init (kurento))
+    return FALSE;
+
   if (!kms_pass_through_plugin_init (kurento))
     return FALSE;
 
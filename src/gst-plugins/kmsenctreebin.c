@@ -35,59 +35,398 @@ G_DEFINE_TYPE (KmsEncTreeBin, kms_enc_tree_bin, KMS_TYPE_TREE_BIN);
   )                                         \
 )
 
+#define DEFAULT_MAX_THREADS 4
+#define SPEED_LEVEL_AUTO -1
+#define MAX_SPEED_LEVEL 3
+#define VP8_DEADLINE G_GINT64_CONSTANT (200000)
+
+/* Pixels per second that one encoding thread is expected to handle */
+#define PIXELS_PER_THREAD (640 * 480 * 30)
+
+/* Load of the host (per cpu) from which encoders must go faster */
+#define HOST_BUSY_LOAD 0.7
+#define HOST_OVERLOADED_LOAD 1.0
+
+/* Runtime adaptation, comparing encoding time and frame interval */
+#define LOAD_SMOOTHING 16
+#define OVERLOAD_RATIO 0.85
+#define UNDERLOAD_RATIO 0.35
+#define SPEED_UP_HOLDOFF (2 * GST_SECOND)
+#define SLOW_DOWN_HOLDOFF (10 * GST_SECOND)
+
+/* Encoder effort for each speed level, from best quality to fastest */
+static const gint vp8_cpu_used[MAX_SPEED_LEVEL + 1] = { 4, 8, 12, 16 };
+
+static const gint x264_speed_preset[MAX_SPEED_LEVEL + 1] = {
+  4 /* faster */ , 3 /* veryfast */ , 2 /* superfast */ , 1 /* ultrafast */
+};
+
+typedef enum
+{
+  ENCODER_TYPE_OTHER,
+  ENCODER_TYPE_VP8,
+  ENCODER_TYPE_X264
+} EncoderType;
+
+typedef struct _EncoderProfile
+{
+  GMutex mutex;
+
+  /* Configuration */
+  gint cfg_threads;
+  gint max_threads;
+  gint cfg_speed;
+  gboolean adaptive;
+
+  /* Active profile */
+  gint threads;
+  gint speed;
+  gint min_speed;
+  gint pending_speed;
+  guint speed_changes;
+
+  /* Encoding load measurement */
+  GstClockTime prev_in;
+  GstClockTime last_in;
+  GstClockTime frame_interval;
+  GstClockTime encode_time;
+  GstClockTime last_change;
+} EncoderProfile;
+
 struct _KmsEncTreeBinPrivate
 {
   GstPad *enc_sink;
   gulong remb_manager_probe_id;
   RembEventManager *remb_manager;
+
+  GstElement *enc;
+  EncoderType enc_type;
+  EncoderProfile profile;
+  GstPad *enc_src;
+  gulong profile_sink_probe_id;
+  gulong profile_src_probe_id;
 };
 
-static void
-configure_encoder (GstElement * encoder, const gchar * factory_name,
-    gint target_bitrate)
+static EncoderType
+get_encoder_type (const gchar * factory_name)
 {
-  GST_DEBUG ("Configure encoder: %s", factory_name);
   if (g_strcmp0 ("vp8enc", factory_name) == 0) {
-    g_object_set (G_OBJECT (encoder), "deadline", G_GINT64_CONSTANT (200000),
-        "threads", 1, "cpu-used", 16, "resize-allowed", TRUE,
-        "target-bitrate", target_bitrate, "end-usage", /* cbr */ 1, NULL);
+    return ENCODER_TYPE_VP8;
   } else if (g_strcmp0 ("x264enc", factory_name) == 0) {
-    g_object_set (G_OBJECT (encoder), "speed-preset", 1 /* ultrafast */ ,
-        "threads", (guint) 1, "bitrate", target_bitrate / 1000, NULL);
+    return ENCODER_TYPE_X264;
+  } else {
+    return ENCODER_TYPE_OTHER;
   }
 }
 
-static GstElement *
-create_encoder_for_caps (const GstCaps * caps, gint target_bitrate)
+static void
+encoder_profile_read_config (EncoderProfile * profile,
+    const GstStructure * config)
 {
-  GList *encoder_list, *filtered_list, *l;
-  GstElementFactory *encoder_factory = NULL;
-  GstElement *encoder = NULL;
+  profile->cfg_threads = 0;
+  profile->max_threads = DEFAULT_MAX_THREADS;
+  profile->cfg_speed = SPEED_LEVEL_AUTO;
+  profile->adaptive = TRUE;
+
+  if (config == NULL) {
+    return;
+  }
+
+  gst_structure_get (config, "threads", G_TYPE_INT, &profile->cfg_threads,
+      NULL);
+  gst_structure_get (config, "max-threads", G_TYPE_INT, &profile->max_threads,
+      NULL);
+  gst_structure_get (config, "speed", G_TYPE_INT, &profile->cfg_speed, NULL);
+  gst_structure_get (config, "adaptive", G_TYPE_BOOLEAN, &profile->adaptive,
+      NULL);
+
+  profile->max_threads = MAX (profile->max_threads, 1);
+  if (profile->cfg_speed != SPEED_LEVEL_AUTO) {
+    profile->cfg_speed = CLAMP (profile->cfg_speed, 0, MAX_SPEED_LEVEL);
+  }
+}
+
+/* Average load of the host per available processor */
+static gdouble
+get_host_load (void)
+{
+  gchar *contents = NULL;
+  gdouble load = 0.0;
+
+  if (g_file_get_contents ("/proc/loadavg", &contents, NULL, NULL)) {
+    load = g_ascii_strtod (contents, NULL);
+  }
+
+  g_free (contents);
+
+  return load / g_get_num_processors ();
+}
+
+/* Pixels per second described by @caps or 0 if size is not known yet */
+static guint64
+get_pixel_rate (const GstCaps * caps)
+{
+  gint width = 0, height = 0, fps_n = 0, fps_d = 1;
+  GstStructure *st;
+
+  if (caps == NULL || gst_caps_get_size (caps) == 0) {
+    return 0;
+  }
+
+  st = gst_caps_get_structure (caps, 0);
+
+  if (!gst_structure_get_int (st, "width", &width) ||
+      !gst_structure_get_int (st, "height", &height)) {
+    return 0;
+  }
+
+  if (!gst_structure_get_fraction (st, "framerate", &fps_n, &fps_d) ||
+      fps_n <= 0 || fps_d <= 0) {
+    /* Variable or unknown framerate, assume usual camera rate */
+    fps_n = 30;
+    fps_d = 1;
+  }
+
+  return gst_util_uint64_scale_int ((guint64) width * height, fps_n, fps_d);
+}
+
+/*
+ * Chooses threads and speed level for the encoder. Speed is chosen from the
+ * amount of pixels to encode and raised when the host is already busy. While
+ * size is unknown the fastest level is used, so that no encoder starts
+ * falling behind.
+ */
+static void
+encoder_profile_choose (EncoderProfile * profile, const GstCaps * caps)
+{
+  guint64 pixel_rate = get_pixel_rate (caps);
+  gdouble load = get_host_load ();
+  gint speed, threads;
+
+  if (pixel_rate == 0) {
+    speed = MAX_SPEED_LEVEL;
+  } else if (pixel_rate <= 320 * 240 * 30) {
+    speed = 0;
+  } else if (pixel_rate <= 640 * 480 * 30) {
+    speed = 1;
+  } else if (pixel_rate <= 1280 * 720 * 30) {
+    speed = 2;
+  } else {
+    speed = MAX_SPEED_LEVEL;
+  }
+
+  if (load > HOST_OVERLOADED_LOAD) {
+    speed = MAX_SPEED_LEVEL;
+  } else if (load > HOST_BUSY_LOAD) {
+    speed = MIN (speed + 1, MAX_SPEED_LEVEL);
+  }
 
-  encoder_list =
-      gst_element_factory_list_get_elements (GST_ELEMENT_FACTORY_TYPE_ENCODER,
-      GST_RANK_NONE);
-  filtered_list =
-      gst_element_factory_list_filter (encoder_list, caps, GST_PAD_SRC, FALSE);
+  threads = (pixel_rate + PIXELS_PER_THREAD - 1) / PIXELS_PER_THREAD;
+  threads = MIN (threads, (gint) g_get_num_processors ());
+  threads = CLAMP (threads, 1, profile->max_threads);
 
-  for (l = filtered_list; l != NULL && encoder_factory == NULL; l = l->next) {
-    encoder_factory = GST_ELEMENT_FACTORY (l->data);
-    if (gst_element_factory_get_num_pad_templates (encoder_factory) != 2)
-      encoder_factory = NULL;
+  if (load > HOST_OVERLOADED_LOAD) {
+    /* More threads will only compete with the rest of the host */
+    threads = 1;
   }
 
+  profile->speed = profile->cfg_speed != SPEED_LEVEL_AUTO ?
+      profile->cfg_speed : speed;
+  if (profile->cfg_threads > 0) {
+    /* Never more than allowed nor than processors available */
+    threads = MIN (profile->cfg_threads, (gint) g_get_num_processors ());
+    threads = CLAMP (threads, 1, profile->max_threads);
+  }
+
+  profile->threads = threads;
+  profile->min_speed = profile->speed;
+  profile->pending_speed = SPEED_LEVEL_AUTO;
+
+  GST_DEBUG ("Encoder profile: %d threads, speed %d (pixel rate %"
+      G_GUINT64_FORMAT ", host load %.2f)", profile->threads, profile->speed,
+      pixel_rate, load);
+}
+
+static void
+configure_encoder (GstElement * encoder, EncoderType type,
+    EncoderProfile * profile, gint target_bitrate)
+{
+  GST_DEBUG ("Configure encoder: %" GST_PTR_FORMAT, encoder);
+  if (type == ENCODER_TYPE_VP8) {
+    g_object_set (G_OBJECT (encoder), "deadline", VP8_DEADLINE,
+        "threads", profile->threads,
+        "cpu-used", vp8_cpu_used[profile->speed], "resize-allowed", TRUE,
+        "target-bitrate", target_bitrate, "end-usage", /* cbr */ 1, NULL);
+  } else if (type == ENCODER_TYPE_X264) {
+    g_object_set (G_OBJECT (encoder),
+        "speed-preset", x264_speed_preset[profile->speed],
+        "threads", (guint) profile->threads, "bitrate", target_bitrate / 1000,
+        NULL);
+  }
+}
+
+static GstElement *
+create_encoder_for_caps (const GstCaps * caps)
+{
+  GstElementFactory *encoder_factory;
+  GstElement *encoder = NULL;
+
+  encoder_factory =
+      kms_utils_get_element_factory_for_caps (GST_ELEMENT_FACTORY_TYPE_ENCODER,
+      NULL, caps, kms_utils_element_factory_has_sink_and_src);
+
   if (encoder_factory != NULL) {
     encoder = gst_element_factory_create (encoder_factory, NULL);
-    configure_encoder (encoder, GST_OBJECT_NAME (encoder_factory),
-        target_bitrate);
+    gst_object_unref (encoder_factory);
   }
 
-  gst_plugin_feature_list_free (filtered_list);
-  gst_plugin_feature_list_free (encoder_list);
-
   return encoder;
 }
 
+static GstClockTime
+ewma (GstClockTime avg, GstClockTime sample)
+{
+  if (!GST_CLOCK_TIME_IS_VALID (avg)) {
+    return sample;
+  }
+
+  return avg + ((gint64) sample - (gint64) avg) / LOAD_SMOOTHING;
+}
+
+static GstPadProbeReturn
+profile_sink_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  KmsEncTreeBin *self = user_data;
+  EncoderProfile *profile = &self->priv->profile;
+  GstClockTime now;
+
+  if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+    GstEvent *event = gst_pad_probe_info_get_event (info);
+    GstCaps *caps;
+
+    if (GST_EVENT_TYPE (event) != GST_EVENT_CAPS) {
+      return GST_PAD_PROBE_OK;
+    }
+
+    /* Raw caps give the real size, encoder is (re)initialized with them */
+    gst_event_parse_caps (event, &caps);
+    g_mutex_lock (&profile->mutex);
+    encoder_profile_choose (profile, caps);
+    g_object_set (self->priv->enc, "threads", profile->threads,
+        "cpu-used", vp8_cpu_used[profile->speed], NULL);
+    g_mutex_unlock (&profile->mutex);
+
+    return GST_PAD_PROBE_OK;
+  }
+
+  now = g_get_monotonic_time () * GST_USECOND;
+
+  g_mutex_lock (&profile->mutex);
+
+  if (GST_CLOCK_TIME_IS_VALID (profile->prev_in) &&
+      now - profile->prev_in < GST_SECOND) {
+    profile->frame_interval =
+        ewma (profile->frame_interval, now - profile->prev_in);
+  }
+
+  profile->prev_in = now;
+  profile->last_in = now;
+
+  if (profile->pending_speed != SPEED_LEVEL_AUTO) {
+    /* Applied here, before the encoder is given the next frame */
+    GST_DEBUG_OBJECT (self, "Encoder speed level changed from %d to %d",
+        profile->speed, profile->pending_speed);
+    profile->speed = profile->pending_speed;
+    profile->pending_speed = SPEED_LEVEL_AUTO;
+    profile->speed_changes++;
+    profile->last_change = now;
+    g_object_set (self->priv->enc, "cpu-used", vp8_cpu_used[profile->speed],
+        NULL);
+  }
+
+  g_mutex_unlock (&profile->mutex);
+
+  return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn
+profile_src_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  KmsEncTreeBin *self = user_data;
+  EncoderProfile *profile = &self->priv->profile;
+  GstClockTime now = g_get_monotonic_time () * GST_USECOND;
+  gdouble ratio;
+
+  g_mutex_lock (&profile->mutex);
+
+  if (!GST_CLOCK_TIME_IS_VALID (profile->last_in)) {
+    goto end;
+  }
+
+  profile->encode_time = ewma (profile->encode_time, now - profile->last_in);
+  profile->last_in = GST_CLOCK_TIME_NONE;
+
+  if (!GST_CLOCK_TIME_IS_VALID (profile->frame_interval) ||
+      profile->frame_interval == 0 ||
+      profile->pending_speed != SPEED_LEVEL_AUTO) {
+    goto end;
+  }
+
+  ratio = (gdouble) profile->encode_time / profile->frame_interval;
+
+  if (ratio > OVERLOAD_RATIO && profile->speed < MAX_SPEED_LEVEL &&
+      now - profile->last_change > SPEED_UP_HOLDOFF) {
+    profile->pending_speed = profile->speed + 1;
+  } else if (ratio < UNDERLOAD_RATIO && profile->speed > profile->min_speed &&
+      now - profile->last_change > SLOW_DOWN_HOLDOFF) {
+    profile->pending_speed = profile->speed - 1;
+  }
+
+end:
+  g_mutex_unlock (&profile->mutex);
+
+  return GST_PAD_PROBE_OK;
+}
+
+GstStructure *
+kms_enc_tree_bin_get_stats (KmsEncTreeBin * self)
+{
+  EncoderProfile *profile = &self->priv->profile;
+  GstElementFactory *factory;
+  GstStructure *stats;
+  gdouble load = 0.0;
+
+  factory = gst_element_get_factory (self->priv->enc);
+
+  g_mutex_lock (&profile->mutex);
+
+  if (GST_CLOCK_TIME_IS_VALID (profile->encode_time) &&
+      GST_CLOCK_TIME_IS_VALID (profile->frame_interval) &&
+      profile->frame_interval > 0) {
+    load = (gdouble) profile->encode_time / profile->frame_interval;
+  }
+
+  stats = gst_structure_new ("encoder",
+      "codec", G_TYPE_STRING, GST_OBJECT_NAME (factory),
+      "threads", G_TYPE_INT, profile->threads,
+      "speed-level", G_TYPE_INT, profile->speed,
+      "adaptive", G_TYPE_BOOLEAN, profile->adaptive,
+      "encode-load", G_TYPE_DOUBLE, load,
+      "speed-changes", G_TYPE_UINT, profile->speed_changes, NULL);
+
+  if (self->priv->enc_type == ENCODER_TYPE_VP8) {
+    gst_structure_set (stats, "cpu-used", G_TYPE_INT,
+        vp8_cpu_used[profile->speed], NULL);
+  } else if (self->priv->enc_type == ENCODER_TYPE_X264) {
+    gst_structure_set (stats, "speed-preset", G_TYPE_INT,
+        x264_speed_preset[profile->speed], NULL);
+  }
+
+  g_mutex_unlock (&profile->mutex);
+
+  return stats;
+}
+
 static void
 enc_set_target_bitrate (GstElement * enc, gint target_bitrate)
 {
@@ -191,15 +530,83 @@ check_caps_probe (GstPad * pad, GstPadProbeInfo * info, gpointer data)
   return GST_PAD_PROBE_OK;
 }
 
+/*
+ * x264enc cannot change its profile once it is playing, so it is kept in
+ * READY until the raw caps give the size to choose the profile from.
+ */
+static GstPadProbeReturn
+x264_profile_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  KmsEncTreeBin *self = user_data;
+  EncoderProfile *profile = &self->priv->profile;
+  GstEvent *event = gst_pad_probe_info_get_event (info);
+  GstCaps *caps;
+
+  if (GST_EVENT_TYPE (event) != GST_EVENT_CAPS) {
+    return GST_PAD_PROBE_OK;
+  }
+
+  gst_event_parse_caps (event, &caps);
+  g_mutex_lock (&profile->mutex);
+  encoder_profile_choose (profile, caps);
+  g_object_set (self->priv->enc,
+      "speed-preset", x264_speed_preset[profile->speed],
+      "threads", (guint) profile->threads, NULL);
+  g_mutex_unlock (&profile->mutex);
+
+  gst_element_set_locked_state (self->priv->enc, FALSE);
+  gst_element_sync_state_with_parent (self->priv->enc);
+
+  return GST_PAD_PROBE_REMOVE;
+}
+
+static void
+kms_enc_tree_bin_configure_profile (KmsEncTreeBin * self,
+    const GstCaps * caps, const GstStructure * config, gint target_bitrate)
+{
+  EncoderProfile *profile = &self->priv->profile;
+  GstPadProbeType sink_mask = GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM;
+
+  encoder_profile_read_config (profile, config);
+  encoder_profile_choose (profile, caps);
+  configure_encoder (self->priv->enc, self->priv->enc_type, profile,
+      target_bitrate);
+
+  /* Other encoders cannot change their profile once they are playing */
+  if (self->priv->enc_type != ENCODER_TYPE_VP8) {
+    profile->adaptive = FALSE;
+
+    if (self->priv->enc_type == ENCODER_TYPE_X264) {
+      /* Started by x264_profile_probe */
+      gst_element_set_locked_state (self->priv->enc, TRUE);
+      gst_element_set_state (self->priv->enc, GST_STATE_READY);
+    }
+
+    return;
+  }
+
+  if (profile->adaptive) {
+    sink_mask |= GST_PAD_PROBE_TYPE_BUFFER;
+    self->priv->enc_src = gst_element_get_static_pad (self->priv->enc, "src");
+    self->priv->profile_src_probe_id =
+        gst_pad_add_probe (self->priv->enc_src, GST_PAD_PROBE_TYPE_BUFFER,
+        profile_src_probe, self, NULL);
+  }
+
+  self->priv->profile_sink_probe_id =
+      gst_pad_add_probe (self->priv->enc_sink, sink_mask, profile_sink_probe,
+      self, NULL);
+}
+
 static gboolean
 kms_enc_tree_bin_configure (KmsEncTreeBin * self, const GstCaps * caps,
-    gint target_bitrate)
+    gint target_bitrate, const GstStructure * config)
 {
   KmsTreeBin *tree_bin = KMS_TREE_BIN (self);
   GstElement *rate, *convert, *mediator, *enc, *output_tee, *capsfilter;
   gboolean is_h264;
 
-  enc = create_encoder_for_caps (caps, target_bitrate);
+  enc = create_encoder_for_caps (caps);
   if (enc == NULL) {
     GST_WARNING_OBJECT (self, "Invalid encoder for caps: %" GST_PTR_FORMAT,
         caps);
@@ -212,7 +619,12 @@ kms_enc_tree_bin_configure (KmsEncTreeBin * self, const GstCaps * caps,
 
   GST_DEBUG_OBJECT (self, "Encoder found: %" GST_PTR_FORMAT, enc);
 
+  self->priv->enc = enc;
+  self->priv->enc_type =
+      get_encoder_type (GST_OBJECT_NAME (gst_element_get_factory (enc)));
   self->priv->enc_sink = gst_element_get_static_pad (enc, "sink");
+  kms_enc_tree_bin_configure_profile (self, caps, config, target_bitrate);
+
   self->priv->remb_manager =
       kms_utils_remb_event_manager_create (self->priv->enc_sink);
   self->priv->remb_manager_probe_id =
@@ -224,7 +636,9 @@ kms_enc_tree_bin_configure (KmsEncTreeBin * self, const GstCaps * caps,
   mediator = kms_utils_create_mediator_element (caps);
 
   gst_bin_add_many (GST_BIN (self), rate, convert, mediator, enc, NULL);
-  gst_element_sync_state_with_parent (enc);
+  if (!gst_element_is_locked_state (enc)) {
+    gst_element_sync_state_with_parent (enc);
+  }
   gst_element_sync_state_with_parent (mediator);
   gst_element_sync_state_with_parent (convert);
   gst_element_sync_state_with_parent (rate);
@@ -236,6 +650,11 @@ kms_enc_tree_bin_configure (KmsEncTreeBin * self, const GstCaps * caps,
     sink = gst_element_get_static_pad (capsfilter, "sink");
     gst_pad_add_probe (sink, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
         check_caps_probe, NULL, NULL);
+    if (self->priv->enc_type == ENCODER_TYPE_X264) {
+      /* Upstream of the encoder, its own pads are not active yet */
+      gst_pad_add_probe (sink, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+          x264_profile_probe, self, NULL);
+    }
     g_object_unref (sink);
 
     g_object_set (capsfilter, "caps", filter_caps, NULL);
@@ -258,13 +677,14 @@ kms_enc_tree_bin_configure (KmsEncTreeBin * self, const GstCaps * caps,
 }
 
 KmsEncTreeBin *
-kms_enc_tree_bin_new (const GstCaps * caps, gint target_bitrate)
+kms_enc_tree_bin_new (const GstCaps * caps, gint target_bitrate,
+    const GstStructure * config)
 {
   GObject *enc;
 
   enc = g_object_new (KMS_TYPE_ENC_TREE_BIN, NULL);
   if (!kms_enc_tree_bin_configure (KMS_ENC_TREE_BIN (enc), caps,
-          target_bitrate)) {
+          target_bitrate, config)) {
     g_object_unref (enc);
     return NULL;
   }
@@ -280,6 +700,23 @@ kms_enc_tree_bin_init (KmsEncTreeBin * self)
   self->priv->enc_sink = NULL;
   self->priv->remb_manager = NULL;
   self->priv->remb_manager_probe_id = 0L;
+
+  self->priv->enc = NULL;
+  self->priv->enc_type = ENCODER_TYPE_OTHER;
+  self->priv->enc_src = NULL;
+  self->priv->profile_sink_probe_id = 0L;
+  self->priv->profile_src_probe_id = 0L;
+
+  g_mutex_init (&self->priv->profile.mutex);
+  self->priv->profile.threads = 1;
+  self->priv->profile.speed = MAX_SPEED_LEVEL;
+  self->priv->profile.pending_speed = SPEED_LEVEL_AUTO;
+  self->priv->profile.speed_changes = 0;
+  self->priv->profile.prev_in = GST_CLOCK_TIME_NONE;
+  self->priv->profile.last_in = GST_CLOCK_TIME_NONE;
+  self->priv->profile.frame_interval = GST_CLOCK_TIME_NONE;
+  self->priv->profile.encode_time = GST_CLOCK_TIME_NONE;
+  self->priv->profile.last_change = 0;
 }
 
 static void
@@ -288,6 +725,11 @@ kms_enc_tree_bin_dispose (GObject * object)
   KmsEncTreeBin *self = KMS_ENC_TREE_BIN (object);
 
   GST_DEBUG_OBJECT (object, "dispose");
+  if (self->priv->enc != NULL && gst_element_is_locked_state (self->priv->enc)) {
+    /* Never got caps, the bin did not change its state */
+    gst_element_set_state (self->priv->enc, GST_STATE_NULL);
+  }
+
   if (self->priv->enc_sink) {
     if (self->priv->remb_manager_probe_id) {
       gst_pad_remove_probe (self->priv->enc_sink,
@@ -296,9 +738,27 @@ kms_enc_tree_bin_dispose (GObject * object)
       self->priv->remb_manager_probe_id = 0L;
     }
 
+    if (self->priv->profile_sink_probe_id) {
+      gst_pad_remove_probe (self->priv->enc_sink,
+          self->priv->profile_sink_probe_id);
+
+      self->priv->profile_sink_probe_id = 0L;
+    }
+
     g_clear_object (&self->priv->enc_sink);
   }
 
+  if (self->priv->enc_src) {
+    if (self->priv->profile_src_probe_id) {
+      gst_pad_remove_probe (self->priv->enc_src,
+          self->priv->profile_src_probe_id);
+
+      self->priv->profile_src_probe_id = 0L;
+    }
+
+    g_clear_object (&self->priv->enc_src);
+  }
+
   if (self->priv->remb_manager) {
     kms_utils_remb_event_manager_destroy (self->priv->remb_manager);
     self->priv->remb_manager = NULL;
@@ -308,6 +768,19 @@ kms_enc_tree_bin_dispose (GObject * object)
   G_OBJECT_CLASS (kms_enc_tree_bin_parent_class)->dispose (object);
 }
 
+static void
+kms_enc_tree_bin_finalize (GObject * object)
+{
+  KmsEncTreeBin *self = KMS_ENC_TREE_BIN (object);
+
+  GST_DEBUG_OBJECT (object, "finalize");
+
+  g_mutex_clear (&self->priv->profile.mutex);
+
+  /* chain up */
+  G_OBJECT_CLASS (kms_enc_tree_bin_parent_class)->finalize (object);
+}
+
 static void
 kms_enc_tree_bin_class_init (KmsEncTreeBinClass * klass)
 {
@@ -324,6 +797,7 @@ kms_enc_tree_bin_class_init (KmsEncTreeBinClass * klass)
       GST_DEFAULT_NAME);
 
   gobject_class->dispose = kms_enc_tree_bin_dispose;
+  gobject_class->finalize = kms_enc_tree_bin_finalize;
 
   g_type_class_add_private (klass, sizeof (KmsEncTreeBinPrivate));
 }
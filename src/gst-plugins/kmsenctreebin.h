@@ -50,7 +50,11 @@ struct _KmsEncTreeBinClass
 
 GType kms_enc_tree_bin_get_type (void);
 
-KmsEncTreeBin * kms_enc_tree_bin_new (const GstCaps * caps, gint target_bitrate);
+KmsEncTreeBin * kms_enc_tree_bin_new (const GstCaps * caps, gint target_bitrate,
+    const GstStructure * config);
+
+/* Active encoder profile: threads, speed level and encoding load */
+GstStructure * kms_enc_tree_bin_get_stats (KmsEncTreeBin * self);
 
 G_END_DECLS
 #endif /* __KMS_ENC_TREE_BIN_H__ */
@@ -0,0 +1,680 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "kmsfanoutqueue.h"
+#include "kms-core-enumtypes.h"
+#include "kmsfanoutleaky.h"
+#include "kmsutils.h"
+#include <gst/base/gstqueuearray.h>
+
+#define PLUGIN_NAME "fanoutqueue"
+
+#define DEFAULT_MAX_SIZE_BUFFERS 60
+#define DEFAULT_LEAKY KMS_FAN_OUT_LEAKY_DOWNSTREAM
+
+/* Items pushed, and time spent, by a pool thread before letting other queues
+ * run */
+#define DRAIN_BATCH 16
+#define DRAIN_TIME (5 * G_TIME_SPAN_MILLISECOND)
+
+/* A drain running for longer than this is blocked in a push. The pool gets an
+ * extra thread for each one, up to MAX_EXTRA_THREADS_FACTOR per processor */
+#define BLOCKED_DRAIN_TIME (50 * G_TIME_SPAN_MILLISECOND)
+#define MAX_EXTRA_THREADS_FACTOR 2
+
+static GstStaticPadTemplate sinktemplate = GST_STATIC_PAD_TEMPLATE ("sink",
+    GST_PAD_SINK,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS_ANY);
+
+static GstStaticPadTemplate srctemplate = GST_STATIC_PAD_TEMPLATE ("src",
+    GST_PAD_SRC,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS_ANY);
+
+GST_DEBUG_CATEGORY_STATIC (kms_fan_out_queue_debug);
+#define GST_CAT_DEFAULT kms_fan_out_queue_debug
+#define kms_fan_out_queue_parent_class parent_class
+
+G_DEFINE_TYPE_WITH_CODE (KmsFanOutQueue, kms_fan_out_queue,
+    GST_TYPE_ELEMENT,
+    GST_DEBUG_CATEGORY_INIT (kms_fan_out_queue_debug,
+        PLUGIN_NAME, 0, "debug category for " PLUGIN_NAME " element"));
+
+#define KMS_FAN_OUT_QUEUE_GET_PRIVATE(obj) ( \
+  G_TYPE_INSTANCE_GET_PRIVATE (              \
+    (obj),                                   \
+    KMS_TYPE_FAN_OUT_QUEUE,                  \
+    KmsFanOutQueuePrivate                    \
+  )                                          \
+)
+
+#define KMS_FAN_OUT_QUEUE_LOCK(obj) (                   \
+  g_mutex_lock (&KMS_FAN_OUT_QUEUE (obj)->priv->mutex)  \
+)
+
+#define KMS_FAN_OUT_QUEUE_UNLOCK(obj) (                   \
+  g_mutex_unlock (&KMS_FAN_OUT_QUEUE (obj)->priv->mutex)  \
+)
+
+struct _KmsFanOutQueuePrivate
+{
+  GMutex mutex;
+  GCond cond;
+
+  GstPad *sinkpad;
+  GstPad *srcpad;
+
+  /* Buffers and serialized events waiting to be pushed */
+  GstQueueArray *items;
+  guint n_buffers;
+  guint max_size_buffers;
+  KmsFanOutLeaky leaky;
+  /* Leaked since the queue was last below its limit, a key frame has already
+   * been requested for it */
+  gboolean leaking;
+
+  GstFlowReturn srcresult;
+  /* Waiting in the pool or being drained */
+  gboolean scheduled;
+  /* A pool thread is pushing an item out of the lock */
+  gboolean pushing;
+
+  /* Last serialized query answered by a pool thread */
+  GstQuery *last_handled_query;
+  gboolean last_query_result;
+
+  guint64 dropped;
+};
+
+enum
+{
+  PROP_0,
+  PROP_MAX_SIZE_BUFFERS,
+  PROP_LEAKY,
+  PROP_DROPPED,
+  N_PROPERTIES
+};
+
+static void kms_fan_out_queue_drain (KmsFanOutQueue * self, gpointer data);
+
+/* Queues do not have their own streaming thread. Every queue with pending
+ * items is drained by one thread of this pool, so the number of threads does
+ * not grow with the number of consumers of a tee.
+ *
+ * A consumer that blocks in a push, like a synchronized sink, holds a pool
+ * thread for as long as it blocks. Running drains are tracked and, while
+ * there are queues waiting for a thread, one is added to the pool for each
+ * blocked drain. They are removed once those drains finish */
+G_LOCK_DEFINE_STATIC (pool);
+static GQueue pool_drains = G_QUEUE_INIT;
+static guint pool_base_threads;
+static gint pool_max_threads;
+
+static gpointer
+kms_fan_out_queue_create_pool (gpointer data)
+{
+  pool_base_threads = g_get_num_processors ();
+  pool_max_threads = pool_base_threads;
+
+  return g_thread_pool_new ((GFunc) kms_fan_out_queue_drain, NULL,
+      pool_base_threads, FALSE, NULL);
+}
+
+static GThreadPool *
+kms_fan_out_queue_get_pool (void)
+{
+  static GOnce once = G_ONCE_INIT;
+
+  g_once (&once, kms_fan_out_queue_create_pool, NULL);
+
+  return once.retval;
+}
+
+static void
+kms_fan_out_queue_check_blocked (void)
+{
+  GThreadPool *pool = kms_fan_out_queue_get_pool ();
+  guint blocked = 0;
+  gint max_threads;
+  gint64 now;
+  GList *l;
+
+  if (g_thread_pool_unprocessed (pool) == 0
+      && g_atomic_int_get (&pool_max_threads) == (gint) pool_base_threads) {
+    return;
+  }
+
+  now = g_get_monotonic_time ();
+
+  G_LOCK (pool);
+
+  for (l = pool_drains.head; l != NULL; l = l->next) {
+    if (now - *(gint64 *) l->data > BLOCKED_DRAIN_TIME) {
+      blocked++;
+    }
+  }
+
+  max_threads = pool_base_threads +
+      MIN (blocked, MAX_EXTRA_THREADS_FACTOR * pool_base_threads);
+
+  if (max_threads != pool_max_threads) {
+    GST_DEBUG ("%u blocked drains, using %d pool threads", blocked,
+        max_threads);
+    g_thread_pool_set_max_threads (pool, max_threads, NULL);
+    g_atomic_int_set (&pool_max_threads, max_threads);
+  }
+
+  G_UNLOCK (pool);
+}
+
+/* Must be called with the queue locked */
+static void
+kms_fan_out_queue_clear (KmsFanOutQueue * self)
+{
+  GstMiniObject *item;
+
+  while (!gst_queue_array_is_empty (self->priv->items)) {
+    item = gst_queue_array_pop_head (self->priv->items);
+
+    /* Queries belong to the thread waiting for them */
+    if (!GST_IS_QUERY (item)) {
+      gst_mini_object_unref (item);
+    }
+  }
+
+  self->priv->n_buffers = 0;
+  self->priv->leaking = FALSE;
+  g_cond_broadcast (&self->priv->cond);
+}
+
+/* Must be called with the queue locked */
+static void
+kms_fan_out_queue_schedule (KmsFanOutQueue * self)
+{
+  if (self->priv->scheduled) {
+    return;
+  }
+
+  self->priv->scheduled = TRUE;
+  g_thread_pool_push (kms_fan_out_queue_get_pool (), gst_object_ref (self),
+      NULL);
+}
+
+static gint
+is_buffer_item (gconstpointer item, gconstpointer not_used)
+{
+  /* Compare function, 0 means found */
+  return GST_IS_BUFFER (item) ? 0 : 1;
+}
+
+/* Must be called with the queue locked. Returns TRUE if the buffer has to be
+ * dropped instead of enqueued */
+static gboolean
+kms_fan_out_queue_leak (KmsFanOutQueue * self)
+{
+  guint idx;
+
+  self->priv->dropped++;
+
+  if (self->priv->leaky == KMS_FAN_OUT_LEAKY_UPSTREAM) {
+    return TRUE;
+  }
+
+  /* Events are never dropped, they keep the stream consistent */
+  idx = gst_queue_array_find (self->priv->items,
+      (GCompareFunc) is_buffer_item, NULL);
+  if (idx != (guint) - 1) {
+    gst_mini_object_unref (gst_queue_array_drop_element (self->priv->items,
+            idx));
+    self->priv->n_buffers--;
+  }
+
+  return FALSE;
+}
+
+static GstFlowReturn
+kms_fan_out_queue_chain (GstPad * pad, GstObject * parent, GstBuffer * buffer)
+{
+  KmsFanOutQueue *self = KMS_FAN_OUT_QUEUE (parent);
+  GstFlowReturn ret;
+  gboolean request_keyframe = FALSE;
+
+  KMS_FAN_OUT_QUEUE_LOCK (self);
+
+  ret = self->priv->srcresult;
+  if (ret != GST_FLOW_OK) {
+    KMS_FAN_OUT_QUEUE_UNLOCK (self);
+    GST_DEBUG_OBJECT (self, "Dropping buffer, reason: %s",
+        gst_flow_get_name (ret));
+    gst_buffer_unref (buffer);
+    return ret;
+  }
+
+  if (self->priv->n_buffers >= self->priv->max_size_buffers) {
+    request_keyframe = !self->priv->leaking;
+    self->priv->leaking = TRUE;
+
+    if (kms_fan_out_queue_leak (self)) {
+      gst_buffer_unref (buffer);
+      buffer = NULL;
+    }
+  } else {
+    self->priv->leaking = FALSE;
+  }
+
+  if (buffer != NULL) {
+    gst_queue_array_push_tail (self->priv->items, buffer);
+    self->priv->n_buffers++;
+    kms_fan_out_queue_schedule (self);
+  }
+
+  KMS_FAN_OUT_QUEUE_UNLOCK (self);
+
+  kms_fan_out_queue_check_blocked ();
+
+  if (request_keyframe) {
+    GST_DEBUG_OBJECT (self, "Queue full, leaking %s",
+        self->priv->leaky == KMS_FAN_OUT_LEAKY_UPSTREAM ? "upstream" :
+        "downstream");
+    /* Encoded video cannot be decoded until the next key frame */
+    kms_utils_drop_until_keyframe (self->priv->srcpad, FALSE);
+  }
+
+  return GST_FLOW_OK;
+}
+
+static gboolean
+kms_fan_out_queue_sink_event (GstPad * pad, GstObject * parent,
+    GstEvent * event)
+{
+  KmsFanOutQueue *self = KMS_FAN_OUT_QUEUE (parent);
+
+  switch (GST_EVENT_TYPE (event)) {
+    case GST_EVENT_FLUSH_START:
+      KMS_FAN_OUT_QUEUE_LOCK (self);
+      self->priv->srcresult = GST_FLOW_FLUSHING;
+      kms_fan_out_queue_clear (self);
+      KMS_FAN_OUT_QUEUE_UNLOCK (self);
+
+      return gst_pad_push_event (self->priv->srcpad, event);
+    case GST_EVENT_FLUSH_STOP:
+      KMS_FAN_OUT_QUEUE_LOCK (self);
+      /* A push started before the flush could overwrite the result */
+      while (self->priv->pushing) {
+        g_cond_wait (&self->priv->cond, &self->priv->mutex);
+      }
+      self->priv->srcresult = GST_FLOW_OK;
+      KMS_FAN_OUT_QUEUE_UNLOCK (self);
+
+      return gst_pad_push_event (self->priv->srcpad, event);
+    default:
+      break;
+  }
+
+  if (!GST_EVENT_IS_SERIALIZED (event)) {
+    return gst_pad_push_event (self->priv->srcpad, event);
+  }
+
+  KMS_FAN_OUT_QUEUE_LOCK (self);
+
+  if (self->priv->srcresult != GST_FLOW_OK) {
+    KMS_FAN_OUT_QUEUE_UNLOCK (self);
+    GST_DEBUG_OBJECT (self, "Dropping %" GST_PTR_FORMAT, event);
+    gst_event_unref (event);
+    return FALSE;
+  }
+
+  gst_queue_array_push_tail (self->priv->items, event);
+  kms_fan_out_queue_schedule (self);
+
+  KMS_FAN_OUT_QUEUE_UNLOCK (self);
+
+  kms_fan_out_queue_check_blocked ();
+
+  return TRUE;
+}
+
+static gboolean
+kms_fan_out_queue_src_event (GstPad * pad, GstObject * parent,
+    GstEvent * event)
+{
+  KmsFanOutQueue *self = KMS_FAN_OUT_QUEUE (parent);
+
+  if (GST_EVENT_TYPE (event) == GST_EVENT_RECONFIGURE) {
+    KMS_FAN_OUT_QUEUE_LOCK (self);
+    /* Linked again, as GstQueue does it starts pushing again */
+    if (self->priv->srcresult == GST_FLOW_NOT_LINKED) {
+      GST_DEBUG_OBJECT (self, "Relinked, accepting data again");
+      self->priv->srcresult = GST_FLOW_OK;
+
+      if (!gst_queue_array_is_empty (self->priv->items)) {
+        kms_fan_out_queue_schedule (self);
+      }
+    }
+    KMS_FAN_OUT_QUEUE_UNLOCK (self);
+  }
+
+  return gst_pad_event_default (pad, parent, event);
+}
+
+static gboolean
+kms_fan_out_queue_sink_query (GstPad * pad, GstObject * parent,
+    GstQuery * query)
+{
+  KmsFanOutQueue *self = KMS_FAN_OUT_QUEUE (parent);
+  gboolean res;
+
+  if (!GST_QUERY_IS_SERIALIZED (query)) {
+    return gst_pad_query_default (pad, parent, query);
+  }
+
+  /* Serialized queries can not overtake pending items. They are queued like
+   * them and the caller waits until a pool thread answers */
+  KMS_FAN_OUT_QUEUE_LOCK (self);
+
+  if (self->priv->srcresult != GST_FLOW_OK) {
+    KMS_FAN_OUT_QUEUE_UNLOCK (self);
+    GST_DEBUG_OBJECT (self, "Refusing %" GST_PTR_FORMAT, query);
+    return FALSE;
+  }
+
+  self->priv->last_handled_query = NULL;
+  gst_queue_array_push_tail (self->priv->items, query);
+  kms_fan_out_queue_schedule (self);
+
+  KMS_FAN_OUT_QUEUE_UNLOCK (self);
+
+  kms_fan_out_queue_check_blocked ();
+
+  KMS_FAN_OUT_QUEUE_LOCK (self);
+
+  while (self->priv->last_handled_query != query
+      && self->priv->srcresult == GST_FLOW_OK) {
+    g_cond_wait (&self->priv->cond, &self->priv->mutex);
+  }
+
+  if (self->priv->last_handled_query == query) {
+    res = self->priv->last_query_result;
+  } else {
+    GST_DEBUG_OBJECT (self, "Flushed while waiting for %" GST_PTR_FORMAT,
+        query);
+    res = FALSE;
+  }
+
+  self->priv->last_handled_query = NULL;
+
+  KMS_FAN_OUT_QUEUE_UNLOCK (self);
+
+  return res;
+}
+
+static void
+kms_fan_out_queue_drain (KmsFanOutQueue * self, gpointer data)
+{
+  gint64 start = g_get_monotonic_time ();
+  GList link = { &start, NULL, NULL };
+  GstMiniObject *item;
+  GstFlowReturn ret;
+  guint i;
+
+  G_LOCK (pool);
+  g_queue_push_tail_link (&pool_drains, &link);
+  G_UNLOCK (pool);
+
+  KMS_FAN_OUT_QUEUE_LOCK (self);
+
+  for (i = 0; i < DRAIN_BATCH; i++) {
+    if (self->priv->srcresult != GST_FLOW_OK
+        || gst_queue_array_is_empty (self->priv->items)) {
+      break;
+    }
+
+    if (i > 0 && g_get_monotonic_time () - start > DRAIN_TIME) {
+      break;
+    }
+
+    item = gst_queue_array_pop_head (self->priv->items);
+    self->priv->pushing = TRUE;
+
+    if (GST_IS_BUFFER (item)) {
+      self->priv->n_buffers--;
+      KMS_FAN_OUT_QUEUE_UNLOCK (self);
+
+      ret = gst_pad_push (self->priv->srcpad, GST_BUFFER_CAST (item));
+
+      KMS_FAN_OUT_QUEUE_LOCK (self);
+
+      if (ret != GST_FLOW_OK && self->priv->srcresult == GST_FLOW_OK) {
+        GST_DEBUG_OBJECT (self, "Push returned %s", gst_flow_get_name (ret));
+        self->priv->srcresult = ret;
+        kms_fan_out_queue_clear (self);
+      }
+    } else if (GST_IS_QUERY (item)) {
+      gboolean res;
+
+      KMS_FAN_OUT_QUEUE_UNLOCK (self);
+      res = gst_pad_peer_query (self->priv->srcpad, GST_QUERY_CAST (item));
+      KMS_FAN_OUT_QUEUE_LOCK (self);
+
+      self->priv->last_query_result = res;
+      self->priv->last_handled_query = GST_QUERY_CAST (item);
+    } else {
+      KMS_FAN_OUT_QUEUE_UNLOCK (self);
+      gst_pad_push_event (self->priv->srcpad, GST_EVENT_CAST (item));
+      KMS_FAN_OUT_QUEUE_LOCK (self);
+    }
+
+    self->priv->pushing = FALSE;
+    g_cond_broadcast (&self->priv->cond);
+  }
+
+  G_LOCK (pool);
+  g_queue_unlink (&pool_drains, &link);
+  G_UNLOCK (pool);
+
+  if (self->priv->srcresult == GST_FLOW_OK
+      && !gst_queue_array_is_empty (self->priv->items)) {
+    /* Go back to the pool so other queues are not starved */
+    g_thread_pool_push (kms_fan_out_queue_get_pool (), self, NULL);
+    KMS_FAN_OUT_QUEUE_UNLOCK (self);
+    kms_fan_out_queue_check_blocked ();
+    return;
+  }
+
+  self->priv->scheduled = FALSE;
+  KMS_FAN_OUT_QUEUE_UNLOCK (self);
+
+  kms_fan_out_queue_check_blocked ();
+
+  gst_object_unref (self);
+}
+
+static gboolean
+kms_fan_out_queue_src_activate_mode (GstPad * pad, GstObject * parent,
+    GstPadMode mode, gboolean active)
+{
+  KmsFanOutQueue *self = KMS_FAN_OUT_QUEUE (parent);
+
+  if (mode != GST_PAD_MODE_PUSH) {
+    return FALSE;
+  }
+
+  KMS_FAN_OUT_QUEUE_LOCK (self);
+  if (active) {
+    self->priv->srcresult = GST_FLOW_OK;
+  } else {
+    self->priv->srcresult = GST_FLOW_FLUSHING;
+    kms_fan_out_queue_clear (self);
+  }
+  KMS_FAN_OUT_QUEUE_UNLOCK (self);
+
+  return TRUE;
+}
+
+static void
+kms_fan_out_queue_init (KmsFanOutQueue * self)
+{
+  self->priv = KMS_FAN_OUT_QUEUE_GET_PRIVATE (self);
+
+  self->priv->sinkpad =
+      gst_pad_new_from_static_template (&sinktemplate, "sink");
+  gst_pad_set_chain_function (self->priv->sinkpad, kms_fan_out_queue_chain);
+  gst_pad_set_event_function (self->priv->sinkpad,
+      kms_fan_out_queue_sink_event);
+  gst_pad_set_query_function (self->priv->sinkpad,
+      kms_fan_out_queue_sink_query);
+  GST_PAD_SET_PROXY_CAPS (self->priv->sinkpad);
+  gst_element_add_pad (GST_ELEMENT (self), self->priv->sinkpad);
+
+  self->priv->srcpad = gst_pad_new_from_static_template (&srctemplate, "src");
+  gst_pad_set_activatemode_function (self->priv->srcpad,
+      kms_fan_out_queue_src_activate_mode);
+  gst_pad_set_event_function (self->priv->srcpad, kms_fan_out_queue_src_event);
+  GST_PAD_SET_PROXY_CAPS (self->priv->srcpad);
+  gst_element_add_pad (GST_ELEMENT (self), self->priv->srcpad);
+
+  g_mutex_init (&self->priv->mutex);
+  g_cond_init (&self->priv->cond);
+
+  self->priv->max_size_buffers = DEFAULT_MAX_SIZE_BUFFERS;
+  self->priv->leaky = DEFAULT_LEAKY;
+  self->priv->items = gst_queue_array_new (DEFAULT_MAX_SIZE_BUFFERS);
+  self->priv->srcresult = GST_FLOW_FLUSHING;
+}
+
+static void
+kms_fan_out_queue_finalize (GObject * object)
+{
+  KmsFanOutQueue *self = KMS_FAN_OUT_QUEUE (object);
+
+  kms_fan_out_queue_clear (self);
+  gst_queue_array_free (self->priv->items);
+
+  g_mutex_clear (&self->priv->mutex);
+  g_cond_clear (&self->priv->cond);
+
+  G_OBJECT_CLASS (parent_class)->finalize (object);
+}
+
+static void
+kms_fan_out_queue_set_property (GObject * object, guint property_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  KmsFanOutQueue *self = KMS_FAN_OUT_QUEUE (object);
+
+  KMS_FAN_OUT_QUEUE_LOCK (self);
+
+  switch (property_id) {
+    case PROP_MAX_SIZE_BUFFERS:
+      self->priv->max_size_buffers = g_value_get_uint (value);
+      break;
+    case PROP_LEAKY:
+      self->priv->leaky = g_value_get_enum (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+      break;
+  }
+
+  KMS_FAN_OUT_QUEUE_UNLOCK (self);
+}
+
+static void
+kms_fan_out_queue_get_property (GObject * object, guint property_id,
+    GValue * value, GParamSpec * pspec)
+{
+  KmsFanOutQueue *self = KMS_FAN_OUT_QUEUE (object);
+
+  KMS_FAN_OUT_QUEUE_LOCK (self);
+
+  switch (property_id) {
+    case PROP_MAX_SIZE_BUFFERS:
+      g_value_set_uint (value, self->priv->max_size_buffers);
+      break;
+    case PROP_LEAKY:
+      g_value_set_enum (value, self->priv->leaky);
+      break;
+    case PROP_DROPPED:
+      g_value_set_uint64 (value, self->priv->dropped);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+      break;
+  }
+
+  KMS_FAN_OUT_QUEUE_UNLOCK (self);
+}
+
+static void
+kms_fan_out_queue_class_init (KmsFanOutQueueClass * klass)
+{
+  GstElementClass *gstelement_class;
+  GObjectClass *gobject_class;
+
+  gobject_class = G_OBJECT_CLASS (klass);
+  gobject_class->finalize = kms_fan_out_queue_finalize;
+  gobject_class->set_property = kms_fan_out_queue_set_property;
+  gobject_class->get_property = kms_fan_out_queue_get_property;
+
+  gstelement_class = GST_ELEMENT_CLASS (klass);
+
+  gst_element_class_set_details_simple (gstelement_class,
+      "Fan out queue",
+      "Generic",
+      "Queue without streaming thread, drained by a shared pool of threads",
+      "Kurento <kurento@googlegroups.com>");
+
+  gst_element_class_add_pad_template (gstelement_class,
+      gst_static_pad_template_get (&srctemplate));
+  gst_element_class_add_pad_template (gstelement_class,
+      gst_static_pad_template_get (&sinktemplate));
+
+  GST_DEBUG_REGISTER_FUNCPTR (kms_fan_out_queue_chain);
+  GST_DEBUG_REGISTER_FUNCPTR (kms_fan_out_queue_sink_event);
+  GST_DEBUG_REGISTER_FUNCPTR (kms_fan_out_queue_sink_query);
+  GST_DEBUG_REGISTER_FUNCPTR (kms_fan_out_queue_src_event);
+  GST_DEBUG_REGISTER_FUNCPTR (kms_fan_out_queue_src_activate_mode);
+
+  g_object_class_install_property (gobject_class, PROP_MAX_SIZE_BUFFERS,
+      g_param_spec_uint ("max-size-buffers", "Max. size (buffers)",
+          "Max. number of buffers in the queue before leaking", 1, G_MAXUINT,
+          DEFAULT_MAX_SIZE_BUFFERS,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_LEAKY,
+      g_param_spec_enum ("leaky", "Leaky",
+          "Where the queue leaks when it is full, new or old buffers",
+          KMS_TYPE_FAN_OUT_LEAKY, DEFAULT_LEAKY,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_DROPPED,
+      g_param_spec_uint64 ("dropped", "Dropped",
+          "Number of buffers leaked because the queue was full", 0,
+          G_MAXUINT64, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  g_type_class_add_private (klass, sizeof (KmsFanOutQueuePrivate));
+}
+
+gboolean
+kms_fan_out_queue_plugin_init (GstPlugin * plugin)
+{
+  return gst_element_register (plugin, PLUGIN_NAME, GST_RANK_NONE,
+      KMS_TYPE_FAN_OUT_QUEUE);
+}
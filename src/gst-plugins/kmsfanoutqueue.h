@@ -0,0 +1,55 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef __KMS_FAN_OUT_QUEUE_H__
+#define __KMS_FAN_OUT_QUEUE_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+#define KMS_TYPE_FAN_OUT_QUEUE \
+  (kms_fan_out_queue_get_type())
+#define KMS_FAN_OUT_QUEUE(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST((obj),KMS_TYPE_FAN_OUT_QUEUE,KmsFanOutQueue))
+#define KMS_FAN_OUT_QUEUE_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_CAST((klass),KMS_TYPE_FAN_OUT_QUEUE,KmsFanOutQueueClass))
+#define KMS_IS_FAN_OUT_QUEUE(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE((obj),KMS_TYPE_FAN_OUT_QUEUE))
+#define KMS_IS_FAN_OUT_QUEUE_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_TYPE((klass),KMS_TYPE_FAN_OUT_QUEUE))
+#define KMS_FAN_OUT_QUEUE_CAST(obj) ((KmsFanOutQueue*)(obj))
+
+typedef struct _KmsFanOutQueue KmsFanOutQueue;
+typedef struct _KmsFanOutQueueClass KmsFanOutQueueClass;
+typedef struct _KmsFanOutQueuePrivate KmsFanOutQueuePrivate;
+
+struct _KmsFanOutQueue
+{
+  GstElement element;
+
+  KmsFanOutQueuePrivate *priv;
+};
+
+struct _KmsFanOutQueueClass
+{
+  GstElementClass parent_class;
+};
+
+GType kms_fan_out_queue_get_type (void);
+
+gboolean kms_fan_out_queue_plugin_init (GstPlugin * plugin);
+
+G_END_DECLS
+#endif /* __KMS_FAN_OUT_QUEUE_H__ */
@@ -0,0 +1,970 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <gst/gst.h>
+#include <gst/base/gstadapter.h>
+
+#include "kmsmixminus.h"
+#include "kmsrefstruct.h"
+
+#define PLUGIN_NAME "kmsmixminus"
+
+#define SINK_PAD_PREFIX "sink_"
+#define SINK_PAD SINK_PAD_PREFIX "%u"
+#define SRC_PAD "src_%u"
+
+#define DEFAULT_RATE 48000
+#define DEFAULT_CHANNELS 2
+#define MAX_CHANNELS 8
+
+/* Time mixed on each iteration */
+#define MIX_PERIOD (10 * GST_MSECOND)
+/* Periods queued on an input before it is mixed in */
+#define PREFILL_PERIODS 4
+/* Periods queued on an input before its oldest data is discarded */
+#define MAX_QUEUED_PERIODS 20
+/* Delay after which the mixer resynchronizes instead of catching up */
+#define MAX_LATE_PERIODS 10
+
+#if G_BYTE_ORDER == G_LITTLE_ENDIAN
+#define SAMPLE_FORMAT "S16LE"
+#else
+#define SAMPLE_FORMAT "S16BE"
+#endif
+
+#define MIX_MINUS_CAPS                                        \
+  "audio/x-raw, "                                             \
+  "format=(string)" SAMPLE_FORMAT ", "                        \
+  "layout=(string)interleaved, "                              \
+  "rate=(int)[ 1, MAX ], "                                    \
+  "channels=(int)[ 1, 8 ]"
+
+#define KMS_MIX_MINUS_LOCK(mixer) \
+  (g_mutex_lock (&(mixer)->priv->mutex))
+
+#define KMS_MIX_MINUS_UNLOCK(mixer) \
+  (g_mutex_unlock (&(mixer)->priv->mutex))
+
+GST_DEBUG_CATEGORY_STATIC (kms_mix_minus_debug_category);
+#define GST_CAT_DEFAULT kms_mix_minus_debug_category
+
+#define KMS_MIX_MINUS_GET_PRIVATE(obj) ( \
+  G_TYPE_INSTANCE_GET_PRIVATE (          \
+    (obj),                               \
+    KMS_TYPE_MIX_MINUS,                  \
+    KmsMixMinusPrivate                   \
+  )                                      \
+)
+
+typedef struct _KmsMixMinusInput
+{
+  KmsRefStruct ref;
+  guint id;
+  GstPad *sinkpad;
+  GstPad *srcpad;
+  GstAdapter *adapter;
+  gboolean primed;
+
+  /* Only accessed from the mixing task */
+  gboolean need_events;
+  gboolean active;
+  gint16 *samples;
+  gsize samples_size;
+} KmsMixMinusInput;
+
+struct _KmsMixMinusPrivate
+{
+  GMutex mutex;
+  GList *inputs;
+  guint count;
+
+  gint rate;
+  gint channels;
+  GstCaps *caps;
+  guint period_samples;
+  gsize period_bytes;
+
+  GstTask *task;
+  GRecMutex task_mutex;
+  GstClockID clock_id;
+  gboolean flushing;
+
+  /* Only accessed from the mixing task */
+  GstClockTime next_time;
+  gint32 *accumulator;
+};
+
+enum
+{
+  PROP_0,
+  PROP_RATE,
+  PROP_CHANNELS,
+  N_PROPERTIES
+};
+
+static GstStaticPadTemplate sink_factory =
+GST_STATIC_PAD_TEMPLATE (SINK_PAD,
+    GST_PAD_SINK,
+    GST_PAD_REQUEST,
+    GST_STATIC_CAPS (MIX_MINUS_CAPS)
+    );
+
+static GstStaticPadTemplate src_factory =
+GST_STATIC_PAD_TEMPLATE (SRC_PAD,
+    GST_PAD_SRC,
+    GST_PAD_SOMETIMES,
+    GST_STATIC_CAPS (MIX_MINUS_CAPS)
+    );
+
+/* class initialization */
+
+G_DEFINE_TYPE_WITH_CODE (KmsMixMinus, kms_mix_minus,
+    GST_TYPE_ELEMENT,
+    GST_DEBUG_CATEGORY_INIT (kms_mix_minus_debug_category,
+        PLUGIN_NAME, 0, "debug category for " PLUGIN_NAME " element"));
+
+static void
+kms_mix_minus_input_destroy (KmsMixMinusInput * input)
+{
+  gst_pad_set_element_private (input->sinkpad, NULL);
+  gst_pad_set_element_private (input->srcpad, NULL);
+
+  g_object_unref (input->adapter);
+  gst_object_unref (input->sinkpad);
+  gst_object_unref (input->srcpad);
+  g_free (input->samples);
+
+  g_slice_free (KmsMixMinusInput, input);
+}
+
+static GstCaps *
+kms_mix_minus_get_caps (KmsMixMinus * self)
+{
+  GstCaps *caps;
+
+  KMS_MIX_MINUS_LOCK (self);
+  caps = gst_caps_ref (self->priv->caps);
+  KMS_MIX_MINUS_UNLOCK (self);
+
+  return caps;
+}
+
+static gboolean
+kms_mix_minus_query_caps (KmsMixMinus * self, GstQuery * query)
+{
+  GstCaps *filter, *caps, *result;
+
+  gst_query_parse_caps (query, &filter);
+  caps = kms_mix_minus_get_caps (self);
+
+  if (filter != NULL) {
+    result = gst_caps_intersect_full (filter, caps, GST_CAPS_INTERSECT_FIRST);
+    gst_caps_unref (caps);
+    caps = result;
+  }
+
+  gst_query_set_caps_result (query, caps);
+  gst_caps_unref (caps);
+
+  return TRUE;
+}
+
+static gboolean
+kms_mix_minus_caps_are_supported (KmsMixMinus * self, GstCaps * caps)
+{
+  GstCaps *allowed;
+  gboolean ret;
+
+  allowed = kms_mix_minus_get_caps (self);
+  ret = gst_caps_is_subset (caps, allowed);
+  gst_caps_unref (allowed);
+
+  return ret;
+}
+
+static GstFlowReturn
+kms_mix_minus_chain (GstPad * pad, GstObject * parent, GstBuffer * buffer)
+{
+  KmsMixMinus *self = KMS_MIX_MINUS (parent);
+  KmsMixMinusInput *input;
+  gsize available, max_bytes, frame_bytes, excess;
+
+  KMS_MIX_MINUS_LOCK (self);
+
+  input = gst_pad_get_element_private (pad);
+  if (input == NULL) {
+    KMS_MIX_MINUS_UNLOCK (self);
+    gst_buffer_unref (buffer);
+    return GST_FLOW_FLUSHING;
+  }
+
+  gst_adapter_push (input->adapter, buffer);
+
+  available = gst_adapter_available (input->adapter);
+  max_bytes = MAX_QUEUED_PERIODS * self->priv->period_bytes;
+
+  if (available > max_bytes) {
+    /* Input is faster than the mixer, keep latency bounded */
+    frame_bytes = self->priv->channels * sizeof (gint16);
+    excess = available - max_bytes;
+    excess += (frame_bytes - excess % frame_bytes) % frame_bytes;
+
+    GST_LOG_OBJECT (pad, "Discarding %" G_GSIZE_FORMAT " bytes", excess);
+    gst_adapter_flush (input->adapter, MIN (excess, available));
+  }
+
+  KMS_MIX_MINUS_UNLOCK (self);
+
+  return GST_FLOW_OK;
+}
+
+static gboolean
+kms_mix_minus_sink_event (GstPad * pad, GstObject * parent, GstEvent * event)
+{
+  KmsMixMinus *self = KMS_MIX_MINUS (parent);
+  KmsMixMinusInput *input;
+  gboolean ret = TRUE;
+
+  switch (GST_EVENT_TYPE (event)) {
+    case GST_EVENT_CAPS:{
+      GstCaps *caps;
+
+      gst_event_parse_caps (event, &caps);
+      ret = kms_mix_minus_caps_are_supported (self, caps);
+      if (!ret) {
+        GST_WARNING_OBJECT (pad, "Not supported caps %" GST_PTR_FORMAT, caps);
+      }
+      break;
+    }
+    case GST_EVENT_FLUSH_STOP:
+      KMS_MIX_MINUS_LOCK (self);
+      input = gst_pad_get_element_private (pad);
+      if (input != NULL) {
+        gst_adapter_clear (input->adapter);
+        input->primed = FALSE;
+      }
+      KMS_MIX_MINUS_UNLOCK (self);
+      break;
+    default:
+      break;
+  }
+
+  /* Output streams are generated by the mixer, nothing is forwarded */
+  gst_event_unref (event);
+
+  return ret;
+}
+
+static gboolean
+kms_mix_minus_sink_query (GstPad * pad, GstObject * parent, GstQuery * query)
+{
+  KmsMixMinus *self = KMS_MIX_MINUS (parent);
+
+  switch (GST_QUERY_TYPE (query)) {
+    case GST_QUERY_CAPS:
+      return kms_mix_minus_query_caps (self, query);
+    case GST_QUERY_ACCEPT_CAPS:{
+      GstCaps *caps;
+
+      gst_query_parse_accept_caps (query, &caps);
+      gst_query_set_accept_caps_result (query,
+          kms_mix_minus_caps_are_supported (self, caps));
+      return TRUE;
+    }
+    default:
+      return gst_pad_query_default (pad, parent, query);
+  }
+}
+
+static gboolean
+kms_mix_minus_src_event (GstPad * pad, GstObject * parent, GstEvent * event)
+{
+  gboolean ret;
+
+  /* Upstream events can not be applied to a mix, drop them */
+  ret = GST_EVENT_TYPE (event) != GST_EVENT_SEEK;
+  gst_event_unref (event);
+
+  return ret;
+}
+
+static gboolean
+kms_mix_minus_src_query (GstPad * pad, GstObject * parent, GstQuery * query)
+{
+  KmsMixMinus *self = KMS_MIX_MINUS (parent);
+
+  switch (GST_QUERY_TYPE (query)) {
+    case GST_QUERY_CAPS:
+      return kms_mix_minus_query_caps (self, query);
+    case GST_QUERY_LATENCY:
+      gst_query_set_latency (query, TRUE, PREFILL_PERIODS * MIX_PERIOD,
+          GST_CLOCK_TIME_NONE);
+      return TRUE;
+    default:
+      return gst_pad_query_default (pad, parent, query);
+  }
+}
+
+static KmsMixMinusInput *
+kms_mix_minus_input_new (KmsMixMinus * self, guint id)
+{
+  KmsMixMinusInput *input;
+  gchar *name;
+
+  input = g_slice_new0 (KmsMixMinusInput);
+  kms_ref_struct_init (KMS_REF_STRUCT_CAST (input),
+      (GDestroyNotify) kms_mix_minus_input_destroy);
+
+  input->id = id;
+  input->adapter = gst_adapter_new ();
+  input->need_events = TRUE;
+
+  name = g_strdup_printf (SINK_PAD, id);
+  input->sinkpad = gst_pad_new_from_static_template (&sink_factory, name);
+  g_free (name);
+
+  gst_object_ref_sink (input->sinkpad);
+  gst_pad_set_element_private (input->sinkpad, input);
+  gst_pad_set_chain_function (input->sinkpad,
+      GST_DEBUG_FUNCPTR (kms_mix_minus_chain));
+  gst_pad_set_event_function (input->sinkpad,
+      GST_DEBUG_FUNCPTR (kms_mix_minus_sink_event));
+  gst_pad_set_query_function (input->sinkpad,
+      GST_DEBUG_FUNCPTR (kms_mix_minus_sink_query));
+
+  name = g_strdup_printf (SRC_PAD, id);
+  input->srcpad = gst_pad_new_from_static_template (&src_factory, name);
+  g_free (name);
+
+  gst_object_ref_sink (input->srcpad);
+  gst_pad_set_element_private (input->srcpad, input);
+  gst_pad_set_event_function (input->srcpad,
+      GST_DEBUG_FUNCPTR (kms_mix_minus_src_event));
+  gst_pad_set_query_function (input->srcpad,
+      GST_DEBUG_FUNCPTR (kms_mix_minus_src_query));
+
+  return input;
+}
+
+static KmsMixMinusInput *
+kms_mix_minus_find_input (KmsMixMinus * self, guint id)
+{
+  GList *l;
+
+  for (l = self->priv->inputs; l != NULL; l = l->next) {
+    KmsMixMinusInput *input = l->data;
+
+    if (input->id == id) {
+      return input;
+    }
+  }
+
+  return NULL;
+}
+
+static void
+kms_mix_minus_push_sticky_events (KmsMixMinus * self, KmsMixMinusInput * input)
+{
+  GstSegment segment;
+  GstCaps *caps;
+  gchar *stream_id;
+
+  stream_id = gst_pad_create_stream_id (input->srcpad, GST_ELEMENT (self),
+      NULL);
+  gst_pad_push_event (input->srcpad, gst_event_new_stream_start (stream_id));
+  g_free (stream_id);
+
+  caps = kms_mix_minus_get_caps (self);
+  gst_pad_push_event (input->srcpad, gst_event_new_caps (caps));
+  gst_caps_unref (caps);
+
+  /* Buffers are timestamped in running time */
+  gst_segment_init (&segment, GST_FORMAT_TIME);
+  gst_pad_push_event (input->srcpad, gst_event_new_segment (&segment));
+}
+
+static void
+kms_mix_minus_push (KmsMixMinus * self, KmsMixMinusInput * input,
+    GstBuffer * buffer)
+{
+  GstFlowReturn ret;
+
+  if (input->need_events) {
+    kms_mix_minus_push_sticky_events (self, input);
+    buffer = gst_buffer_make_writable (buffer);
+    GST_BUFFER_FLAG_SET (buffer, GST_BUFFER_FLAG_DISCONT);
+    input->need_events = FALSE;
+  }
+
+  ret = gst_pad_push (input->srcpad, buffer);
+  if (ret != GST_FLOW_OK) {
+    GST_LOG_OBJECT (input->srcpad, "Push returned %s",
+        gst_flow_get_name (ret));
+  }
+}
+
+static void
+kms_mix_minus_collect (KmsMixMinus * self, GPtrArray * inputs)
+{
+  gsize period_bytes = self->priv->period_bytes;
+  GList *l;
+
+  for (l = self->priv->inputs; l != NULL; l = l->next) {
+    KmsMixMinusInput *input = l->data;
+    gsize available, size;
+
+    available = gst_adapter_available (input->adapter);
+
+    if (!input->primed && available >= PREFILL_PERIODS * period_bytes) {
+      input->primed = TRUE;
+    }
+
+    input->active = input->primed && available > 0;
+
+    if (input->active) {
+      if (input->samples_size != period_bytes) {
+        input->samples = g_realloc (input->samples, period_bytes);
+        input->samples_size = period_bytes;
+      }
+
+      size = MIN (available, period_bytes);
+      gst_adapter_copy (input->adapter, input->samples, 0, size);
+      gst_adapter_flush (input->adapter, size);
+
+      if (size < period_bytes) {
+        /* Underrun: complete with silence and buffer again */
+        memset ((guint8 *) input->samples + size, 0, period_bytes - size);
+        input->primed = FALSE;
+      }
+    }
+
+    g_ptr_array_add (inputs,
+        kms_ref_struct_ref (KMS_REF_STRUCT_CAST (input)));
+  }
+}
+
+static void
+kms_mix_minus_accumulate (gint32 * acc, const gint16 * samples, guint n)
+{
+  guint i;
+
+  /* Plain loop over contiguous arrays, auto-vectorized by the compiler */
+  for (i = 0; i < n; i++) {
+    acc[i] += samples[i];
+  }
+}
+
+static GstBuffer *
+kms_mix_minus_new_buffer (KmsMixMinus * self, const gint32 * acc,
+    const gint16 * own, GstClockTime pts)
+{
+  guint i, n = self->priv->period_samples;
+  GstBuffer *buffer;
+  GstMapInfo info;
+  gint16 *out;
+
+  buffer = gst_buffer_new_allocate (NULL, n * sizeof (gint16), NULL);
+  gst_buffer_map (buffer, &info, GST_MAP_WRITE);
+  out = (gint16 *) info.data;
+
+  if (own == NULL) {
+    for (i = 0; i < n; i++) {
+      out[i] = CLAMP (acc[i], G_MININT16, G_MAXINT16);
+    }
+  } else {
+    for (i = 0; i < n; i++) {
+      gint32 value = acc[i] - own[i];
+
+      out[i] = CLAMP (value, G_MININT16, G_MAXINT16);
+    }
+  }
+
+  gst_buffer_unmap (buffer, &info);
+
+  GST_BUFFER_PTS (buffer) = pts;
+  GST_BUFFER_DURATION (buffer) = MIX_PERIOD;
+
+  return buffer;
+}
+
+static void
+kms_mix_minus_mix (KmsMixMinus * self, GstClockTime pts)
+{
+  gint32 *acc = self->priv->accumulator;
+  guint i, n = self->priv->period_samples;
+  GstBuffer *full_mix = NULL;
+  GPtrArray *inputs;
+
+  inputs = g_ptr_array_new_with_free_func ((GDestroyNotify)
+      kms_ref_struct_unref);
+
+  KMS_MIX_MINUS_LOCK (self);
+  kms_mix_minus_collect (self, inputs);
+  KMS_MIX_MINUS_UNLOCK (self);
+
+  /* The full mix is built once, every output is derived from it */
+  memset (acc, 0, n * sizeof (gint32));
+
+  for (i = 0; i < inputs->len; i++) {
+    KmsMixMinusInput *input = g_ptr_array_index (inputs, i);
+
+    if (input->active) {
+      kms_mix_minus_accumulate (acc, input->samples, n);
+    }
+  }
+
+  for (i = 0; i < inputs->len; i++) {
+    KmsMixMinusInput *input = g_ptr_array_index (inputs, i);
+    GstBuffer *buffer;
+
+    if (input->active) {
+      buffer = kms_mix_minus_new_buffer (self, acc, input->samples, pts);
+    } else {
+      /* Silent inputs all get the same full mix */
+      if (full_mix == NULL) {
+        full_mix = kms_mix_minus_new_buffer (self, acc, NULL, pts);
+      }
+      buffer = gst_buffer_ref (full_mix);
+    }
+
+    kms_mix_minus_push (self, input, buffer);
+  }
+
+  if (full_mix != NULL) {
+    gst_buffer_unref (full_mix);
+  }
+
+  g_ptr_array_unref (inputs);
+}
+
+static void
+kms_mix_minus_loop (KmsMixMinus * self)
+{
+  GstClockTime base_time, now;
+  GstClockTimeDiff jitter = 0;
+  GstClockReturn ret;
+  GstClockID id;
+  GstClock *clock;
+
+  clock = gst_element_get_clock (GST_ELEMENT (self));
+  if (clock == NULL) {
+    GST_WARNING_OBJECT (self, "No clock, pausing");
+    gst_task_pause (self->priv->task);
+    return;
+  }
+
+  base_time = gst_element_get_base_time (GST_ELEMENT (self));
+
+  KMS_MIX_MINUS_LOCK (self);
+
+  if (self->priv->flushing) {
+    self->priv->next_time = GST_CLOCK_TIME_NONE;
+    KMS_MIX_MINUS_UNLOCK (self);
+    gst_object_unref (clock);
+    return;
+  }
+
+  if (!GST_CLOCK_TIME_IS_VALID (self->priv->next_time)) {
+    now = gst_clock_get_time (clock);
+    self->priv->next_time = (now > base_time) ? now - base_time : 0;
+  }
+
+  /* Wake up once the whole period has been received */
+  id = gst_clock_new_single_shot_id (clock,
+      base_time + self->priv->next_time + MIX_PERIOD);
+  self->priv->clock_id = id;
+
+  KMS_MIX_MINUS_UNLOCK (self);
+
+  ret = gst_clock_id_wait (id, &jitter);
+
+  KMS_MIX_MINUS_LOCK (self);
+  self->priv->clock_id = NULL;
+  KMS_MIX_MINUS_UNLOCK (self);
+
+  gst_clock_id_unref (id);
+  gst_object_unref (clock);
+
+  if (ret == GST_CLOCK_UNSCHEDULED) {
+    /* Flushing, timing will be resynchronized on restart */
+    self->priv->next_time = GST_CLOCK_TIME_NONE;
+    return;
+  }
+
+  if (jitter > MAX_LATE_PERIODS * MIX_PERIOD) {
+    GST_WARNING_OBJECT (self, "Mixer late %" G_GINT64_FORMAT
+        " ns, skipping periods", jitter);
+    self->priv->next_time += (jitter / MIX_PERIOD) * MIX_PERIOD;
+  }
+
+  kms_mix_minus_mix (self, self->priv->next_time);
+  self->priv->next_time += MIX_PERIOD;
+}
+
+static void
+kms_mix_minus_set_flushing (KmsMixMinus * self, gboolean flushing)
+{
+  KMS_MIX_MINUS_LOCK (self);
+
+  self->priv->flushing = flushing;
+
+  if (flushing && self->priv->clock_id != NULL) {
+    gst_clock_id_unschedule (self->priv->clock_id);
+  }
+
+  KMS_MIX_MINUS_UNLOCK (self);
+}
+
+static void
+kms_mix_minus_configure (KmsMixMinus * self)
+{
+  KMS_MIX_MINUS_LOCK (self);
+
+  self->priv->period_samples = gst_util_uint64_scale_int (MIX_PERIOD,
+      self->priv->rate, GST_SECOND) * self->priv->channels;
+  self->priv->period_bytes = self->priv->period_samples * sizeof (gint16);
+
+  g_free (self->priv->accumulator);
+  self->priv->accumulator = g_new (gint32, self->priv->period_samples);
+
+  GST_DEBUG_OBJECT (self, "Mixing %u samples every %" GST_TIME_FORMAT,
+      self->priv->period_samples, GST_TIME_ARGS (MIX_PERIOD));
+
+  KMS_MIX_MINUS_UNLOCK (self);
+}
+
+static void
+kms_mix_minus_reset (KmsMixMinus * self)
+{
+  GList *l;
+
+  KMS_MIX_MINUS_LOCK (self);
+
+  for (l = self->priv->inputs; l != NULL; l = l->next) {
+    KmsMixMinusInput *input = l->data;
+
+    gst_adapter_clear (input->adapter);
+    input->primed = FALSE;
+    input->need_events = TRUE;
+  }
+
+  KMS_MIX_MINUS_UNLOCK (self);
+}
+
+static GstStateChangeReturn
+kms_mix_minus_change_state (GstElement * element, GstStateChange transition)
+{
+  KmsMixMinus *self = KMS_MIX_MINUS (element);
+  GstStateChangeReturn ret;
+
+  switch (transition) {
+    case GST_STATE_CHANGE_READY_TO_PAUSED:
+      kms_mix_minus_configure (self);
+      break;
+    case GST_STATE_CHANGE_PAUSED_TO_PLAYING:
+      kms_mix_minus_set_flushing (self, FALSE);
+      gst_task_start (self->priv->task);
+      break;
+    case GST_STATE_CHANGE_PLAYING_TO_PAUSED:
+      kms_mix_minus_set_flushing (self, TRUE);
+      gst_task_pause (self->priv->task);
+      break;
+    case GST_STATE_CHANGE_PAUSED_TO_READY:
+      kms_mix_minus_set_flushing (self, TRUE);
+      gst_task_join (self->priv->task);
+      break;
+    default:
+      break;
+  }
+
+  ret = GST_ELEMENT_CLASS (kms_mix_minus_parent_class)->change_state (element,
+      transition);
+
+  if (ret == GST_STATE_CHANGE_FAILURE) {
+    return ret;
+  }
+
+  switch (transition) {
+    case GST_STATE_CHANGE_READY_TO_PAUSED:
+    case GST_STATE_CHANGE_PLAYING_TO_PAUSED:
+      /* Output is generated from the clock, like a live source */
+      ret = GST_STATE_CHANGE_NO_PREROLL;
+      break;
+    case GST_STATE_CHANGE_PAUSED_TO_READY:
+      kms_mix_minus_reset (self);
+      break;
+    default:
+      break;
+  }
+
+  return ret;
+}
+
+static GstPad *
+kms_mix_minus_request_new_pad (GstElement * element,
+    GstPadTemplate * templ, const gchar * name, const GstCaps * caps)
+{
+  KmsMixMinus *self = KMS_MIX_MINUS (element);
+  KmsMixMinusInput *input;
+  guint64 id;
+
+  if (templ !=
+      gst_element_class_get_pad_template (GST_ELEMENT_CLASS (G_OBJECT_GET_CLASS
+              (element)), SINK_PAD))
+    return NULL;
+
+  KMS_MIX_MINUS_LOCK (self);
+
+  if (name != NULL && g_str_has_prefix (name, SINK_PAD_PREFIX)) {
+    id = g_ascii_strtoull (name + strlen (SINK_PAD_PREFIX), NULL, 10);
+
+    if (id > G_MAXUINT || kms_mix_minus_find_input (self, id) != NULL) {
+      GST_ERROR_OBJECT (self, "Can not create pad %s", name);
+      KMS_MIX_MINUS_UNLOCK (self);
+      return NULL;
+    }
+
+    self->priv->count = MAX (self->priv->count, id + 1);
+  } else {
+    id = self->priv->count++;
+  }
+
+  input = kms_mix_minus_input_new (self, id);
+  self->priv->inputs = g_list_append (self->priv->inputs, input);
+
+  KMS_MIX_MINUS_UNLOCK (self);
+
+  if (GST_STATE (element) >= GST_STATE_PAUSED
+      || GST_STATE_PENDING (element) >= GST_STATE_PAUSED
+      || GST_STATE_TARGET (element) >= GST_STATE_PAUSED) {
+    gst_pad_set_active (input->srcpad, TRUE);
+    gst_pad_set_active (input->sinkpad, TRUE);
+  }
+
+  gst_element_add_pad (element, input->srcpad);
+  gst_element_add_pad (element, input->sinkpad);
+
+  return input->sinkpad;
+}
+
+static void
+kms_mix_minus_release_pad (GstElement * element, GstPad * pad)
+{
+  KmsMixMinus *self = KMS_MIX_MINUS (element);
+  KmsMixMinusInput *input;
+  GList *l;
+
+  if (gst_pad_get_direction (pad) != GST_PAD_SINK)
+    return;
+
+  KMS_MIX_MINUS_LOCK (self);
+
+  input = gst_pad_get_element_private (pad);
+  l = g_list_find (self->priv->inputs, input);
+
+  if (input == NULL || l == NULL) {
+    KMS_MIX_MINUS_UNLOCK (self);
+    GST_WARNING_OBJECT (self, "Pad %" GST_PTR_FORMAT " not managed", pad);
+    return;
+  }
+
+  self->priv->inputs = g_list_delete_link (self->priv->inputs, l);
+
+  KMS_MIX_MINUS_UNLOCK (self);
+
+  GST_DEBUG_OBJECT (self, "Release pad %" GST_PTR_FORMAT, pad);
+
+  /* Waits for any push in progress on this output */
+  gst_pad_set_active (input->srcpad, FALSE);
+  gst_pad_set_active (input->sinkpad, FALSE);
+
+  gst_element_remove_pad (element, input->srcpad);
+  gst_element_remove_pad (element, input->sinkpad);
+
+  kms_ref_struct_unref (KMS_REF_STRUCT_CAST (input));
+}
+
+static void
+kms_mix_minus_update_caps (KmsMixMinus * self)
+{
+  if (self->priv->caps != NULL) {
+    gst_caps_unref (self->priv->caps);
+  }
+
+  self->priv->caps = gst_caps_new_simple ("audio/x-raw",
+      "format", G_TYPE_STRING, SAMPLE_FORMAT,
+      "layout", G_TYPE_STRING, "interleaved",
+      "rate", G_TYPE_INT, self->priv->rate,
+      "channels", G_TYPE_INT, self->priv->channels, NULL);
+}
+
+static void
+kms_mix_minus_set_property (GObject * object, guint property_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  KmsMixMinus *self = KMS_MIX_MINUS (object);
+
+  if (GST_STATE (self) > GST_STATE_READY) {
+    GST_WARNING_OBJECT (self, "Property %s can not be changed in state %s",
+        pspec->name, gst_element_state_get_name (GST_STATE (self)));
+    return;
+  }
+
+  KMS_MIX_MINUS_LOCK (self);
+
+  switch (property_id) {
+    case PROP_RATE:
+      self->priv->rate = g_value_get_int (value);
+      kms_mix_minus_update_caps (self);
+      break;
+    case PROP_CHANNELS:
+      self->priv->channels = g_value_get_int (value);
+      kms_mix_minus_update_caps (self);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+      break;
+  }
+
+  KMS_MIX_MINUS_UNLOCK (self);
+}
+
+static void
+kms_mix_minus_get_property (GObject * object, guint property_id,
+    GValue * value, GParamSpec * pspec)
+{
+  KmsMixMinus *self = KMS_MIX_MINUS (object);
+
+  KMS_MIX_MINUS_LOCK (self);
+
+  switch (property_id) {
+    case PROP_RATE:
+      g_value_set_int (value, self->priv->rate);
+      break;
+    case PROP_CHANNELS:
+      g_value_set_int (value, self->priv->channels);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+      break;
+  }
+
+  KMS_MIX_MINUS_UNLOCK (self);
+}
+
+static void
+kms_mix_minus_dispose (GObject * object)
+{
+  KmsMixMinus *self = KMS_MIX_MINUS (object);
+
+  GST_DEBUG_OBJECT (self, "dispose");
+
+  KMS_MIX_MINUS_LOCK (self);
+  g_list_free_full (self->priv->inputs, (GDestroyNotify) kms_ref_struct_unref);
+  self->priv->inputs = NULL;
+  KMS_MIX_MINUS_UNLOCK (self);
+
+  G_OBJECT_CLASS (kms_mix_minus_parent_class)->dispose (object);
+}
+
+static void
+kms_mix_minus_finalize (GObject * object)
+{
+  KmsMixMinus *self = KMS_MIX_MINUS (object);
+
+  GST_DEBUG_OBJECT (self, "finalize");
+
+  gst_object_unref (self->priv->task);
+  g_rec_mutex_clear (&self->priv->task_mutex);
+
+  gst_caps_unref (self->priv->caps);
+  g_free (self->priv->accumulator);
+  g_mutex_clear (&self->priv->mutex);
+
+  G_OBJECT_CLASS (kms_mix_minus_parent_class)->finalize (object);
+}
+
+static void
+kms_mix_minus_class_init (KmsMixMinusClass * klass)
+{
+  GstElementClass *gstelement_class = GST_ELEMENT_CLASS (klass);
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+
+  gst_element_class_set_static_metadata (gstelement_class,
+      "MixMinus", "Generic",
+      "Mixes all inputs and sends each one the mix without itself",
+      "Kurento <kurento@googlegroups.com>");
+
+  gstelement_class->request_new_pad =
+      GST_DEBUG_FUNCPTR (kms_mix_minus_request_new_pad);
+  gstelement_class->release_pad =
+      GST_DEBUG_FUNCPTR (kms_mix_minus_release_pad);
+  gstelement_class->change_state =
+      GST_DEBUG_FUNCPTR (kms_mix_minus_change_state);
+
+  gst_element_class_add_pad_template (gstelement_class,
+      gst_static_pad_template_get (&sink_factory));
+  gst_element_class_add_pad_template (gstelement_class,
+      gst_static_pad_template_get (&src_factory));
+
+  gobject_class->set_property = kms_mix_minus_set_property;
+  gobject_class->get_property = kms_mix_minus_get_property;
+  gobject_class->dispose = GST_DEBUG_FUNCPTR (kms_mix_minus_dispose);
+  gobject_class->finalize = GST_DEBUG_FUNCPTR (kms_mix_minus_finalize);
+
+  g_object_class_install_property (gobject_class, PROP_RATE,
+      g_param_spec_int ("rate", "Rate", "Sample rate used for mixing",
+          1, G_MAXINT, DEFAULT_RATE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_CHANNELS,
+      g_param_spec_int ("channels", "Channels", "Channels used for mixing",
+          1, MAX_CHANNELS, DEFAULT_CHANNELS,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /* Registers a private structure for the instantiatable type */
+  g_type_class_add_private (klass, sizeof (KmsMixMinusPrivate));
+}
+
+static void
+kms_mix_minus_init (KmsMixMinus * self)
+{
+  self->priv = KMS_MIX_MINUS_GET_PRIVATE (self);
+
+  g_mutex_init (&self->priv->mutex);
+  g_rec_mutex_init (&self->priv->task_mutex);
+
+  self->priv->rate = DEFAULT_RATE;
+  self->priv->channels = DEFAULT_CHANNELS;
+  self->priv->next_time = GST_CLOCK_TIME_NONE;
+  self->priv->flushing = TRUE;
+  kms_mix_minus_update_caps (self);
+
+  self->priv->task = gst_task_new ((GstTaskFunction) kms_mix_minus_loop, self,
+      NULL);
+  gst_task_set_lock (self->priv->task, &self->priv->task_mutex);
+}
+
+gboolean
+kms_mix_minus_plugin_init (GstPlugin * plugin)
+{
+  return gst_element_register (plugin, PLUGIN_NAME, GST_RANK_NONE,
+      KMS_TYPE_MIX_MINUS);
+}
@@ -0,0 +1,76 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+#ifndef _KMS_MIX_MINUS_H_
+#define _KMS_MIX_MINUS_H_
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+#define KMS_TYPE_MIX_MINUS kms_mix_minus_get_type()
+
+#define KMS_MIX_MINUS(obj) ( \
+  G_TYPE_CHECK_INSTANCE_CAST(  \
+    (obj),                     \
+    KMS_TYPE_MIX_MINUS,        \
+    KmsMixMinus                \
+  )                            \
+)
+
+#define KMS_MIX_MINUS_CLASS(klass) ( \
+  G_TYPE_CHECK_CLASS_CAST (          \
+    (klass),                         \
+    KMS_TYPE_MIX_MINUS,              \
+    KmsMixMinusClass                 \
+  )                                  \
+)
+#define KMS_IS_MIX_MINUS(obj) ( \
+  G_TYPE_CHECK_INSTANCE_TYPE (  \
+    (obj),                      \
+    KMS_TYPE_MIX_MINUS          \
+  )                             \
+)
+#define KMS_IS_MIX_MINUS_CLASS(klass) ( \
+  G_TYPE_CHECK_CLASS_TYPE((klass),      \
+  KMS_TYPE_MIX_MINUS)                   \
+)
+
+typedef struct _KmsMixMinus KmsMixMinus;
+typedef struct _KmsMixMinusClass KmsMixMinusClass;
+typedef struct _KmsMixMinusPrivate KmsMixMinusPrivate;
+
+/*
+ * Mixes all sink_%u inputs once per period and pushes on each src_%u the
+ * total mix minus the contribution of its own sink_%u input. Requesting
+ * sink_N makes src_N appear, releasing sink_N removes it.
+ */
+struct _KmsMixMinus
+{
+  GstElement parent;
+
+  /*< private > */
+  KmsMixMinusPrivate *priv;
+};
+
+struct _KmsMixMinusClass
+{
+  GstElementClass parent_class;
+};
+
+GType kms_mix_minus_get_type (void);
+
+gboolean kms_mix_minus_plugin_init (GstPlugin * plugin);
+
+G_END_DECLS
+#endif /* _KMS_MIX_MINUS_H_ */
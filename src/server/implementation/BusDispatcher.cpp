@@ -0,0 +1,244 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <gst/gst.h>
+
+#include "BusDispatcher.hpp"
+#include "WorkerPool.hpp"
+#include <algorithm>
+
+#define GST_CAT_DEFAULT kurento_bus_dispatcher
+GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
+#define GST_DEFAULT_NAME "KurentoBusDispatcher"
+
+/* Messages dispatched before the drain task yields to other buses */
+const int DRAIN_BATCH = 32;
+
+/* Weight of the last lag in the mean, as a shift */
+const int LAG_AVG_SHIFT = 4;
+
+namespace kurento
+{
+
+BusDispatcher::BusDispatcher (GstBus *bus,
+                              std::shared_ptr<WorkerPool> workers,
+                              const std::string &key,
+                              std::function<bool (GstMessage *) > syncFunc) :
+  workers (workers), key (key), syncFunc (syncFunc)
+{
+  this->bus = GST_BUS (gst_object_ref (bus) );
+}
+
+BusDispatcher::~BusDispatcher ()
+{
+  for (auto &pending : queue) {
+    gst_message_unref (pending.message);
+  }
+
+  gst_object_unref (bus);
+}
+
+static void
+destroyWeakDispatcher (gpointer data)
+{
+  delete static_cast <std::weak_ptr<BusDispatcher> *> (data);
+}
+
+void
+BusDispatcher::start ()
+{
+  GstMessage *message;
+
+  gst_bus_set_sync_handler (bus, syncHandler,
+                            new std::weak_ptr<BusDispatcher> (shared_from_this () ),
+                            destroyWeakDispatcher);
+
+  /* Posted before the handler was set */
+  while ( (message = gst_bus_pop (bus) ) != NULL) {
+    handle (message);
+    gst_message_unref (message);
+  }
+}
+
+void
+BusDispatcher::stop ()
+{
+  std::unique_lock<std::mutex> lock (mutex);
+
+  stopped = true;
+
+  for (auto &pending : queue) {
+    gst_message_unref (pending.message);
+  }
+
+  queue.clear ();
+  lock.unlock ();
+
+  gst_bus_set_sync_handler (bus, NULL, NULL, NULL);
+}
+
+void
+BusDispatcher::addTypes (GstMessageType types)
+{
+  std::unique_lock<std::mutex> lock (mutex);
+
+  extraTypes = (GstMessageType) (extraTypes | types);
+}
+
+BusDispatcher::Stats
+BusDispatcher::getStats ()
+{
+  std::unique_lock<std::mutex> lock (mutex);
+  Stats stats;
+
+  stats.dispatched = dispatched;
+  stats.filtered = filtered;
+  stats.pending = queue.size ();
+  stats.maxLag = maxLag;
+  stats.meanLag = meanLag;
+
+  return stats;
+}
+
+GstBusSyncReply
+BusDispatcher::syncHandler (GstBus *bus, GstMessage *message, gpointer data)
+{
+  std::shared_ptr<BusDispatcher> self =
+    static_cast <std::weak_ptr<BusDispatcher> *> (data)->lock ();
+
+  if (self) {
+    self->handle (message);
+  }
+
+  /* Nobody pops the bus */
+  return GST_BUS_DROP;
+}
+
+/* Types with listeners in the media objects, called with the mutex held */
+bool
+BusDispatcher::accept (GstMessage *message)
+{
+  if (GST_MESSAGE_TYPE (message) & extraTypes) {
+    return true;
+  }
+
+  switch (GST_MESSAGE_TYPE (message) ) {
+  case GST_MESSAGE_ERROR:
+  case GST_MESSAGE_WARNING:
+  case GST_MESSAGE_EOS:
+  case GST_MESSAGE_ELEMENT:
+  case GST_MESSAGE_APPLICATION:
+  case GST_MESSAGE_STATE_CHANGED:
+    return true;
+
+  default:
+    return false;
+  }
+}
+
+void
+BusDispatcher::handle (GstMessage *message)
+{
+  std::unique_lock<std::mutex> lock (mutex, std::defer_lock);
+  bool post;
+
+  if (syncFunc && syncFunc (message) ) {
+    return;
+  }
+
+  lock.lock ();
+
+  if (stopped) {
+    return;
+  }
+
+  if (!accept (message) ) {
+    filtered++;
+    return;
+  }
+
+  queue.push_back ({gst_message_ref (message), Clock::now () });
+  post = !scheduled;
+  scheduled = true;
+  lock.unlock ();
+
+  if (post) {
+    schedule ();
+  }
+}
+
+void
+BusDispatcher::schedule ()
+{
+  std::shared_ptr<BusDispatcher> self = shared_from_this ();
+  std::shared_ptr<WorkerPool> pool = workers.lock ();
+
+  if (!pool) {
+    GST_DEBUG ("Worker pool destroyed, dropping messages");
+    stop ();
+    return;
+  }
+
+  pool->post ([self] () {
+    self->drain ();
+  }, key);
+}
+
+void
+BusDispatcher::drain ()
+{
+  std::unique_lock<std::mutex> lock (mutex);
+
+  for (int i = 0; i < DRAIN_BATCH && !queue.empty (); i++) {
+    Pending pending = queue.front ();
+    int64_t lag;
+
+    queue.pop_front ();
+
+    lag = std::chrono::duration_cast<std::chrono::microseconds>
+          (Clock::now () - pending.posted).count ();
+    maxLag = std::max (maxLag, lag);
+    meanLag += (lag - meanLag) >> LAG_AVG_SHIFT;
+    dispatched++;
+
+    lock.unlock ();
+
+    /* Same signal a bus watch emits */
+    gst_bus_async_signal_func (bus, pending.message, NULL);
+    gst_message_unref (pending.message);
+
+    lock.lock ();
+  }
+
+  if (queue.empty () || stopped) {
+    scheduled = false;
+    return;
+  }
+
+  GST_LOG ("Yielding with %" G_GSIZE_FORMAT " messages pending", queue.size () );
+  lock.unlock ();
+
+  schedule ();
+}
+
+BusDispatcher::StaticConstructor BusDispatcher::staticConstructor;
+
+BusDispatcher::StaticConstructor::StaticConstructor()
+{
+  GST_DEBUG_CATEGORY_INIT (GST_CAT_DEFAULT, GST_DEFAULT_NAME, 0,
+                           GST_DEFAULT_NAME);
+}
+
+} // kurento
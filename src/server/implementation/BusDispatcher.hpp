@@ -0,0 +1,117 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef __BUS_DISPATCHER_HPP__
+#define __BUS_DISPATCHER_HPP__
+
+#include <gst/gst.h>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace kurento
+{
+
+class WorkerPool;
+
+/*
+ * Replaces the signal watch of a pipeline bus. Messages are taken by a
+ * sync handler in the thread posting them:
+ *  - syncFunc gets the first chance to consume them there.
+ *  - Types nobody listens to are dropped. Errors, warnings, EOS, element and
+ *    application messages and state changes are kept, listeners needing other
+ *    types add them with addTypes.
+ *  - The rest are queued and emitted as the bus "message" signal from a
+ *    WorkerPool, posted with the key of the dispatcher, so they are ordered
+ *    with the other tasks of the same pipeline.
+ * Only one drain task per bus runs at a time, so messages keep their order,
+ * and it yields after a batch, so a flooding bus does not hold the workers.
+ */
+class BusDispatcher : public std::enable_shared_from_this<BusDispatcher>
+{
+public:
+  struct Stats {
+    uint64_t dispatched;
+    uint64_t filtered;
+    uint64_t pending;
+    /* Microseconds from the post of a message to its dispatch */
+    int64_t maxLag;
+    int64_t meanLag;
+  };
+
+  /* syncFunc returns true if it consumed the message */
+  /* Messages are dropped once workers is destroyed */
+  BusDispatcher (GstBus *bus, std::shared_ptr<WorkerPool> workers,
+                 const std::string &key,
+                 std::function<bool (GstMessage *) > syncFunc);
+  ~BusDispatcher ();
+
+  void start ();
+  /* Also dispatches these types, from every element */
+  void addTypes (GstMessageType types);
+  /* Pending messages are dropped */
+  void stop ();
+
+  Stats getStats ();
+
+private:
+  typedef std::chrono::steady_clock Clock;
+
+  struct Pending {
+    GstMessage *message;
+    Clock::time_point posted;
+  };
+
+  static GstBusSyncReply syncHandler (GstBus *bus, GstMessage *message,
+                                      gpointer data);
+
+  void handle (GstMessage *message);
+  bool accept (GstMessage *message);
+  void schedule ();
+  void drain ();
+
+  GstBus *bus;
+  /* Not owned, a drain could drop the last reference from a worker */
+  std::weak_ptr<WorkerPool> workers;
+  std::string key;
+  std::function<bool (GstMessage *) > syncFunc;
+
+  std::mutex mutex;
+  std::deque<Pending> queue;
+  bool scheduled = false;
+  bool stopped = false;
+  GstMessageType extraTypes = GST_MESSAGE_UNKNOWN;
+
+  uint64_t dispatched = 0;
+  uint64_t filtered = 0;
+  int64_t maxLag = 0;
+  int64_t meanLag = 0;
+
+  class StaticConstructor
+  {
+  public:
+    StaticConstructor();
+  };
+
+  static StaticConstructor staticConstructor;
+};
+
+} // kurento
+
+#endif /* __BUS_DISPATCHER_HPP__ */
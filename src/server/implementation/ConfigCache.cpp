@@ -0,0 +1,195 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <gst/gst.h>
+
+#include "ConfigCache.hpp"
+#include <boost/property_tree/json_parser.hpp>
+#include <sstream>
+
+#define GST_CAT_DEFAULT kurento_config_cache
+GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
+#define GST_DEFAULT_NAME "KurentoConfigCache"
+
+namespace kurento
+{
+
+std::shared_ptr<const ConfigCache::Snapshot> ConfigCache::snapshot;
+std::mutex ConfigCache::mutex;
+
+/* Same value the config used to be deserialized from on every call */
+static Json::Value
+toJson (const boost::property_tree::ptree &node)
+{
+  boost::property_tree::ptree array;
+  std::stringstream ss;
+  Json::Value val;
+  Json::Reader reader;
+
+  array.push_back (std::make_pair ("val", node) );
+  boost::property_tree::write_json (ss, array);
+
+  reader.parse (ss.str(), val);
+
+  return val;
+}
+
+ConfigCache::Value::Value (const boost::property_tree::ptree &node) :
+  json (toJson (node) )
+{
+  /* Only leaves are scalars */
+  if (!node.empty() ) {
+    return;
+  }
+
+  intValue = node.get_value_optional<int> ();
+  uintValue = node.get_value_optional<unsigned int> ();
+  doubleValue = node.get_value_optional<double> ();
+  boolValue = node.get_value_optional<bool> ();
+  stringValue = node.data ();
+}
+
+void
+ConfigCache::compileNode (const boost::property_tree::ptree &node,
+                          const std::string &path, ClassConfig &classConfig)
+{
+  /* The first one wins on repeated keys, as with get_child */
+  if (classConfig.find (path) != classConfig.end() ) {
+    return;
+  }
+
+  classConfig.emplace (path, Value (node) );
+
+  for (auto &child : node) {
+    /* Array items have no key */
+    if (!child.first.empty() ) {
+      compileNode (child.second, path + "." + child.first, classConfig);
+    }
+  }
+}
+
+std::shared_ptr<ConfigCache::Snapshot>
+ConfigCache::compile (const boost::property_tree::ptree &config)
+{
+  std::shared_ptr<Snapshot> compiled (new Snapshot () );
+  auto modules = config.get_child_optional ("modules");
+
+  if (!modules) {
+    return compiled;
+  }
+
+  for (auto &module : modules.get() ) {
+    for (auto &type : module.second) {
+      ClassConfig &classConfig = compiled->modules[module.first][type.first];
+
+      for (auto &key : type.second) {
+        if (!key.first.empty() ) {
+          compileNode (key.second, key.first, classConfig);
+        }
+      }
+    }
+  }
+
+  return compiled;
+}
+
+uint64_t
+ConfigCache::reload (const boost::property_tree::ptree &config)
+{
+  std::shared_ptr<Snapshot> compiled = compile (config);
+  std::unique_lock <std::mutex> lock (mutex);
+  std::shared_ptr<const Snapshot> current = std::atomic_load (&snapshot);
+
+  compiled->generation = current ? current->generation + 1 : 1;
+  compiled->source = &config;
+  std::atomic_store (&snapshot, std::shared_ptr<const Snapshot> (compiled) );
+
+  GST_INFO ("Config compiled, generation %" G_GUINT64_FORMAT,
+            compiled->generation);
+
+  return compiled->generation;
+}
+
+uint64_t
+ConfigCache::getGeneration ()
+{
+  std::shared_ptr<const Snapshot> current = std::atomic_load (&snapshot);
+
+  return current ? current->generation : 0;
+}
+
+const ConfigCache::Value *
+ConfigCache::find (const Snapshot &compiled, const std::string &module,
+                   const std::string &type, const std::string &key)
+{
+  auto moduleIt = compiled.modules.find (module);
+
+  if (moduleIt == compiled.modules.end() ) {
+    return nullptr;
+  }
+
+  auto typeIt = moduleIt->second.find (type);
+
+  if (typeIt == moduleIt->second.end() ) {
+    return nullptr;
+  }
+
+  auto keyIt = typeIt->second.find (key);
+
+  if (keyIt == typeIt->second.end() ) {
+    return nullptr;
+  }
+
+  return &keyIt->second;
+}
+
+std::shared_ptr<const ConfigCache::Value>
+ConfigCache::lookup (const boost::property_tree::ptree &config,
+                     const std::string &module, const std::string &type,
+                     const std::string &key)
+{
+  std::shared_ptr<const Snapshot> current = std::atomic_load (&snapshot);
+  boost::optional<const boost::property_tree::ptree &> node;
+
+  if (current && current->source == &config) {
+    const Value *value = find (*current, module, type, key);
+
+    if (value == nullptr) {
+      return std::shared_ptr<const Value> ();
+    }
+
+    /* Keeps the snapshot alive while the value is used */
+    return std::shared_ptr<const Value> (current, value);
+  }
+
+  node = config.get_child_optional ("modules." + module + "." + type + "." +
+                                    key);
+
+  if (!node) {
+    return std::shared_ptr<const Value> ();
+  }
+
+  return std::make_shared<const Value> (node.get() );
+}
+
+ConfigCache::StaticConstructor ConfigCache::staticConstructor;
+
+ConfigCache::StaticConstructor::StaticConstructor()
+{
+  GST_DEBUG_CATEGORY_INIT (GST_CAT_DEFAULT, GST_DEFAULT_NAME, 0,
+                           GST_DEFAULT_NAME);
+}
+
+} // kurento
@@ -0,0 +1,172 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef __CONFIG_CACHE_HPP__
+#define __CONFIG_CACHE_HPP__
+
+#include <boost/property_tree/ptree.hpp>
+#include <boost/optional.hpp>
+#include <cstdint>
+#include <json/json.h>
+#include <jsonrpc/JsonSerializer.hpp>
+#include <KurentoException.hpp>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace kurento
+{
+
+/*
+ * Configuration of the media object classes, compiled from the server config
+ * so that getConfigValue neither walks the tree nor deserializes JSON on
+ * every call.
+ *
+ * The server config is compiled by reload when the ServerManager is created
+ * with it. The compiled values are immutable, each reload replaces them at
+ * once with a new generation. They are only used for the tree they were
+ * compiled from, any other tree is read directly. Changes to the compiled
+ * tree are only seen after the next reload.
+ */
+class ConfigCache
+{
+public:
+  /* One config value, already converted to the scalar types it can be read
+   * as. Other types are deserialized from its JSON form */
+  class Value
+  {
+  public:
+    Value (const boost::property_tree::ptree &node);
+
+    /* Throws KurentoException if the value is not a T */
+    template <class T>
+    T get () const
+    {
+      T ret {};
+      kurento::JsonSerializer serializer (false);
+
+      serializer.JsonValue = json;
+      serializer.Serialize ("val", ret);
+
+      return ret;
+    }
+
+  private:
+    template <class T>
+    static T checked (const boost::optional<T> &value)
+    {
+      if (!value) {
+        throw KurentoException (MARSHALL_ERROR, "Invalid config value type");
+      }
+
+      return value.get ();
+    }
+
+    /* Same value the config used to be deserialized from on every call */
+    Json::Value json;
+    boost::optional<int> intValue;
+    boost::optional<unsigned int> uintValue;
+    boost::optional<double> doubleValue;
+    boost::optional<bool> boolValue;
+    boost::optional<std::string> stringValue;
+  };
+
+  /* Compiles config and replaces the current values with it, returns the
+   * generation of the new values */
+  static uint64_t reload (const boost::property_tree::ptree &config);
+
+  /* Generation of the current values, 0 before the first reload */
+  static uint64_t getGeneration ();
+
+  /* Returns nullptr if there is no such key. The values of the last reload
+   * are used if they were compiled from config, otherwise config is read */
+  static std::shared_ptr<const Value> lookup (const
+      boost::property_tree::ptree &config, const std::string &module,
+      const std::string &type, const std::string &key);
+
+private:
+  /* Values of one class by key, nested keys are joined with dots */
+  typedef std::unordered_map<std::string, Value> ClassConfig;
+
+  struct Snapshot {
+    uint64_t generation;
+    /* Tree the values were compiled from, only compared */
+    const boost::property_tree::ptree *source;
+    /* By module and type */
+    std::unordered_map<std::string,
+        std::unordered_map<std::string, ClassConfig>> modules;
+  };
+
+  static std::shared_ptr<Snapshot> compile (const
+      boost::property_tree::ptree &config);
+  static void compileNode (const boost::property_tree::ptree &node,
+                           const std::string &path, ClassConfig &classConfig);
+  static const Value *find (const Snapshot &snapshot,
+                            const std::string &module,
+                            const std::string &type, const std::string &key);
+
+  static std::shared_ptr<const Snapshot> snapshot;
+  /* Serializes reloads, lookups do not take it */
+  static std::mutex mutex;
+
+  class StaticConstructor
+  {
+  public:
+    StaticConstructor();
+  };
+
+  static StaticConstructor staticConstructor;
+};
+
+template <>
+inline int ConfigCache::Value::get<int> () const
+{
+  return checked (intValue);
+}
+
+template <>
+inline unsigned int ConfigCache::Value::get<unsigned int> () const
+{
+  return checked (uintValue);
+}
+
+template <>
+inline double ConfigCache::Value::get<double> () const
+{
+  return checked (doubleValue);
+}
+
+template <>
+inline bool ConfigCache::Value::get<bool> () const
+{
+  return checked (boolValue);
+}
+
+template <>
+inline std::string ConfigCache::Value::get<std::string> () const
+{
+  return checked (stringValue);
+}
+
+template <>
+inline Json::Value ConfigCache::Value::get<Json::Value> () const
+{
+  return json;
+}
+
+} // kurento
+
+#endif /* __CONFIG_CACHE_HPP__ */
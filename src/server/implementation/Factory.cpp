@@ -15,6 +15,8 @@
 
 #include "Factory.hpp"
 #include "MediaSet.hpp"
+#include "ObjectPool.hpp"
+#include <chrono>
 
 namespace kurento
 {
@@ -30,10 +32,17 @@ Factory::createObject (const boost::property_tree::ptree &conf,
                        const std::string &session, const Json::Value &params) const
 {
   std::shared_ptr< MediaObjectImpl > object;
+  auto start = std::chrono::steady_clock::now ();
+  int64_t elapsed;
+
   object = MediaSet::getMediaSet()->ref (dynamic_cast <MediaObjectImpl *>
                                          (createObjectPointer (conf, params) ) );
   object->postConstructor ();
 
+  elapsed = std::chrono::duration_cast<std::chrono::microseconds>
+            (std::chrono::steady_clock::now () - start).count ();
+  ObjectPool::getPool ()->recordCreation (getName (), elapsed);
+
   MediaSet::getMediaSet()->ref (session, object);
 
   return object;
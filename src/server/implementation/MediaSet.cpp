@@ -19,7 +19,11 @@
 #include <KurentoException.hpp>
 #include <MediaPipelineImpl.hpp>
 #include <ServerManagerImpl.hpp>
+#include <Reaper.hpp>
+#include <ObjectPool.hpp>
+#include <StatsSampler.hpp>
 
+#include <algorithm>
 #include <functional>
 
 /* This is included to avoid problems with slots and lamdas */
@@ -41,13 +45,26 @@ struct functor_trait<Functor, false> {
 GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
 #define GST_DEFAULT_NAME "KurentoMediaSet"
 
-const int MEDIASET_THREADS_DEFAULT = 1;
+const int MEDIASET_THREADS_DEFAULT = 4;
+const int MEDIASET_THREADS_MAX = 16;
 
 namespace kurento
 {
 
-static const std::chrono::seconds COLLECTOR_INTERVAL = std::chrono::seconds (
-      240);
+static const std::chrono::milliseconds COLLECTOR_INTERVAL =
+  std::chrono::milliseconds (100);
+
+/* Sessions were collected after 240 to 480 seconds without use */
+static const int SESSION_TIMEOUT_DEFAULT = 480; /* seconds */
+static const int SESSION_TEARDOWN_RATE_DEFAULT = 10; /* sessions per second */
+static const int CPU_SAMPLING_INTERVAL_DEFAULT = 2000; /* milliseconds */
+
+static int64_t
+getTimeMsecs ()
+{
+  return std::chrono::duration_cast<std::chrono::milliseconds>
+         (std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
 
 static std::shared_ptr<MediaSet> mediaSet;
 static std::recursive_mutex mutex;
@@ -103,35 +120,159 @@ MediaSet::deleteMediaSet()
   GST_INFO ("Destroying mediaSet");
 
   mediaSet.reset();
+
+  /* Released objects are destroyed by now, but maybe not their media. The
+   * singletons are not left to static destructors, GStreamer may be gone */
+  Reaper::shutdown ();
+  ObjectPool::shutdown ();
+  StatsSampler::shutdown ();
+}
+
+void
+MediaSet::scheduleExpiry (const std::string &sessionId, int64_t deadline,
+                          int64_t created)
+{
+  std::unique_lock <std::mutex> lock (collectorMutex);
+
+  expiryQueue.push ({deadline, created, sessionId});
 }
 
+/*
+ * Sessions are kept in a heap ordered by their deadline. keepAliveSession
+ * only updates the last use time, so entries whose session was used since
+ * they were queued are pushed again with the new deadline when they reach
+ * the top. At most teardownRate sessions are released per second, the rest
+ * wait in the heap for the next runs.
+ */
 void MediaSet::doGarbageCollection ()
 {
-  std::unique_lock <std::recursive_mutex> lock (recMutex);
-  auto sessions = sessionInUse;
+  std::unique_lock <std::mutex> lock (collectorMutex);
+  std::vector<std::string> expired;
+  int64_t now = getTimeMsecs();
+  int64_t timeout = sessionTimeout;
+  int rate = teardownRate;
+
+  if (rate > 0) {
+    teardownTokens += rate * (now - lastCollection) / 1000.0;
+    teardownTokens = std::min (teardownTokens, std::max (1.0,
+                               rate * COLLECTOR_INTERVAL.count() / 1000.0) );
+  }
+
+  lastCollection = now;
+
+  while (!expiryQueue.empty() && expiryQueue.top().deadline <= now) {
+    Expiry entry = expiryQueue.top();
+    SessionState state;
+
+    if (rate > 0 && teardownTokens < 1.0) {
+      break;
+    }
+
+    expiryQueue.pop();
+
+    if (!sessionInUse.find (entry.sessionId, state)
+        || state.created != entry.created) {
+      /* Session already released */
+      continue;
+    }
+
+    if (state.lastUse + timeout > now) {
+      expiryQueue.push ({state.lastUse + timeout, entry.created, entry.sessionId});
+      continue;
+    }
+
+    maxTeardownDelay = std::max<int64_t> (maxTeardownDelay,
+                                          now - state.lastUse - timeout);
+    teardownTokens -= 1.0;
+    expired.push_back (entry.sessionId);
+  }
 
   lock.unlock();
 
-  GST_DEBUG ("Running garbage collector");
+  for (auto sessionId : expired) {
+    GST_WARNING ("Session timeout: %s", sessionId.c_str() );
+    unrefSession (sessionId);
+    expiredSessions++;
+  }
+}
 
-  for (auto it : sessions) {
-    if (it.second) {
-      lock.lock();
-      sessionInUse[it.first] = false;
-      lock.unlock();
-    } else {
-      GST_WARNING ("Session timeout: %s", it.first.c_str() );
-      unrefSession (it.first);
+void
+MediaSet::setSessionCollectorConfig (int sessionTimeout, int teardownRate)
+{
+  GST_INFO ("Sessions timeout: %d s, teardown rate: %d sessions/s",
+            sessionTimeout, teardownRate);
+
+  this->sessionTimeout = std::max (sessionTimeout, 1) * 1000;
+  this->teardownRate = std::max (teardownRate, 0);
+}
+
+void
+MediaSet::doCpuSampling ()
+{
+  int64_t now = getTimeMsecs();
+  int interval = cpuSamplingInterval;
+  int64_t elapsed = now - lastCpuSample;
+
+  if (interval <= 0 || elapsed < interval) {
+    return;
+  }
+
+  lastCpuSample = now;
+
+  for (auto it : getAllPipelines () ) {
+    std::shared_ptr<MediaPipelineImpl> pipeline =
+      std::dynamic_pointer_cast<MediaPipelineImpl> (it);
+
+    if (pipeline) {
+      pipeline->getTaskPool ()->sample (elapsed * GST_MSECOND);
     }
   }
 }
 
+void
+MediaSet::setCpuSamplingInterval (int interval)
+{
+  GST_INFO ("CPU sampling interval: %d ms", interval);
+
+  cpuSamplingInterval = std::max (interval, 0);
+}
+
+int
+MediaSet::getCpuSamplingInterval ()
+{
+  return cpuSamplingInterval;
+}
+
+MediaSet::CollectorStats
+MediaSet::getCollectorStats ()
+{
+  std::unique_lock <std::mutex> lock (collectorMutex);
+  CollectorStats stats;
+
+  stats.sessionTimeout = sessionTimeout / 1000;
+  stats.teardownRate = teardownRate;
+  stats.sessions = sessionInUse.size();
+  stats.queued = expiryQueue.size();
+  stats.expiredSessions = expiredSessions;
+  stats.maxTeardownDelay = maxTeardownDelay;
+
+  return stats;
+}
+
 MediaSet::MediaSet()
 {
   terminated = false;
+  sessionTimeout = SESSION_TIMEOUT_DEFAULT * 1000;
+  teardownRate = SESSION_TEARDOWN_RATE_DEFAULT;
+  teardownTokens = 0;
+  lastCollection = getTimeMsecs();
+  expiredSessions = 0;
+  maxTeardownDelay = 0;
+  cpuSamplingInterval = CPU_SAMPLING_INTERVAL_DEFAULT;
+  lastCpuSample = getTimeMsecs();
 
   workers = std::shared_ptr<WorkerPool> (new WorkerPool (
-      MEDIASET_THREADS_DEFAULT) );
+      MEDIASET_THREADS_DEFAULT, MEDIASET_THREADS_MAX) );
 
   thread = std::thread ( [&] () {
     std::unique_lock <std::recursive_mutex> lock (recMutex);
@@ -144,11 +285,21 @@ MediaSet::MediaSet()
         return;
       }
 
+      lock.unlock();
+
       try {
         doGarbageCollection();
       } catch (...) {
         GST_ERROR ("Error during garbage collection");
       }
+
+      try {
+        doCpuSampling();
+      } catch (...) {
+        GST_ERROR ("Error during CPU sampling");
+      }
+
+      lock.lock();
     }
 
   });
@@ -158,7 +309,7 @@ MediaSet::~MediaSet ()
 {
   std::unique_lock <std::recursive_mutex> lock (recMutex);
 
-  if (!objectsMap.empty() ) {
+  if (objectsMap.size() > 0) {
     std::cerr << "Warning: Still " + std::to_string (objectsMap.size() ) +
               " object/s alive" << std::endl;
   }
@@ -189,6 +340,13 @@ MediaSet::~MediaSet ()
   }
 }
 
+/* Objects ids are prefixed by the id of their pipeline */
+static std::string
+getPipelineId (const std::string &id)
+{
+  return id.substr (0, id.find ('/') );
+}
+
 void
 MediaSet::post (std::function<void (void) > f)
 {
@@ -202,6 +360,40 @@ MediaSet::post (std::function<void (void) > f)
   }
 }
 
+void
+MediaSet::post (std::function<void (void) > f, const std::string &id)
+{
+  std::unique_lock <std::recursive_mutex> lock (recMutex);
+
+  if (!terminated && workers) {
+    workers->post (f, getPipelineId (id) );
+  } else {
+    lock.unlock();
+    f();
+  }
+}
+
+WorkerPool::Stats
+MediaSet::getWorkerPoolStats ()
+{
+  std::unique_lock <std::recursive_mutex> lock (recMutex);
+  WorkerPool::Stats stats = WorkerPool::Stats ();
+
+  if (workers) {
+    stats = workers->getStats();
+  }
+
+  return stats;
+}
+
+std::shared_ptr<WorkerPool>
+MediaSet::getWorkerPool ()
+{
+  std::unique_lock <std::recursive_mutex> lock (recMutex);
+
+  return workers;
+}
+
 void
 MediaSet::setServerManager (std::shared_ptr <ServerManagerImpl> serverManager)
 {
@@ -238,14 +430,17 @@ MediaSet::ref (MediaObjectImpl *mediaObjectPtr)
     });
   }
 
-  objectsMap[mediaObject->getId()] = std::weak_ptr<MediaObjectImpl> (mediaObject);
+  objectsMap.set (mediaObject->getId(),
+                  std::weak_ptr<MediaObjectImpl> (mediaObject) );
 
   if (mediaObject->getParent() ) {
     std::shared_ptr<MediaObjectImpl> parent = std::dynamic_pointer_cast
         <MediaObjectImpl> (mediaObject->getParent() );
 
     ref (parent.get() );
-    childrenMap[parent->getId()][mediaObject->getId()] = mediaObject;
+    childrenMap.update (parent->getId(), [&mediaObject] (ObjectsMap & children) {
+      children[mediaObject->getId()] = mediaObject;
+    });
   }
 
   if (this->serverManager && created) {
@@ -261,9 +456,23 @@ void
 MediaSet::ref (const std::string &sessionId,
                std::shared_ptr<MediaObjectImpl> mediaObject)
 {
+  std::string id = mediaObject->getId();
+  bool referenced = false;
+
+  /* Fast path, the session already holds the object (and its parents) */
+  sessionMap.visit (sessionId, [&id, &referenced] (ObjectsMap & objects) {
+    referenced = objects.find (id) != objects.end();
+    return false;
+  });
+
+  if (referenced) {
+    keepAliveSession (sessionId, true);
+    return;
+  }
+
   std::unique_lock <std::recursive_mutex> lock (recMutex);
 
-  if (objectsMap.find (mediaObject->getId() ) == objectsMap.end() ) {
+  if (!objectsMap.contains (id) ) {
     throw KurentoException (MEDIA_OBJECT_NOT_FOUND,
                             "Cannot register media object, it was not created by MediaSet");
   }
@@ -275,8 +484,15 @@ MediaSet::ref (const std::string &sessionId,
          std::dynamic_pointer_cast<MediaObjectImpl> (mediaObject->getParent() ) );
   }
 
-  sessionMap[sessionId][mediaObject->getId()] = mediaObject;
-  reverseSessionMap[mediaObject->getId()].insert (sessionId);
+  /* reverseSessionMap goes first so the fast path never sees an object
+   * without sessions */
+  reverseSessionMap.update (id, [&sessionId] (std::unordered_set<std::string> &
+  sessions) {
+    sessions.insert (sessionId);
+  });
+  sessionMap.update (sessionId, [&id, &mediaObject] (ObjectsMap & objects) {
+    objects[id] = mediaObject;
+  });
   ref (mediaObject.get() );
 }
 
@@ -298,18 +514,33 @@ MediaSet::keepAliveSession (const std::string &sessionId)
 void
 MediaSet::keepAliveSession (const std::string &sessionId, bool create)
 {
-  std::unique_lock <std::recursive_mutex> lock (recMutex);
+  int64_t now = getTimeMsecs();
 
-  auto it = sessionInUse.find (sessionId);
+  if (create) {
+    bool created = false;
 
-  if (it == sessionInUse.end() ) {
-    if (create) {
-      sessionInUse[sessionId] = true;
-    } else {
-      throw KurentoException (INVALID_SESSION, "Invalid session");
+    sessionInUse.update (sessionId, [now, &created] (SessionState & state) {
+      created = state.created == 0;
+
+      if (created) {
+        state.created = now;
+      }
+
+      state.lastUse = now;
+    });
+
+    if (created) {
+      scheduleExpiry (sessionId, now + sessionTimeout, now);
     }
-  } else {
-    it->second = true;
+
+    return;
+  }
+
+  if (!sessionInUse.visit (sessionId, [now] (SessionState & state) {
+  state.lastUse = now;
+  return false;
+}) ) {
+    throw KurentoException (INVALID_SESSION, "Invalid session");
   }
 }
 
@@ -317,12 +548,9 @@ void
 MediaSet::releaseSession (const std::string &sessionId)
 {
   std::unique_lock <std::recursive_mutex> lock (recMutex);
+  ObjectsMap objects;
 
-  auto it = sessionMap.find (sessionId);
-
-  if (it != sessionMap.end() ) {
-    auto objects = it->second;
-
+  if (sessionMap.find (sessionId, objects) ) {
     for (auto it2 : objects) {
       release (it2.second);
     }
@@ -339,12 +567,9 @@ void
 MediaSet::unrefSession (const std::string &sessionId)
 {
   std::unique_lock <std::recursive_mutex> lock (recMutex);
+  ObjectsMap objects;
 
-  auto it = sessionMap.find (sessionId);
-
-  if (it != sessionMap.end() ) {
-    auto objects = it->second;
-
+  if (sessionMap.find (sessionId, objects) ) {
     for (auto it2 : objects) {
       unref (sessionId, it2.second);
     }
@@ -376,47 +601,57 @@ MediaSet::unref (const std::string &sessionId,
     return;
   }
 
-  auto it = sessionMap.find (sessionId);
+  std::string id = mediaObject->getId();
+  bool found = true;
+  bool unused = false;
+  ObjectsMap childMap;
 
-  if (it != sessionMap.end() ) {
-    auto it2 = it->second.find (mediaObject->getId() );
+  sessionMap.visit (sessionId, [&id, &found] (ObjectsMap & objects) {
+    auto it2 = objects.find (id);
 
-    if (it2 == it->second.end() ) {
-      return;
+    if (it2 == objects.end() ) {
+      found = false;
+    } else {
+      objects.erase (it2);
     }
 
-    it->second.erase (it2);
-  }
-
-  auto childrenIt = childrenMap.find (mediaObject->getId() );
+    return false;
+  });
 
-  if (childrenIt != childrenMap.end() ) {
-    auto childMap = childrenIt->second;
+  if (!found) {
+    return;
+  }
 
+  if (childrenMap.find (id, childMap) ) {
     for (auto child : childMap) {
       unref (sessionId, child.second);
     }
   }
 
-  auto it3 = reverseSessionMap.find (mediaObject->getId() );
+  reverseSessionMap.visit (id, [&sessionId,
+  &unused] (std::unordered_set<std::string> &sessions) {
+    sessions.erase (sessionId);
+    unused = sessions.empty();
 
-  if (it3 != reverseSessionMap.end() ) {
-    it3->second.erase (sessionId);
-
-    if (it3->second.empty() ) {
-      std::shared_ptr<MediaObjectImpl> parent;
+    return unused;
+  });
 
-      released = mediaObject.get() != serverManager.get();
+  if (unused) {
+    std::shared_ptr<MediaObjectImpl> parent;
 
-      if (released) {
-        parent = std::dynamic_pointer_cast<MediaObjectImpl> (mediaObject->getParent() );
+    released = mediaObject.get() != serverManager.get();
 
-        if (parent) {
-          childrenMap[parent->getId()].erase (mediaObject->getId() );
-        }
+    if (released) {
+      parent = std::dynamic_pointer_cast<MediaObjectImpl> (mediaObject->getParent() );
 
-        childrenMap.erase (mediaObject->getId() );
+      if (parent) {
+        childrenMap.visit (parent->getId(), [&id] (ObjectsMap & children) {
+          children.erase (id);
+          return false;
+        });
       }
+
+      childrenMap.erase (id);
     }
   }
 
@@ -427,6 +662,7 @@ MediaSet::unref (const std::string &sessionId,
   }
 
   if (released) {
+    /* Teardown order is kept by the reaper, not by the worker */
     post (std::bind (call_release, mediaObject) );
   }
 
@@ -463,7 +699,7 @@ void MediaSet::releasePointer (MediaObjectImpl *mediaObject)
 
   objectsMap.erase (id );
 
-  post (std::bind (async_delete, mediaObject, id) );
+  post (std::bind (async_delete, mediaObject, id), id);
 
   if (this->serverManager && !terminated) {
     serverManager->signalObjectDestroyed (ObjectDestroyed (this->serverManager,
@@ -478,16 +714,13 @@ void MediaSet::releasePointer (MediaObjectImpl *mediaObject)
 void MediaSet::release (std::shared_ptr< MediaObjectImpl > mediaObject)
 {
   std::unique_lock <std::recursive_mutex> lock (recMutex);
+  std::unordered_set<std::string> sessions;
 
-  auto it = reverseSessionMap.find (mediaObject->getId() );
-
-  if (it == reverseSessionMap.end() ) {
+  if (!reverseSessionMap.find (mediaObject->getId(), sessions) ) {
     /* Already released */
     return;
   }
 
-  auto sessions = it->second;
-
   for (auto it2 : sessions) {
     unref (it2, mediaObject);
   }
@@ -520,30 +753,30 @@ MediaSet::getMediaObject (const std::string &mediaObjectRef)
   }
 
   std::shared_ptr <MediaObjectImpl> objectLocked;
-  std::unique_lock <std::recursive_mutex> lock (recMutex);
-
-  auto it = objectsMap.find (mediaObjectRef);
+  std::weak_ptr <MediaObjectImpl> object;
+  bool inUse = false;
 
-  if (it == objectsMap.end() ) {
+  if (!objectsMap.find (mediaObjectRef, object) ) {
     throw KurentoException (MEDIA_OBJECT_NOT_FOUND,
                             "Object '" + mediaObjectRef + "' not found");
   }
 
-  try {
-    objectLocked = it->second.lock();
-  } catch (...) {
-    throw KurentoException (MEDIA_OBJECT_NOT_FOUND,
-                            "Object '" + mediaObjectRef + "' not found");
-  }
+  objectLocked = object.lock();
 
   if (!objectLocked) {
     throw KurentoException (MEDIA_OBJECT_NOT_FOUND,
                             "Object '" + mediaObjectRef + "' not found");
   }
 
-  auto it2 = reverseSessionMap.find (objectLocked->getId() );
+  reverseSessionMap.visit (objectLocked->getId(),
+  [&inUse] (std::unordered_set<std::string> &sessions) {
+    inUse = !sessions.empty();
+    return false;
+  });
+
+  if (!inUse) {
+    std::unique_lock <std::recursive_mutex> lock (recMutex);
 
-  if (it2 == reverseSessionMap.end() || it2->second.empty() ) {
     if (serverManager && mediaObjectRef == serverManager->getId() ) {
       return serverManager;
     }
@@ -614,21 +847,14 @@ MediaSet::empty()
   if (serverManager) {
     return objectsMap.size () == 1;
   } else {
-    return objectsMap.empty();
+    return objectsMap.size () == 0;
   }
 }
 
 std::vector<std::string>
 MediaSet::getSessions ()
 {
-  std::unique_lock <std::recursive_mutex> lock (recMutex);
-  std::vector<std::string> ret (sessionMap.size () );
-
-  for (auto it : sessionMap) {
-    ret.push_back (it.first);
-  }
-
-  return ret;
+  return sessionMap.keys();
 }
 
 std::list<std::shared_ptr<MediaObjectImpl>>
@@ -637,11 +863,11 @@ std::list<std::shared_ptr<MediaObjectImpl>>
   std::unique_lock <std::recursive_mutex> lock (recMutex);
   std::list<std::shared_ptr<MediaObjectImpl>> ret;
 
-  auto copy = objectsMap;
+  auto copy = objectsMap.keys();
 
   for (auto it : copy) {
     try {
-      auto obj = getMediaObject (sessionId, it.first);
+      auto obj = getMediaObject (sessionId, it);
 
       if (std::dynamic_pointer_cast <MediaPipelineImpl> (obj) ) {
         ret.push_back (obj);
@@ -653,17 +879,33 @@ std::list<std::shared_ptr<MediaObjectImpl>>
   return ret;
 }
 
+std::list<std::shared_ptr<MediaObjectImpl>>
+    MediaSet::getAllPipelines ()
+{
+  std::list<std::shared_ptr<MediaObjectImpl>> ret;
+
+  for (auto &it : objectsMap.snapshot () ) {
+    std::shared_ptr<MediaObjectImpl> obj = it.second.lock ();
+
+    if (std::dynamic_pointer_cast <MediaPipelineImpl> (obj) ) {
+      ret.push_back (obj);
+    }
+  }
+
+  return ret;
+}
+
 std::list<std::shared_ptr<MediaObjectImpl>>
     MediaSet::getChilds (std::shared_ptr<MediaObjectImpl> obj)
 {
-  std::unique_lock <std::recursive_mutex> lock (recMutex);
   std::list<std::shared_ptr<MediaObjectImpl>> ret;
+  ObjectsMap children;
 
-  try {
-    for (auto it : childrenMap.at (obj->getId() ) ) {
+  if (childrenMap.find (obj->getId(), children) ) {
+    for (auto it : children) {
       ret.push_back (it.second);
     }
-  } catch (std::out_of_range) {
+  } else {
     GST_ERROR ("Cannot get childrens of object %s", obj->getId().c_str() );
   }
 
@@ -18,14 +18,17 @@
 
 #include <MediaObjectImpl.hpp>
 
+#include <unordered_map>
 #include <unordered_set>
 #include <map>
 #include <memory>
 #include <mutex>
 #include <thread>
 #include <condition_variable>
+#include <queue>
 #include <atomic>
 
+#include "ShardedMap.hpp"
 #include "WorkerPool.hpp"
 
 namespace kurento
@@ -72,6 +75,8 @@ public:
   std::vector<std::string> getSessions ();
   std::list<std::shared_ptr<MediaObjectImpl>> getPipelines (
         const std::string &sessionId = "");
+  /* Every alive pipeline, without referencing them in any session */
+  std::list<std::shared_ptr<MediaObjectImpl>> getAllPipelines ();
   std::list<std::shared_ptr<MediaObjectImpl>> getChilds (
         std::shared_ptr<MediaObjectImpl> obj);
 
@@ -79,6 +84,29 @@ public:
 
   bool empty();
 
+  WorkerPool::Stats getWorkerPoolStats ();
+  /* Affinity keys of its tasks are pipeline ids, NULL once deleted */
+  std::shared_ptr<WorkerPool> getWorkerPool ();
+
+  struct CollectorStats {
+    int sessionTimeout;
+    int teardownRate;
+    uint64_t sessions;
+    uint64_t queued;
+    uint64_t expiredSessions;
+    int64_t maxTeardownDelay;
+  };
+
+  /* Sessions not used for sessionTimeout seconds are released, at most
+   * teardownRate per second (0 for no limit) */
+  void setSessionCollectorConfig (int sessionTimeout, int teardownRate);
+  CollectorStats getCollectorStats ();
+
+  /* CPU time of the threads of each pipeline is sampled every interval
+   * milliseconds, 0 disables it */
+  void setCpuSamplingInterval (int interval);
+  int getCpuSamplingInterval ();
+
   static const std::shared_ptr<MediaSet> getMediaSet();
   static void deleteMediaSet();
 
@@ -89,6 +117,9 @@ private:
 
   void keepAliveSession (const std::string &sessionId, bool create);
   void doGarbageCollection ();
+  void doCpuSampling ();
+  void scheduleExpiry (const std::string &sessionId, int64_t deadline,
+                       int64_t created);
 
   std::thread thread;
 
@@ -96,7 +127,10 @@ private:
 
   void checkEmpty ();
 
+  /* Tasks whose order does not matter, any worker may run them */
   void post (std::function<void (void) > f);
+  /* Tasks of objects of the same pipeline run in order */
+  void post (std::function<void (void) > f, const std::string &id);
 
   MediaSet ();
 
@@ -106,22 +140,54 @@ private:
 
   std::shared_ptr <ServerManagerImpl> serverManager;
 
-  std::map<std::string, std::weak_ptr <MediaObjectImpl>> objectsMap;
+  typedef std::unordered_map<std::string, std::shared_ptr <MediaObjectImpl>>
+      ObjectsMap;
+
+  /* Registry maps are sharded so lookups do not take recMutex. Mutations
+   * spanning several maps are still serialized by recMutex */
+  ShardedMap<std::string, std::weak_ptr <MediaObjectImpl>> objectsMap;
 
-  std::map<std::string, std::map <std::string, std::shared_ptr <MediaObjectImpl>>>
-  childrenMap;
+  ShardedMap<std::string, ObjectsMap> childrenMap;
 
-  std::map<std::string, std::map <std::string, std::shared_ptr<MediaObjectImpl>>>
-  sessionMap;
+  ShardedMap<std::string, ObjectsMap> sessionMap;
 
-  std::map<std::string, bool> sessionInUse;
+  struct SessionState {
+    int64_t lastUse;
+    int64_t created;
+  };
+
+  ShardedMap<std::string, SessionState> sessionInUse;
   std::map<std::string, std::map<std::string, std::map<std::string, std::shared_ptr<EventHandler>>>>
   eventHandler;
 
-  std::map<std::string, std::unordered_set<std::string>> reverseSessionMap;
+  ShardedMap<std::string, std::unordered_set<std::string>> reverseSessionMap;
 
   std::shared_ptr<WorkerPool> workers;
 
+  struct Expiry {
+    int64_t deadline;
+    int64_t created;
+    std::string sessionId;
+
+    bool operator> (const Expiry &other) const
+    {
+      return deadline > other.deadline;
+    }
+  };
+
+  std::mutex collectorMutex;
+  std::priority_queue<Expiry, std::vector<Expiry>, std::greater<Expiry>>
+      expiryQueue;
+  std::atomic<int64_t> sessionTimeout;
+  std::atomic<int> teardownRate;
+  double teardownTokens;
+  int64_t lastCollection;
+  std::atomic<uint64_t> expiredSessions;
+  std::atomic<int64_t> maxTeardownDelay;
+
+  std::atomic<int> cpuSamplingInterval;
+  int64_t lastCpuSample;
+
   class StaticConstructor
   {
   public:
@@ -0,0 +1,305 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <gst/gst.h>
+
+#include "ObjectPool.hpp"
+#include "kmselementpool.h"
+#include <algorithm>
+
+#define GST_CAT_DEFAULT kurento_object_pool
+GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
+#define GST_DEFAULT_NAME "KurentoObjectPool"
+
+namespace kurento
+{
+
+const std::vector<int64_t> ObjectPool::LATENCY_BUCKETS = {
+  100, 1000, 10000, 100000, 1000000
+};
+
+static std::shared_ptr<ObjectPool> objectPool;
+static std::mutex objectPoolMutex;
+
+std::shared_ptr<ObjectPool>
+ObjectPool::getPool ()
+{
+  std::unique_lock <std::mutex> lock (objectPoolMutex);
+
+  if (!objectPool) {
+    objectPool = std::shared_ptr<ObjectPool> (new ObjectPool () );
+  }
+
+  return objectPool;
+}
+
+void
+ObjectPool::shutdown ()
+{
+  std::unique_lock <std::mutex> lock (objectPoolMutex);
+  std::shared_ptr<ObjectPool> old = objectPool;
+
+  objectPool.reset();
+  lock.unlock();
+
+  /* The last reference is dropped out of the lock, joining the thread */
+  old.reset();
+}
+
+ObjectPool::ObjectPool ()
+{
+  kms_element_pool_set_refill_func (refillElements, this);
+}
+
+ObjectPool::~ObjectPool ()
+{
+  /* Waits for running refills, they take the mutex */
+  kms_element_pool_set_refill_func (NULL, NULL);
+
+  std::unique_lock <std::mutex> lock (mutex);
+
+  terminated = true;
+  cond.notify_all();
+  lock.unlock();
+
+  if (thread.joinable() ) {
+    if (std::this_thread::get_id() != thread.get_id() ) {
+      thread.join();
+    } else {
+      thread.detach();
+    }
+  }
+
+  for (auto pipeline : pipelines) {
+    releasePipeline (pipeline);
+  }
+
+  kms_element_pool_set_size (0);
+}
+
+GstElement *
+ObjectPool::createPipeline ()
+{
+  GstElement *pipeline;
+  GstClock *clock;
+
+  pipeline = gst_pipeline_new (NULL);
+
+  if (pipeline == NULL) {
+    return NULL;
+  }
+
+  g_object_set (G_OBJECT (pipeline), "async-handling", TRUE, NULL);
+
+  clock = gst_system_clock_obtain ();
+  gst_pipeline_use_clock (GST_PIPELINE (pipeline), clock);
+  g_object_unref (clock);
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+  return pipeline;
+}
+
+void
+ObjectPool::releasePipeline (GstElement *pipeline)
+{
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  g_object_unref (pipeline);
+}
+
+void
+ObjectPool::setSize (int readyPipelines, int spareElements)
+{
+  std::unique_lock <std::mutex> lock (mutex);
+  std::vector<GstElement *> dropped;
+
+  GST_INFO ("Ready pipelines: %d, spare elements: %d", readyPipelines,
+            spareElements);
+
+  /* Set before the fill is requested, it applies the new size */
+  kms_element_pool_set_size (std::max (spareElements, 0) );
+
+  pipelineSize = std::max (readyPipelines, 0);
+
+  while (pipelines.size() > (size_t) pipelineSize) {
+    dropped.push_back (pipelines.back() );
+    pipelines.pop_back();
+  }
+
+  pipelinesPending = true;
+  elementsPending = true;
+
+  if (!thread.joinable() && (pipelineSize > 0 || spareElements > 0) ) {
+    thread = std::thread (&ObjectPool::run, this);
+  }
+
+  cond.notify_all();
+  lock.unlock();
+
+  for (auto pipeline : dropped) {
+    releasePipeline (pipeline);
+  }
+}
+
+GstElement *
+ObjectPool::takePipeline ()
+{
+  std::unique_lock <std::mutex> lock (mutex);
+  GstElement *pipeline;
+
+  if (pipelineSize == 0) {
+    return NULL;
+  }
+
+  pipelinesPending = true;
+  cond.notify_all();
+
+  if (pipelines.empty() ) {
+    pipelineMisses++;
+    GST_DEBUG ("No ready pipeline");
+    return NULL;
+  }
+
+  pipelineHits++;
+  pipeline = pipelines.front();
+  pipelines.pop_front();
+  lock.unlock();
+
+  flushBus (pipeline);
+
+  return pipeline;
+}
+
+void
+ObjectPool::flushBus (GstElement *pipeline)
+{
+  GstBus *bus = gst_pipeline_get_bus (GST_PIPELINE (pipeline) );
+
+  /* Messages posted while the pipeline was ready, like its state changes,
+   * must not reach the dispatcher of its media pipeline */
+  gst_bus_set_flushing (bus, TRUE);
+  gst_bus_set_flushing (bus, FALSE);
+  g_object_unref (bus);
+}
+
+void
+ObjectPool::refillElements (gpointer data)
+{
+  ObjectPool *self = static_cast<ObjectPool *> (data);
+  std::unique_lock <std::mutex> lock (self->mutex);
+
+  self->elementsPending = true;
+  self->cond.notify_all();
+}
+
+void
+ObjectPool::run ()
+{
+  std::unique_lock <std::mutex> lock (mutex);
+
+  while (true) {
+    while (!terminated && !pipelinesPending && !elementsPending) {
+      cond.wait (lock);
+    }
+
+    if (terminated) {
+      return;
+    }
+
+    if (pipelinesPending) {
+      pipelinesPending = false;
+
+      while (!terminated && pipelines.size() < (size_t) pipelineSize) {
+        GstElement *pipeline;
+
+        /* Pipelines are built out of the lock, takes are not delayed */
+        lock.unlock();
+        pipeline = createPipeline ();
+        lock.lock();
+
+        if (pipeline == NULL) {
+          GST_ERROR ("Cannot create gstreamer pipeline");
+          break;
+        }
+
+        if (pipelines.size() >= (size_t) pipelineSize) {
+          lock.unlock();
+          releasePipeline (pipeline);
+          lock.lock();
+          break;
+        }
+
+        pipelines.push_back (pipeline);
+      }
+    }
+
+    if (elementsPending) {
+      elementsPending = false;
+      lock.unlock();
+      kms_element_pool_fill ();
+      lock.lock();
+    }
+  }
+}
+
+void
+ObjectPool::recordCreation (const std::string &type, int64_t elapsed)
+{
+  std::unique_lock <std::mutex> lock (mutex);
+  std::vector<uint64_t> &histogram = latency[type];
+  size_t bucket;
+
+  if (histogram.empty() ) {
+    histogram.assign (LATENCY_BUCKETS.size() + 1, 0);
+  }
+
+  for (bucket = 0; bucket < LATENCY_BUCKETS.size(); bucket++) {
+    if (elapsed <= LATENCY_BUCKETS[bucket]) {
+      break;
+    }
+  }
+
+  histogram[bucket]++;
+}
+
+ObjectPool::Stats
+ObjectPool::getStats ()
+{
+  std::unique_lock <std::mutex> lock (mutex);
+  guint64 elementHits, elementMisses;
+  Stats stats;
+
+  stats.pipelines = pipelineSize;
+  stats.elements = kms_element_pool_get_size ();
+  stats.readyPipelines = pipelines.size();
+  stats.pipelineHits = pipelineHits;
+  stats.pipelineMisses = pipelineMisses;
+  kms_element_pool_get_stats (&elementHits, &elementMisses);
+  stats.elementHits = elementHits;
+  stats.elementMisses = elementMisses;
+  stats.latency = latency;
+
+  return stats;
+}
+
+ObjectPool::StaticConstructor ObjectPool::staticConstructor;
+
+ObjectPool::StaticConstructor::StaticConstructor()
+{
+  GST_DEBUG_CATEGORY_INIT (GST_CAT_DEFAULT, GST_DEFAULT_NAME, 0,
+                           GST_DEFAULT_NAME);
+}
+
+} // kurento
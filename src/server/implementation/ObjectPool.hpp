@@ -0,0 +1,114 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef __OBJECT_POOL_HPP__
+#define __OBJECT_POOL_HPP__
+
+#include <gst/gst.h>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace kurento
+{
+
+/*
+ * Keeps GStreamer objects built ahead of time so that creating media
+ * objects does not pay for them:
+ *  - Pipelines with their clock set, already in PLAYING.
+ *  - Spare agnosticbins and tees for the elements, see kmselementpool.h.
+ * Both are refilled by a background thread as they are taken.
+ *
+ * It also keeps the creation latency of every media object type.
+ */
+class ObjectPool
+{
+public:
+  /* Upper bounds, in microseconds, of the creation latency histogram
+   * buckets. Stats::latency has an extra bucket for slower creations */
+  static const std::vector<int64_t> LATENCY_BUCKETS;
+
+  struct Stats {
+    int pipelines;
+    int elements;
+    uint64_t readyPipelines;
+    uint64_t pipelineHits;
+    uint64_t pipelineMisses;
+    uint64_t elementHits;
+    uint64_t elementMisses;
+    std::map<std::string, std::vector<uint64_t>> latency;
+  };
+
+  ~ObjectPool ();
+
+  static std::shared_ptr<ObjectPool> getPool ();
+
+  /* Stops the refill thread and releases the pooled objects, while
+   * GStreamer is still alive. Later calls to getPool create a new pool */
+  static void shutdown ();
+
+  /* Ready pipelines and spare elements of each pooled factory */
+  void setSize (int readyPipelines, int spareElements);
+
+  /* NULL when the pool is empty, the caller owns the pipeline */
+  GstElement *takePipeline ();
+
+  /* Builds a pipeline the same way the pool does */
+  static GstElement *createPipeline ();
+
+  void recordCreation (const std::string &type, int64_t latency);
+
+  Stats getStats ();
+
+private:
+  ObjectPool ();
+
+  void run ();
+  static void refillElements (gpointer data);
+  static void releasePipeline (GstElement *pipeline);
+  static void flushBus (GstElement *pipeline);
+
+  std::mutex mutex;
+  std::condition_variable cond;
+  std::thread thread;
+
+  std::deque<GstElement *> pipelines;
+  int pipelineSize = 0;
+  bool pipelinesPending = false;
+  bool elementsPending = false;
+  bool terminated = false;
+
+  uint64_t pipelineHits = 0;
+  uint64_t pipelineMisses = 0;
+  std::map<std::string, std::vector<uint64_t>> latency;
+
+  class StaticConstructor
+  {
+  public:
+    StaticConstructor();
+  };
+
+  static StaticConstructor staticConstructor;
+};
+
+} // kurento
+
+#endif /* __OBJECT_POOL_HPP__ */
@@ -0,0 +1,586 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <gst/gst.h>
+
+#include "PipelineTaskPool.hpp"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <pthread.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define GST_CAT_DEFAULT kurento_pipeline_task_pool
+GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
+#define GST_DEFAULT_NAME "KurentoPipelineTaskPool"
+
+#define MIN_NICE -20
+#define MAX_NICE 19
+
+namespace kurento
+{
+
+static pid_t
+getThreadId ()
+{
+  return syscall (SYS_gettid);
+}
+
+static int64_t
+getCpuTime (clockid_t clock)
+{
+  struct timespec ts;
+
+  if (clock_gettime (clock, &ts) != 0) {
+    return -1;
+  }
+
+  return ts.tv_sec * GST_SECOND + ts.tv_nsec;
+}
+
+/* Factory name of the top level element of the pipeline owning @element */
+static std::string
+getElementClass (GstElement *element)
+{
+  GstObject *object;
+  GstElementFactory *factory;
+
+  if (element == NULL) {
+    return "unknown";
+  }
+
+  object = GST_OBJECT (element);
+
+  while (GST_OBJECT_PARENT (object) != NULL
+         && GST_OBJECT_PARENT (GST_OBJECT_PARENT (object) ) != NULL) {
+    object = GST_OBJECT_PARENT (object);
+  }
+
+  factory = GST_IS_ELEMENT (object) ? gst_element_get_factory (GST_ELEMENT (
+              object) ) : NULL;
+
+  if (factory == NULL) {
+    return G_OBJECT_TYPE_NAME (object);
+  }
+
+  return GST_OBJECT_NAME (factory);
+}
+
+static bool
+parseCpuRange (const std::string &range, cpu_set_t *set)
+{
+  unsigned int first, last;
+  int end = -1;
+
+  if (range.find_first_not_of ("0123456789- ") != std::string::npos) {
+    return false;
+  }
+
+  /* The whole range must be consumed, "1-" or "1 2" are not valid */
+  if (sscanf (range.c_str(), " %u-%u %n", &first, &last, &end) == 2
+      && end == (int) range.size () ) {
+  } else if (sscanf (range.c_str(), " %u %n", &first, &end) == 1
+             && end == (int) range.size () ) {
+    last = first;
+  } else {
+    return false;
+  }
+
+  if (first > last || last >= CPU_SETSIZE) {
+    return false;
+  }
+
+  for (unsigned int cpu = first; cpu <= last; cpu++) {
+    CPU_SET (cpu, set);
+  }
+
+  return true;
+}
+
+/* Gives a pool thread back the affinity and priority of the process */
+static void
+restoreThread (pid_t tid, const cpu_set_t *cpus, int priority)
+{
+  cpu_set_t current;
+
+  if (CPU_COUNT (cpus) > 0
+      && sched_getaffinity (tid, sizeof (current), &current) == 0
+      && !CPU_EQUAL (&current, cpus)
+      && sched_setaffinity (tid, sizeof (*cpus), cpus) != 0) {
+    GST_WARNING ("Cannot restore CPU affinity of thread %d: %s", tid,
+                 strerror (errno) );
+  }
+
+  if (getpriority (PRIO_PROCESS, tid) != priority
+      && setpriority (PRIO_PROCESS, tid, priority) != 0) {
+    GST_WARNING ("Cannot restore priority %d of thread %d: %s", priority, tid,
+                 strerror (errno) );
+  }
+}
+
+/*
+ * GstTaskPool that runs every task through runTask, so the thread is left
+ * from itself when the task returns. The GThreadPool of the default
+ * implementation is not exclusive, its threads also run other pools.
+ */
+typedef struct _KmsPipelineTaskPool {
+  GstTaskPool parent;
+
+  /* Protected by the object lock, cleared when the PipelineTaskPool goes */
+  PipelineTaskPool *owner;
+  cpu_set_t processCpus;
+  int processPriority;
+} KmsPipelineTaskPool;
+
+typedef struct _KmsPipelineTaskPoolClass {
+  GstTaskPoolClass parent_class;
+} KmsPipelineTaskPoolClass;
+
+G_DEFINE_TYPE (KmsPipelineTaskPool, kms_pipeline_task_pool,
+               GST_TYPE_TASK_POOL);
+
+struct PooledTask {
+  KmsPipelineTaskPool *pool;
+  GstTaskPoolFunction func;
+  gpointer userData;
+};
+
+static void
+runTask (gpointer data)
+{
+  PooledTask *task = static_cast <PooledTask *> (data);
+  KmsPipelineTaskPool *self = task->pool;
+
+  task->func (task->userData);
+
+  GST_OBJECT_LOCK (self);
+
+  if (self->owner != NULL) {
+    self->owner->leaveThread ();
+  } else {
+    restoreThread (getThreadId (), &self->processCpus, self->processPriority);
+  }
+
+  GST_OBJECT_UNLOCK (self);
+
+  gst_object_unref (self);
+  g_slice_free (PooledTask, task);
+}
+
+static gpointer
+kms_pipeline_task_pool_push (GstTaskPool *pool, GstTaskPoolFunction func,
+                             gpointer user_data, GError **error)
+{
+  PooledTask *task = g_slice_new (PooledTask);
+  GError *err = NULL;
+  gpointer id;
+
+  task->pool = (KmsPipelineTaskPool *) gst_object_ref (pool);
+  task->func = func;
+  task->userData = user_data;
+
+  id = GST_TASK_POOL_CLASS (kms_pipeline_task_pool_parent_class)->push (pool,
+       runTask, task, &err);
+
+  if (err != NULL) {
+    gst_object_unref (task->pool);
+    g_slice_free (PooledTask, task);
+    g_propagate_error (error, err);
+  }
+
+  return id;
+}
+
+static void
+kms_pipeline_task_pool_class_init (KmsPipelineTaskPoolClass *klass)
+{
+  GST_TASK_POOL_CLASS (klass)->push = kms_pipeline_task_pool_push;
+}
+
+static void
+kms_pipeline_task_pool_init (KmsPipelineTaskPool *self)
+{
+  self->owner = NULL;
+  CPU_ZERO (&self->processCpus);
+  self->processPriority = 0;
+}
+
+bool
+PipelineTaskPool::parseCpuSet (const std::string &list, cpu_set_t *set)
+{
+  std::stringstream ss (list);
+  std::string range;
+
+  CPU_ZERO (set);
+
+  while (std::getline (ss, range, ',') ) {
+    if (!parseCpuRange (range, set) ) {
+      GST_WARNING ("Invalid CPU list '%s'", list.c_str() );
+      CPU_ZERO (set);
+      return false;
+    }
+  }
+
+  return CPU_COUNT (set) > 0;
+}
+
+PipelineTaskPool::Placement::Placement ()
+{
+  for (int i = 0; i < CLASSES; i++) {
+    priority[i] = 0;
+  }
+}
+
+PipelineTaskPool::PipelineTaskPool (const Placement &placement) :
+  placement (placement)
+{
+  KmsPipelineTaskPool *taskPool;
+  GError *err = NULL;
+
+  if (sched_getaffinity (0, sizeof (processCpus), &processCpus) != 0) {
+    CPU_ZERO (&processCpus);
+  }
+
+  processPriority = getpriority (PRIO_PROCESS, 0);
+
+  taskPool = (KmsPipelineTaskPool *) g_object_new (
+               kms_pipeline_task_pool_get_type (), NULL);
+  gst_object_ref_sink (taskPool);
+  taskPool->owner = this;
+  taskPool->processCpus = processCpus;
+  taskPool->processPriority = processPriority;
+
+  pool = GST_TASK_POOL (taskPool);
+  gst_task_pool_prepare (pool, &err);
+
+  if (err != NULL) {
+    GST_WARNING ("Cannot prepare task pool, using the default one: %s",
+                 err->message);
+    g_error_free (err);
+    gst_object_unref (pool);
+    pool = NULL;
+  }
+}
+
+PipelineTaskPool::~PipelineTaskPool ()
+{
+  if (pool != NULL) {
+    /* Tasks still running restore their threads by themselves */
+    GST_OBJECT_LOCK (pool);
+    ((KmsPipelineTaskPool *) pool)->owner = NULL;
+    GST_OBJECT_UNLOCK (pool);
+
+    gst_task_pool_cleanup (pool);
+    gst_object_unref (pool);
+  }
+}
+
+void
+PipelineTaskPool::setPlacement (const Placement &placement)
+{
+  std::unique_lock<std::mutex> lock (mutex);
+
+  this->placement = placement;
+
+  for (auto &it : threads) {
+    apply (it.first, it.second.threadClass);
+  }
+}
+
+PipelineTaskPool::Placement
+PipelineTaskPool::getPlacement ()
+{
+  std::unique_lock<std::mutex> lock (mutex);
+
+  return placement;
+}
+
+/* Called with the mutex held */
+void
+PipelineTaskPool::apply (pid_t tid, ThreadClass threadClass)
+{
+  const std::string &cpus = placement.cpuSet[threadClass].empty () ?
+                            placement.cpuSet[DEFAULT] : placement.cpuSet[threadClass];
+  int nice = CLAMP (processPriority + placement.priority[threadClass],
+                    MIN_NICE, MAX_NICE);
+  cpu_set_t set;
+
+  if (!cpus.empty () && parseCpuSet (cpus, &set) ) {
+    pinning = true;
+  } else {
+    set = processCpus;
+  }
+
+  /* Threads are only moved back once they have been pinned */
+  if (pinning && CPU_COUNT (&set) > 0
+      && sched_setaffinity (tid, sizeof (set), &set) != 0) {
+    GST_WARNING ("Cannot set CPU affinity of thread %d: %s", tid,
+                 strerror (errno) );
+  }
+
+  if (getpriority (PRIO_PROCESS, tid) != nice
+      && setpriority (PRIO_PROCESS, tid, nice) != 0) {
+    GST_WARNING ("Cannot set priority %d of thread %d: %s", nice, tid,
+                 strerror (errno) );
+  }
+}
+
+void
+PipelineTaskPool::enterThread (ThreadClass threadClass,
+                               const std::string &elementClass)
+{
+  std::unique_lock<std::mutex> lock (mutex);
+  pid_t tid = getThreadId ();
+  ThreadInfo &info = threads[tid];
+
+  GST_DEBUG ("Thread %d of %s entered with class %d", tid,
+             elementClass.c_str (), threadClass);
+
+  info.threadClass = threadClass;
+  info.elementClass = elementClass;
+
+  if (pthread_getcpuclockid (pthread_self (), &info.clock) != 0) {
+    info.clock = CLOCK_THREAD_CPUTIME_ID;
+  }
+
+  info.lastCpuTime = getCpuTime (CLOCK_THREAD_CPUTIME_ID);
+  apply (tid, threadClass);
+}
+
+void
+PipelineTaskPool::leaveThread ()
+{
+  std::unique_lock<std::mutex> lock (mutex);
+  auto it = threads.find (getThreadId () );
+
+  if (it == threads.end () ) {
+    return;
+  }
+
+  account (it->second, getCpuTime (CLOCK_THREAD_CPUTIME_ID) );
+  threads.erase (it);
+  restoreThread (getThreadId (), &processCpus, processPriority);
+}
+
+/* Called with the mutex held */
+void
+PipelineTaskPool::account (ThreadInfo &info, int64_t cpuTime)
+{
+  /* Pool threads are reused, only what they run since they entered counts */
+  if (cpuTime < 0 || info.lastCpuTime < 0 || cpuTime < info.lastCpuTime) {
+    return;
+  }
+
+  usage[info.elementClass].cpuTime += cpuTime - info.lastCpuTime;
+  info.lastCpuTime = cpuTime;
+}
+
+void
+PipelineTaskPool::sample (int64_t elapsed)
+{
+  std::unique_lock<std::mutex> lock (mutex);
+
+  for (auto &it : threads) {
+    if (it.second.clock != CLOCK_THREAD_CPUTIME_ID) {
+      account (it.second, getCpuTime (it.second.clock) );
+    }
+  }
+
+  for (auto &it : usage) {
+    Usage &u = it.second;
+
+    u.usedCpu = elapsed > 0 ? 100.0 * (u.cpuTime - u.sampledCpuTime) / elapsed :
+                0;
+    u.sampledCpuTime = u.cpuTime;
+  }
+}
+
+std::vector<PipelineTaskPool::CpuStats>
+PipelineTaskPool::getCpuStats ()
+{
+  std::unique_lock<std::mutex> lock (mutex);
+  std::map<std::string, int> running;
+  std::vector<CpuStats> stats;
+
+  for (auto &it : threads) {
+    running[it.second.elementClass]++;
+  }
+
+  for (auto &it : usage) {
+    stats.push_back ({it.first, it.second.usedCpu, it.second.cpuTime,
+                      running[it.first]
+                     });
+  }
+
+  return stats;
+}
+
+void
+PipelineTaskPool::reclassifyThread (GstElement *owner, GstCaps *caps)
+{
+  std::unique_lock<std::mutex> lock (mutex);
+  ThreadClass threadClass = classify (owner, caps);
+  pid_t tid = getThreadId ();
+  auto it = threads.find (tid);
+
+  if (it == threads.end () || it->second.threadClass == threadClass) {
+    return;
+  }
+
+  GST_DEBUG ("Thread %d changed to class %d", tid, threadClass);
+  it->second.threadClass = threadClass;
+  apply (tid, threadClass);
+}
+
+GstPadProbeReturn
+PipelineTaskPool::capsProbe (GstPad *pad, GstPadProbeInfo *info,
+                             gpointer data)
+{
+  GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+  std::shared_ptr<PipelineTaskPool> self;
+  GstElement *owner;
+  GstCaps *caps;
+
+  if (GST_EVENT_TYPE (event) != GST_EVENT_CAPS) {
+    return GST_PAD_PROBE_OK;
+  }
+
+  self = static_cast <std::weak_ptr<PipelineTaskPool> *> (data)->lock ();
+
+  if (self) {
+    gst_event_parse_caps (event, &caps);
+    owner = gst_pad_get_parent_element (pad);
+    self->reclassifyThread (owner, caps);
+    g_clear_object (&owner);
+  }
+
+  return GST_PAD_PROBE_REMOVE;
+}
+
+static void
+destroyWeakPool (gpointer data)
+{
+  delete static_cast <std::weak_ptr<PipelineTaskPool> *> (data);
+}
+
+void
+PipelineTaskPool::handleStreamStatus (GstMessage *message)
+{
+  GstStreamStatusType type;
+  GstElement *owner;
+
+  gst_message_parse_stream_status (message, &type, &owner);
+
+  switch (type) {
+  case GST_STREAM_STATUS_TYPE_CREATE: {
+    const GValue *val = gst_message_get_stream_status_object (message);
+
+    if (pool != NULL && val != NULL && G_VALUE_HOLDS (val, GST_TYPE_TASK) ) {
+      gst_task_set_pool (GST_TASK (g_value_get_object (val) ), pool);
+    }
+
+    break;
+  }
+
+  case GST_STREAM_STATUS_TYPE_ENTER: {
+    GstObject *src = GST_MESSAGE_SRC (message);
+    GstCaps *caps = NULL;
+    ThreadClass threadClass;
+
+    if (GST_IS_PAD (src) ) {
+      caps = gst_pad_get_current_caps (GST_PAD (src) );
+    }
+
+    threadClass = classify (owner, caps);
+
+    if (threadClass == DEFAULT && caps == NULL && GST_IS_PAD (src) ) {
+      /* Queues only know what they carry once caps are pushed */
+      gst_pad_add_probe (GST_PAD (src), GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+                         capsProbe, new std::weak_ptr<PipelineTaskPool> (shared_from_this () ),
+                         destroyWeakPool);
+    }
+
+    if (caps != NULL) {
+      gst_caps_unref (caps);
+    }
+
+    enterThread (threadClass, getElementClass (owner) );
+    break;
+  }
+
+  case GST_STREAM_STATUS_TYPE_LEAVE:
+    leaveThread ();
+    break;
+
+  default:
+    break;
+  }
+}
+
+PipelineTaskPool::ThreadClass
+PipelineTaskPool::classify (GstElement *owner, GstCaps *caps)
+{
+  if (owner != NULL) {
+    const gchar *klass = gst_element_class_get_metadata (GST_ELEMENT_GET_CLASS (
+                           owner), GST_ELEMENT_METADATA_KLASS);
+
+    if (klass != NULL) {
+      if (strstr (klass, "Network") != NULL) {
+        return RTP_IO;
+      }
+
+      if (strstr (klass, "Encoder") != NULL
+          || strstr (klass, "Decoder") != NULL) {
+        if (strstr (klass, "Audio") != NULL) {
+          return AUDIO;
+        } else if (strstr (klass, "Video") != NULL) {
+          return VIDEO;
+        }
+      }
+    }
+  }
+
+  if (caps != NULL && !gst_caps_is_any (caps) && !gst_caps_is_empty (caps) ) {
+    const gchar *name = gst_structure_get_name (gst_caps_get_structure (caps,
+                        0) );
+
+    if (g_str_has_prefix (name, "audio/") ) {
+      return AUDIO;
+    } else if (g_str_has_prefix (name, "video/") ) {
+      return VIDEO;
+    } else if (g_str_has_prefix (name, "application/x-rtp")
+               || g_str_has_prefix (name, "application/x-rtcp")
+               || g_str_has_prefix (name, "application/x-srtp")
+               || g_str_has_prefix (name, "application/x-srtcp") ) {
+      return RTP_IO;
+    }
+  }
+
+  return DEFAULT;
+}
+
+PipelineTaskPool::StaticConstructor PipelineTaskPool::staticConstructor;
+
+PipelineTaskPool::StaticConstructor::StaticConstructor()
+{
+  GST_DEBUG_CATEGORY_INIT (GST_CAT_DEFAULT, GST_DEFAULT_NAME, 0,
+                           GST_DEFAULT_NAME);
+}
+
+} // kurento
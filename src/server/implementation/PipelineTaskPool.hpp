@@ -0,0 +1,142 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef __PIPELINE_TASK_POOL_HPP__
+#define __PIPELINE_TASK_POOL_HPP__
+
+#include <gst/gst.h>
+#include <sched.h>
+#include <sys/types.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace kurento
+{
+
+/*
+ * Task pool of the streaming threads of one pipeline. Every thread is
+ * classified when it starts, from the element that owns it and the caps it
+ * pushes, and gets the CPU set and priority of its class. Pool threads are
+ * shared with the rest of the process, so each one gets back the affinity and
+ * priority of the process when its task returns, even if the LEAVE message
+ * is never handled.
+ *
+ * The CPU time of the threads is also accounted to the media element that
+ * owns them, the top level element of the pipeline.
+ */
+class PipelineTaskPool : public std::enable_shared_from_this<PipelineTaskPool>
+{
+public:
+  enum ThreadClass {
+    DEFAULT,
+    AUDIO,
+    /* Raw video and video encoders and decoders */
+    VIDEO,
+    /* Network sources, RTP sessions and jitterbuffers */
+    RTP_IO,
+    CLASSES
+  };
+
+  struct Placement {
+    /* CPU lists like "0-7,16". Classes with an empty list use the DEFAULT
+     * one, and threads are not pinned if it is empty too */
+    std::string cpuSet[CLASSES];
+    /* Added to the nice value of the server process */
+    int priority[CLASSES];
+
+    Placement ();
+  };
+
+  struct CpuStats {
+    /* Factory name of the media element */
+    std::string elementClass;
+    /* Percentage of one CPU during the last sampling period */
+    double usedCpu;
+    /* Nanoseconds since the pipeline was created */
+    int64_t cpuTime;
+    int threads;
+  };
+
+  PipelineTaskPool (const Placement &placement);
+  ~PipelineTaskPool ();
+
+  /* Applies to running threads too */
+  void setPlacement (const Placement &placement);
+  Placement getPlacement ();
+
+  /* To be called synchronously for every GST_MESSAGE_STREAM_STATUS of the
+   * pipeline, ENTER messages are posted from the new thread itself */
+  void handleStreamStatus (GstMessage *message);
+
+  /* Called from a streaming thread once it is done with the pipeline */
+  void leaveThread ();
+
+  static ThreadClass classify (GstElement *owner, GstCaps *caps);
+
+  /* Parses CPU lists like "0-7,16", false if it is invalid or empty */
+  static bool parseCpuSet (const std::string &list, cpu_set_t *set);
+
+  /* Accounts the CPU time of the running threads, elapsed is the time since
+   * the previous sample in nanoseconds */
+  void sample (int64_t elapsed);
+  std::vector<CpuStats> getCpuStats ();
+
+private:
+  struct ThreadInfo {
+    ThreadClass threadClass;
+    std::string elementClass;
+    clockid_t clock;
+    int64_t lastCpuTime;
+  };
+
+  struct Usage {
+    int64_t cpuTime = 0;
+    int64_t sampledCpuTime = 0;
+    double usedCpu = 0;
+  };
+
+  void enterThread (ThreadClass threadClass, const std::string &elementClass);
+  void account (ThreadInfo &info, int64_t cpuTime);
+  void reclassifyThread (GstElement *owner, GstCaps *caps);
+  void apply (pid_t tid, ThreadClass threadClass);
+
+  static GstPadProbeReturn capsProbe (GstPad *pad, GstPadProbeInfo *info,
+                                      gpointer data);
+
+  GstTaskPool *pool;
+
+  std::mutex mutex;
+  Placement placement;
+  cpu_set_t processCpus;
+  int processPriority;
+  bool pinning = false;
+  std::map<pid_t, ThreadInfo> threads;
+  std::map<std::string, Usage> usage;
+
+  class StaticConstructor
+  {
+  public:
+    StaticConstructor();
+  };
+
+  static StaticConstructor staticConstructor;
+};
+
+} // kurento
+
+#endif /* __PIPELINE_TASK_POOL_HPP__ */
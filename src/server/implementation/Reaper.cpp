@@ -0,0 +1,246 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <gst/gst.h>
+
+#include "Reaper.hpp"
+#include <algorithm>
+
+#define GST_CAT_DEFAULT kurento_reaper
+GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
+#define GST_DEFAULT_NAME "KurentoReaper"
+
+const int REAPER_CONCURRENCY_DEFAULT = 4;
+
+namespace kurento
+{
+
+const std::vector<int64_t> Reaper::LATENCY_BUCKETS = {
+  10, 100, 1000, 5000, 10000
+};
+
+static std::shared_ptr<Reaper> reaper;
+static std::mutex reaperMutex;
+
+std::shared_ptr<Reaper>
+Reaper::getReaper ()
+{
+  std::unique_lock <std::mutex> lock (reaperMutex);
+
+  if (!reaper) {
+    reaper = std::shared_ptr<Reaper> (new Reaper () );
+  }
+
+  return reaper;
+}
+
+void
+Reaper::shutdown ()
+{
+  std::unique_lock <std::mutex> lock (reaperMutex);
+  std::shared_ptr<Reaper> old = reaper;
+
+  reaper.reset();
+  lock.unlock();
+
+  if (old) {
+    old->waitIdle ();
+  }
+}
+
+Reaper::Reaper ()
+{
+  concurrency = REAPER_CONCURRENCY_DEFAULT;
+  latency.assign (LATENCY_BUCKETS.size() + 1, 0);
+}
+
+Reaper::~Reaper ()
+{
+  std::unique_lock <std::mutex> lock (mutex);
+
+  terminated = true;
+  cond.notify_all();
+  lock.unlock();
+
+  /* Pending teardowns are still run */
+  for (auto &thread : threads) {
+    if (std::this_thread::get_id() != thread.get_id() ) {
+      thread.join();
+    } else {
+      thread.detach();
+    }
+  }
+}
+
+void
+Reaper::setConcurrency (int concurrency)
+{
+  std::unique_lock <std::mutex> lock (mutex);
+
+  GST_INFO ("Release concurrency: %d", concurrency);
+
+  this->concurrency = std::max (concurrency, 1);
+  cond.notify_all();
+}
+
+void
+Reaper::post (const std::string &id, const std::string &key,
+              std::function<void (void) > teardown)
+{
+  std::unique_lock <std::mutex> lock (mutex);
+
+  if (terminated) {
+    lock.unlock();
+    teardown();
+    return;
+  }
+
+  queue.push_back ({id, key, teardown, Clock::now() });
+  releasing.insert (id);
+
+  /* Threads are only created when needed, up to the concurrency limit */
+  if (threads.size() < (size_t) concurrency
+      && threads.size() < running + queue.size() ) {
+    threads.push_back (std::thread (&Reaper::run, this) );
+  }
+
+  cond.notify_all();
+}
+
+/* Called with the mutex held */
+bool
+Reaper::nextJob (Job &job)
+{
+  if (running >= (uint64_t) concurrency) {
+    return false;
+  }
+
+  for (auto it = queue.begin(); it != queue.end(); it++) {
+    if (busyKeys.find (it->key) != busyKeys.end() ) {
+      continue;
+    }
+
+    job = std::move (*it);
+    queue.erase (it);
+    busyKeys.insert (job.key);
+    running++;
+
+    return true;
+  }
+
+  return false;
+}
+
+void
+Reaper::run ()
+{
+  std::unique_lock <std::mutex> lock (mutex);
+
+  while (true) {
+    Job job;
+    int64_t elapsed;
+    size_t bucket;
+
+    while (!nextJob (job) ) {
+      if (terminated && queue.empty() ) {
+        return;
+      }
+
+      cond.wait (lock);
+    }
+
+    lock.unlock();
+
+    GST_DEBUG ("Tearing down %s", job.id.c_str() );
+
+    try {
+      job.teardown();
+    } catch (...) {
+      GST_ERROR ("Error tearing down %s", job.id.c_str() );
+    }
+
+    /* Whatever the teardown holds is released out of the lock */
+    job.teardown = nullptr;
+
+    elapsed = std::chrono::duration_cast<std::chrono::milliseconds>
+              (Clock::now() - job.queued).count();
+
+    lock.lock();
+
+    running--;
+    busyKeys.erase (job.key);
+    releasing.erase (job.id);
+    released++;
+    maxLatency = std::max (maxLatency, elapsed);
+
+    for (bucket = 0; bucket < LATENCY_BUCKETS.size(); bucket++) {
+      if (elapsed <= LATENCY_BUCKETS[bucket]) {
+        break;
+      }
+    }
+
+    latency[bucket]++;
+
+    if (queue.empty() && running == 0) {
+      idleCond.notify_all();
+    }
+
+    cond.notify_all();
+  }
+}
+
+std::vector<std::string>
+Reaper::getReleasing ()
+{
+  std::unique_lock <std::mutex> lock (mutex);
+
+  return std::vector<std::string> (releasing.begin(), releasing.end() );
+}
+
+void
+Reaper::waitIdle ()
+{
+  std::unique_lock <std::mutex> lock (mutex);
+
+  while (!queue.empty() || running > 0) {
+    idleCond.wait (lock);
+  }
+}
+
+Reaper::Stats
+Reaper::getStats ()
+{
+  std::unique_lock <std::mutex> lock (mutex);
+  Stats stats;
+
+  stats.concurrency = concurrency;
+  stats.queued = queue.size();
+  stats.running = running;
+  stats.released = released;
+  stats.maxLatency = maxLatency;
+  stats.latency = latency;
+
+  return stats;
+}
+
+Reaper::StaticConstructor Reaper::staticConstructor;
+
+Reaper::StaticConstructor::StaticConstructor()
+{
+  GST_DEBUG_CATEGORY_INIT (GST_CAT_DEFAULT, GST_DEFAULT_NAME, 0,
+                           GST_DEFAULT_NAME);
+}
+
+} // kurento
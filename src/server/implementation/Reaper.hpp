@@ -0,0 +1,121 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef __REAPER_HPP__
+#define __REAPER_HPP__
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+namespace kurento
+{
+
+/*
+ * Runs the GStreamer teardown of released objects: setting a pipeline or
+ * an element to NULL joins its streaming threads and may take seconds.
+ *
+ * At most concurrency teardowns run at the same time. Teardowns with the
+ * same key (the pipeline id) run one after the other, in the order they
+ * were posted, so elements are gone before their pipeline.
+ */
+class Reaper
+{
+public:
+  /* Upper bounds, in milliseconds, of the release latency histogram
+   * buckets. Stats::latency has an extra bucket for longer releases */
+  static const std::vector<int64_t> LATENCY_BUCKETS;
+
+  struct Stats {
+    int concurrency;
+    uint64_t queued;
+    uint64_t running;
+    uint64_t released;
+    int64_t maxLatency;
+    std::vector<uint64_t> latency;
+  };
+
+  ~Reaper ();
+
+  static std::shared_ptr<Reaper> getReaper ();
+
+  /* Waits for the posted teardowns and stops the reaper threads, while
+   * GStreamer is still alive. Later posts get a new reaper */
+  static void shutdown ();
+
+  void setConcurrency (int concurrency);
+
+  void post (const std::string &id, const std::string &key,
+             std::function<void (void) > teardown);
+
+  /* Ids of the objects whose teardown is queued or running */
+  std::vector<std::string> getReleasing ();
+
+  /* Blocks until every posted teardown has finished */
+  void waitIdle ();
+
+  Stats getStats ();
+
+private:
+  typedef std::chrono::steady_clock Clock;
+
+  struct Job {
+    std::string id;
+    std::string key;
+    std::function<void (void) > teardown;
+    Clock::time_point queued;
+  };
+
+  Reaper ();
+
+  void run ();
+  bool nextJob (Job &job);
+
+  std::mutex mutex;
+  std::condition_variable cond;
+  std::condition_variable idleCond;
+
+  std::deque<Job> queue;
+  std::unordered_set<std::string> busyKeys;
+  std::unordered_set<std::string> releasing;
+  std::vector<std::thread> threads;
+
+  int concurrency;
+  uint64_t running = 0;
+  uint64_t released = 0;
+  int64_t maxLatency = 0;
+  std::vector<uint64_t> latency;
+  bool terminated = false;
+
+  class StaticConstructor
+  {
+  public:
+    StaticConstructor();
+  };
+
+  static StaticConstructor staticConstructor;
+};
+
+} // kurento
+
+#endif /* __REAPER_HPP__ */
@@ -0,0 +1,204 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef __SHARDED_MAP_HPP__
+#define __SHARDED_MAP_HPP__
+
+#include <array>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace kurento
+{
+
+/*
+ * Hash map split in shards, each one protected by its own mutex. Operations
+ * only lock the shard of the key, so lookups of different keys do not
+ * contend. Callbacks run with the shard locked and must not access the same
+ * map again.
+ */
+template <typename Key, typename Value, size_t Shards = 64>
+class ShardedMap
+{
+public:
+  ShardedMap () : count (0) {}
+
+  /* Copies the value of key into value. Returns false if it is not found */
+  bool find (const Key &key, Value &value) const
+  {
+    const Shard &shard = getShard (key);
+    std::unique_lock <std::mutex> lock (shard.mutex);
+    auto it = shard.map.find (key);
+
+    if (it == shard.map.end() ) {
+      return false;
+    }
+
+    value = it->second;
+    return true;
+  }
+
+  bool contains (const Key &key) const
+  {
+    const Shard &shard = getShard (key);
+    std::unique_lock <std::mutex> lock (shard.mutex);
+
+    return shard.map.find (key) != shard.map.end();
+  }
+
+  void set (const Key &key, const Value &value)
+  {
+    update (key, [&value] (Value & current) {
+      current = value;
+    });
+  }
+
+  /* Calls func with the value of key, inserting a default one if needed */
+  void update (const Key &key, std::function<void (Value &) > func)
+  {
+    Shard &shard = getShard (key);
+    std::unique_lock <std::mutex> lock (shard.mutex);
+    auto it = shard.map.find (key);
+
+    if (it == shard.map.end() ) {
+      it = shard.map.insert (std::make_pair (key, Value () ) ).first;
+      count++;
+    }
+
+    func (it->second);
+  }
+
+  /* Calls func with the value of key if it exists. The entry is removed when
+   * func returns true. Returns false if key is not found */
+  bool visit (const Key &key, std::function<bool (Value &) > func)
+  {
+    Shard &shard = getShard (key);
+    std::unique_lock <std::mutex> lock (shard.mutex);
+    auto it = shard.map.find (key);
+
+    if (it == shard.map.end() ) {
+      return false;
+    }
+
+    if (func (it->second) ) {
+      shard.map.erase (it);
+      count--;
+    }
+
+    return true;
+  }
+
+  bool erase (const Key &key)
+  {
+    Shard &shard = getShard (key);
+    std::unique_lock <std::mutex> lock (shard.mutex);
+
+    if (shard.map.erase (key) == 0) {
+      return false;
+    }
+
+    count--;
+    return true;
+  }
+
+  /* Removes key and moves its value out. Returns false if it is not found */
+  bool take (const Key &key, Value &value)
+  {
+    Shard &shard = getShard (key);
+    std::unique_lock <std::mutex> lock (shard.mutex);
+    auto it = shard.map.find (key);
+
+    if (it == shard.map.end() ) {
+      return false;
+    }
+
+    value = std::move (it->second);
+    shard.map.erase (it);
+    count--;
+    return true;
+  }
+
+  size_t size () const
+  {
+    return count;
+  }
+
+  /* Calls func for every entry, one shard locked at a time */
+  void forEach (std::function<void (const Key &, Value &) > func)
+  {
+    for (Shard &shard : shards) {
+      std::unique_lock <std::mutex> lock (shard.mutex);
+
+      for (auto &it : shard.map) {
+        func (it.first, it.second);
+      }
+    }
+  }
+
+  std::vector<std::pair<Key, Value>> snapshot () const
+  {
+    std::vector<std::pair<Key, Value>> ret;
+
+    for (const Shard &shard : shards) {
+      std::unique_lock <std::mutex> lock (shard.mutex);
+
+      ret.insert (ret.end(), shard.map.begin(), shard.map.end() );
+    }
+
+    return ret;
+  }
+
+  std::vector<Key> keys () const
+  {
+    std::vector<Key> ret;
+
+    for (const Shard &shard : shards) {
+      std::unique_lock <std::mutex> lock (shard.mutex);
+
+      for (auto &it : shard.map) {
+        ret.push_back (it.first);
+      }
+    }
+
+    return ret;
+  }
+
+private:
+  struct Shard {
+    mutable std::mutex mutex;
+    std::unordered_map<Key, Value> map;
+  };
+
+  Shard &getShard (const Key &key)
+  {
+    return shards[std::hash<Key> () (key) % Shards];
+  }
+
+  const Shard &getShard (const Key &key) const
+  {
+    return shards[std::hash<Key> () (key) % Shards];
+  }
+
+  std::array<Shard, Shards> shards;
+  std::atomic<size_t> count;
+};
+
+} /* kurento */
+
+#endif /* __SHARDED_MAP_HPP__ */
@@ -17,6 +17,8 @@
 #include "RTCStatsType.hpp"
 #include "RTCInboundRTPStreamStats.hpp"
 #include "RTCOutboundRTPStreamStats.hpp"
+#include "RTCEncoderStats.hpp"
+#include "RTCKeyframeRequestStats.hpp"
 
 #define GST_CAT_DEFAULT kurento_statistics
 GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
@@ -25,6 +27,8 @@ GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
 #define UUID_STR_SIZE 37 /* 36-byte string (plus tailing '\0') */
 #define KMS_STATISTIC_FIELD_PREFIX_SESSION "session-"
 #define KMS_STATISTIC_FIELD_PREFIX_SSRC "ssrc-"
+#define KMS_STATISTIC_FIELD_VIDEO_ENCODERS "video-encoders"
+#define KMS_STATISTIC_FIELD_KEYFRAME_REQUESTS "keyframe-requests"
 
 namespace kurento
 {
@@ -177,6 +181,80 @@ collectRTCRTPStreamStats (std::map <std::string, std::shared_ptr<RTCStats>>
   }
 }
 
+static std::shared_ptr<RTCEncoderStats>
+createRTCEncoderStats (const std::string &id, const GstStructure *stats)
+{
+  gint threads, speedLevel;
+  guint speedChanges;
+  gboolean adaptive;
+  gdouble encodeLoad;
+  const gchar *codec;
+
+  threads = speedLevel = 0;
+  speedChanges = 0;
+  adaptive = FALSE;
+  encodeLoad = 0.0;
+
+  gst_structure_get (stats, "threads", G_TYPE_INT, &threads, "speed-level",
+                     G_TYPE_INT, &speedLevel, "adaptive", G_TYPE_BOOLEAN, &adaptive,
+                     "encode-load", G_TYPE_DOUBLE, &encodeLoad, "speed-changes",
+                     G_TYPE_UINT, &speedChanges, NULL);
+
+  codec = gst_structure_get_string (stats, "codec");
+
+  return std::make_shared <RTCEncoderStats> (id,
+         std::make_shared <RTCStatsType> (RTCStatsType::encoder), 0.0,
+         codec != NULL ? codec : "", threads, speedLevel, adaptive, encodeLoad,
+         speedChanges);
+}
+
+static void
+collectRTCEncoderStats (std::map <std::string, std::shared_ptr<RTCStats>>
+                        &rtcStatsReport, double timestamp, const GstStructure *stats)
+{
+  gint i, n;
+
+  n = gst_structure_n_fields (stats);
+
+  for (i = 0; i < n; i++) {
+    std::shared_ptr<RTCStats> rtcStats;
+    const GValue *value;
+    const gchar *name;
+
+    name = gst_structure_nth_field_name (stats, i);
+    value = gst_structure_get_value (stats, name);
+
+    if (!GST_VALUE_HOLDS_STRUCTURE (value) ) {
+      continue;
+    }
+
+    rtcStats = createRTCEncoderStats (std::string (
+                                        KMS_STATISTIC_FIELD_VIDEO_ENCODERS) + "-" + name,
+                                      gst_value_get_structure (value) );
+    rtcStats->setTimestamp (timestamp);
+
+    rtcStatsReport[rtcStats->getId ()] = rtcStats;
+  }
+}
+
+static std::shared_ptr<RTCKeyframeRequestStats>
+createRTCKeyframeRequestStats (const GstStructure *stats)
+{
+  guint64 requests, grants, keyframes, dispersion;
+
+  requests = grants = keyframes = dispersion = G_GUINT64_CONSTANT (0);
+
+  gst_structure_get (stats, "requests", G_TYPE_UINT64, &requests, "grants",
+                     G_TYPE_UINT64, &grants, "keyframes", G_TYPE_UINT64, &keyframes,
+                     "dispersion", G_TYPE_UINT64, &dispersion, NULL);
+
+  return std::make_shared <RTCKeyframeRequestStats> (
+           KMS_STATISTIC_FIELD_KEYFRAME_REQUESTS,
+           std::make_shared <RTCStatsType> (RTCStatsType::keyframerequests), 0.0,
+           (int) requests, (int) grants, (int) keyframes,
+           (double) dispersion / GST_SECOND);
+}
+
 std::map <std::string, std::shared_ptr<RTCStats>> createRTCStatsReport (
       double timestamp, const GstStructure *stats)
 {
@@ -192,7 +270,9 @@ std::map <std::string, std::shared_ptr<RTCStats>> createRTCStatsReport (
 
     name = gst_structure_nth_field_name (stats, i);
 
-    if (!g_str_has_prefix (name, KMS_STATISTIC_FIELD_PREFIX_SESSION) ) {
+    if (!g_str_has_prefix (name, KMS_STATISTIC_FIELD_PREFIX_SESSION) &&
+        g_strcmp0 (name, KMS_STATISTIC_FIELD_VIDEO_ENCODERS) != 0 &&
+        g_strcmp0 (name, KMS_STATISTIC_FIELD_KEYFRAME_REQUESTS) != 0) {
       GST_DEBUG ("Ignoring field %s", name);
       continue;
     }
@@ -209,6 +289,19 @@ std::map <std::string, std::shared_ptr<RTCStats>> createRTCStatsReport (
       continue;
     }
 
+    if (g_strcmp0 (name, KMS_STATISTIC_FIELD_VIDEO_ENCODERS) == 0) {
+      collectRTCEncoderStats (rtcStatsReport, timestamp,
+                              gst_value_get_structure (value) );
+      continue;
+    }
+
+    if (g_strcmp0 (name, KMS_STATISTIC_FIELD_KEYFRAME_REQUESTS) == 0) {
+      rtcStats = createRTCKeyframeRequestStats (gst_value_get_structure (value) );
+      rtcStats->setTimestamp (timestamp);
+      rtcStatsReport[rtcStats->getId ()] = rtcStats;
+      continue;
+    }
+
     collectRTCRTPStreamStats (rtcStatsReport, timestamp,
                               gst_value_get_structure (value) );
   }
@@ -216,6 +309,129 @@ std::map <std::string, std::shared_ptr<RTCStats>> createRTCStatsReport (
   return rtcStatsReport;
 }
 
+static bool
+getNumericValue (const GValue *value, double &ret)
+{
+  switch (G_VALUE_TYPE (value) ) {
+  case G_TYPE_INT:
+    ret = g_value_get_int (value);
+    return true;
+
+  case G_TYPE_UINT:
+    ret = g_value_get_uint (value);
+    return true;
+
+  case G_TYPE_INT64:
+    ret = g_value_get_int64 (value);
+    return true;
+
+  case G_TYPE_UINT64:
+    ret = g_value_get_uint64 (value);
+    return true;
+
+  case G_TYPE_FLOAT:
+    ret = g_value_get_float (value);
+    return true;
+
+  case G_TYPE_DOUBLE:
+    ret = g_value_get_double (value);
+    return true;
+
+  case G_TYPE_BOOLEAN:
+    ret = g_value_get_boolean (value) ? 1 : 0;
+    return true;
+
+  default:
+    return false;
+  }
+}
+
+static void
+collectStructureValues (const std::string &id, const GstStructure *stats,
+                        std::map <std::string, double> &values,
+                        std::map <std::string, double> &changes)
+{
+  gint i, n;
+
+  n = gst_structure_n_fields (stats);
+
+  for (i = 0; i < n; i++) {
+    const gchar *name;
+    double val;
+
+    name = gst_structure_nth_field_name (stats, i);
+
+    if (!getNumericValue (gst_structure_get_value (stats, name), val) ) {
+      continue;
+    }
+
+    std::string key = id + "." + name;
+    auto it = values.find (key);
+
+    if (it == values.end () ) {
+      values[key] = val;
+      changes[key] = val;
+    } else if (it->second != val) {
+      it->second = val;
+      changes[key] = val;
+    }
+  }
+}
+
+void collectChangedValues (const GstStructure *stats,
+                           std::map <std::string, double> &values,
+                           std::map <std::string, double> &changes)
+{
+  gint i, n;
+
+  n = gst_structure_n_fields (stats);
+
+  for (i = 0; i < n; i++) {
+    const GstStructure *session;
+    const GValue *value;
+    const gchar *name;
+    gint j, m;
+
+    name = gst_structure_nth_field_name (stats, i);
+
+    if (!g_str_has_prefix (name, KMS_STATISTIC_FIELD_PREFIX_SESSION) ) {
+      continue;
+    }
+
+    value = gst_structure_get_value (stats, name);
+
+    if (!GST_VALUE_HOLDS_STRUCTURE (value) ) {
+      continue;
+    }
+
+    /* Only values of ssrcs, getStats has no object for the session */
+    session = gst_value_get_structure (value);
+    m = gst_structure_n_fields (session);
+
+    for (j = 0; j < m; j++) {
+      const GstStructure *ssrc;
+      const gchar *ssrcName, *id;
+
+      ssrcName = gst_structure_nth_field_name (session, j);
+
+      if (!g_str_has_prefix (ssrcName, KMS_STATISTIC_FIELD_PREFIX_SSRC) ) {
+        continue;
+      }
+
+      value = gst_structure_get_value (session, ssrcName);
+
+      if (!GST_VALUE_HOLDS_STRUCTURE (value) ) {
+        continue;
+      }
+
+      ssrc = gst_value_get_structure (value);
+      id = gst_structure_get_string (ssrc, "id");
+
+      collectStructureValues (id != NULL ? id : ssrcName, ssrc, values, changes);
+    }
+  }
+}
+
 } /* statistics */
 
 } /* kurento */
@@ -28,6 +28,14 @@ namespace stats
 std::map <std::string, std::shared_ptr<RTCStats>> createRTCStatsReport (
       double timestamp, const GstStructure *stats);
 
+/* Stores the numeric fields of the ssrc stats in values, keyed by the
+ * stats id and the field name as "<id>.<field>", and the ones that are new
+ * or differ from the value already stored in changes. values is meant to be
+ * kept between calls */
+void collectChangedValues (const GstStructure *stats,
+                           std::map <std::string, double> &values,
+                           std::map <std::string, double> &changes);
+
 } /* statistics */
 
 } /* kurento */
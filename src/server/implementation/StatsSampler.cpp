@@ -0,0 +1,176 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <gst/gst.h>
+
+#include "StatsSampler.hpp"
+#include <vector>
+
+#define GST_CAT_DEFAULT kurento_stats_sampler
+GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
+#define GST_DEFAULT_NAME "KurentoStatsSampler"
+
+namespace kurento
+{
+
+static std::shared_ptr<StatsSampler> sampler;
+static std::mutex samplerMutex;
+
+std::shared_ptr<StatsSampler>
+StatsSampler::getStatsSampler ()
+{
+  std::unique_lock <std::mutex> lock (samplerMutex);
+
+  if (!sampler) {
+    sampler = std::shared_ptr<StatsSampler> (new StatsSampler () );
+  }
+
+  return sampler;
+}
+
+void
+StatsSampler::shutdown ()
+{
+  std::unique_lock <std::mutex> lock (samplerMutex);
+  std::shared_ptr<StatsSampler> old = sampler;
+
+  sampler.reset();
+  lock.unlock();
+
+  /* The last reference is dropped out of the lock, joining the thread */
+  old.reset();
+}
+
+StatsSampler::StatsSampler ()
+{
+  thread = std::thread (&StatsSampler::run, this);
+}
+
+StatsSampler::~StatsSampler ()
+{
+  std::unique_lock <std::mutex> lock (mutex);
+
+  terminated = true;
+  entries.clear();
+  cond.notify_all();
+  lock.unlock();
+
+  if (std::this_thread::get_id() != thread.get_id() ) {
+    thread.join();
+  } else {
+    thread.detach();
+  }
+}
+
+void
+StatsSampler::add (const std::string &id, int interval,
+                   std::function<bool (void) > sample)
+{
+  std::unique_lock <std::mutex> lock (mutex);
+  std::chrono::milliseconds period (interval);
+
+  entries[id] = {period, Clock::now() + period, sample, ++seq};
+  cond.notify_all();
+}
+
+void
+StatsSampler::remove (const std::string &id)
+{
+  std::unique_lock <std::mutex> lock (mutex);
+
+  entries.erase (id);
+}
+
+size_t
+StatsSampler::size ()
+{
+  std::unique_lock <std::mutex> lock (mutex);
+
+  return entries.size();
+}
+
+void
+StatsSampler::run ()
+{
+  std::unique_lock <std::mutex> lock (mutex);
+
+  while (!terminated) {
+    std::vector<std::pair<std::string, Entry>> due;
+    Clock::time_point now = Clock::now();
+    Clock::time_point wakeup = Clock::time_point::max();
+
+    for (auto &it : entries) {
+      if (it.second.next <= now) {
+        due.push_back (it);
+      } else if (it.second.next < wakeup) {
+        wakeup = it.second.next;
+      }
+    }
+
+    if (due.empty() ) {
+      if (wakeup == Clock::time_point::max() ) {
+        cond.wait (lock);
+      } else {
+        cond.wait_until (lock, wakeup);
+      }
+
+      continue;
+    }
+
+    lock.unlock();
+
+    for (auto &it : due) {
+      bool keep = false;
+
+      try {
+        keep = it.second.sample();
+      } catch (...) {
+        GST_ERROR ("Error sampling stats of %s", it.first.c_str() );
+      }
+
+      lock.lock();
+
+      auto entry = entries.find (it.first);
+
+      /* Removed or replaced while sampling */
+      if (entry != entries.end() && entry->second.seq == it.second.seq) {
+        if (!keep) {
+          entries.erase (entry);
+        } else {
+          entry->second.next += entry->second.interval;
+
+          /* Do not try to catch up after a slow sample */
+          if (entry->second.next < now) {
+            entry->second.next = now + entry->second.interval;
+          }
+        }
+      }
+
+      lock.unlock();
+    }
+
+    lock.lock();
+  }
+}
+
+StatsSampler::StaticConstructor StatsSampler::staticConstructor;
+
+StatsSampler::StaticConstructor::StaticConstructor()
+{
+  GST_DEBUG_CATEGORY_INIT (GST_CAT_DEFAULT, GST_DEFAULT_NAME, 0,
+                           GST_DEFAULT_NAME);
+}
+
+} // kurento
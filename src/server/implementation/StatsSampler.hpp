@@ -0,0 +1,89 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef __STATS_SAMPLER_HPP__
+#define __STATS_SAMPLER_HPP__
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace kurento
+{
+
+/*
+ * Single timer for the periodic stats of every object. Samples run one
+ * after the other in the sampler thread, so they never reach the GLib
+ * main context.
+ */
+class StatsSampler
+{
+public:
+  ~StatsSampler ();
+
+  static std::shared_ptr<StatsSampler> getStatsSampler ();
+
+  /* Stops the sampling thread, while GStreamer is still alive */
+  static void shutdown ();
+
+  /* Calls sample every interval milliseconds until it returns false or id
+   * is removed. Adding an id again replaces its previous sample */
+  void add (const std::string &id, int interval,
+            std::function<bool (void) > sample);
+  void remove (const std::string &id);
+
+  /* Number of ids being sampled */
+  size_t size ();
+
+private:
+  typedef std::chrono::steady_clock Clock;
+
+  struct Entry {
+    std::chrono::milliseconds interval;
+    Clock::time_point next;
+    std::function<bool (void) > sample;
+    uint64_t seq;
+  };
+
+  StatsSampler ();
+
+  void run ();
+
+  std::mutex mutex;
+  std::condition_variable cond;
+  std::map<std::string, Entry> entries;
+  std::thread thread;
+
+  uint64_t seq = 0;
+  bool terminated = false;
+
+  class StaticConstructor
+  {
+  public:
+    StaticConstructor();
+  };
+
+  static StaticConstructor staticConstructor;
+};
+
+} // kurento
+
+#endif /* __STATS_SAMPLER_HPP__ */
@@ -16,55 +16,526 @@
 #include <gst/gst.h>
 
 #include "WorkerPool.hpp"
+#include <algorithm>
 #include <atomic>
+#include <chrono>
+#include <deque>
+#include <unordered_set>
 
 #define GST_CAT_DEFAULT kurento_worker_pool
 GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
 #define GST_DEFAULT_NAME "KurentoWorkerPool"
 
 const int WORKER_THREADS_TIMEOUT = 3; /* seconds */
+const int WORKER_WATCHER_INTERVAL = 1; /* seconds */
 
 namespace kurento
 {
 
+const std::vector<int64_t> WorkerPool::LATENCY_BUCKETS = {
+  100, 1000, 10000, 100000, 1000000
+};
+
+static const size_t LATENCY_BUCKETS_COUNT = 6;
+
+typedef std::chrono::steady_clock Clock;
+
+static int64_t
+nowUsecs ()
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>
+         (Clock::now().time_since_epoch() ).count();
+}
+
+struct Task {
+  std::function<void (void) > func;
+  int64_t queued;
+  std::string affinity;
+  /* Worker whose ordered queue the task came from, -1 if it had none */
+  int owner;
+};
+
+struct Worker {
+  std::mutex mutex;
+  /* Tasks without affinity, other workers can steal them */
+  std::deque<Task> local;
+  /* Tasks with affinity, run in order and one at a time per affinity */
+  std::deque<Task> pinned;
+  std::atomic<uint64_t> pinnedCount;
+  /* Affinities of the pinned tasks being run right now */
+  std::unordered_set<std::string> running;
+  /* Time when the current task started, 0 if idle */
+  std::atomic<int64_t> busySince;
+  /* Set by the watcher while the current task takes too long, other
+   * workers may run pinned tasks of different affinities meanwhile */
+  std::atomic<bool> blocked;
+
+  Worker () : pinnedCount (0), busySince (0), blocked (false) {}
+};
+
+class WorkerPool::Scheduler
+{
+public:
+  Scheduler (int threads, int maxThreads);
+
+  void push (Task task, int index, bool pin);
+  int chooseWorker ();
+  int affineWorker (const std::string &affinity);
+
+  void run (int index);
+  void spawn ();
+  void terminate ();
+  void drain ();
+  void checkBlocked ();
+  std::vector<std::thread> takeThreads ();
+
+  void fillStats (Stats &stats);
+
+  std::shared_ptr<Scheduler> self;
+
+private:
+  bool popPinned (int index, Task &task);
+  bool pop (int index, Task &task);
+  void execute (int index, Task &task);
+  void finishPinned (int index, Task &task);
+  void wake (bool all);
+
+  int base;
+  int maxThreads;
+  std::vector<std::unique_ptr<Worker>> workers;
+  std::atomic<int> active;
+
+  std::atomic<uint64_t> stealable;
+  /* Changes every time there may be new work, sleeping workers wait for it */
+  std::atomic<uint64_t> generation;
+  std::atomic<uint64_t> next;
+  std::atomic<uint64_t> executed;
+  std::atomic<uint64_t> steals;
+  std::atomic<uint64_t> latency[LATENCY_BUCKETS_COUNT];
+
+  std::mutex sleepMutex;
+  std::condition_variable sleepCond;
+  std::atomic<bool> terminated;
+
+  std::mutex threadsMutex;
+  std::vector<std::thread> threads;
+};
+
+static thread_local WorkerPool::Scheduler *currentScheduler = nullptr;
+static thread_local int currentIndex = -1;
+
 static void
-workerThreadLoop ( boost::shared_ptr< boost::asio::io_service > io_service )
+workerThreadLoop (std::shared_ptr<WorkerPool::Scheduler> scheduler, int index)
 {
-  bool running = true;
+  GST_DEBUG ("Working thread %d starting", index);
+  scheduler->run (index);
+  GST_DEBUG ("Working thread %d finished", index);
+}
 
-  while (running) {
-    try {
-      GST_DEBUG ("Working thread starting");
-      io_service->run();
-      running = false;
-    } catch (std::exception &e) {
-      GST_ERROR ("Unexpected error while running the server: %s", e.what() );
-    } catch (...) {
-      GST_ERROR ("Unexpected error while running the server");
+WorkerPool::Scheduler::Scheduler (int threads, int maxThreads) :
+  base (threads), maxThreads (maxThreads), active (0), stealable (0),
+  generation (0), next (0), executed (0), steals (0), terminated (false)
+{
+  for (int i = 0; i < maxThreads; i++) {
+    workers.push_back (std::unique_ptr<Worker> (new Worker () ) );
+  }
+
+  for (size_t i = 0; i < LATENCY_BUCKETS_COUNT; i++) {
+    latency[i] = 0;
+  }
+}
+
+void
+WorkerPool::Scheduler::push (Task task, int index, bool pin)
+{
+  Worker &worker = *workers[index];
+
+  std::unique_lock <std::mutex> lock (worker.mutex);
+
+  if (pin) {
+    worker.pinned.push_back (std::move (task) );
+    worker.pinnedCount++;
+  } else {
+    worker.local.push_back (std::move (task) );
+    stealable++;
+  }
+
+  lock.unlock();
+
+  wake (pin);
+}
+
+void
+WorkerPool::Scheduler::wake (bool all)
+{
+  generation++;
+
+  /* Sleeping workers check the generation with sleepMutex held */
+  std::unique_lock <std::mutex> sleepLock (sleepMutex);
+  sleepLock.unlock();
+
+  if (all) {
+    sleepCond.notify_all();
+  } else {
+    sleepCond.notify_one();
+  }
+}
+
+int
+WorkerPool::Scheduler::chooseWorker ()
+{
+  if (currentScheduler == this) {
+    return currentIndex;
+  }
+
+  return next++ % base;
+}
+
+int
+WorkerPool::Scheduler::affineWorker (const std::string &affinity)
+{
+  return std::hash<std::string> () (affinity) % base;
+}
+
+/* Takes the oldest pinned task of the worker whose affinity is not already
+ * running. Called with the worker mutex held */
+bool
+WorkerPool::Scheduler::popPinned (int index, Task &task)
+{
+  Worker &worker = *workers[index];
+
+  for (auto it = worker.pinned.begin(); it != worker.pinned.end(); it++) {
+    if (worker.running.find (it->affinity) != worker.running.end() ) {
+      continue;
+    }
+
+    task = std::move (*it);
+    task.owner = index;
+    worker.pinned.erase (it);
+    worker.pinnedCount--;
+    worker.running.insert (task.affinity);
+
+    return true;
+  }
+
+  return false;
+}
+
+bool
+WorkerPool::Scheduler::pop (int index, Task &task)
+{
+  Worker &worker = *workers[index];
+  int n = active;
+
+  std::unique_lock <std::mutex> lock (worker.mutex);
+
+  if (popPinned (index, task) ) {
+    return true;
+  }
+
+  /* The owner takes the oldest task to keep latency bounded, thieves take
+   * from the other end */
+  if (!worker.local.empty() ) {
+    task = std::move (worker.local.front() );
+    worker.local.pop_front();
+    stealable--;
+    return true;
+  }
+
+  lock.unlock();
+
+  for (int i = 1; i < n; i++) {
+    Worker &victim = *workers[ (index + i) % n];
+    std::unique_lock <std::mutex> victimLock (victim.mutex);
+
+    if (!victim.local.empty() ) {
+      task = std::move (victim.local.back() );
+      victim.local.pop_back();
+      stealable--;
+      steals++;
+      return true;
     }
   }
 
-  GST_DEBUG ("Working thread finished");
+  /* A blocked worker only holds back the tasks sharing its affinity */
+  for (int i = 1; i < n; i++) {
+    int victimIndex = (index + i) % n;
+    Worker &victim = *workers[victimIndex];
+
+    if (!victim.blocked || victim.pinnedCount == 0) {
+      continue;
+    }
+
+    std::unique_lock <std::mutex> victimLock (victim.mutex);
+
+    if (popPinned (victimIndex, task) ) {
+      steals++;
+      return true;
+    }
+  }
+
+  return false;
 }
 
-WorkerPool::WorkerPool (int threads)
+void
+WorkerPool::Scheduler::finishPinned (int index, Task &task)
 {
-  /* Prepare watcher */
-  watcher_service = boost::shared_ptr< boost::asio::io_service >
-                    ( new boost::asio::io_service () );
-  watcher_work = std::shared_ptr< boost::asio::io_service::work >
-                 ( new boost::asio::io_service::work (*watcher_service) );
-  watcher = std::thread (std::bind (&workerThreadLoop, watcher_service) );
+  Worker &owner = *workers[task.owner];
+  bool pending;
 
-  /* Prepare pool of threads */
-  io_service = boost::shared_ptr< boost::asio::io_service >
-               ( new boost::asio::io_service () );
-  work = std::shared_ptr< boost::asio::io_service::work >
-         ( new boost::asio::io_service::work (*io_service) );
+  std::unique_lock <std::mutex> lock (owner.mutex);
+  owner.running.erase (task.affinity);
+  pending = !owner.pinned.empty();
+  lock.unlock();
+
+  /* Tasks of the same affinity may be waiting for this one to finish */
+  if (pending && task.owner != index) {
+    wake (true);
+  }
+}
+
+void
+WorkerPool::Scheduler::execute (int index, Task &task)
+{
+  Worker &worker = *workers[index];
+
+  int64_t start = nowUsecs();
+  int64_t wait = start - task.queued;
+  size_t bucket = 0;
+
+  while (bucket < LATENCY_BUCKETS.size() && wait >= LATENCY_BUCKETS[bucket]) {
+    bucket++;
+  }
+
+  latency[bucket]++;
+  worker.busySince = start;
+
+  try {
+    task.func();
+  } catch (std::exception &e) {
+    GST_ERROR ("Unexpected error while running a task: %s", e.what() );
+  } catch (...) {
+    GST_ERROR ("Unexpected error while running a task");
+  }
+
+  worker.busySince = 0;
+  worker.blocked = false;
+  executed++;
+
+  if (task.owner >= 0) {
+    finishPinned (index, task);
+  }
+}
+
+void
+WorkerPool::Scheduler::run (int index)
+{
+  currentScheduler = this;
+  currentIndex = index;
+
+  while (!terminated) {
+    uint64_t seen = generation;
+    Task task;
+
+    if (pop (index, task) ) {
+      execute (index, task);
+      continue;
+    }
+
+    std::unique_lock <std::mutex> lock (sleepMutex);
+
+    sleepCond.wait (lock, [&] () {
+      return terminated || generation != seen;
+    });
+  }
+
+  currentScheduler = nullptr;
+  currentIndex = -1;
+}
+
+void
+WorkerPool::Scheduler::spawn ()
+{
+  std::unique_lock <std::mutex> lock (threadsMutex);
+  int index = active;
+
+  if (terminated || index >= maxThreads) {
+    return;
+  }
+
+  active++;
+  threads.push_back (std::thread (std::bind (&workerThreadLoop, self,
+                                  index) ) );
+}
+
+void
+WorkerPool::Scheduler::terminate ()
+{
+  std::unique_lock <std::mutex> lock (sleepMutex);
+
+  terminated = true;
+  lock.unlock();
+
+  sleepCond.notify_all();
+}
+
+std::vector<std::thread>
+WorkerPool::Scheduler::takeThreads ()
+{
+  std::unique_lock <std::mutex> lock (threadsMutex);
+  std::vector<std::thread> ret;
+
+  ret.swap (threads);
+
+  return ret;
+}
+
+void
+WorkerPool::Scheduler::drain ()
+{
+  bool pending = true;
+
+  /* Tasks may post new tasks while draining */
+  while (pending) {
+    pending = false;
+
+    for (int i = 0; i < maxThreads; i++) {
+      Task task;
+
+      while (pop (i, task) ) {
+        execute (i, task);
+        pending = true;
+      }
+    }
+  }
+
+  self.reset();
+}
+
+void
+WorkerPool::Scheduler::checkBlocked ()
+{
+  int64_t limit = nowUsecs() - WORKER_THREADS_TIMEOUT * G_USEC_PER_SEC;
+  int n = active;
+  int blocked = 0, idle = 0;
+  uint64_t runnable = 0;
+
+  for (int i = 0; i < n; i++) {
+    Worker &worker = *workers[i];
+    int64_t busySince = worker.busySince;
+
+    if (busySince == 0) {
+      idle++;
+      continue;
+    }
+
+    if (busySince > limit) {
+      continue;
+    }
+
+    blocked++;
+    worker.blocked = true;
+
+    if (worker.busySince != busySince) {
+      /* Finished meanwhile */
+      worker.blocked = false;
+      continue;
+    }
+
+    if (worker.pinnedCount == 0) {
+      continue;
+    }
+
+    std::unique_lock <std::mutex> lock (worker.mutex);
+    uint64_t held = 0;
+
+    for (const Task &task : worker.pinned) {
+      if (worker.running.find (task.affinity) == worker.running.end() ) {
+        runnable++;
+      } else {
+        held++;
+      }
+    }
+
+    lock.unlock();
+
+    GST_WARNING ("Worker %d blocked with %" G_GUINT64_FORMAT
+                 " ordered tasks pending, %" G_GUINT64_FORMAT
+                 " of them waiting for the blocked one", i,
+                 (guint64) worker.pinnedCount, (guint64) held);
+  }
+
+  if (blocked == 0) {
+    return;
+  }
+
+  if (runnable > 0) {
+    /* Idle workers take the ordered tasks the blocked ones cannot run */
+    wake (true);
+  }
+
+  if (stealable == 0 && (runnable == 0 || idle > 0) ) {
+    return;
+  }
+
+  if (n < maxThreads) {
+    GST_WARNING ("Worker threads locked. Spawning a new one.");
+    spawn ();
+  } else {
+    GST_WARNING ("Worker threads locked, limit of %d threads reached",
+                 maxThreads);
+  }
+}
+
+void
+WorkerPool::Scheduler::fillStats (Stats &stats)
+{
+  stats.threads = active;
+  stats.maxThreads = maxThreads;
+  stats.queueDepth = stealable;
+  stats.executed = executed;
+  stats.steals = steals;
+
+  for (int i = 0; i < maxThreads; i++) {
+    stats.queueDepth += workers[i]->pinnedCount;
+  }
+
+  stats.latency.clear();
+
+  for (size_t i = 0; i < LATENCY_BUCKETS_COUNT; i++) {
+    stats.latency.push_back (latency[i]);
+  }
+}
+
+WorkerPool::WorkerPool (int threads, int maxThreads)
+{
+  threads = std::max (threads, 1);
+  maxThreads = std::max (threads, maxThreads);
+
+  scheduler = std::make_shared<Scheduler> (threads, maxThreads);
+  /* Threads keep the scheduler alive in case the pool is destroyed from one
+   * of them */
+  scheduler->self = scheduler;
 
   for (int i = 0; i < threads; i++) {
-    workers.push_back (std::thread (std::bind (&workerThreadLoop, io_service) ) );
+    scheduler->spawn ();
   }
+
+  watcher = std::thread ( [this] () {
+    std::unique_lock <std::mutex> lock (mutex);
+
+    while (!terminated) {
+      cond.wait_for (lock, std::chrono::seconds (WORKER_WATCHER_INTERVAL) );
+
+      if (terminated) {
+        break;
+      }
+
+      lock.unlock();
+      checkWorkers();
+      lock.lock();
+    }
+  });
 }
 
 WorkerPool::~WorkerPool()
@@ -73,8 +544,8 @@ WorkerPool::~WorkerPool()
   terminated = true ;
   lock.unlock();
 
-  watcher_service->stop();
-  io_service->stop();
+  cond.notify_all();
+  scheduler->terminate();
 
   try {
     if (std::this_thread::get_id() != watcher.get_id() ) {
@@ -92,6 +563,8 @@ WorkerPool::~WorkerPool()
     GST_ERROR ("Error detaching: %s", e.what() );
   }
 
+  std::vector<std::thread> workers = scheduler->takeThreads();
+
   for (uint i = 0; i < workers.size (); i++) {
     try {
       if (std::this_thread::get_id() != workers[i].get_id() ) {
@@ -110,60 +583,39 @@ WorkerPool::~WorkerPool()
     }
   }
 
-  workers.empty();
-
   // Executing queued tasks
-  io_service->reset();
-
-  while (io_service->poll() ) {
-  }
+  scheduler->drain();
 }
 
-static void
-async_worker_test (std::shared_ptr<std::atomic<bool>> alive)
+void
+WorkerPool::post (std::function<void (void) > task)
 {
-  *alive = true;
+  scheduler->push ({task, nowUsecs(), "", -1}, scheduler->chooseWorker(),
+                   false);
 }
 
 void
-WorkerPool::checkWorkers ()
+WorkerPool::post (std::function<void (void) > task,
+                  const std::string &affinity)
 {
-  std::shared_ptr<std::atomic<bool>> alive;
-
-  alive = std::shared_ptr<std::atomic<bool>> ( new std::atomic<bool> (false) );
-
-  io_service->post (std::bind (&async_worker_test, alive) );
-
-  boost::shared_ptr< boost::asio::deadline_timer > timer (
-    new boost::asio::deadline_timer ( *watcher_service ) );
-
-  timer->expires_from_now ( boost::posix_time::seconds (
-                              WORKER_THREADS_TIMEOUT) );
-  timer->async_wait ( [timer, alive,
-  this] (const boost::system::error_code & error) {
-    if (error) {
-      GST_ERROR ("ERROR: %s", error.message().c_str() );
-      return;
-    }
-
-    if (*alive) {
-      return;
-    }
+  scheduler->push ({task, nowUsecs(), affinity, -1},
+                   scheduler->affineWorker (affinity), true);
+}
 
-    GST_WARNING ("Worker threads locked. Spawning a new one.");
+WorkerPool::Stats
+WorkerPool::getStats ()
+{
+  Stats stats;
 
-    std::unique_lock <std::mutex> lock (mutex);
+  scheduler->fillStats (stats);
 
-    if (!terminated) {
-      workers.push_back (std::thread (std::bind (&workerThreadLoop, io_service) ) );
-    }
-  });
+  return stats;
 }
 
 void
-WorkerPool::setWatcher ()
+WorkerPool::checkWorkers ()
 {
-  watcher_service->post (std::bind (&WorkerPool::checkWorkers, this) );
+  scheduler->checkBlocked();
 }
 
 WorkerPool::StaticConstructor WorkerPool::staticConstructor;
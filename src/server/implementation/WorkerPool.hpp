@@ -16,40 +16,64 @@
 #ifndef __WORKERPOOL_HPP__
 #define __WORKERPOOL_HPP__
 
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
 #include <mutex>
+#include <string>
 #include <thread>
-#include <boost/asio.hpp>
+#include <vector>
 
 namespace kurento
 {
 
+/*
+ * Work stealing pool. Every thread owns a deque of tasks: tasks posted
+ * from a worker go to its own deque and idle workers steal from the others.
+ *
+ * Tasks posted with an affinity key are queued in the same worker and run
+ * in the same order they were posted, never two of the same key at once.
+ * This is used to keep the tasks of one pipeline ordered.
+ *
+ * When a worker is blocked for too long, the other workers run the tasks of
+ * its queue that have a different key, and the pool spawns helper threads
+ * up to maxThreads if none of them is idle.
+ */
 class WorkerPool
 {
 public:
-  WorkerPool (int threads);
+  /* Upper bounds, in microseconds, of the queue latency histogram buckets.
+   * Stats::latency has an extra bucket for longer waits */
+  static const std::vector<int64_t> LATENCY_BUCKETS;
+
+  struct Stats {
+    int threads;
+    int maxThreads;
+    uint64_t queueDepth;
+    uint64_t executed;
+    uint64_t steals;
+    std::vector<uint64_t> latency;
+  };
+
+  WorkerPool (int threads, int maxThreads = 0);
   ~WorkerPool();
 
-  template <typename CompletionHandler>
-  BOOST_ASIO_INITFN_RESULT_TYPE (CompletionHandler, void () )
-  post (BOOST_ASIO_MOVE_ARG (CompletionHandler) handler)
-  {
-    setWatcher();
-    return io_service->post (handler);
-  }
+  void post (std::function<void (void) > task);
+  void post (std::function<void (void) > task, const std::string &affinity);
+
+  Stats getStats ();
+
+  class Scheduler;
 
 private:
-  void setWatcher();
   void checkWorkers();
 
-  boost::shared_ptr< boost::asio::io_service > io_service;
-  std::shared_ptr< boost::asio::io_service::work > work;
-  std::vector<std::thread> workers;
+  std::shared_ptr<Scheduler> scheduler;
 
-  boost::shared_ptr< boost::asio::io_service > watcher_service;
-  std::shared_ptr< boost::asio::io_service::work > watcher_work;
   std::thread watcher;
-
   std::mutex mutex;
+  std::condition_variable cond;
 
   bool terminated = false;
 
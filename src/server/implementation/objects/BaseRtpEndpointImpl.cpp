@@ -6,9 +6,11 @@
 #include <KurentoException.hpp>
 #include <MediaState.hpp>
 #include <time.h>
+#include <algorithm>
 #include <SignalHandler.hpp>
 
 #include "Statistics.hpp"
+#include "StatsSampler.hpp"
 
 #define GST_CAT_DEFAULT kurento_base_rtp_endpoint_impl
 GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
@@ -17,6 +19,8 @@ GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
 #define KMS_MEDIA_DISCONNECTED 0
 #define KMS_MEDIA_CONNECTED 1
 
+#define MIN_STATS_INTERVAL 100 /* ms */
+
 namespace kurento
 {
 void BaseRtpEndpointImpl::postConstructor ()
@@ -43,6 +47,8 @@ BaseRtpEndpointImpl::BaseRtpEndpointImpl (const boost::property_tree::ptree
                   (MediaState::DISCONNECTED);
 
   stateChangedHandlerId = 0;
+  statsInterval = 0;
+  statsGeneration = 0;
 }
 
 BaseRtpEndpointImpl::~BaseRtpEndpointImpl ()
@@ -50,6 +56,10 @@ BaseRtpEndpointImpl::~BaseRtpEndpointImpl ()
   if (stateChangedHandlerId > 0) {
     unregister_signal_handler (element, stateChangedHandlerId);
   }
+
+  if (statsInterval > 0) {
+    StatsSampler::getStatsSampler ()->remove (getId () );
+  }
 }
 
 void
@@ -115,6 +125,20 @@ void BaseRtpEndpointImpl::setMaxVideoSendBandwidth (int maxVideoSendBandwidth)
   g_object_set (element, "max-video-send-bandwidth", maxVideoSendBandwidth, NULL);
 }
 
+bool BaseRtpEndpointImpl::getDelayBasedBwe ()
+{
+  gboolean delayBasedBwe;
+
+  g_object_get (element, "delay-based-bwe", &delayBasedBwe, NULL);
+
+  return delayBasedBwe;
+}
+
+void BaseRtpEndpointImpl::setDelayBasedBwe (bool delayBasedBwe)
+{
+  g_object_set (element, "delay-based-bwe", delayBasedBwe, NULL);
+}
+
 std::map <std::string, std::shared_ptr<RTCStats>>
     BaseRtpEndpointImpl::getStats ()
 {
@@ -130,6 +154,80 @@ std::map <std::string, std::shared_ptr<RTCStats>>
   return rtcStatsReport;
 }
 
+void
+BaseRtpEndpointImpl::sampleStats ()
+{
+  std::unique_lock<std::recursive_mutex> lock (mutex);
+  GstStructure *stats;
+
+  /* Only RTP sessions with RTCP since the previous sample are collected */
+  g_signal_emit_by_name (getGstreamerElement(), "changed-stats",
+                         statsGeneration, &stats);
+
+  gst_structure_get_uint (stats, "generation", &statsGeneration);
+
+  statsChanges.clear ();
+  stats::collectChangedValues (stats, statsValues, statsChanges);
+  gst_structure_free (stats);
+
+  if (statsChanges.empty () ) {
+    return;
+  }
+
+  StatsChanged event (shared_from_this(), StatsChanged::getName (),
+                      g_get_real_time () / (double) G_USEC_PER_SEC, statsChanges);
+
+  lock.unlock ();
+
+  signalStatsChanged (event);
+}
+
+int BaseRtpEndpointImpl::getStatsInterval ()
+{
+  std::unique_lock<std::recursive_mutex> lock (mutex);
+
+  return statsInterval;
+}
+
+void BaseRtpEndpointImpl::setStatsInterval (int statsInterval)
+{
+  std::unique_lock<std::recursive_mutex> lock (mutex);
+
+  StatsSampler::getStatsSampler ()->remove (getId () );
+
+  if (statsInterval > 0 && statsInterval < MIN_STATS_INTERVAL) {
+    GST_WARNING ("Stats interval %d too small, using %d ms", statsInterval,
+                 MIN_STATS_INTERVAL);
+    statsInterval = MIN_STATS_INTERVAL;
+  }
+
+  this->statsInterval = std::max (statsInterval, 0);
+
+  /* First sample after a change reports every value */
+  statsValues.clear ();
+  statsGeneration = 0;
+
+  if (this->statsInterval == 0) {
+    return;
+  }
+
+  std::weak_ptr<BaseRtpEndpointImpl> weak =
+    std::dynamic_pointer_cast<BaseRtpEndpointImpl> (shared_from_this() );
+
+  StatsSampler::getStatsSampler ()->add (getId (), this->statsInterval,
+  [weak] () {
+    std::shared_ptr<BaseRtpEndpointImpl> self = weak.lock ();
+
+    if (!self) {
+      return false;
+    }
+
+    self->sampleStats ();
+
+    return true;
+  });
+}
+
 std::shared_ptr<MediaState>
 BaseRtpEndpointImpl::getMediaState ()
 {
@@ -44,7 +44,14 @@ public:
 
   virtual std::map <std::string, std::shared_ptr<RTCStats>> getStats ();
 
+  virtual int getStatsInterval ();
+  virtual void setStatsInterval (int statsInterval);
+
+  virtual bool getDelayBasedBwe ();
+  virtual void setDelayBasedBwe (bool delayBasedBwe);
+
   sigc::signal<void, MediaStateChanged> signalMediaStateChanged;
+  sigc::signal<void, StatsChanged> signalStatsChanged;
 
   /* Next methods are automatically implemented by code generator */
   virtual bool connect (const std::string &eventType,
@@ -66,6 +73,15 @@ private:
 
   void updateState (guint new_state);
 
+  int statsInterval;
+  /* Stats generation of the element at the previous sample */
+  guint statsGeneration;
+  /* Kept between samples to find out the changed values */
+  std::map <std::string, double> statsValues;
+  std::map <std::string, double> statsChanges;
+
+  void sampleStats ();
+
   class StaticConstructor
   {
   public:
@@ -73,7 +89,6 @@ private:
   };
 
   static StaticConstructor staticConstructor;
-
 };
 
 } /* kurento */
@@ -12,15 +12,20 @@
 #include <MediaSet.hpp>
 #include <gst/gst.h>
 #include <ElementConnectionData.hpp>
+#include <ElementConnectionResult.hpp>
 #include "kmselement.h"
 #include <DotGraph.hpp>
 #include <GstreamerDotDetails.hpp>
+#include <Reaper.hpp>
 
 #define GST_CAT_DEFAULT kurento_media_element_impl
 GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
 #define GST_DEFAULT_NAME "KurentoMediaElementImpl"
 
 #define TARGET_BITRATE "output-bitrate"
+#define ENCODER_CONFIG "encoder-config"
+#define SHARED_FAN_OUT "shared-fan-out"
+#define GOP_CACHE "gop-cache"
 
 namespace kurento
 {
@@ -365,11 +370,45 @@ MediaElementImpl::MediaElementImpl (const boost::property_tree::ptree &config,
   } catch (boost::property_tree::ptree_error &e) {
   }
 
+  //read default configuration for video encoders
+  if (g_object_class_find_property (G_OBJECT_GET_CLASS (element),
+                                    ENCODER_CONFIG) != NULL) {
+    GstStructure *encoderConfig;
+
+    encoderConfig = gst_structure_new ("encoder-config",
+                                       "threads", G_TYPE_INT,
+                                       getConfigValue<int, MediaElement> ("encoderThreads", 0),
+                                       "max-threads", G_TYPE_INT,
+                                       getConfigValue<int, MediaElement> ("encoderMaxThreads", 4),
+                                       "speed", G_TYPE_INT,
+                                       getConfigValue<int, MediaElement> ("encoderSpeed", -1),
+                                       "adaptive", G_TYPE_BOOLEAN,
+                                       getConfigValue<bool, MediaElement> ("encoderAdaptive", true),
+                                       "layers", G_TYPE_INT,
+                                       getConfigValue<int, MediaElement> ("encoderLayers", 0),
+                                       NULL);
+    g_object_set (G_OBJECT (element), ENCODER_CONFIG, encoderConfig, NULL);
+    gst_structure_free (encoderConfig);
+  }
+
+  if (g_object_class_find_property (G_OBJECT_GET_CLASS (element),
+                                    SHARED_FAN_OUT) != NULL) {
+    g_object_set (G_OBJECT (element), SHARED_FAN_OUT,
+                  getConfigValue<bool, MediaElement> ("sharedFanOut", false), NULL);
+  }
+
+  if (g_object_class_find_property (G_OBJECT_GET_CLASS (element),
+                                    GOP_CACHE) != NULL) {
+    g_object_set (G_OBJECT (element), GOP_CACHE,
+                  getConfigValue<bool, MediaElement> ("gopCache", false), NULL);
+  }
 }
 
 MediaElementImpl::~MediaElementImpl ()
 {
   std::shared_ptr<MediaPipelineImpl> pipe;
+  GstElement *gstElement = element;
+  GstBin *bin;
 
   GST_LOG ("Deleting media element %s", getName().c_str () );
 
@@ -377,15 +416,20 @@ MediaElementImpl::~MediaElementImpl ()
 
   pipe = std::dynamic_pointer_cast<MediaPipelineImpl> (getMediaPipeline() );
 
-  gst_element_send_event (element, gst_event_new_eos () );
-  gst_element_set_locked_state (element, TRUE);
-  gst_element_set_state (element, GST_STATE_NULL);
-  gst_bin_remove (GST_BIN ( pipe->getPipeline() ), element);
-  g_signal_handler_disconnect (element, padAddedHandlerId);
-  g_object_unref (element);
-
+  g_signal_handler_disconnect (gstElement, padAddedHandlerId);
   g_signal_handler_disconnect (bus, handlerId);
   g_object_unref (bus);
+
+  /* Runs before the teardown of the pipeline, both use its id as key */
+  bin = GST_BIN (gst_object_ref (pipe->getPipeline() ) );
+  Reaper::getReaper ()->post (getId (), pipe->getId (), [gstElement, bin] () {
+    gst_element_send_event (gstElement, gst_event_new_eos () );
+    gst_element_set_locked_state (gstElement, TRUE);
+    gst_element_set_state (gstElement, GST_STATE_NULL);
+    gst_bin_remove (bin, gstElement);
+    g_object_unref (gstElement);
+    gst_object_unref (bin);
+  });
 }
 
 void
@@ -607,8 +651,6 @@ void MediaElementImpl::connect (std::shared_ptr<MediaElement> sink,
                                 const std::string &sourceMediaDescription,
                                 const std::string &sinkMediaDescription)
 {
-  KmsElementPadType type;
-  gchar *padName;
   std::shared_ptr<MediaElementImpl> sinkImpl =
     std::dynamic_pointer_cast<MediaElementImpl> (sink);
 
@@ -619,6 +661,115 @@ void MediaElementImpl::connect (std::shared_ptr<MediaElement> sink,
 
   std::unique_lock<std::recursive_timed_mutex> lock (sinksMutex);
   std::unique_lock<std::recursive_timed_mutex> sinkLock (sinkImpl->sourcesMutex);
+
+  connectLocked (sink, mediaType, sourceMediaDescription, sinkMediaDescription);
+
+  sinkLock.unlock();
+  lock.unlock ();
+
+  ElementConnected elementConnected (shared_from_this(),
+                                     ElementConnected::getName (),
+                                     sink, mediaType, sourceMediaDescription,
+                                     sinkMediaDescription);
+  signalElementConnected (elementConnected);
+}
+
+static std::vector<std::shared_ptr<MediaType>>
+getConnectionTypes (std::shared_ptr<MediaType> mediaType)
+{
+  std::vector<std::shared_ptr<MediaType>> types;
+
+  if (mediaType) {
+    types.push_back (mediaType);
+  } else {
+    // Until mediaDescriptions are really used, we just connect audio an video
+    types.push_back (std::shared_ptr<MediaType> (new MediaType (
+                       MediaType::AUDIO) ) );
+    types.push_back (std::shared_ptr<MediaType> (new MediaType (
+                       MediaType::VIDEO) ) );
+  }
+
+  return types;
+}
+
+std::vector<std::shared_ptr<ElementConnectionResult>>
+    MediaElementImpl::connectMany (std::vector<std::shared_ptr<MediaElement>>
+                                   sinks)
+{
+  return connectMany (sinks, std::shared_ptr<MediaType> () );
+}
+
+std::vector<std::shared_ptr<ElementConnectionResult>>
+    MediaElementImpl::connectMany (std::vector<std::shared_ptr<MediaElement>>
+                                   sinks, std::shared_ptr<MediaType> mediaType)
+{
+  std::vector<std::shared_ptr<ElementConnectionResult>> ret;
+  std::vector<std::shared_ptr<MediaType>> types = getConnectionTypes (mediaType);
+  std::vector<ElementConnected> events;
+  std::string pipelineId = getMediaPipeline ()->getId ();
+
+  std::unique_lock<std::recursive_timed_mutex> lock (sinksMutex);
+
+  /* New outputs are configured at once when the batch ends */
+  g_signal_emit_by_name (getGstreamerElement (), "begin-batch");
+
+  for (auto sink : sinks) {
+    std::shared_ptr<MediaElementImpl> sinkImpl =
+      std::dynamic_pointer_cast<MediaElementImpl> (sink);
+
+    if (!sinkImpl) {
+      /* Keep results in the same order as the sinks */
+      for (auto type : types) {
+        ret.push_back (std::make_shared <ElementConnectionResult> (sink, type,
+                       false, "Sink not available") );
+      }
+
+      continue;
+    }
+
+    std::unique_lock<std::recursive_timed_mutex> sinkLock (sinkImpl->sourcesMutex);
+
+    for (auto type : types) {
+      try {
+        if (sinkImpl->getMediaPipeline ()->getId () != pipelineId) {
+          throw KurentoException (CONNECT_ERROR,
+                                  "Media elements does not share pipeline");
+        }
+
+        connectLocked (sink, type, "", "");
+        events.push_back (ElementConnected (shared_from_this(),
+                                            ElementConnected::getName (), sink, type, "", "") );
+        ret.push_back (std::make_shared <ElementConnectionResult> (sink, type,
+                       true, "") );
+      } catch (KurentoException &e) {
+        GST_WARNING ("Cannot connect %s -> %s: %s", getName().c_str(),
+                     sink->getName ().c_str (), e.getMessage ().c_str () );
+        ret.push_back (std::make_shared <ElementConnectionResult> (sink, type,
+                       false, e.getMessage () ) );
+      }
+    }
+  }
+
+  g_signal_emit_by_name (getGstreamerElement (), "end-batch");
+  lock.unlock ();
+
+  for (auto event : events) {
+    signalElementConnected (event);
+  }
+
+  return ret;
+}
+
+/* Requires sinksMutex and the sourcesMutex of sink to be locked */
+void MediaElementImpl::connectLocked (std::shared_ptr<MediaElement> sink,
+                                      std::shared_ptr<MediaType> mediaType,
+                                      const std::string &sourceMediaDescription,
+                                      const std::string &sinkMediaDescription)
+{
+  KmsElementPadType type;
+  gchar *padName;
+  std::shared_ptr<MediaElementImpl> sinkImpl =
+    std::dynamic_pointer_cast<MediaElementImpl> (sink);
   std::vector <std::shared_ptr <ElementConnectionData>> connections;
   std::shared_ptr <ElementConnectionDataInternal> connectionData (
     new ElementConnectionDataInternal (std::dynamic_pointer_cast<MediaElement>
@@ -656,15 +807,6 @@ void MediaElementImpl::connect (std::shared_ptr<MediaElement> sink,
   sinkImpl->sources[mediaType][sinkMediaDescription] = connectionData;
 
   performConnection (connectionData);
-
-  sinkLock.unlock();
-  lock.unlock ();
-
-  ElementConnected elementConnected (shared_from_this(),
-                                     ElementConnected::getName (),
-                                     sink, mediaType, sourceMediaDescription,
-                                     sinkMediaDescription);
-  signalElementConnected (elementConnected);
 }
 
 void
@@ -746,8 +888,85 @@ void MediaElementImpl::disconnect (std::shared_ptr<MediaElement> sink,
   std::unique_lock<std::recursive_timed_mutex> sinkLock (sinkImpl->sourcesMutex);
   std::unique_lock<std::recursive_timed_mutex> lock (sinksMutex);
 
+  disconnectLocked (sinkImpl, mediaType, sourceMediaDescription,
+                    sinkMediaDescription);
+
+  sinkLock.unlock();
+  lock.unlock ();
+
+  ElementDisconnected elementDisconnected (shared_from_this(),
+      ElementDisconnected::getName (),
+      sink, mediaType, sourceMediaDescription,
+      sinkMediaDescription);
+  signalElementDisconnected (elementDisconnected);
+}
+
+std::vector<std::shared_ptr<ElementConnectionResult>>
+    MediaElementImpl::disconnectMany (std::vector<std::shared_ptr<MediaElement>>
+                                      sinks)
+{
+  return disconnectMany (sinks, std::shared_ptr<MediaType> () );
+}
+
+std::vector<std::shared_ptr<ElementConnectionResult>>
+    MediaElementImpl::disconnectMany (std::vector<std::shared_ptr<MediaElement>>
+                                      sinks, std::shared_ptr<MediaType> mediaType)
+{
+  std::vector<std::shared_ptr<ElementConnectionResult>> ret;
+  std::vector<std::shared_ptr<MediaType>> types = getConnectionTypes (mediaType);
+  std::vector<ElementDisconnected> events;
+
+  std::unique_lock<std::recursive_timed_mutex> lock (sinksMutex);
+
+  g_signal_emit_by_name (getGstreamerElement (), "begin-batch");
+
+  for (auto sink : sinks) {
+    std::shared_ptr<MediaElementImpl> sinkImpl =
+      std::dynamic_pointer_cast<MediaElementImpl> (sink);
+
+    if (!sinkImpl) {
+      /* Keep results in the same order as the sinks */
+      for (auto type : types) {
+        ret.push_back (std::make_shared <ElementConnectionResult> (sink, type,
+                       false, "Sink not available") );
+      }
+
+      continue;
+    }
+
+    std::unique_lock<std::recursive_timed_mutex> sinkLock (sinkImpl->sourcesMutex);
+
+    for (auto type : types) {
+      bool done = disconnectLocked (sinkImpl, type, "", "");
+
+      if (done) {
+        events.push_back (ElementDisconnected (shared_from_this(),
+                                               ElementDisconnected::getName (), sink, type, "", "") );
+      }
+
+      ret.push_back (std::make_shared <ElementConnectionResult> (sink, type,
+                     done, done ? "" : "Elements are not connected") );
+    }
+  }
+
+  g_signal_emit_by_name (getGstreamerElement (), "end-batch");
+  lock.unlock ();
+
+  for (auto event : events) {
+    signalElementDisconnected (event);
+  }
+
+  return ret;
+}
+
+/* Requires sinksMutex and the sourcesMutex of sink to be locked */
+bool MediaElementImpl::disconnectLocked (std::shared_ptr<MediaElementImpl>
+    sinkImpl, std::shared_ptr<MediaType> mediaType,
+    const std::string &sourceMediaDescription,
+    const std::string &sinkMediaDescription)
+{
   GST_DEBUG ("Disconnecting %s - %s params %s %s %s", getName().c_str(),
-             sink->getName ().c_str (), mediaType->getString ().c_str (),
+             sinkImpl->getName ().c_str (), mediaType->getString ().c_str (),
              sourceMediaDescription.c_str(), sinkMediaDescription.c_str() );
 
   try {
@@ -761,17 +980,10 @@ void MediaElementImpl::disconnect (std::shared_ptr<MediaElement> sink,
     g_signal_emit_by_name (getGstreamerElement (), "release-requested-srcpad",
                            connectionData->getSourcePadName (), &ret, NULL);
   } catch (std::out_of_range) {
-
+    return false;
   }
 
-  sinkLock.unlock();
-  lock.unlock ();
-
-  ElementDisconnected elementDisconnected (shared_from_this(),
-      ElementDisconnected::getName (),
-      sink, mediaType, sourceMediaDescription,
-      sinkMediaDescription);
-  signalElementDisconnected (elementDisconnected);
+  return true;
 }
 
 void MediaElementImpl::setAudioFormat (std::shared_ptr<AudioCaps> caps)
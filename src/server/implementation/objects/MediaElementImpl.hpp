@@ -16,6 +16,7 @@ namespace kurento
 class MediaType;
 class MediaElementImpl;
 class AudioCodec;
+class ElementConnectionResult;
 class VideoCodec;
 
 struct MediaTypeCmp {
@@ -81,6 +82,16 @@ public:
                            std::shared_ptr<MediaType> mediaType,
                            const std::string &sourceMediaDescription,
                            const std::string &sinkMediaDescription);
+  virtual std::vector<std::shared_ptr<ElementConnectionResult>> connectMany (
+        std::vector<std::shared_ptr<MediaElement>> sinks);
+  virtual std::vector<std::shared_ptr<ElementConnectionResult>> connectMany (
+        std::vector<std::shared_ptr<MediaElement>> sinks,
+        std::shared_ptr<MediaType> mediaType);
+  virtual std::vector<std::shared_ptr<ElementConnectionResult>> disconnectMany (
+        std::vector<std::shared_ptr<MediaElement>> sinks);
+  virtual std::vector<std::shared_ptr<ElementConnectionResult>> disconnectMany (
+        std::vector<std::shared_ptr<MediaElement>> sinks,
+        std::shared_ptr<MediaType> mediaType);
   void setAudioFormat (std::shared_ptr<AudioCaps> caps);
   void setVideoFormat (std::shared_ptr<VideoCaps> caps);
 
@@ -127,6 +138,14 @@ private:
 
   void disconnectAll();
   void performConnection (std::shared_ptr <ElementConnectionDataInternal> data);
+  void connectLocked (std::shared_ptr<MediaElement> sink,
+                      std::shared_ptr<MediaType> mediaType,
+                      const std::string &sourceMediaDescription,
+                      const std::string &sinkMediaDescription);
+  bool disconnectLocked (std::shared_ptr<MediaElementImpl> sinkImpl,
+                         std::shared_ptr<MediaType> mediaType,
+                         const std::string &sourceMediaDescription,
+                         const std::string &sinkMediaDescription);
 
   class StaticConstructor
   {
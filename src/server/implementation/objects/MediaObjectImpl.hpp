@@ -4,6 +4,7 @@
 #include <Factory.hpp>
 #include "MediaObject.hpp"
 #include <EventHandler.hpp>
+#include <ConfigCache.hpp>
 #include <boost/property_tree/ptree.hpp>
 #include <boost/property_tree/json_parser.hpp>
 #include <jsonrpc/JsonSerializer.hpp>
@@ -80,26 +81,15 @@ protected:
   template <class T, class C>
   T getConfigValue (const std::string &key)
   {
-    auto child = config.get_child ("modules." + dynamic_cast <C *>
-                                   (this)->getModule() + "."
-                                   + dynamic_cast <C *> (this)->getType() + "." + key);
-    std::stringstream ss;
-    Json::Value val;
-    Json::Reader reader;
-    kurento::JsonSerializer serializer (false);
-    boost::property_tree::ptree array;
+    std::shared_ptr<const ConfigCache::Value> value = ConfigCache::lookup (
+          config, dynamic_cast <C *> (this)->getModule(),
+          dynamic_cast <C *> (this)->getType(), key);
 
-    array.push_back (std::make_pair ("val", child) );
-    boost::property_tree::write_json (ss, array);
-
-    reader.parse (ss.str(), val);
-
-    T ret {};
-
-    serializer.JsonValue = val;
-    serializer.Serialize ("val", ret);
+    if (!value) {
+      throw boost::property_tree::ptree_bad_path ("No such node", key);
+    }
 
-    return ret;
+    return value->get<T> ();
   }
 
   template <class T, class C>
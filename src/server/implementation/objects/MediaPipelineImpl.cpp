@@ -6,12 +6,25 @@
 #include <gst/gst.h>
 #include <DotGraph.hpp>
 #include <GstreamerDotDetails.hpp>
+#include <ThreadPlacement.hpp>
+#include <BusDispatchStats.hpp>
 #include <SignalHandler.hpp>
+#include <Reaper.hpp>
+#include <MediaSet.hpp>
+#include <ObjectPool.hpp>
 
 #define GST_CAT_DEFAULT kurento_media_pipeline_impl
 GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
 #define GST_DEFAULT_NAME "KurentoMediaPipelineImpl"
 
+#define CPU_SET "cpuSet"
+#define AUDIO_CPU_SET "audioCpuSet"
+#define VIDEO_CPU_SET "videoCpuSet"
+#define RTP_CPU_SET "rtpCpuSet"
+#define AUDIO_PRIORITY "audioPriority"
+#define VIDEO_PRIORITY "videoPriority"
+#define RTP_PRIORITY "rtpPriority"
+
 namespace kurento
 {
 void
@@ -57,51 +70,165 @@ void MediaPipelineImpl::postConstructor ()
   MediaObjectImpl::postConstructor ();
 
   bus = gst_pipeline_get_bus (GST_PIPELINE (pipeline) );
-  gst_bus_add_signal_watch (bus);
   busMessageHandler = register_signal_handler (G_OBJECT (bus), "message",
                       std::function <void (GstBus *, GstMessage *) > (std::bind (
                             &MediaPipelineImpl::busMessage, this,
                             std::placeholders::_2) ),
                       std::dynamic_pointer_cast<MediaPipelineImpl>
                       (shared_from_this() ) );
+
+  /* Streaming threads are placed as soon as they are created */
+  std::shared_ptr<PipelineTaskPool> pool = taskPool;
+  busDispatcher = std::make_shared <BusDispatcher> (bus,
+                  MediaSet::getMediaSet ()->getWorkerPool (), getId (),
+  [pool] (GstMessage * message) {
+    if (GST_MESSAGE_TYPE (message) != GST_MESSAGE_STREAM_STATUS) {
+      return false;
+    }
+
+    pool->handleStreamStatus (message);
+    return true;
+  });
+  busDispatcher->start ();
   g_object_unref (bus);
 }
 
 MediaPipelineImpl::MediaPipelineImpl (const boost::property_tree::ptree &config)
   : MediaObjectImpl (config)
 {
-  GstClock *clock;
+  PipelineTaskPool::Placement placement;
+
+  placement.cpuSet[PipelineTaskPool::DEFAULT] =
+    getConfigValue <std::string, MediaPipeline> (CPU_SET, "");
+  placement.cpuSet[PipelineTaskPool::AUDIO] =
+    getConfigValue <std::string, MediaPipeline> (AUDIO_CPU_SET, "");
+  placement.cpuSet[PipelineTaskPool::VIDEO] =
+    getConfigValue <std::string, MediaPipeline> (VIDEO_CPU_SET, "");
+  placement.cpuSet[PipelineTaskPool::RTP_IO] =
+    getConfigValue <std::string, MediaPipeline> (RTP_CPU_SET, "");
+  placement.priority[PipelineTaskPool::AUDIO] =
+    getConfigValue <int, MediaPipeline> (AUDIO_PRIORITY, 0);
+  placement.priority[PipelineTaskPool::VIDEO] =
+    getConfigValue <int, MediaPipeline> (VIDEO_PRIORITY, 0);
+  placement.priority[PipelineTaskPool::RTP_IO] =
+    getConfigValue <int, MediaPipeline> (RTP_PRIORITY, 0);
+
+  taskPool = std::make_shared <PipelineTaskPool> (placement);
 
-  pipeline = gst_pipeline_new (NULL);
+  pipeline = ObjectPool::getPool ()->takePipeline ();
+
+  if (pipeline == NULL) {
+    pipeline = ObjectPool::createPipeline ();
+  }
 
   if (pipeline == NULL) {
     throw KurentoException (MEDIA_OBJECT_NOT_AVAILABLE,
                             "Cannot create gstreamer pipeline");
   }
 
-  g_object_set (G_OBJECT (pipeline), "async-handling", TRUE, NULL);
-
-  clock = gst_system_clock_obtain ();
-  gst_pipeline_use_clock (GST_PIPELINE (pipeline), clock);
-  g_object_unref (clock);
-
-  gst_element_set_state (pipeline, GST_STATE_PLAYING);
-
   busMessageHandler = 0;
 }
 
 MediaPipelineImpl::~MediaPipelineImpl ()
 {
   GstBus *bus = gst_pipeline_get_bus (GST_PIPELINE (pipeline) );
+  GstElement *gstPipeline = pipeline;
+  std::shared_ptr<PipelineTaskPool> pool = taskPool;
+
+  if (busDispatcher) {
+    busDispatcher->stop ();
+  }
 
   if (busMessageHandler > 0) {
     unregister_signal_handler (bus, busMessageHandler);
   }
 
-  gst_bus_remove_signal_watch (bus);
   g_object_unref (bus);
-  gst_element_set_state (pipeline, GST_STATE_NULL);
-  g_object_unref (pipeline);
+
+  /* Going to NULL joins every streaming thread, the task pool is kept until
+   * they are done */
+  Reaper::getReaper ()->post (getId (), getId (), [gstPipeline, pool] () {
+    gst_element_set_state (gstPipeline, GST_STATE_NULL);
+    g_object_unref (gstPipeline);
+  });
+}
+
+void MediaPipelineImpl::addBusMessageTypes (GstMessageType types)
+{
+  if (busDispatcher) {
+    busDispatcher->addTypes (types);
+  }
+}
+
+std::shared_ptr<BusDispatchStats> MediaPipelineImpl::getBusDispatchStats ()
+{
+  BusDispatcher::Stats stats = {};
+
+  if (busDispatcher) {
+    stats = busDispatcher->getStats ();
+  }
+
+  return std::make_shared <BusDispatchStats> ( (int) stats.dispatched,
+         (int) stats.filtered, (int) stats.pending, (int) stats.maxLag,
+         (int) stats.meanLag);
+}
+
+std::shared_ptr<ThreadPlacement> MediaPipelineImpl::getThreadPlacement ()
+{
+  PipelineTaskPool::Placement placement = taskPool->getPlacement ();
+  std::shared_ptr<ThreadPlacement> threadPlacement =
+    std::make_shared <ThreadPlacement> ();
+
+  threadPlacement->setCpuSet (placement.cpuSet[PipelineTaskPool::DEFAULT]);
+  threadPlacement->setAudioCpuSet (placement.cpuSet[PipelineTaskPool::AUDIO]);
+  threadPlacement->setVideoCpuSet (placement.cpuSet[PipelineTaskPool::VIDEO]);
+  threadPlacement->setRtpCpuSet (placement.cpuSet[PipelineTaskPool::RTP_IO]);
+  threadPlacement->setAudioPriority (
+    placement.priority[PipelineTaskPool::AUDIO]);
+  threadPlacement->setVideoPriority (
+    placement.priority[PipelineTaskPool::VIDEO]);
+  threadPlacement->setRtpPriority (placement.priority[PipelineTaskPool::RTP_IO]);
+
+  return threadPlacement;
+}
+
+void MediaPipelineImpl::setThreadPlacement (std::shared_ptr<ThreadPlacement>
+    threadPlacement)
+{
+  PipelineTaskPool::Placement placement = taskPool->getPlacement ();
+
+  if (threadPlacement->isSetCpuSet () ) {
+    placement.cpuSet[PipelineTaskPool::DEFAULT] = threadPlacement->getCpuSet ();
+  }
+
+  if (threadPlacement->isSetAudioCpuSet () ) {
+    placement.cpuSet[PipelineTaskPool::AUDIO] = threadPlacement->getAudioCpuSet ();
+  }
+
+  if (threadPlacement->isSetVideoCpuSet () ) {
+    placement.cpuSet[PipelineTaskPool::VIDEO] = threadPlacement->getVideoCpuSet ();
+  }
+
+  if (threadPlacement->isSetRtpCpuSet () ) {
+    placement.cpuSet[PipelineTaskPool::RTP_IO] = threadPlacement->getRtpCpuSet ();
+  }
+
+  if (threadPlacement->isSetAudioPriority () ) {
+    placement.priority[PipelineTaskPool::AUDIO] =
+      threadPlacement->getAudioPriority ();
+  }
+
+  if (threadPlacement->isSetVideoPriority () ) {
+    placement.priority[PipelineTaskPool::VIDEO] =
+      threadPlacement->getVideoPriority ();
+  }
+
+  if (threadPlacement->isSetRtpPriority () ) {
+    placement.priority[PipelineTaskPool::RTP_IO] =
+      threadPlacement->getRtpPriority ();
+  }
+
+  taskPool->setPlacement (placement);
 }
 
 std::string MediaPipelineImpl::getGstreamerDot (
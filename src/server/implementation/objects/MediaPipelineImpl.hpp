@@ -4,6 +4,8 @@
 #include "MediaObjectImpl.hpp"
 #include "MediaPipeline.hpp"
 #include <EventHandler.hpp>
+#include <PipelineTaskPool.hpp>
+#include <BusDispatcher.hpp>
 #include <gst/gst.h>
 #include <boost/property_tree/ptree.hpp>
 
@@ -29,6 +31,20 @@ public:
     return pipeline;
   }
 
+  std::shared_ptr<PipelineTaskPool> getTaskPool()
+  {
+    return taskPool;
+  }
+
+  /* Bus messages of these types are dispatched too, see BusDispatcher */
+  void addBusMessageTypes (GstMessageType types);
+
+  virtual std::shared_ptr<BusDispatchStats> getBusDispatchStats ();
+
+  virtual std::shared_ptr<ThreadPlacement> getThreadPlacement ();
+  virtual void setThreadPlacement (std::shared_ptr<ThreadPlacement>
+                                   threadPlacement);
+
   virtual std::string getGstreamerDot ();
   virtual std::string getGstreamerDot (std::shared_ptr<GstreamerDotDetails>
                                        details);
@@ -50,6 +66,9 @@ private:
 
   gulong busMessageHandler;
 
+  std::shared_ptr<PipelineTaskPool> taskPool;
+  std::shared_ptr<BusDispatcher> busDispatcher;
+
   void busMessage (GstMessage *message);
 
   class StaticConstructor
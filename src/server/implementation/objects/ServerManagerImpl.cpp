@@ -2,18 +2,40 @@
 
 #include <gst/gst.h>
 #include "ServerInfo.hpp"
+#include "WorkerPoolStats.hpp"
+#include "SessionCollectorStats.hpp"
+#include "PipelineCpuStats.hpp"
+#include "ElementCpuStats.hpp"
+#include "ReleaseStats.hpp"
+#include "ObjectPoolStats.hpp"
+#include "CreationLatency.hpp"
+#include "LoopPoolStats.hpp"
 #include "MediaPipelineImpl.hpp"
 #include "ServerManagerImpl.hpp"
 #include <jsonrpc/JsonSerializer.hpp>
 #include <KurentoException.hpp>
 #include <MediaSet.hpp>
+#include <Reaper.hpp>
+#include <ObjectPool.hpp>
+#include <ConfigCache.hpp>
 #include <boost/property_tree/json_parser.hpp>
+#include "kmsloop.h"
 
 #define GST_CAT_DEFAULT kurento_server_manager_impl
 GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
 #define GST_DEFAULT_NAME "KurentoServerManagerImpl"
 
 #define METADATA "metadata"
+#define SESSION_TIMEOUT "sessionTimeout"
+#define SESSION_TEARDOWN_RATE "sessionTeardownRate"
+#define CPU_SAMPLING_INTERVAL "cpuSamplingInterval"
+#define RELEASE_CONCURRENCY "releaseConcurrency"
+#define PIPELINE_POOL_SIZE "pipelinePoolSize"
+#define ELEMENT_POOL_SIZE "elementPoolSize"
+#define LOOP_THREADS "loopThreads"
+
+const int PIPELINE_POOL_SIZE_DEFAULT = 2;
+const int ELEMENT_POOL_SIZE_DEFAULT = 4;
 
 namespace kurento
 {
@@ -42,7 +64,39 @@ ServerManagerImpl::ServerManagerImpl (const std::shared_ptr<ServerInfo> info,
                                       ModuleManager &moduleManager) : MediaObjectImpl (config),
   info (info), moduleManager (moduleManager)
 {
+  MediaSet::CollectorStats collector;
+
+  /* The server config reaches the media objects from here */
+  ConfigCache::reload (config);
+
   metadata = childToString (config, METADATA);
+
+  collector = MediaSet::getMediaSet ()->getCollectorStats ();
+  MediaSet::getMediaSet ()->setSessionCollectorConfig (
+    getConfigValue <int, ServerManagerImpl> (SESSION_TIMEOUT,
+        collector.sessionTimeout),
+    getConfigValue <int, ServerManagerImpl> (SESSION_TEARDOWN_RATE,
+        collector.teardownRate) );
+  MediaSet::getMediaSet ()->setCpuSamplingInterval (
+    getConfigValue <int, ServerManagerImpl> (CPU_SAMPLING_INTERVAL,
+        MediaSet::getMediaSet ()->getCpuSamplingInterval () ) );
+  Reaper::getReaper ()->setConcurrency (
+    getConfigValue <int, ServerManagerImpl> (RELEASE_CONCURRENCY,
+        Reaper::getReaper ()->getStats ().concurrency) );
+  ObjectPool::getPool ()->setSize (
+    getConfigValue <int, ServerManagerImpl> (PIPELINE_POOL_SIZE,
+        PIPELINE_POOL_SIZE_DEFAULT),
+    getConfigValue <int, ServerManagerImpl> (ELEMENT_POOL_SIZE,
+        ELEMENT_POOL_SIZE_DEFAULT) );
+
+  int loopThreads = getConfigValue <int, ServerManagerImpl> (LOOP_THREADS,
+                    kms_loop_get_pool_size () );
+
+  if (loopThreads > 0) {
+    kms_loop_set_pool_size (loopThreads);
+  } else {
+    GST_WARNING ("Invalid %s: %d", LOOP_THREADS, loopThreads);
+  }
 }
 
 std::shared_ptr<ServerInfo> ServerManagerImpl::getInfo ()
@@ -71,6 +125,138 @@ std::string ServerManagerImpl::getMetadata ()
   return metadata;
 }
 
+std::shared_ptr<WorkerPoolStats> ServerManagerImpl::getWorkerPoolStats ()
+{
+  WorkerPool::Stats stats = MediaSet::getMediaSet ()->getWorkerPoolStats();
+  std::vector<int> buckets;
+  std::vector<int> histogram;
+
+  for (auto bound : WorkerPool::LATENCY_BUCKETS) {
+    buckets.push_back (bound);
+  }
+
+  for (auto count : stats.latency) {
+    histogram.push_back (count);
+  }
+
+  return std::make_shared <WorkerPoolStats> (stats.threads, stats.maxThreads,
+         (int) stats.queueDepth, (int) stats.executed, (int) stats.steals,
+         buckets, histogram);
+}
+
+std::shared_ptr<SessionCollectorStats>
+ServerManagerImpl::getSessionCollectorStats ()
+{
+  MediaSet::CollectorStats stats = MediaSet::getMediaSet ()->getCollectorStats();
+
+  return std::make_shared <SessionCollectorStats> (stats.sessionTimeout,
+         stats.teardownRate, (int) stats.sessions, (int) stats.queued,
+         (int) stats.expiredSessions, (int) stats.maxTeardownDelay);
+}
+
+std::vector<std::string> ServerManagerImpl::getReleasingObjects ()
+{
+  return Reaper::getReaper ()->getReleasing ();
+}
+
+std::shared_ptr<ReleaseStats> ServerManagerImpl::getReleaseStats ()
+{
+  Reaper::Stats stats = Reaper::getReaper ()->getStats ();
+  std::vector<int> buckets;
+  std::vector<int> histogram;
+
+  for (auto bound : Reaper::LATENCY_BUCKETS) {
+    buckets.push_back (bound);
+  }
+
+  for (auto count : stats.latency) {
+    histogram.push_back (count);
+  }
+
+  return std::make_shared <ReleaseStats> (stats.concurrency, (int) stats.queued,
+                                          (int) stats.running, (int) stats.released, (int) stats.maxLatency,
+                                          buckets, histogram);
+}
+
+std::shared_ptr<ObjectPoolStats> ServerManagerImpl::getObjectPoolStats ()
+{
+  ObjectPool::Stats stats = ObjectPool::getPool ()->getStats ();
+  std::vector<std::shared_ptr<CreationLatency>> creationLatency;
+  std::vector<int> buckets;
+
+  for (auto bound : ObjectPool::LATENCY_BUCKETS) {
+    buckets.push_back (bound);
+  }
+
+  for (auto it : stats.latency) {
+    std::vector<int> histogram;
+
+    for (auto count : it.second) {
+      histogram.push_back (count);
+    }
+
+    creationLatency.push_back (std::make_shared <CreationLatency> (it.first,
+                               histogram) );
+  }
+
+  return std::make_shared <ObjectPoolStats> (stats.pipelines, stats.elements,
+         (int) stats.readyPipelines, (int) stats.pipelineHits,
+         (int) stats.pipelineMisses, (int) stats.elementHits,
+         (int) stats.elementMisses, buckets, creationLatency);
+}
+
+std::shared_ptr<LoopPoolStats> ServerManagerImpl::getLoopPoolStats ()
+{
+  GstStructure *stats = kms_loop_get_pool_stats ();
+  guint size = 0, threads = 0, loops = 0;
+  guint64 dispatched = 0, meanLatency = 0, maxLatency = 0;
+
+  gst_structure_get (stats, "size", G_TYPE_UINT, &size,
+                     "threads", G_TYPE_UINT, &threads,
+                     "loops", G_TYPE_UINT, &loops,
+                     "dispatched", G_TYPE_UINT64, &dispatched,
+                     "mean-latency", G_TYPE_UINT64, &meanLatency,
+                     "max-latency", G_TYPE_UINT64, &maxLatency, NULL);
+  gst_structure_free (stats);
+
+  return std::make_shared <LoopPoolStats> (size, threads, loops,
+         (int) dispatched, (int) (meanLatency / GST_USECOND),
+         (int) (maxLatency / GST_USECOND) );
+}
+
+std::vector<std::shared_ptr<PipelineCpuStats>>
+    ServerManagerImpl::getPipelinesCpu ()
+{
+  std::vector<std::shared_ptr<PipelineCpuStats>> ret;
+
+  for (auto it : MediaSet::getMediaSet ()->getAllPipelines () ) {
+    std::shared_ptr<MediaPipelineImpl> pipeline =
+      std::dynamic_pointer_cast <MediaPipelineImpl> (it);
+    std::vector<std::shared_ptr<ElementCpuStats>> elements;
+    double usedCpu = 0;
+    int64_t cpuTime = 0;
+    int threads = 0;
+
+    if (!pipeline) {
+      continue;
+    }
+
+    for (auto stats : pipeline->getTaskPool ()->getCpuStats () ) {
+      elements.push_back (std::make_shared <ElementCpuStats> (stats.elementClass,
+                          stats.usedCpu, (double) stats.cpuTime / GST_SECOND, stats.threads) );
+      usedCpu += stats.usedCpu;
+      cpuTime += stats.cpuTime;
+      threads += stats.threads;
+    }
+
+    ret.push_back (std::make_shared <PipelineCpuStats> (
+                     std::dynamic_pointer_cast <MediaPipeline> (pipeline), usedCpu,
+                     (double) cpuTime / GST_SECOND, threads, elements) );
+  }
+
+  return ret;
+}
+
 std::string ServerManagerImpl::getKmd (const std::string &moduleName)
 {
   for (auto moduleIt : moduleManager.getModules () ) {
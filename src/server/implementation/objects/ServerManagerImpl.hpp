@@ -23,6 +23,12 @@ void Serialize (std::shared_ptr<kurento::ServerManagerImpl> &object,
 namespace kurento
 {
 class ServerInfo;
+class WorkerPoolStats;
+class SessionCollectorStats;
+class PipelineCpuStats;
+class ReleaseStats;
+class ObjectPoolStats;
+class LoopPoolStats;
 class MediaPipelineImpl;
 } /* kurento */
 
@@ -55,6 +61,20 @@ public:
 
   virtual std::string getMetadata ();
 
+  virtual std::shared_ptr<WorkerPoolStats> getWorkerPoolStats ();
+
+  virtual std::shared_ptr<SessionCollectorStats> getSessionCollectorStats ();
+
+  virtual std::vector<std::string> getReleasingObjects ();
+
+  virtual std::shared_ptr<ReleaseStats> getReleaseStats ();
+
+  virtual std::shared_ptr<ObjectPoolStats> getObjectPoolStats ();
+
+  virtual std::shared_ptr<LoopPoolStats> getLoopPoolStats ();
+
+  virtual std::vector<std::shared_ptr<PipelineCpuStats>> getPipelinesCpu ();
+
   /* Next methods are automatically implemented by code generator */
   virtual bool connect (const std::string &eventType,
                         std::shared_ptr<EventHandler> handler);
@@ -934,6 +934,78 @@ GST_START_TEST (simple_link)
   g_main_loop_unref (loop);
 }
 
+GST_END_TEST
+#define N_FAN_OUT_SINKS 4
+static gint fan_out_pending;
+
+static void
+fakesink_hand_off_fan_out (GstElement * fakesink, GstBuffer * buf,
+    GstPad * pad, gpointer data)
+{
+  GMainLoop *loop = (GMainLoop *) data;
+  gint count =
+      GPOINTER_TO_INT (g_object_get_data (G_OBJECT (fakesink), COUNT_KEY));
+
+  g_object_set_data (G_OBJECT (fakesink), COUNT_KEY,
+      GINT_TO_POINTER (++count));
+
+  if (count == 40) {
+    g_object_set (G_OBJECT (fakesink), "signal-handoffs", FALSE, NULL);
+
+    if (g_atomic_int_dec_and_test (&fan_out_pending)) {
+      g_idle_add (quit_main_loop_idle, loop);
+    }
+  }
+}
+
+GST_START_TEST (shared_fan_out_link)
+{
+  GMainLoop *loop = g_main_loop_new (NULL, TRUE);
+  GstElement *pipeline = gst_pipeline_new (__FUNCTION__);
+  GstElement *videotestsrc = gst_element_factory_make ("videotestsrc", NULL);
+  GstElement *agnosticbin = gst_element_factory_make ("agnosticbin", NULL);
+  GstBus *bus = gst_pipeline_get_bus (GST_PIPELINE (pipeline));
+  gint i;
+
+  fan_out_pending = N_FAN_OUT_SINKS;
+
+  g_object_set (G_OBJECT (pipeline), "async-handling", TRUE, NULL);
+  g_object_set (G_OBJECT (videotestsrc), "is-live", TRUE, NULL);
+  g_object_set (G_OBJECT (agnosticbin), "shared-fan-out", TRUE, NULL);
+
+  gst_bus_add_signal_watch (bus);
+  g_signal_connect (bus, "message", G_CALLBACK (bus_msg), pipeline);
+
+  gst_bin_add_many (GST_BIN (pipeline), videotestsrc, agnosticbin, NULL);
+  fail_unless (gst_element_link (videotestsrc, agnosticbin));
+
+  for (i = 0; i < N_FAN_OUT_SINKS; i++) {
+    GstElement *fakesink = gst_element_factory_make ("fakesink", NULL);
+
+    g_object_set (G_OBJECT (fakesink), "sync", TRUE, "signal-handoffs", TRUE,
+        "async", FALSE, NULL);
+    g_signal_connect (G_OBJECT (fakesink), "handoff",
+        G_CALLBACK (fakesink_hand_off_fan_out), loop);
+
+    gst_bin_add (GST_BIN (pipeline), fakesink);
+    fail_unless (gst_element_link (agnosticbin, fakesink));
+  }
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+  g_timeout_add_seconds (10, timeout_check, pipeline);
+
+  mark_point ();
+  g_main_loop_run (loop);
+  mark_point ();
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_bus_remove_signal_watch (bus);
+  g_object_unref (bus);
+  g_object_unref (pipeline);
+  g_main_loop_unref (loop);
+}
+
 GST_END_TEST
 GST_START_TEST (create_test)
 {
@@ -977,6 +1049,354 @@ GST_START_TEST (h264_encoding_odd_dimension)
   g_main_loop_unref (loop);
 }
 
+GST_END_TEST
+static gboolean
+check_encoder_stats (GQuark field_id, const GValue * value, gpointer user_data)
+{
+  const GstStructure *enc_stats = gst_value_get_structure (value);
+  gint threads, speed, cpu_used;
+  gboolean adaptive;
+
+  fail_unless (gst_structure_get (enc_stats, "threads", G_TYPE_INT, &threads,
+          "speed-level", G_TYPE_INT, &speed, "cpu-used", G_TYPE_INT, &cpu_used,
+          "adaptive", G_TYPE_BOOLEAN, &adaptive, NULL));
+
+  /* Configured values are used instead of the ones chosen for the caps */
+  fail_unless (threads == 2);
+  fail_unless (speed == 1);
+  fail_unless (cpu_used == 8);
+  fail_if (adaptive);
+
+  (*(gint *) user_data)++;
+
+  return TRUE;
+}
+
+GST_START_TEST (vp8_encoder_profile)
+{
+  GstElement *pipeline =
+      gst_parse_launch
+      ("videotestsrc is-live=true num-buffers=30 ! video/x-raw, width=(int)320, height=(int)240, framerate=(fraction)30/1 ! agnosticbin name=agnostic ! video/x-vp8 ! fakesink async=true",
+      NULL);
+  GstBus *bus = gst_pipeline_get_bus (GST_PIPELINE (pipeline));
+  GstElement *agnosticbin = gst_bin_get_by_name (GST_BIN (pipeline),
+      "agnostic");
+  GstStructure *config, *stats;
+  gint encoders = 0;
+
+  loop = g_main_loop_new (NULL, TRUE);
+
+  config = gst_structure_new ("encoder-config", "threads", G_TYPE_INT, 2,
+      "speed", G_TYPE_INT, 1, "adaptive", G_TYPE_BOOLEAN, FALSE, NULL);
+  g_object_set (agnosticbin, "encoder-config", config, NULL);
+  gst_structure_free (config);
+
+  gst_bus_add_signal_watch (bus);
+  g_signal_connect (bus, "message", G_CALLBACK (bus_msg), pipeline);
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+  mark_point ();
+  g_main_loop_run (loop);
+  mark_point ();
+
+  g_signal_emit_by_name (agnosticbin, "stats", &stats);
+  fail_unless (stats != NULL);
+  gst_structure_foreach (stats, check_encoder_stats, &encoders);
+  fail_unless (encoders == 1);
+  gst_structure_free (stats);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_bus_remove_signal_watch (bus);
+  g_object_unref (agnosticbin);
+  g_object_unref (bus);
+  g_object_unref (pipeline);
+  g_main_loop_unref (loop);
+}
+
+GST_END_TEST
+static gboolean
+count_encoders (GQuark field_id, const GValue * value, gpointer user_data)
+{
+  (*(gint *) user_data)++;
+
+  return TRUE;
+}
+
+GST_START_TEST (vp8_encoding_ladder)
+{
+  GstElement *pipeline =
+      gst_parse_launch
+      ("videotestsrc is-live=true num-buffers=60 ! video/x-raw, width=(int)320, height=(int)240, framerate=(fraction)30/1 ! agnosticbin name=agnostic "
+      "agnostic. ! video/x-vp8 ! fakesink async=true "
+      "agnostic. ! video/x-vp8 ! fakesink async=true "
+      "agnostic. ! video/x-vp8 ! fakesink async=true",
+      NULL);
+  GstBus *bus = gst_pipeline_get_bus (GST_PIPELINE (pipeline));
+  GstElement *agnosticbin = gst_bin_get_by_name (GST_BIN (pipeline),
+      "agnostic");
+  GstStructure *config, *stats;
+  gint encoders = 0;
+
+  loop = g_main_loop_new (NULL, TRUE);
+
+  config = gst_structure_new ("encoder-config", "layers", G_TYPE_INT, 3,
+      NULL);
+  g_object_set (agnosticbin, "encoder-config", config, NULL);
+  gst_structure_free (config);
+
+  gst_bus_add_signal_watch (bus);
+  g_signal_connect (bus, "message", G_CALLBACK (bus_msg), pipeline);
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+  mark_point ();
+  g_main_loop_run (loop);
+  mark_point ();
+
+  /* Consumers share the layers instead of getting their own encoder */
+  g_signal_emit_by_name (agnosticbin, "stats", &stats);
+  gst_structure_foreach (stats, count_encoders, &encoders);
+  fail_unless (encoders == 3);
+  gst_structure_free (stats);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_bus_remove_signal_watch (bus);
+  g_object_unref (agnosticbin);
+  g_object_unref (bus);
+  g_object_unref (pipeline);
+  g_main_loop_unref (loop);
+}
+
+GST_END_TEST
+#define LADDER_MEASURE_FROM (3 * GST_SECOND)
+
+static GstPadProbeReturn
+count_ladder_bytes (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+
+  /* Only once a switch had time to happen */
+  if (GST_BUFFER_PTS_IS_VALID (buffer) &&
+      GST_BUFFER_PTS (buffer) >= LADDER_MEASURE_FROM) {
+    *(gsize *) user_data += gst_buffer_get_size (buffer);
+  }
+
+  return GST_PAD_PROBE_OK;
+}
+
+static gboolean
+send_low_remb (gpointer sink)
+{
+  GstPad *pad = gst_element_get_static_pad (GST_ELEMENT (sink), "sink");
+  GstEvent *remb;
+
+  /* Same event KmsRembLocal sends upstream when it gets a REMB */
+  remb = gst_event_new_custom (GST_EVENT_CUSTOM_UPSTREAM,
+      gst_structure_new ("REMB", "bitrate", G_TYPE_UINT, 1000, "ssrc",
+          G_TYPE_UINT, 1, NULL));
+
+  GST_DEBUG_OBJECT (sink, "Sending low REMB");
+  gst_pad_push_event (pad, remb);
+  g_object_unref (pad);
+
+  return G_SOURCE_REMOVE;
+}
+
+GST_START_TEST (vp8_encoding_ladder_remb)
+{
+  GstElement *pipeline =
+      gst_parse_launch
+      ("videotestsrc is-live=true num-buffers=180 pattern=snow ! video/x-raw, width=(int)320, height=(int)240, framerate=(fraction)30/1 ! agnosticbin name=agnostic "
+      "agnostic. ! video/x-vp8 ! fakesink name=low async=true "
+      "agnostic. ! video/x-vp8 ! fakesink name=high async=true",
+      NULL);
+  GstBus *bus = gst_pipeline_get_bus (GST_PIPELINE (pipeline));
+  GstElement *agnosticbin = gst_bin_get_by_name (GST_BIN (pipeline),
+      "agnostic");
+  GstElement *low = gst_bin_get_by_name (GST_BIN (pipeline), "low");
+  GstElement *high = gst_bin_get_by_name (GST_BIN (pipeline), "high");
+  gsize low_bytes = 0, high_bytes = 0;
+  GstStructure *config;
+  GstPad *pad;
+
+  loop = g_main_loop_new (NULL, TRUE);
+
+  config = gst_structure_new ("encoder-config", "layers", G_TYPE_INT, 3,
+      NULL);
+  g_object_set (agnosticbin, "encoder-config", config, NULL);
+  gst_structure_free (config);
+
+  pad = gst_element_get_static_pad (low, "sink");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, count_ladder_bytes,
+      &low_bytes, NULL);
+  g_object_unref (pad);
+
+  pad = gst_element_get_static_pad (high, "sink");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, count_ladder_bytes,
+      &high_bytes, NULL);
+  g_object_unref (pad);
+
+  gst_bus_add_signal_watch (bus);
+  g_signal_connect (bus, "message", G_CALLBACK (bus_msg), pipeline);
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+  /* Only the first consumer gets an estimation */
+  g_timeout_add (500, send_low_remb, low);
+
+  mark_point ();
+  g_main_loop_run (loop);
+  mark_point ();
+
+  GST_DEBUG ("Bytes received: low %" G_GSIZE_FORMAT ", high %"
+      G_GSIZE_FORMAT, low_bytes, high_bytes);
+
+  /* Low consumer moved to the last layer, the other one kept the first */
+  fail_unless (high_bytes > 0);
+  fail_unless (low_bytes * 4 < high_bytes);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_bus_remove_signal_watch (bus);
+  g_object_unref (agnosticbin);
+  g_object_unref (low);
+  g_object_unref (high);
+  g_object_unref (bus);
+  g_object_unref (pipeline);
+  g_main_loop_unref (loop);
+}
+
+GST_END_TEST
+#define GOP_JOIN_BUFFERS 10
+static gint force_key_units;
+static gboolean join_first_keyframe;
+
+static GstPadProbeReturn
+count_force_key_units (GstPad * pad, GstPadProbeInfo * info, gpointer data)
+{
+  GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+
+  if (gst_event_has_name (event, "GstForceKeyUnit")) {
+    g_atomic_int_inc (&force_key_units);
+  }
+
+  return GST_PAD_PROBE_OK;
+}
+
+static void
+fakesink_hand_off_joined (GstElement * fakesink, GstBuffer * buf,
+    GstPad * pad, gpointer data)
+{
+  gint count =
+      GPOINTER_TO_INT (g_object_get_data (G_OBJECT (fakesink), COUNT_KEY));
+
+  if (count == 0) {
+    join_first_keyframe =
+        !GST_BUFFER_FLAG_IS_SET (buf, GST_BUFFER_FLAG_DELTA_UNIT);
+  }
+
+  g_object_set_data (G_OBJECT (fakesink), COUNT_KEY,
+      GINT_TO_POINTER (++count));
+
+  if (count == GOP_JOIN_BUFFERS) {
+    g_object_set (G_OBJECT (fakesink), "signal-handoffs", FALSE, NULL);
+    g_idle_add (quit_main_loop_idle, loop);
+  }
+}
+
+static gboolean
+join_gop_cache_idle (gpointer pipeline)
+{
+  GstElement *agnosticbin = gst_bin_get_by_name (GST_BIN (pipeline),
+      "agnostic");
+  GstElement *filter = gst_element_factory_make ("capsfilter", NULL);
+  GstElement *fakesink = gst_element_factory_make ("fakesink", NULL);
+  GstCaps *caps = gst_caps_from_string ("video/x-vp8");
+
+  g_object_set (G_OBJECT (filter), "caps", caps, NULL);
+  gst_caps_unref (caps);
+  g_object_set (G_OBJECT (fakesink), "sync", FALSE, "signal-handoffs", TRUE,
+      "async", FALSE, NULL);
+  g_signal_connect (G_OBJECT (fakesink), "handoff",
+      G_CALLBACK (fakesink_hand_off_joined), NULL);
+
+  /* Only the requests made by the join from now on */
+  g_atomic_int_set (&force_key_units, 0);
+
+  gst_bin_add_many (GST_BIN (pipeline), filter, fakesink, NULL);
+  fail_unless (gst_element_link (filter, fakesink));
+  gst_element_sync_state_with_parent (fakesink);
+  gst_element_sync_state_with_parent (filter);
+  fail_unless (gst_element_link (agnosticbin, filter));
+
+  g_object_unref (agnosticbin);
+
+  return FALSE;
+}
+
+static void
+fakesink_hand_off_first (GstElement * fakesink, GstBuffer * buf,
+    GstPad * pad, gpointer pipeline)
+{
+  gint count =
+      GPOINTER_TO_INT (g_object_get_data (G_OBJECT (fakesink), COUNT_KEY));
+
+  g_object_set_data (G_OBJECT (fakesink), COUNT_KEY,
+      GINT_TO_POINTER (++count));
+
+  /* Halfway through the GOP */
+  if (count == GOP_JOIN_BUFFERS) {
+    g_object_set (G_OBJECT (fakesink), "signal-handoffs", FALSE, NULL);
+    g_idle_add (join_gop_cache_idle, pipeline);
+  }
+}
+
+GST_START_TEST (gop_cache_join)
+{
+  GstElement *pipeline =
+      gst_parse_launch
+      ("videotestsrc is-live=true ! video/x-raw, width=(int)320, height=(int)240, framerate=(fraction)30/1 ! vp8enc deadline=1 keyframe-max-dist=300 ! agnosticbin name=agnostic gop-cache=true ! video/x-vp8 ! fakesink name=first sync=false async=false signal-handoffs=true",
+      NULL);
+  GstBus *bus = gst_pipeline_get_bus (GST_PIPELINE (pipeline));
+  GstElement *agnosticbin = gst_bin_get_by_name (GST_BIN (pipeline),
+      "agnostic");
+  GstElement *first = gst_bin_get_by_name (GST_BIN (pipeline), "first");
+  GstPad *sink = gst_element_get_static_pad (agnosticbin, "sink");
+
+  loop = g_main_loop_new (NULL, TRUE);
+  force_key_units = 0;
+  join_first_keyframe = FALSE;
+
+  gst_pad_add_probe (sink, GST_PAD_PROBE_TYPE_EVENT_UPSTREAM,
+      count_force_key_units, NULL, NULL);
+  g_signal_connect (G_OBJECT (first), "handoff",
+      G_CALLBACK (fakesink_hand_off_first), pipeline);
+
+  gst_bus_add_signal_watch (bus);
+  g_signal_connect (bus, "message", G_CALLBACK (bus_msg), pipeline);
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+  g_timeout_add_seconds (10, timeout_check, pipeline);
+
+  mark_point ();
+  g_main_loop_run (loop);
+  mark_point ();
+
+  /* Started with the cached key frame, without asking for a new one */
+  fail_unless (join_first_keyframe);
+  fail_unless_equals_int (g_atomic_int_get (&force_key_units), 0);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_bus_remove_signal_watch (bus);
+  g_object_unref (sink);
+  g_object_unref (first);
+  g_object_unref (agnosticbin);
+  g_object_unref (bus);
+  g_object_unref (pipeline);
+  g_main_loop_unref (loop);
+}
+
 GST_END_TEST
 /*
  * End of test cases
@@ -990,6 +1410,7 @@ agnostic2_suite (void)
   suite_add_tcase (s, tc_chain);
   tcase_add_test (tc_chain, create_test);
   tcase_add_test (tc_chain, simple_link);
+  tcase_add_test (tc_chain, shared_fan_out_link);
   tcase_add_test (tc_chain, encoded_input_link);
   tcase_add_test (tc_chain, static_link);
   tcase_add_test (tc_chain, reconnect_test);
@@ -1004,6 +1425,10 @@ agnostic2_suite (void)
   tcase_add_test (tc_chain, input_caps_reconfiguration);
   tcase_add_test (tc_chain, encoded_input_n_encoded_output);
   tcase_add_test (tc_chain, h264_encoding_odd_dimension);
+  tcase_add_test (tc_chain, vp8_encoder_profile);
+  tcase_add_test (tc_chain, vp8_encoding_ladder);
+  tcase_add_test (tc_chain, vp8_encoding_ladder_remb);
+  tcase_add_test (tc_chain, gop_cache_join);
 
   return s;
 }
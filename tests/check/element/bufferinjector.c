@@ -266,6 +266,131 @@ GST_START_TEST (renegotiate_input)
 
 GST_END_TEST;
 
+#define INJECTED_BUFFERS 3
+
+static GMutex stalled_mutex;
+static GCond stalled_cond;
+static gboolean stalled_released;
+
+static GstPadProbeReturn
+drop_after_first_probe (GstPad * pad, GstPadProbeInfo * info, gpointer data)
+{
+  /* Input stalls after the first buffer, so the injector starts injecting */
+  if (g_atomic_int_add ((gint *) data, 1) > 0) {
+    return GST_PAD_PROBE_DROP;
+  }
+
+  return GST_PAD_PROBE_OK;
+}
+
+static void
+stalled_hand_off (GstElement * fakesink, GstBuffer * buf, GstPad * pad,
+    gpointer data)
+{
+  if (!GST_BUFFER_FLAG_IS_SET (buf, GST_BUFFER_FLAG_GAP)) {
+    return;
+  }
+
+  /* Injected buffers block until the test ends */
+  g_mutex_lock (&stalled_mutex);
+  while (!stalled_released) {
+    g_cond_wait (&stalled_cond, &stalled_mutex);
+  }
+  g_mutex_unlock (&stalled_mutex);
+}
+
+static gboolean
+quit_main_loop_idle (gpointer data)
+{
+  g_main_loop_quit (data);
+
+  return FALSE;
+}
+
+static void
+injected_hand_off (GstElement * fakesink, GstBuffer * buf, GstPad * pad,
+    gpointer data)
+{
+  static gint injected = 0;
+
+  if (GST_BUFFER_FLAG_IS_SET (buf, GST_BUFFER_FLAG_GAP)
+      && g_atomic_int_add (&injected, 1) + 1 == INJECTED_BUFFERS) {
+    g_idle_add (quit_main_loop_idle, data);
+  }
+}
+
+static gboolean
+injection_timeout (gpointer data)
+{
+  fail ("Injector starved by stalled ones");
+
+  return FALSE;
+}
+
+static void
+add_injector (GstElement * pipeline, GCallback hand_off, gpointer data)
+{
+  GstElement *videotestsrc = gst_element_factory_make ("videotestsrc", NULL);
+  GstElement *bufferinjector = gst_element_factory_make ("bufferinjector",
+      NULL);
+  GstElement *fakesink = gst_element_factory_make ("fakesink", NULL);
+  gint *count = g_new0 (gint, 1);
+  GstPad *sink;
+
+  g_object_set (videotestsrc, "is-live", TRUE, NULL);
+  g_object_set (fakesink, "sync", FALSE, "async", FALSE, "signal-handoffs",
+      TRUE, NULL);
+  g_signal_connect (G_OBJECT (fakesink), "handoff", hand_off, data);
+
+  gst_bin_add_many (GST_BIN (pipeline), videotestsrc, bufferinjector,
+      fakesink, NULL);
+  fail_unless (gst_element_link_many (videotestsrc, bufferinjector, fakesink,
+          NULL));
+
+  sink = gst_element_get_static_pad (bufferinjector, "sink");
+  gst_pad_add_probe (sink, GST_PAD_PROBE_TYPE_BUFFER, drop_after_first_probe,
+      count, g_free);
+  g_object_unref (sink);
+}
+
+GST_START_TEST (stalled_downstream)
+{
+  GMainLoop *loop = g_main_loop_new (NULL, FALSE);
+  GstElement *pipeline = gst_pipeline_new (__FUNCTION__);
+  guint ncpu = g_get_num_processors ();
+  guint source, i;
+
+  stalled_released = FALSE;
+
+  /* Enough blocked pushes to hold every thread of the pool */
+  for (i = 0; i < ncpu; i++) {
+    add_injector (pipeline, G_CALLBACK (stalled_hand_off), NULL);
+  }
+
+  add_injector (pipeline, G_CALLBACK (injected_hand_off), loop);
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+  source = g_timeout_add_seconds (10, injection_timeout, NULL);
+
+  mark_point ();
+  g_main_loop_run (loop);
+  mark_point ();
+
+  g_source_remove (source);
+
+  g_mutex_lock (&stalled_mutex);
+  stalled_released = TRUE;
+  g_cond_broadcast (&stalled_cond);
+  g_mutex_unlock (&stalled_mutex);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (GST_OBJECT (pipeline));
+  g_main_loop_unref (loop);
+}
+
+GST_END_TEST;
+
 static Suite *
 buffer_injector_suite (void)
 {
@@ -277,6 +402,7 @@ buffer_injector_suite (void)
   tcase_add_test (tc_chain, video_test_buffer_injector);
   tcase_add_test (tc_chain, buffer_injector_drop_buffers);
   tcase_add_test (tc_chain, renegotiate_input);
+  tcase_add_test (tc_chain, stalled_downstream);
   return s;
 }
 
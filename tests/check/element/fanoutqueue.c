@@ -0,0 +1,292 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+#include <gst/check/gstcheck.h>
+#include <gst/gst.h>
+
+#define FAST_BUFFERS 30
+#define SLOW_PUSH_TIME (200 * G_TIME_SPAN_MILLISECOND)
+#define N_BUFFERS 10
+
+static GstStaticPadTemplate srctemplate = GST_STATIC_PAD_TEMPLATE ("src",
+    GST_PAD_SRC,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS_ANY);
+
+static GstStaticPadTemplate sinktemplate = GST_STATIC_PAD_TEMPLATE ("sink",
+    GST_PAD_SINK,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS_ANY);
+
+static guint
+count_threads (void)
+{
+  GDir *dir = g_dir_open ("/proc/self/task", 0, NULL);
+  guint n = 0;
+
+  if (dir == NULL) {
+    return 0;
+  }
+
+  while (g_dir_read_name (dir) != NULL) {
+    n++;
+  }
+
+  g_dir_close (dir);
+
+  return n;
+}
+
+static gboolean
+quit_main_loop_idle (gpointer data)
+{
+  GMainLoop *loop = data;
+
+  g_main_loop_quit (loop);
+  return FALSE;
+}
+
+static gboolean
+timeout_check (gpointer pipeline)
+{
+  fail ("Fast consumer starved");
+
+  return FALSE;
+}
+
+static void
+slow_hand_off (GstElement * fakesink, GstBuffer * buf, GstPad * pad,
+    gpointer data)
+{
+  g_usleep (SLOW_PUSH_TIME);
+}
+
+static guint max_threads;
+
+static void
+fast_hand_off (GstElement * fakesink, GstBuffer * buf, GstPad * pad,
+    gpointer data)
+{
+  GMainLoop *loop = data;
+  static gint count = 0;
+
+  max_threads = MAX (max_threads, count_threads ());
+
+  if (++count == FAST_BUFFERS) {
+    g_object_set (G_OBJECT (fakesink), "signal-handoffs", FALSE, NULL);
+    g_idle_add (quit_main_loop_idle, loop);
+  }
+}
+
+static void
+add_consumer (GstElement * pipeline, GstElement * tee, GCallback hand_off,
+    gpointer data)
+{
+  GstElement *queue = gst_element_factory_make ("fanoutqueue", NULL);
+  GstElement *fakesink = gst_element_factory_make ("fakesink", NULL);
+
+  g_object_set (G_OBJECT (fakesink), "sync", FALSE, "async", FALSE,
+      "signal-handoffs", TRUE, NULL);
+  g_signal_connect (G_OBJECT (fakesink), "handoff", hand_off, data);
+
+  gst_bin_add_many (GST_BIN (pipeline), queue, fakesink, NULL);
+  fail_unless (gst_element_link_many (tee, queue, fakesink, NULL));
+}
+
+GST_START_TEST (slow_consumers)
+{
+  GMainLoop *loop = g_main_loop_new (NULL, TRUE);
+  GstElement *pipeline = gst_pipeline_new (__FUNCTION__);
+  GstElement *videotestsrc = gst_element_factory_make ("videotestsrc", NULL);
+  GstElement *tee = gst_element_factory_make ("tee", NULL);
+  guint ncpu = g_get_num_processors ();
+  guint threads, i;
+  guint source;
+
+  g_object_set (G_OBJECT (videotestsrc), "is-live", TRUE, NULL);
+
+  gst_bin_add_many (GST_BIN (pipeline), videotestsrc, tee, NULL);
+  fail_unless (gst_element_link (videotestsrc, tee));
+
+  /* Enough blocking consumers to hold every thread of the pool */
+  for (i = 0; i < ncpu; i++) {
+    add_consumer (pipeline, tee, G_CALLBACK (slow_hand_off), NULL);
+  }
+
+  add_consumer (pipeline, tee, G_CALLBACK (fast_hand_off), loop);
+
+  threads = count_threads ();
+  max_threads = 0;
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+  source = g_timeout_add_seconds (10, timeout_check, pipeline);
+
+  mark_point ();
+  g_main_loop_run (loop);
+  mark_point ();
+
+  g_source_remove (source);
+
+  /* The pool grows while consumers block, but never above its limit. A few
+   * threads more are used by the source and the pipeline itself */
+  GST_DEBUG ("Threads: %u before, %u max", threads, max_threads);
+  fail_unless (max_threads <= threads + 3 * ncpu + 8);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  g_object_unref (pipeline);
+  g_main_loop_unref (loop);
+}
+
+GST_END_TEST static gint freed_buffers;
+
+static void
+buffer_freed (gpointer data, GstMiniObject * obj)
+{
+  g_atomic_int_inc (&freed_buffers);
+}
+
+static GstElement *
+setup_queue (GstPad ** srcpad, GstPad ** sinkpad)
+{
+  GstElement *queue = gst_check_setup_element ("fanoutqueue");
+
+  *srcpad = gst_check_setup_src_pad (queue, &srctemplate);
+  *sinkpad = gst_check_setup_sink_pad (queue, &sinktemplate);
+  gst_pad_set_active (*srcpad, TRUE);
+  gst_pad_set_active (*sinkpad, TRUE);
+
+  fail_unless (gst_element_set_state (queue, GST_STATE_PLAYING) ==
+      GST_STATE_CHANGE_SUCCESS);
+  gst_check_setup_events (*srcpad, queue, NULL, GST_FORMAT_TIME);
+
+  return queue;
+}
+
+static void
+teardown_queue (GstElement * queue)
+{
+  /* A pool thread may still hold the queue for a moment */
+  while (GST_OBJECT_REFCOUNT_VALUE (queue) > 1) {
+    g_usleep (G_TIME_SPAN_MILLISECOND);
+  }
+
+  gst_element_set_state (queue, GST_STATE_NULL);
+  gst_check_teardown_src_pad (queue);
+  gst_check_teardown_sink_pad (queue);
+  gst_check_teardown_element (queue);
+}
+
+GST_START_TEST (unlink_no_leak)
+{
+  GstPad *srcpad, *sinkpad, *queue_src;
+  GstElement *queue = setup_queue (&srcpad, &sinkpad);
+  GstFlowReturn ret = GST_FLOW_OK;
+  guint i;
+
+  freed_buffers = 0;
+
+  queue_src = gst_element_get_static_pad (queue, "src");
+  fail_unless (gst_pad_unlink (queue_src, sinkpad));
+
+  /* The first buffers are accepted, the next ones get the push result */
+  for (i = 0; i < N_BUFFERS; i++) {
+    GstBuffer *buffer = gst_buffer_new ();
+
+    gst_mini_object_weak_ref (GST_MINI_OBJECT (buffer), buffer_freed, NULL);
+    ret = gst_pad_push (srcpad, buffer);
+    g_usleep (10 * G_TIME_SPAN_MILLISECOND);
+  }
+
+  fail_unless (ret == GST_FLOW_NOT_LINKED);
+
+  for (i = 0; i < 100 && g_atomic_int_get (&freed_buffers) < N_BUFFERS; i++) {
+    g_usleep (10 * G_TIME_SPAN_MILLISECOND);
+  }
+
+  fail_unless (g_atomic_int_get (&freed_buffers) == N_BUFFERS);
+
+  /* Relinking reconfigures the queue, it accepts buffers again */
+  fail_unless (gst_pad_link (queue_src, sinkpad) == GST_PAD_LINK_OK);
+  g_object_unref (queue_src);
+
+  fail_unless (gst_pad_push (srcpad, gst_buffer_new ()) == GST_FLOW_OK);
+
+  g_mutex_lock (&check_mutex);
+  while (g_list_length (buffers) < 1) {
+    g_cond_wait (&check_cond, &check_mutex);
+  }
+  g_mutex_unlock (&check_mutex);
+
+  gst_check_drop_buffers ();
+  teardown_queue (queue);
+}
+
+GST_END_TEST static guint buffers_at_query;
+
+static gboolean
+drain_query (GstPad * pad, GstObject * parent, GstQuery * query)
+{
+  if (GST_QUERY_TYPE (query) != GST_QUERY_DRAIN) {
+    return gst_pad_query_default (pad, parent, query);
+  }
+
+  g_mutex_lock (&check_mutex);
+  buffers_at_query = g_list_length (buffers);
+  g_mutex_unlock (&check_mutex);
+
+  return TRUE;
+}
+
+GST_START_TEST (serialized_query_order)
+{
+  GstPad *srcpad, *sinkpad;
+  GstElement *queue = setup_queue (&srcpad, &sinkpad);
+  GstQuery *query;
+  guint i;
+
+  gst_pad_set_query_function (sinkpad, drain_query);
+
+  for (i = 0; i < N_BUFFERS; i++) {
+    fail_unless (gst_pad_push (srcpad, gst_buffer_new ()) == GST_FLOW_OK);
+  }
+
+  /* Answered after the pending buffers, not refused */
+  query = gst_query_new_drain ();
+  fail_unless (gst_pad_peer_query (srcpad, query));
+  gst_query_unref (query);
+
+  fail_unless (buffers_at_query == N_BUFFERS);
+
+  gst_check_drop_buffers ();
+  teardown_queue (queue);
+}
+
+GST_END_TEST
+/* Suite initialization */
+static Suite *
+fanoutqueue_suite (void)
+{
+  Suite *s = suite_create ("fanoutqueue");
+  TCase *tc_chain = tcase_create ("element");
+
+  suite_add_tcase (s, tc_chain);
+  tcase_add_test (tc_chain, slow_consumers);
+  tcase_add_test (tc_chain, unlink_no_leak);
+  tcase_add_test (tc_chain, serialized_query_order);
+
+  return s;
+}
+
+GST_CHECK_MAIN (fanoutqueue);
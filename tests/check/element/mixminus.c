@@ -0,0 +1,196 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gst/check/gstcheck.h>
+#include <gst/gst.h>
+#include <glib.h>
+
+#define AUDIBLE_BUFFERS 10
+
+static GMainLoop *loop;
+
+/* Buffers with sound received on each output */
+static gint talker_audible;
+static gint listener_audible;
+
+static gboolean
+quit_main_loop (gpointer data)
+{
+  g_main_loop_quit (loop);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+bus_msg (GstBus * bus, GstMessage * msg, gpointer pipe)
+{
+  switch (GST_MESSAGE_TYPE (msg)) {
+    case GST_MESSAGE_ERROR:{
+      GST_ERROR ("Error: %" GST_PTR_FORMAT, msg);
+      GST_DEBUG_BIN_TO_DOT_FILE_WITH_TS (GST_BIN (pipe),
+          GST_DEBUG_GRAPH_SHOW_ALL, "bus_error");
+      fail ("Error received on bus");
+      break;
+    }
+    default:
+      break;
+  }
+}
+
+static gboolean
+buffer_is_audible (GstBuffer * buffer)
+{
+  gboolean audible = FALSE;
+  GstMapInfo info;
+  gint16 *samples;
+  gsize i;
+
+  gst_buffer_map (buffer, &info, GST_MAP_READ);
+  samples = (gint16 *) info.data;
+
+  for (i = 0; i < info.size / sizeof (gint16) && !audible; i++) {
+    audible = samples[i] != 0;
+  }
+
+  gst_buffer_unmap (buffer, &info);
+
+  return audible;
+}
+
+static GstPadProbeReturn
+talker_probe_cb (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  /* The only other input is silent, the talker must not hear itself */
+  if (buffer_is_audible (GST_PAD_PROBE_INFO_BUFFER (info))) {
+    g_atomic_int_inc (&talker_audible);
+  }
+
+  return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn
+listener_probe_cb (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  if (!buffer_is_audible (GST_PAD_PROBE_INFO_BUFFER (info))) {
+    return GST_PAD_PROBE_OK;
+  }
+
+  if (g_atomic_int_add (&listener_audible, 1) + 1 == AUDIBLE_BUFFERS) {
+    g_idle_add (quit_main_loop, NULL);
+  }
+
+  return GST_PAD_PROBE_OK;
+}
+
+static void
+pad_added_cb (GstElement * element, GstPad * pad, gpointer data)
+{
+  GstElement *pipeline = GST_ELEMENT (data);
+  GstPadProbeCallback callback;
+  GstElement *sink;
+  GstPad *sinkpad;
+
+  if (gst_pad_get_direction (pad) != GST_PAD_SRC)
+    return;
+
+  /* src_0 gives back the mix of every input except sink_0 (the talker) */
+  if (g_strcmp0 (GST_OBJECT_NAME (pad), "src_0") == 0) {
+    callback = talker_probe_cb;
+  } else {
+    callback = listener_probe_cb;
+  }
+
+  sink = gst_element_factory_make ("fakesink", NULL);
+  g_object_set (G_OBJECT (sink), "sync", FALSE, "async", FALSE, NULL);
+  gst_bin_add (GST_BIN (pipeline), sink);
+
+  sinkpad = gst_element_get_static_pad (sink, "sink");
+  fail_unless (gst_pad_link (pad, sinkpad) == GST_PAD_LINK_OK);
+  gst_object_unref (sinkpad);
+
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, callback, NULL, NULL);
+
+  gst_element_sync_state_with_parent (sink);
+}
+
+GST_START_TEST (check_own_input_is_removed)
+{
+  GstElement *pipeline, *talker, *listener, *mixminus;
+  guint bus_watch_id;
+  GstBus *bus;
+
+  g_atomic_int_set (&talker_audible, 0);
+  g_atomic_int_set (&listener_audible, 0);
+
+  loop = g_main_loop_new (NULL, FALSE);
+
+  pipeline = gst_pipeline_new ("mixminus-test");
+  talker = gst_element_factory_make ("audiotestsrc", NULL);
+  listener = gst_element_factory_make ("audiotestsrc", NULL);
+  mixminus = gst_element_factory_make ("kmsmixminus", NULL);
+
+  /* Sine wave against silence */
+  g_object_set (G_OBJECT (talker), "is-live", TRUE, "wave", 0, NULL);
+  g_object_set (G_OBJECT (listener), "is-live", TRUE, "wave", 4, NULL);
+
+  g_signal_connect (mixminus, "pad-added", G_CALLBACK (pad_added_cb),
+      pipeline);
+
+  bus = gst_pipeline_get_bus (GST_PIPELINE (pipeline));
+  bus_watch_id = gst_bus_add_watch (bus, gst_bus_async_signal_func, NULL);
+  g_signal_connect (bus, "message", G_CALLBACK (bus_msg), pipeline);
+  g_object_unref (bus);
+
+  gst_bin_add_many (GST_BIN (pipeline), talker, listener, mixminus, NULL);
+  fail_unless (gst_element_link_pads (talker, NULL, mixminus, "sink_0"));
+  fail_unless (gst_element_link_pads (listener, NULL, mixminus, "sink_1"));
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+  g_main_loop_run (loop);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+
+  fail_unless (g_atomic_int_get (&listener_audible) >= AUDIBLE_BUFFERS);
+  fail_unless (g_atomic_int_get (&talker_audible) == 0,
+      "Talker received its own audio");
+
+  gst_object_unref (pipeline);
+  g_source_remove (bus_watch_id);
+  g_main_loop_unref (loop);
+}
+
+GST_END_TEST
+/******************************/
+/* mixminus test suit */
+/******************************/
+static Suite *
+mixminus_suite (void)
+{
+  Suite *s = suite_create ("kmsmixminus");
+  TCase *tc_chain = tcase_create ("element");
+
+  suite_add_tcase (s, tc_chain);
+
+  tcase_add_test (tc_chain, check_own_input_is_removed);
+
+  return s;
+}
+
+GST_CHECK_MAIN (mixminus);
@@ -2140,6 +2140,150 @@ GST_START_TEST (sdp_agent_regression_tests)
 
 GST_END_TEST;
 
+#define BENCH_OFFERS 1000
+#define BENCH_BANDWIDTH 500
+
+static gchar *
+offer_as_text (KmsSdpAgent * agent)
+{
+  SdpMessageContext *ctx;
+  GstSDPMessage *offer;
+  GError *err = NULL;
+  gchar *sdp_str;
+
+  ctx = kms_sdp_agent_create_offer (agent, &err);
+  fail_if (err != NULL);
+
+  offer = kms_sdp_message_context_pack (ctx, &err);
+  kms_sdp_message_context_destroy (ctx);
+  fail_if (err != NULL);
+
+  /* The session id changes on every offer */
+  gst_sdp_message_set_origin (offer, "-", "0", "0", "IN", "IP4",
+      OFFERER_ADDR);
+  sdp_str = gst_sdp_message_as_text (offer);
+  gst_sdp_message_free (offer);
+
+  return sdp_str;
+}
+
+/* An agent as created for each endpoint, with its own handlers */
+static KmsSdpAgent *
+create_templates_agent (guint bandwidth, KmsSdpMediaHandler ** handlers)
+{
+  KmsSdpAgent *agent;
+  GError *err = NULL;
+  gint id;
+
+  gchar *audio_codecs[] = {
+    "opus/48000/2",
+    "PCMU/8000"
+  };
+
+  gchar *video_codecs[] = {
+    "VP8/90000",
+    "H264/90000"
+  };
+
+  agent = kms_sdp_agent_new ();
+  fail_if (agent == NULL);
+
+  handlers[0] = KMS_SDP_MEDIA_HANDLER (kms_sdp_rtp_savpf_media_handler_new ());
+  set_default_codecs (KMS_SDP_RTP_AVP_MEDIA_HANDLER (handlers[0]),
+      audio_codecs, G_N_ELEMENTS (audio_codecs), NULL, 0);
+  id = kms_sdp_agent_add_proto_handler (agent, "audio", handlers[0]);
+  fail_if (id < 0);
+
+  handlers[1] = KMS_SDP_MEDIA_HANDLER (kms_sdp_rtp_savpf_media_handler_new ());
+  set_default_codecs (KMS_SDP_RTP_AVP_MEDIA_HANDLER (handlers[1]), NULL, 0,
+      video_codecs, G_N_ELEMENTS (video_codecs));
+  kms_sdp_rtp_avp_media_handler_add_extmap (KMS_SDP_RTP_AVP_MEDIA_HANDLER
+      (handlers[1]), 1, "URI-A", &err);
+  fail_if (err != NULL);
+
+  if (bandwidth > 0) {
+    kms_sdp_media_handler_add_bandwidth (handlers[1], "AS", bandwidth);
+  }
+
+  id = kms_sdp_agent_add_proto_handler (agent, "video", handlers[1]);
+  fail_if (id < 0);
+
+  return agent;
+}
+
+static gint64
+bench_offers (gboolean cached)
+{
+  KmsSdpMediaHandler *handlers[2];
+  KmsSdpAgent *agent;
+  gint64 start;
+  guint i;
+
+  start = g_get_monotonic_time ();
+
+  for (i = 0; i < BENCH_OFFERS; i++) {
+    /* Every other configuration is new, so its offers are built */
+    agent = create_templates_agent (cached ? BENCH_BANDWIDTH :
+        BENCH_BANDWIDTH + i + 1, handlers);
+    g_free (offer_as_text (agent));
+    g_object_unref (agent);
+  }
+
+  return g_get_monotonic_time () - start;
+}
+
+GST_START_TEST (sdp_agent_test_offer_templates)
+{
+  KmsSdpMediaHandler *handlers[2];
+  KmsSdpAgent *agents[3];
+  gchar *first, *cached, *changed, *unchanged;
+  gint64 cached_time, rebuilt_time;
+
+  /* Offers from templates are the same as freshly built ones */
+  agents[0] = create_templates_agent (0, handlers);
+  first = offer_as_text (agents[0]);
+  agents[1] = create_templates_agent (0, handlers);
+  cached = offer_as_text (agents[1]);
+
+  GST_DEBUG ("Offer:\n%s", first);
+  fail_if (g_strcmp0 (first, cached) != 0);
+
+  /* Configuration changes are not hidden by templates */
+  agents[2] = create_templates_agent (BENCH_BANDWIDTH, handlers);
+  changed = offer_as_text (agents[2]);
+  fail_if (g_strcmp0 (first, changed) == 0);
+  fail_if (g_strstr_len (changed, -1, "b=AS:500") == NULL);
+  fail_if (g_strstr_len (changed, -1, "a=rtcp-mux") == NULL);
+
+  g_object_set (handlers[0], "rtcp-mux", FALSE, NULL);
+  g_object_set (handlers[1], "rtcp-mux", FALSE, NULL);
+  g_free (changed);
+  changed = offer_as_text (agents[2]);
+  fail_if (g_strstr_len (changed, -1, "b=AS:500") == NULL);
+  fail_if (g_strstr_len (changed, -1, "a=rtcp-mux") != NULL);
+
+  /* Nor shared with handlers configured in other way */
+  unchanged = offer_as_text (agents[1]);
+  fail_if (g_strcmp0 (first, unchanged) != 0);
+
+  cached_time = bench_offers (TRUE);
+  rebuilt_time = bench_offers (FALSE);
+
+  GST_INFO ("Creating %d offers with new agents: from templates %"
+      G_GINT64_FORMAT " us, rebuilt %" G_GINT64_FORMAT " us", BENCH_OFFERS,
+      cached_time, rebuilt_time);
+
+  g_free (first);
+  g_free (cached);
+  g_free (changed);
+  g_free (unchanged);
+  g_object_unref (agents[0]);
+  g_object_unref (agents[1]);
+  g_object_unref (agents[2]);
+}
+
+GST_END_TEST;
+
 static Suite *
 sdp_agent_suite (void)
 {
@@ -2167,6 +2311,7 @@ sdp_agent_suite (void)
   tcase_add_test (tc_chain, sdp_agent_test_dynamic_pts);
   tcase_add_test (tc_chain, sdp_agent_test_optional_enc_parameters);
   tcase_add_test (tc_chain, sdp_agent_regression_tests);
+  tcase_add_test (tc_chain, sdp_agent_test_offer_templates);
 
   return s;
 }
@@ -0,0 +1,222 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <gst/check/gstcheck.h>
+#include <glib.h>
+
+#include "kmsdelaybwe.h"
+#include "kmsremb.h"
+#include "kmsrtphdrext.h"
+
+#define PACKET_SIZE 1200
+#define START_BITRATE 300000
+#define MIN_BITRATE 30000
+#define PROPAGATION_DELAY (50 * GST_MSECOND)
+#define FEEDBACK_INTERVAL GST_SECOND
+
+/*
+ * Network emulation: a sender paced at the bitrate received in the last
+ * feedback, a bottleneck link with a FIFO queue and a fixed propagation delay.
+ * Everything runs on simulated time.
+ */
+typedef struct _Packet
+{
+  GstClockTime arrival;
+  guint32 send_time;
+} Packet;
+
+typedef struct _Network
+{
+  KmsDelayBwe *bwe;
+  GQueue *in_flight;
+  GstClockTime now;
+  GstClockTime link_free;
+  GstClockTime next_feedback;
+  guint send_bitrate;
+  guint capacity;
+} Network;
+
+static void
+network_init (Network * net, guint capacity)
+{
+  net->bwe = kms_delay_bwe_new (MIN_BITRATE, 0);
+  net->in_flight = g_queue_new ();
+  net->now = 0;
+  net->link_free = 0;
+  net->next_feedback = FEEDBACK_INTERVAL;
+  net->send_bitrate = START_BITRATE;
+  net->capacity = capacity;
+}
+
+static void
+network_clear (Network * net)
+{
+  g_queue_free_full (net->in_flight, g_free);
+  kms_delay_bwe_free (net->bwe);
+}
+
+static GstClockTime
+network_get_queue_delay (Network * net)
+{
+  return net->link_free > net->now ? net->link_free - net->now : 0;
+}
+
+/* Runs until @end and returns the max queuing delay */
+static GstClockTime
+network_run (Network * net, GstClockTime end)
+{
+  GstClockTime max_delay = 0;
+
+  while (net->now < end) {
+    Packet *packet = g_new (Packet, 1);
+    GstClockTime start;
+
+    /* Bottleneck link */
+    start = MAX (net->now, net->link_free);
+    net->link_free = start + gst_util_uint64_scale (PACKET_SIZE * 8,
+        GST_SECOND, net->capacity);
+    max_delay = MAX (max_delay, network_get_queue_delay (net));
+
+    packet->arrival = net->link_free + PROPAGATION_DELAY;
+    packet->send_time = kms_rtp_hdr_ext_abs_send_time (net->now);
+    g_queue_push_tail (net->in_flight, packet);
+
+    /* Receiver */
+    while (!g_queue_is_empty (net->in_flight)) {
+      packet = g_queue_peek_head (net->in_flight);
+
+      if (packet->arrival > net->now) {
+        break;
+      }
+
+      kms_delay_bwe_incoming_packet (net->bwe, packet->arrival,
+          packet->send_time, PACKET_SIZE);
+      g_free (g_queue_pop_head (net->in_flight));
+    }
+
+    /* REMB feedback */
+    if (net->now >= net->next_feedback) {
+      guint estimate = kms_delay_bwe_get_estimate (net->bwe);
+
+      if (estimate > 0) {
+        net->send_bitrate = estimate;
+      }
+
+      GST_DEBUG ("%" GST_TIME_FORMAT ": bitrate %u, queue %" GST_TIME_FORMAT,
+          GST_TIME_ARGS (net->now), net->send_bitrate,
+          GST_TIME_ARGS (network_get_queue_delay (net)));
+
+      net->next_feedback += FEEDBACK_INTERVAL;
+    }
+
+    net->now += gst_util_uint64_scale (PACKET_SIZE * 8, GST_SECOND,
+        net->send_bitrate);
+  }
+
+  return max_delay;
+}
+
+GST_START_TEST (converge_to_capacity)
+{
+  Network net;
+  GstClockTime max_delay;
+
+  network_init (&net, 1000000);
+
+  network_run (&net, 20 * GST_SECOND);
+
+  /* Once it reaches the capacity it stays close without building queues */
+  max_delay = network_run (&net, 40 * GST_SECOND);
+  fail_unless (max_delay < 200 * GST_MSECOND);
+  fail_unless (net.send_bitrate > 0.6 * net.capacity);
+  fail_unless (net.send_bitrate < 1.1 * net.capacity);
+
+  network_clear (&net);
+}
+
+GST_END_TEST
+GST_START_TEST (capacity_drop)
+{
+  Network net;
+
+  network_init (&net, 1500000);
+
+  network_run (&net, 30 * GST_SECOND);
+  fail_unless (net.send_bitrate > 0.6 * net.capacity);
+
+  net.capacity = 500000;
+  network_run (&net, 35 * GST_SECOND);
+
+  /* The queue growth is detected before any packet is lost */
+  fail_unless (net.send_bitrate <= net.capacity);
+  fail_unless (kms_delay_bwe_get_incoming_bitrate (net.bwe) <=
+      1.05 * net.capacity);
+
+  /* And the standing queue is drained afterwards */
+  network_run (&net, 60 * GST_SECOND);
+  fail_unless (network_get_queue_delay (&net) < 100 * GST_MSECOND);
+  fail_unless (net.send_bitrate > 0.6 * net.capacity);
+
+  network_clear (&net);
+}
+
+GST_END_TEST
+GST_START_TEST (toggle_while_receiving)
+{
+  GstElement *rtpsession = gst_element_factory_make ("rtpsession", NULL);
+  GstPad *pad = gst_pad_new ("sink", GST_PAD_SINK);
+  KmsRembLocal *rl;
+  GObject *sess;
+
+  g_object_get (rtpsession, "internal-session", &sess, NULL);
+  rl = kms_remb_local_create (sess, 1, 0, 0);
+
+  /* Packets are already being received when the estimation is enabled */
+  kms_remb_local_set_recv_pad (rl, pad);
+
+  kms_remb_local_enable_delay_bwe (rl, 3);
+  fail_unless (rl->delay_bwe != NULL);
+  fail_unless (rl->abs_send_time_id == 3);
+
+  kms_remb_local_disable_delay_bwe (rl);
+  fail_unless (rl->delay_bwe == NULL);
+  fail_unless (rl->abs_send_time_id == -1);
+
+  kms_remb_local_enable_delay_bwe (rl, 3);
+  fail_unless (rl->delay_bwe != NULL);
+
+  kms_remb_local_destroy (rl);
+  g_object_unref (sess);
+  g_object_unref (pad);
+  g_object_unref (rtpsession);
+}
+
+GST_END_TEST
+/* Suite initialization */
+static Suite *
+delay_bwe_suite (void)
+{
+  Suite *s = suite_create ("delaybwe");
+  TCase *tc_chain = tcase_create ("emulated_network");
+
+  suite_add_tcase (s, tc_chain);
+  tcase_add_test (tc_chain, converge_to_capacity);
+  tcase_add_test (tc_chain, capacity_drop);
+  tcase_add_test (tc_chain, toggle_while_receiving);
+
+  return s;
+}
+
+GST_CHECK_MAIN (delay_bwe);
@@ -0,0 +1,93 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+#include <gst/check/gstcheck.h>
+#include <glib.h>
+
+#include "kmselementpool.h"
+
+#define POOL_SIZE 3
+
+static void
+count_refill (gint * refills)
+{
+  (*refills)++;
+}
+
+GST_START_TEST (take_spares)
+{
+  guint64 hits, misses;
+  gint refills = 0;
+  GstElement *tee, *identity;
+  gint i;
+
+  kms_element_pool_set_refill_func ((KmsElementPoolRefillFunc) count_refill,
+      &refills);
+
+  /* Nothing is pooled until a size is set */
+  tee = kms_element_pool_make ("tee");
+  fail_unless (tee != NULL);
+  fail_unless (g_object_is_floating (tee));
+  gst_object_unref (gst_object_ref_sink (tee));
+  kms_element_pool_get_stats (&hits, &misses);
+  fail_unless_equals_uint64 (hits, 0);
+  fail_unless_equals_uint64 (misses, 0);
+  fail_unless_equals_int (refills, 0);
+
+  kms_element_pool_set_size (POOL_SIZE);
+  fail_if (kms_element_pool_is_full ());
+
+  kms_element_pool_fill ();
+
+  for (i = 0; i < POOL_SIZE + 1; i++) {
+    tee = kms_element_pool_make ("tee");
+    fail_unless (tee != NULL);
+    fail_unless (g_object_is_floating (tee));
+    gst_object_unref (gst_object_ref_sink (tee));
+  }
+
+  kms_element_pool_get_stats (&hits, &misses);
+  fail_unless_equals_uint64 (hits, POOL_SIZE);
+  fail_unless_equals_uint64 (misses, 1);
+  fail_unless_equals_int (refills, POOL_SIZE + 1);
+
+  /* Other factories are not pooled */
+  identity = kms_element_pool_make ("identity");
+  fail_unless (identity != NULL);
+  gst_object_unref (gst_object_ref_sink (identity));
+  kms_element_pool_get_stats (&hits, &misses);
+  fail_unless_equals_uint64 (hits, POOL_SIZE);
+  fail_unless_equals_uint64 (misses, 1);
+
+  kms_element_pool_fill ();
+  kms_element_pool_set_size (0);
+  fail_unless (kms_element_pool_is_full ());
+  kms_element_pool_set_refill_func (NULL, NULL);
+}
+
+GST_END_TEST
+/* Suite initialization */
+static Suite *
+element_pool_suite (void)
+{
+  Suite *s = suite_create ("elementpool");
+  TCase *tc_chain = tcase_create ("element");
+
+  suite_add_tcase (s, tc_chain);
+  tcase_add_test (tc_chain, take_spares);
+
+  return s;
+}
+
+GST_CHECK_MAIN (element_pool);
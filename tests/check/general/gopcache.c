@@ -0,0 +1,145 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <gst/check/gstcheck.h>
+#include <glib.h>
+
+#include "kmsgopcache.h"
+
+#define FRAME_SIZE 1000
+#define FRAME_DURATION (40 * GST_MSECOND)
+
+static GstBuffer *
+create_frame (guint n, gboolean key)
+{
+  GstBuffer *buffer = gst_buffer_new_allocate (NULL, FRAME_SIZE, NULL);
+
+  GST_BUFFER_DTS (buffer) = n * FRAME_DURATION;
+  GST_BUFFER_PTS (buffer) = n * FRAME_DURATION;
+
+  if (!key) {
+    GST_BUFFER_FLAG_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+  }
+
+  return buffer;
+}
+
+GST_START_TEST (replay_since_keyframe)
+{
+  KmsGopCache *cache = kms_gop_cache_new (G_MAXSIZE, GST_CLOCK_TIME_NONE);
+  GstBufferList *replay;
+  GstBuffer *next;
+  GstClockTime last = 0;
+  guint i;
+
+  /* Nothing until the first key frame */
+  for (i = 0; i < 3; i++) {
+    GstBuffer *frame = create_frame (i, FALSE);
+
+    kms_gop_cache_add (cache, frame);
+    gst_buffer_unref (frame);
+  }
+
+  fail_if (kms_gop_cache_is_valid (cache));
+
+  for (i = 3; i < 10; i++) {
+    GstBuffer *frame = create_frame (i, i == 5);
+
+    kms_gop_cache_add (cache, frame);
+    gst_buffer_unref (frame);
+  }
+
+  fail_unless (kms_gop_cache_is_valid (cache));
+
+  next = create_frame (10, FALSE);
+  kms_gop_cache_add (cache, next);
+  replay = kms_gop_cache_get_replay (cache, next);
+
+  /* Frames 5 to 9, the next one is not replayed */
+  fail_unless (replay != NULL);
+  fail_unless_equals_int (gst_buffer_list_length (replay), 5);
+  fail_if (GST_BUFFER_FLAG_IS_SET (gst_buffer_list_get (replay, 0),
+          GST_BUFFER_FLAG_DELTA_UNIT));
+
+  for (i = 0; i < gst_buffer_list_length (replay); i++) {
+    GstBuffer *frame = gst_buffer_list_get (replay, i);
+
+    fail_unless (GST_BUFFER_DTS (frame) > last);
+    fail_unless (GST_BUFFER_DTS (frame) < GST_BUFFER_DTS (next));
+    fail_unless (GST_BUFFER_DTS (frame) >= GST_BUFFER_DTS (next) - GST_SECOND);
+    last = GST_BUFFER_DTS (frame);
+  }
+
+  gst_buffer_list_unref (replay);
+  gst_buffer_unref (next);
+  kms_gop_cache_unref (cache);
+}
+
+GST_END_TEST
+GST_START_TEST (drop_over_limits)
+{
+  KmsGopCache *cache = kms_gop_cache_new (5 * FRAME_SIZE, GST_SECOND);
+  GstBuffer *frame;
+  guint i;
+
+  for (i = 0; i < 6; i++) {
+    frame = create_frame (i, i == 0);
+    kms_gop_cache_add (cache, frame);
+    gst_buffer_unref (frame);
+  }
+
+  /* Too many bytes, invalid until the next key frame */
+  fail_if (kms_gop_cache_is_valid (cache));
+
+  frame = create_frame (6, FALSE);
+  fail_unless (kms_gop_cache_get_replay (cache, frame) == NULL);
+  gst_buffer_unref (frame);
+
+  frame = create_frame (7, TRUE);
+  kms_gop_cache_add (cache, frame);
+  gst_buffer_unref (frame);
+  fail_unless (kms_gop_cache_is_valid (cache));
+
+  kms_gop_cache_unref (cache);
+
+  /* Too long */
+  cache = kms_gop_cache_new (G_MAXSIZE, 3 * FRAME_DURATION);
+  for (i = 0; i < 5; i++) {
+    frame = create_frame (i, i == 0);
+    kms_gop_cache_add (cache, frame);
+    gst_buffer_unref (frame);
+  }
+
+  fail_if (kms_gop_cache_is_valid (cache));
+
+  kms_gop_cache_unref (cache);
+}
+
+GST_END_TEST
+/* Suite initialization */
+static Suite *
+gop_cache_suite (void)
+{
+  Suite *s = suite_create ("gopcache");
+  TCase *tc_chain = tcase_create ("cache");
+
+  suite_add_tcase (s, tc_chain);
+  tcase_add_test (tc_chain, replay_since_keyframe);
+  tcase_add_test (tc_chain, drop_over_limits);
+
+  return s;
+}
+
+GST_CHECK_MAIN (gop_cache);
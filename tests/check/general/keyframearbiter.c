@@ -0,0 +1,232 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <gst/check/gstcheck.h>
+#include <gst/check/gsttestclock.h>
+#include <gst/video/video-event.h>
+#include <glib.h>
+
+#include "kmskeyframearbiter.h"
+
+#define KEYFRAME_SIZE 10000
+#define FRAME_SIZE 1000
+
+static gint upstream_requests;
+
+static gboolean
+src_event (GstPad * pad, GstObject * parent, GstEvent * event)
+{
+  if (gst_video_event_is_force_key_unit (event)) {
+    g_atomic_int_inc (&upstream_requests);
+  }
+
+  gst_event_unref (event);
+
+  return TRUE;
+}
+
+static GstFlowReturn
+sink_chain (GstPad * pad, GstObject * parent, GstBuffer * buffer)
+{
+  gst_buffer_unref (buffer);
+
+  return GST_FLOW_OK;
+}
+
+static void
+push_frame (GstPad * src, gboolean key)
+{
+  GstBuffer *buffer =
+      gst_buffer_new_allocate (NULL, key ? KEYFRAME_SIZE : FRAME_SIZE, NULL);
+
+  if (!key) {
+    GST_BUFFER_FLAG_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+  }
+
+  fail_unless (gst_pad_push (src, buffer) == GST_FLOW_OK);
+}
+
+static void
+request_keyframe (GstPad * sink)
+{
+  gst_pad_push_event (sink,
+      gst_video_event_new_upstream_force_key_unit (GST_CLOCK_TIME_NONE, FALSE,
+          0));
+}
+
+/* Fires the timer of the arbiter, moving the clock to its time */
+static void
+fire_timer (GstClock * clock)
+{
+  GstTestClock *test_clock = GST_TEST_CLOCK (clock);
+  GstClockID id;
+
+  gst_test_clock_wait_for_next_pending_id (test_clock, &id);
+  gst_test_clock_set_time (test_clock, gst_clock_id_get_time (id));
+  fail_unless (gst_test_clock_process_next_clock_id (test_clock) == id);
+  gst_clock_id_unref (id);
+}
+
+static KmsKeyframeArbiter *
+setup_arbiter (GstClock * clock, GstPad ** src, GstPad ** sink)
+{
+  KmsKeyframeArbiter *arbiter = kms_keyframe_arbiter_new ();
+  GstSegment segment;
+
+  upstream_requests = 0;
+
+  *src = gst_pad_new ("src", GST_PAD_SRC);
+  *sink = gst_pad_new ("sink", GST_PAD_SINK);
+  gst_pad_set_event_function (*src, src_event);
+  gst_pad_set_chain_function (*sink, sink_chain);
+  fail_unless (gst_pad_link (*src, *sink) == GST_PAD_LINK_OK);
+  gst_pad_set_active (*src, TRUE);
+  gst_pad_set_active (*sink, TRUE);
+
+  kms_keyframe_arbiter_set_clock (arbiter, clock);
+  kms_keyframe_arbiter_attach (arbiter, *sink);
+
+  gst_segment_init (&segment, GST_FORMAT_TIME);
+  gst_pad_push_event (*src, gst_event_new_stream_start ("test"));
+  gst_pad_push_event (*src, gst_event_new_segment (&segment));
+
+  return arbiter;
+}
+
+static void
+teardown_arbiter (KmsKeyframeArbiter * arbiter, GstPad * src, GstPad * sink)
+{
+  gst_pad_set_active (src, FALSE);
+  gst_pad_set_active (sink, FALSE);
+  g_object_unref (src);
+  g_object_unref (sink);
+  kms_keyframe_arbiter_unref (arbiter);
+}
+
+GST_START_TEST (merge_requests)
+{
+  GstClock *clock = gst_test_clock_new_with_start_time (GST_SECOND);
+  KmsKeyframeArbiter *arbiter;
+  GstPad *src, *sink;
+  GstStructure *stats;
+  guint64 requests, grants;
+  gint i;
+
+  arbiter = setup_arbiter (clock, &src, &sink);
+
+  for (i = 0; i < 10; i++) {
+    push_frame (src, FALSE);
+  }
+
+  /* Only the first one goes upstream, the rest wait for its key frame */
+  for (i = 0; i < 5; i++) {
+    request_keyframe (sink);
+  }
+
+  fail_unless_equals_int (g_atomic_int_get (&upstream_requests), 1);
+  push_frame (src, TRUE);
+
+  /* After the key frame it is deferred until the window ends */
+  request_keyframe (sink);
+  push_frame (src, FALSE);
+  fail_unless_equals_int (g_atomic_int_get (&upstream_requests), 1);
+
+  /* A key frame 10 times bigger opens the window after around 500 ms */
+  gst_test_clock_advance_time (GST_TEST_CLOCK (clock),
+      700 * GST_MSECOND);
+  push_frame (src, FALSE);
+  fail_unless_equals_int (g_atomic_int_get (&upstream_requests), 2);
+
+  stats = kms_keyframe_arbiter_get_stats (arbiter);
+  fail_unless (gst_structure_get_uint64 (stats, "requests", &requests));
+  fail_unless (gst_structure_get_uint64 (stats, "grants", &grants));
+  fail_unless_equals_int (requests, 6);
+  fail_unless_equals_int (grants, 2);
+  gst_structure_free (stats);
+
+  teardown_arbiter (arbiter, src, sink);
+  gst_object_unref (clock);
+}
+
+GST_END_TEST
+GST_START_TEST (forward_without_frames)
+{
+  GstClock *clock = gst_test_clock_new_with_start_time (GST_SECOND);
+  KmsKeyframeArbiter *arbiter;
+  GstPad *src, *sink;
+
+  arbiter = setup_arbiter (clock, &src, &sink);
+
+  push_frame (src, FALSE);
+  request_keyframe (sink);
+  push_frame (src, TRUE);
+  fail_unless_equals_int (g_atomic_int_get (&upstream_requests), 1);
+
+  /* The source stops sending frames, the merged request is sent anyway when
+   * the window ends */
+  request_keyframe (sink);
+  fail_unless_equals_int (g_atomic_int_get (&upstream_requests), 1);
+  fire_timer (clock);
+  fail_unless_equals_int (g_atomic_int_get (&upstream_requests), 2);
+
+  teardown_arbiter (arbiter, src, sink);
+  gst_object_unref (clock);
+}
+
+GST_END_TEST
+GST_START_TEST (lost_keyframe)
+{
+  GstClock *clock = gst_test_clock_new_with_start_time (GST_SECOND);
+  KmsKeyframeArbiter *arbiter;
+  GstPad *src, *sink;
+
+  arbiter = setup_arbiter (clock, &src, &sink);
+
+  push_frame (src, FALSE);
+  request_keyframe (sink);
+  fail_unless_equals_int (g_atomic_int_get (&upstream_requests), 1);
+
+  /* Requests are merged while the key frame is expected... */
+  gst_test_clock_advance_time (GST_TEST_CLOCK (clock), 500 * GST_MSECOND);
+  request_keyframe (sink);
+  push_frame (src, FALSE);
+  fail_unless_equals_int (g_atomic_int_get (&upstream_requests), 1);
+
+  /* ...but only until the window ends, not for the maximum dispersion */
+  fire_timer (clock);
+  fail_unless_equals_int (g_atomic_int_get (&upstream_requests), 2);
+  fail_unless (gst_clock_get_time (clock) < 3 * GST_SECOND);
+
+  teardown_arbiter (arbiter, src, sink);
+  gst_object_unref (clock);
+}
+
+GST_END_TEST
+/* Suite initialization */
+static Suite *
+keyframe_arbiter_suite (void)
+{
+  Suite *s = suite_create ("keyframearbiter");
+  TCase *tc_chain = tcase_create ("requests");
+
+  suite_add_tcase (s, tc_chain);
+  tcase_add_test (tc_chain, merge_requests);
+  tcase_add_test (tc_chain, forward_without_frames);
+  tcase_add_test (tc_chain, lost_keyframe);
+
+  return s;
+}
+
+GST_CHECK_MAIN (keyframe_arbiter);
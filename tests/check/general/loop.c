@@ -0,0 +1,236 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <gst/check/gstcheck.h>
+#include <glib.h>
+
+#include "kmsloop.h"
+
+#define N_CALLBACKS 100
+
+typedef struct _OrderData
+{
+  GMutex mutex;
+  GCond cond;
+  guint expected[2];
+  guint done;
+} OrderData;
+
+typedef struct _OrderCallback
+{
+  OrderData *data;
+  guint loop;
+  guint value;
+} OrderCallback;
+
+static gboolean
+order_cb (OrderCallback * cb)
+{
+  OrderData *data = cb->data;
+
+  g_mutex_lock (&data->mutex);
+  fail_unless (data->expected[cb->loop] == cb->value);
+  data->expected[cb->loop]++;
+
+  if (++data->done == 2 * N_CALLBACKS) {
+    g_cond_signal (&data->cond);
+  }
+
+  g_mutex_unlock (&data->mutex);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+order_callback_destroy (OrderCallback * cb)
+{
+  g_slice_free (OrderCallback, cb);
+}
+
+GST_START_TEST (shared_thread_order)
+{
+  KmsLoop *loops[2];
+  GstStructure *stats;
+  OrderData data;
+  guint64 dispatched;
+  guint i, j, threads[2];
+
+  g_mutex_init (&data.mutex);
+  g_cond_init (&data.cond);
+  data.expected[0] = data.expected[1] = 0;
+  data.done = 0;
+
+  loops[0] = kms_loop_new ();
+  loops[1] = kms_loop_new ();
+
+  for (i = 0; i < N_CALLBACKS; i++) {
+    for (j = 0; j < 2; j++) {
+      OrderCallback *cb = g_slice_new (OrderCallback);
+
+      cb->data = &data;
+      cb->loop = j;
+      cb->value = i;
+      fail_if (kms_loop_idle_add_full (loops[j], G_PRIORITY_DEFAULT,
+              (GSourceFunc) order_cb, cb,
+              (GDestroyNotify) order_callback_destroy) == 0);
+    }
+  }
+
+  g_mutex_lock (&data.mutex);
+  while (data.done < 2 * N_CALLBACKS) {
+    g_cond_wait (&data.cond, &data.mutex);
+  }
+  g_mutex_unlock (&data.mutex);
+
+  for (j = 0; j < 2; j++) {
+    stats = kms_loop_get_stats (loops[j]);
+    fail_unless (gst_structure_get_uint (stats, "thread", &threads[j]));
+    fail_unless (gst_structure_get_uint64 (stats, "dispatched", &dispatched));
+    fail_unless (dispatched == N_CALLBACKS);
+    gst_structure_free (stats);
+  }
+
+  /* The pool has a single thread, so both loops share it */
+  fail_unless (threads[0] == threads[1]);
+
+  g_object_unref (loops[0]);
+  g_object_unref (loops[1]);
+
+  g_mutex_clear (&data.mutex);
+  g_cond_clear (&data.cond);
+}
+
+GST_END_TEST
+static gboolean
+never_cb (gpointer data)
+{
+  fail ("Callback should not be called");
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+count_destroy (gint * count)
+{
+  g_atomic_int_inc (count);
+}
+
+GST_START_TEST (dispose_pending)
+{
+  KmsLoop *loop = kms_loop_new ();
+  gint count = 0;
+
+  fail_if (kms_loop_timeout_add_full (loop, G_PRIORITY_DEFAULT, 10000,
+          never_cb, &count, (GDestroyNotify) count_destroy) == 0);
+  fail_if (kms_loop_timeout_add_full (loop, G_PRIORITY_DEFAULT, 10000,
+          never_cb, &count, (GDestroyNotify) count_destroy) == 0);
+
+  g_object_unref (loop);
+
+  /* Pending sources are destroyed along with the loop */
+  fail_unless (g_atomic_int_get (&count) == 2);
+}
+
+GST_END_TEST
+typedef struct _BlockData
+{
+  GMutex mutex;
+  GCond cond;
+  gboolean running;
+  gboolean release;
+} BlockData;
+
+static gboolean
+block_cb (BlockData * data)
+{
+  g_mutex_lock (&data->mutex);
+  data->running = TRUE;
+  g_cond_signal (&data->cond);
+
+  while (!data->release) {
+    g_cond_wait (&data->cond, &data->mutex);
+  }
+
+  g_mutex_unlock (&data->mutex);
+
+  return G_SOURCE_REMOVE;
+}
+
+GST_START_TEST (dispose_busy_thread)
+{
+  KmsLoop *busy = kms_loop_new ();
+  KmsLoop *loop = kms_loop_new ();
+  GstStructure *stats;
+  BlockData data;
+  guint threads, loops;
+  gint count = 0;
+
+  g_mutex_init (&data.mutex);
+  g_cond_init (&data.cond);
+  data.running = FALSE;
+  data.release = FALSE;
+
+  fail_if (kms_loop_idle_add (busy, (GSourceFunc) block_cb, &data) == 0);
+
+  g_mutex_lock (&data.mutex);
+  while (!data.running) {
+    g_cond_wait (&data.cond, &data.mutex);
+  }
+  g_mutex_unlock (&data.mutex);
+
+  stats = kms_loop_get_pool_stats ();
+  fail_unless (gst_structure_get_uint (stats, "threads", &threads));
+  fail_unless (gst_structure_get_uint (stats, "loops", &loops));
+  fail_unless (threads == 1);
+  fail_unless (loops == 2);
+  gst_structure_free (stats);
+
+  /* The shared thread is stuck in a callback of another loop, disposing this
+   * one must not wait for it */
+  fail_if (kms_loop_idle_add_full (loop, G_PRIORITY_DEFAULT, never_cb, &count,
+          (GDestroyNotify) count_destroy) == 0);
+  g_object_unref (loop);
+  fail_unless (g_atomic_int_get (&count) == 1);
+
+  g_mutex_lock (&data.mutex);
+  data.release = TRUE;
+  g_cond_signal (&data.cond);
+  g_mutex_unlock (&data.mutex);
+
+  g_object_unref (busy);
+
+  g_mutex_clear (&data.mutex);
+  g_cond_clear (&data.cond);
+}
+
+GST_END_TEST
+/* Suite initialization */
+static Suite *
+loop_suite (void)
+{
+  Suite *s = suite_create ("loop");
+  TCase *tc_chain = tcase_create ("shared");
+
+  kms_loop_set_pool_size (1);
+
+  suite_add_tcase (s, tc_chain);
+  tcase_add_test (tc_chain, shared_thread_order);
+  tcase_add_test (tc_chain, dispose_pending);
+  tcase_add_test (tc_chain, dispose_busy_thread);
+
+  return s;
+}
+
+GST_CHECK_MAIN (loop);
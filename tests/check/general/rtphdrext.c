@@ -0,0 +1,155 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+#include "kmsrtphdrext.h"
+
+#include <gst/check/gstcheck.h>
+#include <gst/rtp/gstrtpbuffer.h>
+#include <glib.h>
+
+#define ABS_SEND_TIME_ID 3
+#define PAYLOAD_SIZE 1000
+#define LIST_SIZE 64
+#define BENCHMARK_ITERATIONS 20000
+
+static guint32
+get_abs_send_time (GstBuffer * buffer, guint nth)
+{
+  GstRTPBuffer rtp = { NULL, };
+  guint32 value = G_MAXUINT32;
+  guint8 *data;
+  guint size;
+
+  fail_unless (gst_rtp_buffer_map (buffer, GST_MAP_READ, &rtp));
+
+  if (gst_rtp_buffer_get_extension_onebyte_header (&rtp, ABS_SEND_TIME_ID, nth,
+          (gpointer *) & data, &size)) {
+    fail_unless (size == KMS_RTP_HDR_EXT_ABS_SEND_TIME_SIZE);
+    value = (data[0] << 16) | (data[1] << 8) | data[2];
+  }
+
+  gst_rtp_buffer_unmap (&rtp);
+
+  return value;
+}
+
+GST_START_TEST (check_abs_send_time_added)
+{
+  KmsRtpHdrExtWriter *writer = kms_rtp_hdr_ext_writer_new (ABS_SEND_TIME_ID);
+  GstBuffer *buffer = gst_rtp_buffer_new_allocate (PAYLOAD_SIZE, 0, 0);
+  GstClockTime time = 5 * GST_SECOND + 250 * GST_MSECOND;
+
+  buffer = kms_rtp_hdr_ext_writer_write_buffer (writer, buffer, time);
+
+  fail_unless (get_abs_send_time (buffer, 0) ==
+      kms_rtp_hdr_ext_abs_send_time (time));
+  fail_unless (kms_rtp_hdr_ext_abs_send_time (time) == (5 << 18) + (1 << 16));
+
+  gst_buffer_unref (buffer);
+  kms_rtp_hdr_ext_writer_free (writer);
+}
+
+GST_END_TEST
+GST_START_TEST (check_abs_send_time_replaced)
+{
+  KmsRtpHdrExtWriter *writer = kms_rtp_hdr_ext_writer_new (ABS_SEND_TIME_ID);
+  GstBuffer *buffer = gst_rtp_buffer_new_allocate (PAYLOAD_SIZE, 0, 0);
+  gsize size;
+
+  buffer = kms_rtp_hdr_ext_writer_write_buffer (writer, buffer, GST_SECOND);
+  size = gst_buffer_get_size (buffer);
+  buffer = kms_rtp_hdr_ext_writer_write_buffer (writer, buffer,
+      2 * GST_SECOND);
+
+  /* Second write reuses the extension of the first one */
+  fail_unless (gst_buffer_get_size (buffer) == size);
+  fail_unless (get_abs_send_time (buffer, 0) ==
+      kms_rtp_hdr_ext_abs_send_time (2 * GST_SECOND));
+  fail_unless (get_abs_send_time (buffer, 1) == G_MAXUINT32);
+
+  gst_buffer_unref (buffer);
+  kms_rtp_hdr_ext_writer_free (writer);
+}
+
+GST_END_TEST
+GST_START_TEST (check_buffer_list_same_time)
+{
+  KmsRtpHdrExtWriter *writer = kms_rtp_hdr_ext_writer_new (ABS_SEND_TIME_ID);
+  GstBufferList *list = gst_buffer_list_new_sized (LIST_SIZE);
+  guint i;
+
+  for (i = 0; i < LIST_SIZE; i++) {
+    gst_buffer_list_add (list, gst_rtp_buffer_new_allocate (PAYLOAD_SIZE, 0,
+            0));
+  }
+
+  list = kms_rtp_hdr_ext_writer_write_buffer_list (writer, list, GST_SECOND);
+
+  for (i = 0; i < LIST_SIZE; i++) {
+    fail_unless (get_abs_send_time (gst_buffer_list_get (list, i), 0) ==
+        kms_rtp_hdr_ext_abs_send_time (GST_SECOND));
+  }
+
+  gst_buffer_list_unref (list);
+  kms_rtp_hdr_ext_writer_free (writer);
+}
+
+GST_END_TEST
+GST_START_TEST (benchmark_buffer_list)
+{
+  KmsRtpHdrExtWriter *writer = kms_rtp_hdr_ext_writer_new (ABS_SEND_TIME_ID);
+  GstBufferList *list = gst_buffer_list_new_sized (LIST_SIZE);
+  gint64 start, elapsed;
+  guint i;
+
+  for (i = 0; i < LIST_SIZE; i++) {
+    gst_buffer_list_add (list, gst_rtp_buffer_new_allocate (PAYLOAD_SIZE, 0,
+            0));
+  }
+
+  start = g_get_monotonic_time ();
+
+  for (i = 0; i < BENCHMARK_ITERATIONS; i++) {
+    list = kms_rtp_hdr_ext_writer_write_buffer_list (writer, list,
+        i * GST_MSECOND);
+  }
+
+  elapsed = MAX (g_get_monotonic_time () - start, 1);
+
+  GST_INFO ("abs-send-time writer: %.0f packets/s (%d lists of %d packets)",
+      (gdouble) BENCHMARK_ITERATIONS * LIST_SIZE * G_USEC_PER_SEC / elapsed,
+      BENCHMARK_ITERATIONS, LIST_SIZE);
+
+  gst_buffer_list_unref (list);
+  kms_rtp_hdr_ext_writer_free (writer);
+}
+
+GST_END_TEST
+/* Suite initialization */
+static Suite *
+rtphdrext_suite (void)
+{
+  Suite *s = suite_create ("rtphdrext");
+  TCase *tc_chain = tcase_create ("element");
+
+  suite_add_tcase (s, tc_chain);
+  tcase_add_test (tc_chain, check_abs_send_time_added);
+  tcase_add_test (tc_chain, check_abs_send_time_replaced);
+  tcase_add_test (tc_chain, check_buffer_list_same_time);
+  tcase_add_test (tc_chain, benchmark_buffer_list);
+
+  return s;
+}
+
+GST_CHECK_MAIN (rtphdrext);
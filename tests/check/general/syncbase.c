@@ -0,0 +1,195 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <gst/check/gstcheck.h>
+#include <glib.h>
+
+#include "kmssyncbase.h"
+
+#define BASE_CLOCK (10 * GST_SECOND)
+#define BENCH_STREAMS 2
+#define BENCH_ITERATIONS 1000000
+
+typedef struct _ClockData
+{
+  GstClockTime running_time;
+  gint calls;
+} ClockData;
+
+static GstClockTime
+get_running_time (ClockData * data)
+{
+  g_atomic_int_inc (&data->calls);
+
+  return data->running_time;
+}
+
+GST_START_TEST (rebase)
+{
+  ClockData clock = { GST_CLOCK_TIME_NONE, 0 };
+  KmsSyncBase *base = kms_sync_base_new ((KmsSyncBaseClockFunc)
+      get_running_time, &clock);
+  KmsSyncBasePad *audio = kms_sync_base_pad_new (base);
+  KmsSyncBasePad *video = kms_sync_base_pad_new (base);
+  GstBufferList *list;
+  GstBuffer *buffer;
+  guint i;
+
+  /* No clock yet, but the base time is taken from the first timestamp */
+  fail_if (GST_CLOCK_TIME_IS_VALID (kms_sync_base_pad_rebase (audio,
+              5 * GST_SECOND)));
+
+  clock.running_time = BASE_CLOCK;
+
+  fail_unless_equals_uint64 (kms_sync_base_pad_rebase (video,
+          6 * GST_SECOND), BASE_CLOCK + GST_SECOND);
+  fail_unless_equals_uint64 (kms_sync_base_pad_rebase (audio,
+          7 * GST_SECOND), BASE_CLOCK + 2 * GST_SECOND);
+
+  /* Earlier than base */
+  fail_unless_equals_uint64 (kms_sync_base_pad_rebase (audio, GST_SECOND),
+      BASE_CLOCK);
+  fail_if (GST_CLOCK_TIME_IS_VALID (kms_sync_base_pad_rebase (audio,
+              GST_CLOCK_TIME_NONE)));
+
+  list = gst_buffer_list_new ();
+  for (i = 0; i < 3; i++) {
+    buffer = gst_buffer_new ();
+    GST_BUFFER_PTS (buffer) = (5 + i) * GST_SECOND;
+    gst_buffer_list_add (list, buffer);
+  }
+
+  list = kms_sync_base_pad_rebase_list (video, list);
+
+  for (i = 0; i < 3; i++) {
+    buffer = gst_buffer_list_get (list, i);
+    fail_unless_equals_uint64 (GST_BUFFER_PTS (buffer),
+        BASE_CLOCK + i * GST_SECOND);
+    fail_unless_equals_uint64 (GST_BUFFER_DTS (buffer),
+        GST_BUFFER_PTS (buffer));
+  }
+
+  gst_buffer_list_unref (list);
+
+  /* The clock is not queried once the base is set */
+  fail_unless_equals_int (clock.calls, 2);
+
+  kms_sync_base_pad_free (audio);
+  kms_sync_base_pad_free (video);
+  kms_sync_base_unref (base);
+}
+
+GST_END_TEST
+/* Same work under a lock per timestamp, as it was done before */
+typedef struct _LockedBase
+{
+  GMutex mutex;
+  GstClockTime base_time;
+  GstClockTime base_clock;
+} LockedBase;
+
+static gpointer
+bench_locked (LockedBase * locked)
+{
+  GstClockTime sum = 0;
+  guint i;
+
+  for (i = 0; i < BENCH_ITERATIONS; i++) {
+    g_mutex_lock (&locked->mutex);
+    sum += (i * GST_MSECOND - locked->base_time) + locked->base_clock;
+    g_mutex_unlock (&locked->mutex);
+  }
+
+  return GSIZE_TO_POINTER (sum != 0);
+}
+
+static gpointer
+bench_lock_free (KmsSyncBase * base)
+{
+  KmsSyncBasePad *pad = kms_sync_base_pad_new (base);
+  GstClockTime sum = 0;
+  guint i;
+
+  for (i = 0; i < BENCH_ITERATIONS; i++) {
+    sum += kms_sync_base_pad_rebase (pad, i * GST_MSECOND);
+  }
+
+  kms_sync_base_pad_free (pad);
+
+  return GSIZE_TO_POINTER (sum != 0);
+}
+
+static gint64
+run_streams (GThreadFunc func, gpointer data)
+{
+  GThread *threads[BENCH_STREAMS];
+  gint64 start;
+  guint i;
+
+  start = g_get_monotonic_time ();
+
+  for (i = 0; i < BENCH_STREAMS; i++) {
+    threads[i] = g_thread_new ("stream", func, data);
+  }
+
+  for (i = 0; i < BENCH_STREAMS; i++) {
+    fail_unless (g_thread_join (threads[i]));
+  }
+
+  return g_get_monotonic_time () - start;
+}
+
+GST_START_TEST (benchmark_contended_rebase)
+{
+  ClockData clock = { BASE_CLOCK, 0 };
+  KmsSyncBase *base = kms_sync_base_new ((KmsSyncBaseClockFunc)
+      get_running_time, &clock);
+  LockedBase locked;
+  gint64 locked_time, lock_free_time;
+
+  g_mutex_init (&locked.mutex);
+  locked.base_time = 0;
+  locked.base_clock = BASE_CLOCK;
+
+  locked_time = run_streams ((GThreadFunc) bench_locked, &locked);
+  lock_free_time = run_streams ((GThreadFunc) bench_lock_free, base);
+
+  GST_INFO ("Rebasing %d timestamps in %d streams: locked %" G_GINT64_FORMAT
+      " us, lock free %" G_GINT64_FORMAT " us", BENCH_ITERATIONS,
+      BENCH_STREAMS, locked_time, lock_free_time);
+
+  /* Only the first timestamp goes through the slow path */
+  fail_unless_equals_int (clock.calls, 1);
+
+  g_mutex_clear (&locked.mutex);
+  kms_sync_base_unref (base);
+}
+
+GST_END_TEST
+/* Suite initialization */
+static Suite *
+sync_base_suite (void)
+{
+  Suite *s = suite_create ("syncbase");
+  TCase *tc_chain = tcase_create ("rebase");
+
+  suite_add_tcase (s, tc_chain);
+  tcase_add_test (tc_chain, rebase);
+  tcase_add_test (tc_chain, benchmark_contended_rebase);
+
+  return s;
+}
+
+GST_CHECK_MAIN (sync_base);
@@ -0,0 +1,110 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <gst/check/gstcheck.h>
+#include <glib.h>
+
+#include "kmstimerwheel.h"
+
+#define N_TIMERS 4
+
+typedef struct _TimerData
+{
+  GMutex *mutex;
+  GCond *cond;
+  guint *fired;
+  gint64 deadline;
+  gint64 expired;
+} TimerData;
+
+static void
+timer_cb (KmsTimerWheelTimer * timer, gpointer user_data)
+{
+  TimerData *data = user_data;
+
+  g_mutex_lock (data->mutex);
+  data->expired = g_get_monotonic_time ();
+  (*data->fired)++;
+  g_cond_signal (data->cond);
+  g_mutex_unlock (data->mutex);
+}
+
+GST_START_TEST (expire_after_deadline)
+{
+  /* The last one is beyond the first level of the wheel */
+  gint64 delays[N_TIMERS] = { 50, 10, 120, 700 };
+  KmsTimerWheelTimer *timers[N_TIMERS], *cancelled;
+  TimerData data[N_TIMERS], cancelled_data;
+  gint64 now = g_get_monotonic_time ();
+  guint fired = 0;
+  GMutex mutex;
+  GCond cond;
+  guint i;
+
+  g_mutex_init (&mutex);
+  g_cond_init (&cond);
+
+  for (i = 0; i < N_TIMERS; i++) {
+    data[i].mutex = &mutex;
+    data[i].cond = &cond;
+    data[i].fired = &fired;
+    data[i].deadline = now + delays[i] * G_TIME_SPAN_MILLISECOND;
+    data[i].expired = 0;
+    timers[i] = kms_timer_wheel_timer_new (timer_cb, &data[i], NULL);
+    kms_timer_wheel_timer_arm (timers[i], data[i].deadline);
+  }
+
+  cancelled_data = data[0];
+  cancelled = kms_timer_wheel_timer_new (timer_cb, &cancelled_data, NULL);
+  kms_timer_wheel_timer_arm (cancelled, now + 20 * G_TIME_SPAN_MILLISECOND);
+  fail_unless (kms_timer_wheel_timer_is_armed (cancelled));
+  kms_timer_wheel_timer_cancel (cancelled);
+  fail_if (kms_timer_wheel_timer_is_armed (cancelled));
+
+  g_mutex_lock (&mutex);
+  while (fired < N_TIMERS) {
+    g_cond_wait (&cond, &mutex);
+  }
+  g_mutex_unlock (&mutex);
+
+  for (i = 0; i < N_TIMERS; i++) {
+    /* Timers never expire before their deadline */
+    fail_unless (data[i].expired >= data[i].deadline);
+    fail_if (kms_timer_wheel_timer_is_armed (timers[i]));
+    kms_timer_wheel_timer_free (timers[i]);
+  }
+
+  fail_unless (cancelled_data.expired == 0);
+  kms_timer_wheel_timer_free (cancelled);
+
+  g_mutex_clear (&mutex);
+  g_cond_clear (&cond);
+}
+
+GST_END_TEST
+/* Suite initialization */
+static Suite *
+timer_wheel_suite (void)
+{
+  Suite *s = suite_create ("timerwheel");
+  TCase *tc_chain = tcase_create ("timers");
+
+  suite_add_tcase (s, tc_chain);
+  tcase_add_test (tc_chain, expire_after_deadline);
+
+  return s;
+}
+
+GST_CHECK_MAIN (timer_wheel);
@@ -34,6 +34,39 @@ GST_START_TEST (check_urls)
 
 }
 
+GST_END_TEST
+GST_START_TEST (check_factory_cache)
+{
+  GstElementFactory *first, *second;
+  guint64 hits, misses, prev_hits, prev_misses;
+  GstCaps *caps = gst_caps_from_string ("audio/x-raw");
+
+  kms_utils_get_element_factory_cache_stats (&prev_hits, &prev_misses);
+
+  first =
+      kms_utils_get_element_factory_for_caps (GST_ELEMENT_FACTORY_TYPE_ANY,
+      caps, caps, NULL);
+  second =
+      kms_utils_get_element_factory_for_caps (GST_ELEMENT_FACTORY_TYPE_ANY,
+      caps, caps, NULL);
+
+  kms_utils_get_element_factory_cache_stats (&hits, &misses);
+
+  fail_unless (first == second);
+  fail_unless (misses == prev_misses + 1);
+  fail_unless (hits == prev_hits + 1);
+
+  if (first != NULL) {
+    gst_object_unref (first);
+  }
+
+  if (second != NULL) {
+    gst_object_unref (second);
+  }
+
+  gst_caps_unref (caps);
+}
+
 GST_END_TEST
 /* Suite initialization */
 static Suite *
@@ -44,6 +77,7 @@ utils_suite (void)
 
   suite_add_tcase (s, tc_chain);
   tcase_add_test (tc_chain, check_urls);
+  tcase_add_test (tc_chain, check_factory_cache);
 
   return s;
 }
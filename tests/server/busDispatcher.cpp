@@ -0,0 +1,248 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE BusDispatcher
+#include <boost/test/unit_test.hpp>
+#include <gst/gst.h>
+#include <BusDispatcher.hpp>
+#include <MediaSet.hpp>
+#include <WorkerPool.hpp>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+
+using namespace kurento;
+
+struct GF {
+  GF();
+  ~GF();
+};
+
+BOOST_GLOBAL_FIXTURE (GF)
+
+GF::GF()
+{
+  gst_init (NULL, NULL);
+}
+
+GF::~GF()
+{
+  MediaSet::deleteMediaSet();
+}
+
+/* Shared by the dispatchers as the pool of the MediaSet is */
+static std::shared_ptr<WorkerPool> workers (new WorkerPool (2, 8) );
+
+/* A pipeline with its bus handled by a BusDispatcher, keyed by its name */
+struct Bus {
+  Bus ();
+  ~Bus ();
+
+  void post (int seq);
+  std::vector<int> received ();
+  bool waitReceived (size_t count, int timeoutMs);
+
+  GstElement *pipeline;
+  GstBus *bus;
+  std::shared_ptr<BusDispatcher> dispatcher;
+  gulong handler;
+
+  std::mutex mutex;
+  std::condition_variable cond;
+  std::vector<int> seqs;
+  std::atomic<int> handlingTime;
+};
+
+static void
+busMessage (GstBus *bus, GstMessage *message, gpointer data)
+{
+  Bus *self = static_cast <Bus *> (data);
+  const GstStructure *st = gst_message_get_structure (message);
+  int seq = -1;
+
+  if (self->handlingTime > 0) {
+    std::this_thread::sleep_for (std::chrono::milliseconds (
+                                   self->handlingTime) );
+  }
+
+  if (st != NULL) {
+    gst_structure_get_int (st, "seq", &seq);
+  }
+
+  std::unique_lock<std::mutex> lock (self->mutex);
+  self->seqs.push_back (seq);
+  self->cond.notify_all ();
+}
+
+Bus::Bus () : handlingTime (0)
+{
+  pipeline = gst_pipeline_new (NULL);
+  bus = gst_pipeline_get_bus (GST_PIPELINE (pipeline) );
+  handler = g_signal_connect (bus, "message", G_CALLBACK (busMessage), this);
+  dispatcher = std::make_shared <BusDispatcher> (bus, workers,
+               GST_OBJECT_NAME (pipeline), nullptr);
+  dispatcher->start ();
+}
+
+Bus::~Bus ()
+{
+  dispatcher->stop ();
+
+  /* A drain task keeps a reference while it emits its last message */
+  while (dispatcher.use_count () > 1) {
+    std::this_thread::sleep_for (std::chrono::milliseconds (1) );
+  }
+
+  g_signal_handler_disconnect (bus, handler);
+  dispatcher.reset ();
+  g_object_unref (bus);
+  g_object_unref (pipeline);
+}
+
+void
+Bus::post (int seq)
+{
+  gst_bus_post (bus, gst_message_new_application (GST_OBJECT (pipeline),
+                gst_structure_new ("test", "seq", G_TYPE_INT, seq, NULL) ) );
+}
+
+std::vector<int>
+Bus::received ()
+{
+  std::unique_lock<std::mutex> lock (mutex);
+
+  return seqs;
+}
+
+bool
+Bus::waitReceived (size_t count, int timeoutMs)
+{
+  std::unique_lock<std::mutex> lock (mutex);
+
+  return cond.wait_for (lock, std::chrono::milliseconds (timeoutMs),
+  [this, count] () {
+    return seqs.size () >= count;
+  });
+}
+
+BOOST_AUTO_TEST_CASE (ordered_across_batches)
+{
+  /* Several times the batch a drain task runs before yielding */
+  const int MESSAGES = 500;
+  Bus bus;
+  std::vector<int> seqs;
+
+  for (int i = 0; i < MESSAGES; i++) {
+    bus.post (i);
+  }
+
+  BOOST_REQUIRE (bus.waitReceived (MESSAGES, 5000) );
+
+  seqs = bus.received ();
+  BOOST_REQUIRE_EQUAL (seqs.size (), (size_t) MESSAGES);
+
+  for (int i = 0; i < MESSAGES; i++) {
+    BOOST_CHECK_EQUAL (seqs[i], i);
+  }
+
+  BOOST_CHECK_EQUAL (bus.dispatcher->getStats ().dispatched,
+                     (uint64_t) MESSAGES);
+}
+
+BOOST_AUTO_TEST_CASE (flooding_bus)
+{
+  const int FLOOD = 1000;
+  Bus flooding;
+  Bus other;
+  GError *error = g_error_new_literal (GST_CORE_ERROR, GST_CORE_ERROR_FAILED,
+                                       "test");
+  std::chrono::steady_clock::time_point start;
+  int64_t elapsed;
+
+  /* Enough to keep every worker busy for seconds if it did not yield */
+  flooding.handlingTime = 5;
+
+  for (int i = 0; i < FLOOD; i++) {
+    flooding.post (i);
+  }
+
+  start = std::chrono::steady_clock::now ();
+  gst_bus_post (other.bus, gst_message_new_error (GST_OBJECT (other.pipeline),
+                error, "test") );
+  g_error_free (error);
+
+  BOOST_REQUIRE (other.waitReceived (1, 5000) );
+  elapsed = std::chrono::duration_cast<std::chrono::milliseconds>
+            (std::chrono::steady_clock::now () - start).count ();
+
+  BOOST_TEST_MESSAGE ("Error dispatched after " << elapsed << " ms");
+  BOOST_CHECK (elapsed < 500);
+  BOOST_CHECK (flooding.received ().size () < (size_t) FLOOD);
+
+  /* The rest are dropped with the dispatcher */
+}
+
+BOOST_AUTO_TEST_CASE (dropped_after_stop)
+{
+  Bus bus;
+  BusDispatcher::Stats stats;
+
+  bus.post (0);
+  BOOST_REQUIRE (bus.waitReceived (1, 5000) );
+
+  bus.dispatcher->stop ();
+  bus.post (1);
+
+  BOOST_CHECK (!bus.waitReceived (2, 200) );
+  stats = bus.dispatcher->getStats ();
+  BOOST_CHECK_EQUAL (stats.dispatched, 1u);
+  BOOST_CHECK_EQUAL (stats.pending, 0u);
+}
+
+BOOST_AUTO_TEST_CASE (extra_types)
+{
+  Bus bus;
+  BusDispatcher::Stats stats;
+
+  /* Not dispatched by default */
+  gst_bus_post (bus.bus, gst_message_new_latency (GST_OBJECT (bus.pipeline) ) );
+  stats = bus.dispatcher->getStats ();
+  BOOST_CHECK_EQUAL (stats.filtered, 1u);
+
+  bus.dispatcher->addTypes (GST_MESSAGE_LATENCY);
+  gst_bus_post (bus.bus, gst_message_new_latency (GST_OBJECT (bus.pipeline) ) );
+
+  BOOST_CHECK (bus.waitReceived (1, 5000) );
+  stats = bus.dispatcher->getStats ();
+  BOOST_CHECK_EQUAL (stats.filtered, 1u);
+  BOOST_CHECK_EQUAL (stats.dispatched, 1u);
+}
+
+BOOST_AUTO_TEST_CASE (element_state_changes)
+{
+  Bus bus;
+  GstElement *element = gst_element_factory_make ("fakesrc", NULL);
+
+  /* Media elements listen to the state changes of their own elements */
+  gst_bin_add (GST_BIN (bus.pipeline), element);
+  gst_bus_post (bus.bus, gst_message_new_state_changed (GST_OBJECT (element),
+                GST_STATE_NULL, GST_STATE_READY, GST_STATE_VOID_PENDING) );
+
+  BOOST_CHECK (bus.waitReceived (1, 5000) );
+  BOOST_CHECK_EQUAL (bus.dispatcher->getStats ().filtered, 0u);
+}
@@ -19,6 +19,7 @@
 #include <MediaPipelineImpl.hpp>
 #include <MediaElementImpl.hpp>
 #include <ElementConnectionData.hpp>
+#include <ElementConnectionResult.hpp>
 #include <MediaType.hpp>
 #include <KurentoException.hpp>
 #include <GstreamerDotDetails.hpp>
@@ -285,3 +286,133 @@ BOOST_AUTO_TEST_CASE (dot_test)
   src.reset();
   pipe.reset();
 }
+
+BOOST_AUTO_TEST_CASE (connect_many)
+{
+  const int N_SINKS = 50;
+  std::string mediaPipelineId =
+    moduleManager.getFactory ("MediaPipeline")->createObject (
+      config, "",
+      Json::Value() )->getId();
+  std::string otherPipelineId =
+    moduleManager.getFactory ("MediaPipeline")->createObject (
+      config, "",
+      Json::Value() )->getId();
+  std::shared_ptr <MediaElementImpl> src = createDummyElement ("dummysrc",
+      mediaPipelineId);
+  std::shared_ptr <MediaElementImpl> other = createDummyElement ("dummysink",
+      otherPipelineId);
+  std::vector<std::shared_ptr<MediaElement>> sinks;
+  std::vector<std::shared_ptr<ElementConnectionResult>> results;
+
+  g_object_set (src->getGstreamerElement(), "audio", TRUE, "video", TRUE, NULL);
+
+  for (int i = 0; i < N_SINKS; i++) {
+    std::shared_ptr <MediaElementImpl> sink = createDummyElement ("dummysink",
+        mediaPipelineId);
+
+    g_object_set (sink->getGstreamerElement(), "audio", TRUE, "video", TRUE,
+                  NULL);
+    sinks.push_back (sink);
+  }
+
+  /* Outputs are only configured once the agnosticbins are running */
+  gst_element_set_state (std::dynamic_pointer_cast <MediaPipelineImpl>
+                         (MediaSet::getMediaSet()->getMediaObject (mediaPipelineId) )->getPipeline(),
+                         GST_STATE_PLAYING);
+
+  auto start = std::chrono::steady_clock::now();
+
+  for (auto sink : sinks) {
+    src->connect (sink);
+  }
+
+  auto single = std::chrono::steady_clock::now() - start;
+
+  for (auto sink : sinks) {
+    src->disconnect (sink);
+  }
+
+  BOOST_CHECK (src->getSinkConnections ().size() == 0);
+
+  start = std::chrono::steady_clock::now();
+  results = src->connectMany (sinks);
+  auto batch = std::chrono::steady_clock::now() - start;
+
+  BOOST_TEST_MESSAGE ("connect: " <<
+                      std::chrono::duration_cast<std::chrono::microseconds>
+                      (single).count() << " us, connectMany: " <<
+                      std::chrono::duration_cast<std::chrono::microseconds>
+                      (batch).count() << " us");
+
+  BOOST_REQUIRE (results.size() == 2 * N_SINKS);
+
+  for (auto result : results) {
+    BOOST_CHECK (result->getSuccess () );
+  }
+
+  BOOST_CHECK (src->getSinkConnections ().size() == 2 * N_SINKS);
+
+  for (auto sink : sinks) {
+    GstElement *element = std::dynamic_pointer_cast <MediaElementImpl>
+                          (sink)->getGstreamerElement();
+
+    for (const char *name : {
+           "sink_audio", "sink_video"
+         }) {
+      GstPad *pad = gst_element_get_static_pad (element, name);
+
+      BOOST_REQUIRE (pad != NULL);
+      BOOST_CHECK (gst_pad_is_linked (pad) );
+      g_object_unref (pad);
+    }
+  }
+
+  /* Pads are blocked once and outputs configured once for the whole batch */
+  BOOST_CHECK (batch < single);
+
+  int disconnected = 0;
+  sigc::connection conn = src->signalElementDisconnected.connect ([&] (
+  ElementDisconnected event) {
+    disconnected++;
+  });
+
+  sinks.push_back (other);
+  results = src->disconnectMany (sinks, std::shared_ptr <MediaType>
+                                 (new MediaType (MediaType::VIDEO) ) );
+
+  BOOST_REQUIRE (results.size() == N_SINKS + 1);
+  BOOST_CHECK (results.back()->getSuccess () == false);
+  BOOST_CHECK (src->getSinkConnections ().size() == N_SINKS);
+  /* Nothing to disconnect from other */
+  BOOST_CHECK (disconnected == N_SINKS);
+
+  /* Sinks that are not media elements still get their result */
+  results = src->disconnectMany ({std::shared_ptr<MediaElement> (), sinks[0]},
+                                 std::shared_ptr <MediaType> (new MediaType (MediaType::AUDIO) ) );
+
+  BOOST_REQUIRE (results.size() == 2);
+  BOOST_CHECK (results[0]->getSuccess () == false);
+  BOOST_CHECK (results[1]->getSuccess () );
+  BOOST_CHECK (disconnected == N_SINKS + 1);
+
+  conn.disconnect ();
+
+  results = src->connectMany ({other});
+
+  for (auto result : results) {
+    BOOST_CHECK (result->getSuccess () == false);
+  }
+
+  for (auto sink : sinks) {
+    releaseMediaObject (sink->getId() );
+  }
+
+  releaseMediaObject (src->getId() );
+  releaseMediaObject (mediaPipelineId);
+  releaseMediaObject (otherPipelineId);
+
+  sinks.clear();
+  src.reset();
+  other.reset();
+}
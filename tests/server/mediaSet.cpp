@@ -26,6 +26,13 @@
 #include <ServerType.hpp>
 #include <ObjectCreated.hpp>
 #include <ObjectDestroyed.hpp>
+#include <WorkerPoolStats.hpp>
+#include <MediaPipelineImpl.hpp>
+#include <PipelineCpuStats.hpp>
+#include <ElementCpuStats.hpp>
+#include <ObjectPoolStats.hpp>
+#include <CreationLatency.hpp>
+#include <future>
 
 #include <config.h>
 
@@ -61,13 +68,16 @@ InitTests::~InitTests()
 
 
 struct F {
-  F();
+  F (const boost::property_tree::ptree &config = boost::property_tree::ptree
+     () );
   ~F();
 
+  /* Media objects keep a reference to it */
+  boost::property_tree::ptree config;
   std::shared_ptr<ServerManagerImpl> serverManager;
 };
 
-F::F ()
+F::F (const boost::property_tree::ptree &config) : config (config)
 {
   std::vector<std::shared_ptr<ModuleInfo>> modules;
 
@@ -92,7 +102,7 @@ F::F ()
 
   serverManager =  std::dynamic_pointer_cast <ServerManagerImpl>
                    (MediaSet::getMediaSet ()->ref (new ServerManagerImpl (
-                         serverInfo, boost::property_tree::ptree (), *moduleManager.get() ) ) );
+                         serverInfo, this->config, *moduleManager.get() ) ) );
   MediaSet::getMediaSet ()->setServerManager (std::dynamic_pointer_cast
       <ServerManagerImpl> (serverManager) );
 }
@@ -240,3 +250,358 @@ BOOST_FIXTURE_TEST_CASE (get_pipelines, F)
 
   pipes.clear();
 }
+
+BOOST_FIXTURE_TEST_CASE (worker_pool_stats, F)
+{
+  std::shared_ptr<kurento::Factory> mediaPipelineFactory;
+  std::shared_ptr<WorkerPoolStats> stats;
+  int executed;
+
+  mediaPipelineFactory = moduleManager->getFactory ("MediaPipeline");
+  executed = serverManager->getWorkerPoolStats ()->getExecutedTasks ();
+
+  for (int i = 0; i < 10; i++) {
+    std::string id = mediaPipelineFactory->createObject (
+                       boost::property_tree::ptree(), "session1",
+                       Json::Value() )->getId();
+
+    kurento::MediaSet::getMediaSet()->release (id);
+  }
+
+  for (int i = 0; i < 100; i++) {
+    stats = serverManager->getWorkerPoolStats ();
+
+    if (stats->getQueueDepth () == 0 && stats->getExecutedTasks () > executed) {
+      break;
+    }
+
+    std::this_thread::sleep_for (std::chrono::milliseconds (10) );
+  }
+
+  BOOST_CHECK (stats->getQueueDepth () == 0);
+  BOOST_CHECK (stats->getExecutedTasks () > executed);
+  BOOST_CHECK (stats->getThreads () <= stats->getMaxThreads () );
+  BOOST_CHECK (stats->getLatencyHistogram ().size () ==
+               stats->getLatencyBuckets ().size () + 1);
+}
+
+BOOST_AUTO_TEST_CASE (worker_pool_blocked_affinity)
+{
+  /* One worker, so both pipelines share its ordered queue */
+  WorkerPool pool (1, 2);
+  std::promise<void> unblock;
+  std::shared_future<void> blocked = unblock.get_future().share();
+  std::atomic<bool> otherRun (false);
+  std::vector<int> order;
+  std::mutex mutex;
+
+  pool.post ([blocked, &order, &mutex] () {
+    blocked.wait();
+    std::unique_lock<std::mutex> lock (mutex);
+    order.push_back (1);
+  }, "pipeline1");
+  pool.post ([&order, &mutex] () {
+    std::unique_lock<std::mutex> lock (mutex);
+    order.push_back (2);
+  }, "pipeline1");
+  pool.post ([&otherRun] () {
+    otherRun = true;
+  }, "pipeline2");
+
+  for (int i = 0; i < 100 && !otherRun; i++) {
+    std::this_thread::sleep_for (std::chrono::milliseconds (100) );
+  }
+
+  BOOST_CHECK (otherRun);
+
+  std::unique_lock<std::mutex> lock (mutex);
+  BOOST_CHECK (order.empty () );
+  lock.unlock();
+
+  unblock.set_value();
+
+  for (int i = 0; i < 100; i++) {
+    lock.lock();
+
+    if (order.size () == 2) {
+      lock.unlock();
+      break;
+    }
+
+    lock.unlock();
+    std::this_thread::sleep_for (std::chrono::milliseconds (10) );
+  }
+
+  lock.lock();
+  BOOST_REQUIRE (order.size () == 2);
+  BOOST_CHECK (order[0] == 1 && order[1] == 2);
+}
+
+BOOST_FIXTURE_TEST_CASE (lookup_contention, F)
+{
+  const int N_OBJECTS = 64;
+  const int N_THREADS = 8;
+  const int N_LOOKUPS = 20000;
+  std::shared_ptr<kurento::Factory> mediaPipelineFactory;
+  std::vector<std::string> ids;
+  std::vector<std::thread> threads;
+  std::atomic<int> errors (0);
+
+  mediaPipelineFactory = moduleManager->getFactory ("MediaPipeline");
+
+  for (int i = 0; i < N_OBJECTS; i++) {
+    ids.push_back (mediaPipelineFactory->createObject (
+                     boost::property_tree::ptree(), "session1",
+                     Json::Value() )->getId() );
+  }
+
+  auto start = std::chrono::steady_clock::now();
+
+  for (int i = 0; i < N_THREADS; i++) {
+    threads.push_back (std::thread ([&ids, &errors, i] () {
+      std::string sessionId = "session1";
+
+      for (int j = 0; j < N_LOOKUPS; j++) {
+        try {
+          kurento::MediaSet::getMediaSet()->keepAliveSession (sessionId);
+          kurento::MediaSet::getMediaSet()->getMediaObject (sessionId,
+              ids[ (i + j) % ids.size()]);
+        } catch (KurentoException &e) {
+          errors++;
+        }
+      }
+    }) );
+  }
+
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>
+                 (std::chrono::steady_clock::now() - start).count();
+
+  BOOST_TEST_MESSAGE ("lookup_contention: " << N_THREADS << " threads, " <<
+                      (N_THREADS * N_LOOKUPS * 1000000.0 / std::max<int64_t>
+                       (elapsed, 1) ) << " lookups/s");
+
+  BOOST_CHECK (errors == 0);
+
+  for (auto id : ids) {
+    kurento::MediaSet::getMediaSet()->release (id);
+  }
+}
+
+BOOST_FIXTURE_TEST_CASE (session_timeout, F)
+{
+  std::shared_ptr<kurento::Factory> mediaPipelineFactory;
+  std::string mediaPipelineId;
+  MediaSet::CollectorStats stats;
+
+  kurento::MediaSet::getMediaSet()->setSessionCollectorConfig (1, 0);
+  mediaPipelineFactory = moduleManager->getFactory ("MediaPipeline");
+
+  mediaPipelineId = mediaPipelineFactory->createObject (
+                      boost::property_tree::ptree(), "session1",
+                      Json::Value() )->getId();
+  mediaPipelineFactory->createObject (boost::property_tree::ptree(),
+                                      "session2", Json::Value() );
+
+  for (int i = 0; i < 30; i++) {
+    kurento::MediaSet::getMediaSet()->keepAliveSession ("session1");
+    std::this_thread::sleep_for (std::chrono::milliseconds (100) );
+  }
+
+  stats = kurento::MediaSet::getMediaSet()->getCollectorStats ();
+
+  BOOST_CHECK (stats.sessionTimeout == 1);
+  BOOST_CHECK (stats.expiredSessions == 1);
+  BOOST_CHECK (kurento::MediaSet::getMediaSet()->getPipelines ("session3").size()
+               == 1);
+
+  kurento::MediaSet::getMediaSet()->release (mediaPipelineId);
+}
+
+#define BUSY_BUFFERS 20
+#define BUSY_TIME_PER_BUFFER (20 * G_TIME_SPAN_MILLISECOND)
+
+static void
+busyHandoff (GstElement *sink, GstBuffer *buffer, GstPad *pad, gpointer data)
+{
+  std::atomic<int> *handled = static_cast <std::atomic<int> *> (data);
+  gint64 end = g_get_monotonic_time () + BUSY_TIME_PER_BUFFER;
+
+  while (g_get_monotonic_time () < end) {
+  }
+
+  (*handled)++;
+}
+
+BOOST_FIXTURE_TEST_CASE (pipelines_cpu, F)
+{
+  std::shared_ptr<kurento::Factory> mediaPipelineFactory;
+  std::shared_ptr<MediaPipelineImpl> pipeline;
+  std::shared_ptr<ElementCpuStats> source;
+  std::atomic<int> handled (0);
+  double pipelineCpuTime = 0;
+  std::vector<std::string> sessions;
+  GstElement *fakesrc, *fakesink;
+
+  mediaPipelineFactory = moduleManager->getFactory ("MediaPipeline");
+  pipeline = std::dynamic_pointer_cast <MediaPipelineImpl>
+             (MediaSet::getMediaSet ()->getMediaObject (
+                mediaPipelineFactory->createObject (boost::property_tree::ptree(),
+                    "session1", Json::Value() )->getId() ) );
+  BOOST_REQUIRE (pipeline);
+
+  /* The handoff runs in the streaming thread of the source */
+  fakesrc = gst_element_factory_make ("fakesrc", NULL);
+  fakesink = gst_element_factory_make ("fakesink", NULL);
+  g_object_set (fakesrc, "num-buffers", BUSY_BUFFERS, NULL);
+  g_object_set (fakesink, "sync", FALSE, "signal-handoffs", TRUE, NULL);
+  g_signal_connect (fakesink, "handoff", G_CALLBACK (busyHandoff), &handled);
+
+  gst_bin_add_many (GST_BIN (pipeline->getPipeline () ), fakesrc, fakesink,
+                    NULL);
+  BOOST_REQUIRE (gst_element_link (fakesrc, fakesink) );
+  gst_element_sync_state_with_parent (fakesink);
+  gst_element_sync_state_with_parent (fakesrc);
+
+  for (int i = 0; i < 100 && handled < BUSY_BUFFERS; i++) {
+    std::this_thread::sleep_for (std::chrono::milliseconds (100) );
+  }
+
+  BOOST_REQUIRE (handled == BUSY_BUFFERS);
+
+  pipeline->getTaskPool ()->sample (GST_SECOND);
+  sessions = MediaSet::getMediaSet ()->getSessions ();
+
+  for (auto stats : serverManager->getPipelinesCpu () ) {
+    if (std::dynamic_pointer_cast <MediaPipelineImpl> (stats->getPipeline () ) !=
+        pipeline) {
+      continue;
+    }
+
+    pipelineCpuTime = stats->getCpuTime ();
+
+    for (auto element : stats->getElements () ) {
+      BOOST_CHECK (element->getElementClass () != "fakesink");
+
+      if (element->getElementClass () == "fakesrc") {
+        source = element;
+      }
+    }
+  }
+
+  /* Reading the stats does not keep the pipelines alive in any session */
+  BOOST_CHECK (MediaSet::getMediaSet ()->getSessions () == sessions);
+
+  BOOST_REQUIRE (source);
+  BOOST_CHECK (pipelineCpuTime >= source->getCpuTime () );
+  BOOST_CHECK (source->getCpuTime () >= (BUSY_BUFFERS - 1) *
+               BUSY_TIME_PER_BUFFER / (double) G_USEC_PER_SEC);
+  BOOST_CHECK (source->getThreads () == 1);
+
+  gst_element_set_state (fakesrc, GST_STATE_NULL);
+  gst_element_set_state (fakesink, GST_STATE_NULL);
+  gst_bin_remove_many (GST_BIN (pipeline->getPipeline () ), fakesrc, fakesink,
+                       NULL);
+
+  MediaSet::getMediaSet ()->release (pipeline->getId () );
+}
+
+#define POOL_SIZE 2
+
+static boost::property_tree::ptree
+poolConfig ()
+{
+  boost::property_tree::ptree config;
+
+  config.add ("modules.kurento.ServerManager.pipelinePoolSize", POOL_SIZE);
+  config.add ("modules.kurento.ServerManager.elementPoolSize", 0);
+
+  return config;
+}
+
+struct PoolF : F {
+  PoolF () : F (poolConfig () ) {}
+};
+
+static std::shared_ptr<ObjectPoolStats>
+waitReadyPipelines (std::shared_ptr<ServerManagerImpl> serverManager,
+                    int ready)
+{
+  std::shared_ptr<ObjectPoolStats> stats;
+
+  for (int i = 0; i < 100; i++) {
+    stats = serverManager->getObjectPoolStats ();
+
+    if (stats->getReadyPipelines () == ready) {
+      break;
+    }
+
+    std::this_thread::sleep_for (std::chrono::milliseconds (50) );
+  }
+
+  return stats;
+}
+
+static int
+createdObjects (std::shared_ptr<ObjectPoolStats> stats, const std::string &type)
+{
+  int created = 0;
+
+  for (auto latency : stats->getCreationLatency () ) {
+    if (latency->getType () != type) {
+      continue;
+    }
+
+    BOOST_CHECK_EQUAL (latency->getHistogram ().size (),
+                       stats->getLatencyBuckets ().size () + 1);
+
+    for (auto count : latency->getHistogram () ) {
+      created += count;
+    }
+  }
+
+  return created;
+}
+
+BOOST_FIXTURE_TEST_CASE (object_pool_stats, PoolF)
+{
+  const int PIPELINES = POOL_SIZE + 1;
+  std::shared_ptr<kurento::Factory> mediaPipelineFactory;
+  std::shared_ptr<ObjectPoolStats> before, after;
+  std::vector<std::string> ids;
+
+  mediaPipelineFactory = moduleManager->getFactory ("MediaPipeline");
+
+  /* The refill thread builds them in the background */
+  before = waitReadyPipelines (serverManager, POOL_SIZE);
+  BOOST_REQUIRE_EQUAL (before->getPipelines (), POOL_SIZE);
+  BOOST_REQUIRE_EQUAL (before->getReadyPipelines (), POOL_SIZE);
+
+  for (int i = 0; i < PIPELINES; i++) {
+    ids.push_back (mediaPipelineFactory->createObject (
+                     boost::property_tree::ptree(), "session1",
+                     Json::Value() )->getId() );
+  }
+
+  /* The ready ones are taken first, the rest may be built on demand */
+  after = serverManager->getObjectPoolStats ();
+  BOOST_CHECK (after->getPipelineHits () - before->getPipelineHits () >=
+               POOL_SIZE);
+  BOOST_CHECK_EQUAL (after->getPipelineHits () + after->getPipelineMisses () -
+                     before->getPipelineHits () - before->getPipelineMisses (),
+                     PIPELINES);
+
+  BOOST_CHECK_EQUAL (createdObjects (after, "MediaPipeline") -
+                     createdObjects (before, "MediaPipeline"), PIPELINES);
+
+  /* And the pool is filled again */
+  after = waitReadyPipelines (serverManager, POOL_SIZE);
+  BOOST_CHECK_EQUAL (after->getReadyPipelines (), POOL_SIZE);
+
+  for (auto id : ids) {
+    kurento::MediaSet::getMediaSet()->release (id);
+  }
+}
@@ -0,0 +1,299 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE PipelineTaskPool
+#include <boost/test/unit_test.hpp>
+#include <gst/gst.h>
+#include <PipelineTaskPool.hpp>
+#include <MediaSet.hpp>
+#include <atomic>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using namespace kurento;
+
+struct GF {
+  GF();
+  ~GF();
+};
+
+BOOST_GLOBAL_FIXTURE (GF)
+
+GF::GF()
+{
+  gst_init (NULL, NULL);
+}
+
+GF::~GF()
+{
+  MediaSet::deleteMediaSet();
+}
+
+static PipelineTaskPool::ThreadClass
+classify (const char *factory, const char *caps)
+{
+  GstElement *owner = NULL;
+  GstCaps *c = NULL;
+  PipelineTaskPool::ThreadClass threadClass;
+
+  if (factory != NULL) {
+    owner = gst_element_factory_make (factory, NULL);
+    BOOST_REQUIRE_MESSAGE (owner != NULL, "Cannot create " << factory);
+    gst_object_ref_sink (owner);
+  }
+
+  if (caps != NULL) {
+    c = gst_caps_from_string (caps);
+  }
+
+  threadClass = PipelineTaskPool::classify (owner, c);
+
+  if (c != NULL) {
+    gst_caps_unref (c);
+  }
+
+  if (owner != NULL) {
+    gst_object_unref (owner);
+  }
+
+  return threadClass;
+}
+
+BOOST_AUTO_TEST_CASE (classify_caps)
+{
+  BOOST_CHECK_EQUAL (classify (NULL, NULL), PipelineTaskPool::DEFAULT);
+  BOOST_CHECK_EQUAL (classify (NULL, "ANY"), PipelineTaskPool::DEFAULT);
+  BOOST_CHECK_EQUAL (classify (NULL, "EMPTY"), PipelineTaskPool::DEFAULT);
+  BOOST_CHECK_EQUAL (classify (NULL, "audio/x-raw"), PipelineTaskPool::AUDIO);
+  BOOST_CHECK_EQUAL (classify (NULL, "audio/x-opus"), PipelineTaskPool::AUDIO);
+  BOOST_CHECK_EQUAL (classify (NULL, "video/x-raw"), PipelineTaskPool::VIDEO);
+  BOOST_CHECK_EQUAL (classify (NULL, "video/x-vp8"), PipelineTaskPool::VIDEO);
+  BOOST_CHECK_EQUAL (classify (NULL, "application/x-rtp"),
+                     PipelineTaskPool::RTP_IO);
+  BOOST_CHECK_EQUAL (classify (NULL, "application/x-rtcp"),
+                     PipelineTaskPool::RTP_IO);
+  BOOST_CHECK_EQUAL (classify (NULL, "application/x-srtp"),
+                     PipelineTaskPool::RTP_IO);
+  BOOST_CHECK_EQUAL (classify (NULL, "application/x-srtcp"),
+                     PipelineTaskPool::RTP_IO);
+  BOOST_CHECK_EQUAL (classify (NULL, "application/data"),
+                     PipelineTaskPool::DEFAULT);
+}
+
+BOOST_AUTO_TEST_CASE (classify_owner)
+{
+  /* Elements with no specific class depend on what they push */
+  BOOST_CHECK_EQUAL (classify ("queue", NULL), PipelineTaskPool::DEFAULT);
+  BOOST_CHECK_EQUAL (classify ("queue", "video/x-raw"),
+                     PipelineTaskPool::VIDEO);
+  BOOST_CHECK_EQUAL (classify ("queue", "application/x-rtp"),
+                     PipelineTaskPool::RTP_IO);
+
+  /* The class of the owner goes first */
+  BOOST_CHECK_EQUAL (classify ("udpsrc", NULL), PipelineTaskPool::RTP_IO);
+  BOOST_CHECK_EQUAL (classify ("udpsrc", "video/x-raw"),
+                     PipelineTaskPool::RTP_IO);
+  BOOST_CHECK_EQUAL (classify ("vp8enc", NULL), PipelineTaskPool::VIDEO);
+  BOOST_CHECK_EQUAL (classify ("vp8dec", "application/x-rtp"),
+                     PipelineTaskPool::VIDEO);
+  BOOST_CHECK_EQUAL (classify ("alawenc", NULL), PipelineTaskPool::AUDIO);
+  BOOST_CHECK_EQUAL (classify ("alawdec", "video/x-raw"),
+                     PipelineTaskPool::AUDIO);
+}
+
+static bool
+parse (const std::string &list, cpu_set_t *set)
+{
+  return PipelineTaskPool::parseCpuSet (list, set);
+}
+
+BOOST_AUTO_TEST_CASE (parse_cpu_set)
+{
+  cpu_set_t set;
+
+  BOOST_REQUIRE (parse ("0", &set) );
+  BOOST_CHECK_EQUAL (CPU_COUNT (&set), 1);
+  BOOST_CHECK (CPU_ISSET (0, &set) );
+
+  BOOST_REQUIRE (parse ("0-3,8", &set) );
+  BOOST_CHECK_EQUAL (CPU_COUNT (&set), 5);
+  BOOST_CHECK (CPU_ISSET (3, &set) );
+  BOOST_CHECK (!CPU_ISSET (4, &set) );
+  BOOST_CHECK (CPU_ISSET (8, &set) );
+
+  /* Overlapping ranges, spaces and a trailing comma */
+  BOOST_REQUIRE (parse (" 1-2 , 2-3,", &set) );
+  BOOST_CHECK_EQUAL (CPU_COUNT (&set), 3);
+
+  BOOST_REQUIRE (parse ("5-5", &set) );
+  BOOST_CHECK_EQUAL (CPU_COUNT (&set), 1);
+  BOOST_CHECK (CPU_ISSET (5, &set) );
+
+  BOOST_REQUIRE (parse ("0-" + std::to_string (CPU_SETSIZE - 1), &set) );
+  BOOST_CHECK_EQUAL (CPU_COUNT (&set), CPU_SETSIZE);
+}
+
+BOOST_AUTO_TEST_CASE (parse_invalid_cpu_set)
+{
+  cpu_set_t set;
+
+  BOOST_CHECK (!parse ("", &set) );
+  BOOST_CHECK (!parse (",", &set) );
+  BOOST_CHECK (!parse ("1,,2", &set) );
+  BOOST_CHECK (!parse ("a", &set) );
+  BOOST_CHECK (!parse ("0x1", &set) );
+  BOOST_CHECK (!parse ("3-1", &set) );
+  BOOST_CHECK (!parse ("1-", &set) );
+  BOOST_CHECK (!parse ("-1", &set) );
+  BOOST_CHECK (!parse ("1--2", &set) );
+  BOOST_CHECK (!parse ("1 2", &set) );
+  BOOST_CHECK (!parse ("1 - 2", &set) );
+  BOOST_CHECK (!parse (std::to_string (CPU_SETSIZE), &set) );
+
+  /* Nothing is left from a valid part before the error */
+  BOOST_CHECK (!parse ("0,x", &set) );
+  BOOST_CHECK_EQUAL (CPU_COUNT (&set), 0);
+}
+
+static std::atomic<pid_t> streamingThread;
+static std::atomic<bool> pinned;
+static int pinnedCpu;
+
+static GstBusSyncReply
+streamStatus (GstBus *bus, GstMessage *message, gpointer data)
+{
+  PipelineTaskPool *pool = static_cast <PipelineTaskPool *> (data);
+
+  if (GST_MESSAGE_TYPE (message) == GST_MESSAGE_STREAM_STATUS) {
+    pool->handleStreamStatus (message);
+  }
+
+  return GST_BUS_PASS;
+}
+
+static void
+handoff (GstElement *sink, GstBuffer *buffer, GstPad *pad, gpointer data)
+{
+  cpu_set_t set;
+
+  streamingThread = syscall (SYS_gettid);
+
+  if (sched_getaffinity (0, sizeof (set), &set) == 0) {
+    pinned = CPU_COUNT (&set) == 1 && CPU_ISSET (pinnedCpu, &set);
+  }
+}
+
+BOOST_AUTO_TEST_CASE (restore_after_pipeline)
+{
+  PipelineTaskPool::Placement placement;
+  std::shared_ptr<PipelineTaskPool> pool;
+  GstElement *pipeline = gst_parse_launch (
+                           "fakesrc num-buffers=10 ! fakesink name=sink signal-handoffs=true",
+                           NULL);
+  GstElement *sink = gst_bin_get_by_name (GST_BIN (pipeline), "sink");
+  GstBus *bus = gst_pipeline_get_bus (GST_PIPELINE (pipeline) );
+  cpu_set_t processCpus, threadCpus;
+  GstMessage *eos;
+
+  BOOST_REQUIRE (sched_getaffinity (0, sizeof (processCpus),
+                                    &processCpus) == 0);
+
+  for (pinnedCpu = 0; !CPU_ISSET (pinnedCpu, &processCpus); pinnedCpu++) {
+  }
+
+  placement.cpuSet[PipelineTaskPool::DEFAULT] = std::to_string (pinnedCpu);
+  pool = std::make_shared <PipelineTaskPool> (placement);
+
+  streamingThread = 0;
+  pinned = false;
+  g_signal_connect (sink, "handoff", G_CALLBACK (handoff), NULL);
+  gst_bus_set_sync_handler (bus, streamStatus, pool.get (), NULL);
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  eos = gst_bus_timed_pop_filtered (bus, 5 * GST_SECOND, GST_MESSAGE_EOS);
+  BOOST_REQUIRE (eos != NULL);
+  gst_message_unref (eos);
+
+  BOOST_CHECK (streamingThread != 0);
+  BOOST_CHECK (pinned);
+
+  /* Like a pipeline released after its bus dispatcher stopped, the LEAVE
+   * message is never handled */
+  gst_bus_set_sync_handler (bus, NULL, NULL, NULL);
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+
+  /* The thread is given back when its task returns, before the pool is
+   * cleaned up, and it may still be kept by the GThreadPool */
+  pool.reset ();
+
+  if (sched_getaffinity (streamingThread, sizeof (threadCpus),
+                         &threadCpus) == 0) {
+    BOOST_CHECK (CPU_EQUAL (&threadCpus, &processCpus) );
+  }
+
+  g_object_unref (sink);
+  g_object_unref (bus);
+  g_object_unref (pipeline);
+}
+
+static void
+burnCpu (gint64 time)
+{
+  gint64 end = g_get_monotonic_time () + time;
+
+  while (g_get_monotonic_time () < end) {
+  }
+}
+
+static void
+postStreamStatus (PipelineTaskPool &pool, GstElement *owner,
+                  GstStreamStatusType type)
+{
+  GstMessage *message = gst_message_new_stream_status (GST_OBJECT (owner),
+                        type, owner);
+
+  pool.handleStreamStatus (message);
+  gst_message_unref (message);
+}
+
+BOOST_AUTO_TEST_CASE (reused_thread_charged_from_enter)
+{
+  PipelineTaskPool pool{PipelineTaskPool::Placement () };
+  GstElement *owner = gst_element_factory_make ("fakesrc", NULL);
+  std::vector<PipelineTaskPool::CpuStats> stats;
+
+  gst_object_ref_sink (owner);
+
+  /* Like a pool thread that ran something else before */
+  burnCpu (200 * G_TIME_SPAN_MILLISECOND);
+
+  postStreamStatus (pool, owner, GST_STREAM_STATUS_TYPE_ENTER);
+  burnCpu (20 * G_TIME_SPAN_MILLISECOND);
+  postStreamStatus (pool, owner, GST_STREAM_STATUS_TYPE_LEAVE);
+
+  /* Nothing is charged after it left either */
+  burnCpu (200 * G_TIME_SPAN_MILLISECOND);
+  pool.sample (GST_SECOND);
+
+  stats = pool.getCpuStats ();
+  BOOST_REQUIRE_EQUAL (stats.size (), 1u);
+  BOOST_CHECK_EQUAL (stats[0].elementClass, "fakesrc");
+  BOOST_CHECK_EQUAL (stats[0].threads, 0);
+  BOOST_CHECK (stats[0].cpuTime >= (int64_t) (15 * GST_MSECOND));
+  BOOST_CHECK (stats[0].cpuTime < (int64_t) (100 * GST_MSECOND));
+
+  gst_object_unref (owner);
+}
@@ -0,0 +1,147 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE Reaper
+#include <boost/test/unit_test.hpp>
+#include <gst/gst.h>
+#include <Reaper.hpp>
+#include <MediaSet.hpp>
+#include <algorithm>
+#include <atomic>
+#include <future>
+
+using namespace kurento;
+
+struct GF {
+  GF();
+  ~GF();
+};
+
+BOOST_GLOBAL_FIXTURE (GF)
+
+GF::GF()
+{
+  gst_init (NULL, NULL);
+}
+
+GF::~GF()
+{
+  MediaSet::deleteMediaSet();
+}
+
+static bool
+isReleasing (const std::string &id)
+{
+  std::vector<std::string> ids = Reaper::getReaper ()->getReleasing ();
+
+  return std::find (ids.begin (), ids.end (), id) != ids.end ();
+}
+
+BOOST_AUTO_TEST_CASE (element_before_pipeline)
+{
+  GstElement *pipeline = gst_pipeline_new (NULL);
+  GstElement *element = gst_element_factory_make ("fakesrc", NULL);
+  std::promise<void> unblock;
+  std::shared_future<void> blocked = unblock.get_future ().share ();
+  std::atomic<bool> removed (false);
+  std::atomic<bool> elementFirst (false);
+
+  gst_bin_add (GST_BIN (pipeline), element);
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+  /* Both use the pipeline as key, so they run in the order they are posted
+   * even with more threads available */
+  Reaper::getReaper ()->setConcurrency (4);
+  Reaper::getReaper ()->post ("element", "pipeline", [pipeline, element,
+  blocked, &removed] () {
+    blocked.wait ();
+    gst_element_set_state (element, GST_STATE_NULL);
+    gst_bin_remove (GST_BIN (pipeline), element);
+    removed = true;
+  });
+  Reaper::getReaper ()->post ("pipeline", "pipeline", [pipeline, &removed,
+  &elementFirst] () {
+    elementFirst = removed.load ();
+    gst_element_set_state (pipeline, GST_STATE_NULL);
+    g_object_unref (pipeline);
+  });
+
+  /* Both are listed until their teardown is done */
+  BOOST_CHECK (isReleasing ("element") );
+  BOOST_CHECK (isReleasing ("pipeline") );
+
+  unblock.set_value ();
+  Reaper::getReaper ()->waitIdle ();
+
+  BOOST_CHECK (elementFirst);
+  BOOST_CHECK (!isReleasing ("element") );
+  BOOST_CHECK (!isReleasing ("pipeline") );
+}
+
+BOOST_AUTO_TEST_CASE (concurrency_limit)
+{
+  const int CONCURRENCY = 2;
+  const int JOBS = 8;
+  std::atomic<int> running (0);
+  std::atomic<int> maxRunning (0);
+  Reaper::Stats before, after;
+
+  Reaper::getReaper ()->setConcurrency (CONCURRENCY);
+  before = Reaper::getReaper ()->getStats ();
+
+  for (int i = 0; i < JOBS; i++) {
+    std::string id = "object" + std::to_string (i);
+
+    /* Every job has its own key, only the limit holds them */
+    Reaper::getReaper ()->post (id, id, [&running, &maxRunning] () {
+      int now = ++running;
+      int max = maxRunning;
+
+      while (now > max && !maxRunning.compare_exchange_weak (max, now) ) {
+      }
+
+      std::this_thread::sleep_for (std::chrono::milliseconds (50) );
+      running--;
+    });
+  }
+
+  Reaper::getReaper ()->waitIdle ();
+  after = Reaper::getReaper ()->getStats ();
+
+  BOOST_CHECK (maxRunning.load () > 0);
+  BOOST_CHECK (maxRunning.load () <= CONCURRENCY);
+  BOOST_CHECK_EQUAL (after.concurrency, CONCURRENCY);
+  BOOST_CHECK_EQUAL (after.released - before.released, (uint64_t) JOBS);
+  BOOST_CHECK_EQUAL (after.queued, 0u);
+  BOOST_CHECK_EQUAL (after.running, 0u);
+  BOOST_CHECK (Reaper::getReaper ()->getReleasing ().empty () );
+}
+
+BOOST_AUTO_TEST_CASE (delete_media_set_waits)
+{
+  std::atomic<bool> done (false);
+
+  MediaSet::getMediaSet ();
+
+  Reaper::getReaper ()->post ("slow", "slow", [&done] () {
+    std::this_thread::sleep_for (std::chrono::milliseconds (200) );
+    done = true;
+  });
+
+  MediaSet::deleteMediaSet ();
+
+  BOOST_CHECK (done);
+}
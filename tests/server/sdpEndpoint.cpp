@@ -24,6 +24,9 @@
 #include <objects/SdpEndpointImpl.hpp>
 #include <MediaSet.hpp>
 #include <ModuleManager.hpp>
+#include <ConfigCache.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include <chrono>
 
 using namespace kurento;
 
@@ -69,6 +72,7 @@ BOOST_AUTO_TEST_CASE (duplicate_offer)
   config.add ("modules.kurento.SdpEndpoint.numVideoMedias", 0);
   config.add ("modules.kurento.SdpEndpoint.audioCodecs", "[]");
   config.add ("modules.kurento.SdpEndpoint.videoCodecs", "[]");
+  ConfigCache::reload (config);
 
   std::shared_ptr <MediaObjectImpl> pipe =
     MediaSet::getMediaSet()->getMediaObject (
@@ -108,6 +112,7 @@ BOOST_AUTO_TEST_CASE (process_answer_without_offer)
   config.add ("modules.kurento.SdpEndpoint.numVideoMedias", 0);
   config.add ("modules.kurento.SdpEndpoint.audioCodecs", "[]");
   config.add ("modules.kurento.SdpEndpoint.videoCodecs", "[]");
+  ConfigCache::reload (config);
 
   std::shared_ptr <MediaObjectImpl> pipe =
     MediaSet::getMediaSet()->getMediaObject (
@@ -145,6 +150,7 @@ BOOST_AUTO_TEST_CASE (duplicate_answer)
   config.add ("modules.kurento.SdpEndpoint.numVideoMedias", 0);
   config.add ("modules.kurento.SdpEndpoint.audioCodecs", "[]");
   config.add ("modules.kurento.SdpEndpoint.videoCodecs", "[]");
+  ConfigCache::reload (config);
 
   std::shared_ptr <MediaObjectImpl> pipe =
     MediaSet::getMediaSet()->getMediaObject (
@@ -197,6 +203,7 @@ BOOST_AUTO_TEST_CASE (codec_parsing)
   vc.put ("name", "H264/90000");
   videoCodecs.push_back (std::make_pair ("", vc) );
   config.add_child ("modules.kurento.SdpEndpoint.videoCodecs", videoCodecs);
+  ConfigCache::reload (config);
 
   std::shared_ptr <MediaObjectImpl> pipe =
     MediaSet::getMediaSet()->getMediaObject (
@@ -210,3 +217,109 @@ BOOST_AUTO_TEST_CASE (codec_parsing)
   sdpEndpoint.reset ();
   pipe.reset ();
 }
+
+/* What getConfigValue did on every call before the config was cached */
+static Json::Value
+parseConfigValue (const std::string &path)
+{
+  std::stringstream ss;
+  Json::Value val;
+  Json::Reader reader;
+  boost::property_tree::ptree array;
+
+  array.push_back (std::make_pair ("val", config.get_child (path) ) );
+  boost::property_tree::write_json (ss, array);
+  reader.parse (ss.str(), val);
+
+  return val;
+}
+
+BOOST_AUTO_TEST_CASE (benchmark_construction)
+{
+  const int N_ENDPOINTS = 100;
+  const std::vector<std::string> keys = {"numAudioMedias", "numVideoMedias",
+                                         "audioCodecs", "videoCodecs"
+                                        };
+  std::shared_ptr<const ConfigCache::Value> val;
+  boost::property_tree::ptree other;
+
+  mediaPipelineId =
+    moduleManager.getFactory ("MediaPipeline")->createObject (
+      config, "",
+      Json::Value() )->getId();
+
+  config.add ("configPath", "../../../tests" );
+  config.add ("modules.kurento.SdpEndpoint.numAudioMedias", 1);
+  config.add ("modules.kurento.SdpEndpoint.numVideoMedias", 1);
+  ConfigCache::reload (config);
+
+  std::shared_ptr <MediaObjectImpl> pipe =
+    MediaSet::getMediaSet()->getMediaObject (
+      mediaPipelineId);
+
+  auto start = std::chrono::steady_clock::now();
+
+  for (int i = 0; i < N_ENDPOINTS; i++) {
+    std::shared_ptr <SdpEndpointImpl> sdpEndpoint ( new  SdpEndpointImpl
+        (config, pipe, "dummysdp") );
+  }
+
+  auto construction = std::chrono::steady_clock::now() - start;
+
+  start = std::chrono::steady_clock::now();
+
+  for (int i = 0; i < N_ENDPOINTS; i++) {
+    for (auto key : keys) {
+      parseConfigValue ("modules.kurento.SdpEndpoint." + key);
+    }
+  }
+
+  auto parsing = std::chrono::steady_clock::now() - start;
+
+  BOOST_TEST_MESSAGE ("construction of " << N_ENDPOINTS << " endpoints: " <<
+                      std::chrono::duration_cast<std::chrono::microseconds>
+                      (construction).count() <<
+                      " us, config parsing it no longer does: " <<
+                      std::chrono::duration_cast<std::chrono::microseconds>
+                      (parsing).count() << " us");
+
+  for (auto key : keys) {
+    val = ConfigCache::lookup (config, "kurento", "SdpEndpoint", key);
+    BOOST_REQUIRE (val);
+    BOOST_CHECK (val->get<Json::Value> () == parseConfigValue (
+                   "modules.kurento.SdpEndpoint." + key) );
+  }
+
+  /* Scalars are read as compiled, without deserializing */
+  val = ConfigCache::lookup (config, "kurento", "SdpEndpoint", "numAudioMedias");
+  BOOST_REQUIRE (val);
+  BOOST_CHECK_EQUAL (val->get<int> (),
+                     config.get<int> ("modules.kurento.SdpEndpoint.numAudioMedias") );
+  BOOST_CHECK_THROW (ConfigCache::lookup (config, "kurento", "SdpEndpoint",
+                                          "audioCodecs")->get<int> (), KurentoException);
+
+  BOOST_CHECK (!ConfigCache::lookup (config, "kurento", "SdpEndpoint",
+                                     "unknownKey") );
+
+  /* Other trees get their own values, not the compiled ones */
+  other.put ("modules.kurento.SdpEndpoint.numAudioMedias", 7);
+  val = ConfigCache::lookup (other, "kurento", "SdpEndpoint", "numAudioMedias");
+  BOOST_REQUIRE (val);
+  BOOST_CHECK_EQUAL (val->get<int> (), 7);
+  BOOST_CHECK (!ConfigCache::lookup (other, "kurento", "SdpEndpoint",
+                                     "audioCodecs") );
+
+  /* Changes to the tree are only seen after a reload */
+  uint64_t generation = ConfigCache::getGeneration ();
+
+  config.put ("modules.kurento.SdpEndpoint.unknownKey", 1);
+  BOOST_CHECK (!ConfigCache::lookup (config, "kurento", "SdpEndpoint",
+                                     "unknownKey") );
+  BOOST_CHECK_EQUAL (ConfigCache::reload (config), generation + 1);
+  BOOST_CHECK (ConfigCache::lookup (config, "kurento", "SdpEndpoint",
+                                    "unknownKey") );
+
+  releaseMediaObject (mediaPipelineId);
+
+  pipe.reset ();
+}
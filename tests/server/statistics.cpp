@@ -0,0 +1,163 @@
+/*
+ * (C) Copyright 2016 Kurento (http://kurento.org/)
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * (LGPL) version 2.1 which accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE Statistics
+#include <boost/test/unit_test.hpp>
+#include <gst/gst.h>
+#include <Statistics.hpp>
+#include <StatsSampler.hpp>
+#include <RTCKeyframeRequestStats.hpp>
+#include <RTCStatsType.hpp>
+#include <MediaSet.hpp>
+#include <atomic>
+#include <set>
+
+using namespace kurento;
+
+struct GF {
+  GF();
+  ~GF();
+};
+
+BOOST_GLOBAL_FIXTURE (GF)
+
+GF::GF()
+{
+  gst_init (NULL, NULL);
+}
+
+GF::~GF()
+{
+  MediaSet::deleteMediaSet();
+}
+
+static GstStructure *
+createSessionStats (guint64 packets, guint jitter)
+{
+  GstStructure *stats, *session, *ssrc;
+
+  ssrc = gst_structure_new ("source-stats", "id", G_TYPE_STRING, "ssrc-id",
+                            "ssrc", G_TYPE_UINT, 1234, "packets-received", G_TYPE_UINT64,
+                            packets, "rb-jitter", G_TYPE_UINT, jitter, NULL);
+  session = gst_structure_new ("session-stats", "recv-nack-count",
+                               G_TYPE_UINT, 3, "ssrc-1234", GST_TYPE_STRUCTURE, ssrc, NULL);
+  stats = gst_structure_new ("stats", "generation", G_TYPE_UINT, 1,
+                             "session-1", GST_TYPE_STRUCTURE, session, NULL);
+
+  gst_structure_free (ssrc);
+  gst_structure_free (session);
+
+  return stats;
+}
+
+BOOST_AUTO_TEST_CASE (changed_values)
+{
+  std::map <std::string, double> values, changes;
+  GstStructure *stats;
+
+  stats = createSessionStats (10, 5);
+  stats::collectChangedValues (stats, values, changes);
+  gst_structure_free (stats);
+
+  /* Keys use the ids reported by getStats, sessions have none */
+  BOOST_CHECK (changes.size () == 3);
+  BOOST_CHECK (changes["ssrc-id.packets-received"] == 10);
+  BOOST_CHECK (changes["ssrc-id.rb-jitter"] == 5);
+  BOOST_CHECK (changes.find ("ssrc-id.ssrc") != changes.end () );
+
+  for (auto change : changes) {
+    BOOST_CHECK (change.first.find ("session-") != 0);
+  }
+
+  changes.clear ();
+  stats = createSessionStats (20, 5);
+  stats::collectChangedValues (stats, values, changes);
+  gst_structure_free (stats);
+
+  BOOST_CHECK (changes.size () == 1);
+  BOOST_CHECK (changes["ssrc-id.packets-received"] == 20);
+}
+
+BOOST_AUTO_TEST_CASE (keyframe_requests)
+{
+  std::map <std::string, std::shared_ptr<RTCStats>> report;
+  std::shared_ptr<RTCKeyframeRequestStats> keyframeStats;
+  GstStructure *stats, *requests;
+
+  requests = gst_structure_new ("keyframe-requests", "requests", G_TYPE_UINT64,
+                                (guint64) 6, "grants", G_TYPE_UINT64, (guint64) 2, "keyframes",
+                                G_TYPE_UINT64, (guint64) 2, "dispersion", G_TYPE_UINT64,
+                                (guint64) (500 * GST_MSECOND), NULL);
+  stats = gst_structure_new ("stats", "keyframe-requests", GST_TYPE_STRUCTURE,
+                             requests, NULL);
+  gst_structure_free (requests);
+
+  report = stats::createRTCStatsReport (1.0, stats);
+  gst_structure_free (stats);
+
+  BOOST_REQUIRE (report.find ("keyframe-requests") != report.end () );
+  keyframeStats = std::dynamic_pointer_cast <RTCKeyframeRequestStats>
+                  (report["keyframe-requests"]);
+  BOOST_REQUIRE (keyframeStats);
+  BOOST_CHECK (keyframeStats->getType ()->getValue () ==
+               RTCStatsType::keyframerequests);
+  BOOST_CHECK (keyframeStats->getRequests () == 6);
+  BOOST_CHECK (keyframeStats->getGrants () == 2);
+  BOOST_CHECK (keyframeStats->getKeyframes () == 2);
+  BOOST_CHECK (keyframeStats->getDispersion () == 0.5);
+  BOOST_CHECK (keyframeStats->getTimestamp () == 1.0);
+}
+
+BOOST_AUTO_TEST_CASE (shared_sampler)
+{
+  std::shared_ptr<StatsSampler> sampler = StatsSampler::getStatsSampler ();
+  std::set<std::thread::id> threads;
+  std::atomic<int> first (0), second (0);
+  std::mutex mutex;
+
+  sampler->add ("first", 50, [&] () {
+    std::unique_lock<std::mutex> lock (mutex);
+    threads.insert (std::this_thread::get_id () );
+    first++;
+    return true;
+  });
+  sampler->add ("second", 50, [&] () {
+    std::unique_lock<std::mutex> lock (mutex);
+    threads.insert (std::this_thread::get_id () );
+    second++;
+    return second < 3;
+  });
+
+  std::this_thread::sleep_for (std::chrono::milliseconds (500) );
+
+  /* Returning false stops sampling */
+  BOOST_CHECK (second == 3);
+  BOOST_CHECK (first >= 5);
+  BOOST_CHECK (sampler->size () == 1);
+
+  sampler->remove ("first");
+  int sampled = first;
+
+  std::this_thread::sleep_for (std::chrono::milliseconds (200) );
+
+  BOOST_CHECK (first <= sampled + 1);
+  BOOST_CHECK (sampler->size () == 0);
+
+  /* Every sample ran in the sampler thread */
+  std::unique_lock<std::mutex> lock (mutex);
+  BOOST_CHECK (threads.size () == 1);
+  BOOST_CHECK (threads.find (std::this_thread::get_id () ) == threads.end () );
+}